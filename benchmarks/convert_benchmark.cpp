@@ -0,0 +1,82 @@
+// Microbenchmark for the id -> color kernels in nw_simd.h against the plain px_LUT loop they
+// replaced, for layer textures that show their ids as colors.
+// Usage: nw_convert_benchmark [megapixels]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "nw_simd.h"
+
+static std::vector<uint32_t> make_palette(int colors, std::mt19937& random) {
+    std::vector<uint32_t> px_LUT(256, 0);
+    for (int id = 0; id < colors; id++) px_LUT[id] = ((random() & 0xFFFFFF) << 8) | 0xFF;
+    return px_LUT;
+}
+
+// "map" looks like a painted layer: wide areas of a few ids with some detail, "noise" is random ids
+static std::vector<uint8_t> make_ids(size_t count, int colors, bool noise, std::mt19937& random) {
+    std::vector<uint8_t> ids(count);
+    uint8_t current = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (noise || random() % 64 == 0) current = uint8_t(random() % colors);
+        ids[i] = current;
+    }
+    return ids;
+}
+
+// Best of a few runs, in millions of pixels per second
+static double measure(size_t pixels, const std::function<void()>& run) {
+    double best = 1e30;
+    for (int repeat = 0; repeat < 5; repeat++) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return double(pixels) / best / 1e6;
+}
+
+static void legacy_expand(const uint8_t* src, uint32_t* dst, size_t n, const std::vector<uint32_t>& px_LUT) {
+    for (size_t x = 0; x < n; x++) {
+        dst[x] = px_LUT[src[x]];
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t pixels = size_t(argc > 1 ? std::atof(argv[1]) * 1e6 : 16e6);
+    SimdLevel best = detect_simd_level();
+    std::printf("%zu pixels, best kernel level: %s\n", pixels, simd_level_name(best));
+
+    std::mt19937 random(1234);
+    std::vector<uint32_t> colors(pixels), colors_out(pixels);
+
+    for (int palette_size : {29, 255}) {
+        std::vector<uint32_t> px_LUT = make_palette(palette_size, random);
+        for (bool noise : {false, true}) {
+            std::vector<uint8_t> ids = make_ids(pixels, palette_size, noise, random);
+            legacy_expand(ids.data(), colors.data(), pixels, px_LUT);
+
+            std::printf("%d colors, %s\n", palette_size, noise ? "noise" : "map");
+            double base = measure(pixels, [&]() { legacy_expand(ids.data(), colors_out.data(), pixels, px_LUT); });
+            std::printf("  id->color  px_LUT loop   %8.1f Mpx/s\n", base);
+
+            auto kernel = [&](const char* name, void (*expand)(const uint8_t*, uint32_t*, size_t, const uint32_t*)) {
+                double speed = measure(pixels, [&]() { expand(ids.data(), colors_out.data(), pixels, px_LUT.data()); });
+                bool same = colors_out == colors;
+                std::printf("  id->color  %-12s  %8.1f Mpx/s  %5.2fx%s\n", name, speed, speed / base, same ? "" : "  MISMATCH");
+            };
+            kernel("scalar", expand_indices_scalar);
+#ifdef NW_SIMD_SSE2
+            kernel("sse2", expand_indices_sse2);
+#endif
+#ifdef NW_SIMD_X86
+            if (best >= SIMD_AVX2) kernel("avx2", expand_indices_avx2);
+#endif
+        }
+    }
+    return 0;
+}
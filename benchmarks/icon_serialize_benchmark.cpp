@@ -0,0 +1,283 @@
+// Microbenchmark for the icon layer section: the per-field out.write calls it used to make
+// against ByteWriter, which fills one buffer (points in bulk) and writes it in one go, and
+// write_icon_layer/read_icon_layer from nw_savefile.h, the columnar layout of version 6 sections
+// (varints, positions as deltas in 1/16 pixel steps). The first two write the same bytes.
+// Usage: nw_icon_serialize_benchmark [icons] [shapes] [points per shape]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "nw_savefile.h"
+#include "nw_serialize.h"
+
+static IconLayerSnapshot make_layer(int icons, int shapes, int points, std::mt19937& random) {
+    std::uniform_real_distribution<float> distribution(0.0f, 16384.0f);
+    // quarter pixels, which the 1/16 pixel steps of the columnar layout keep exactly
+    auto coordinate = [&](std::mt19937& random) { return std::round(distribution(random) * 4.0f) / 4.0f; };
+    IconLayerSnapshot layer;
+    layer.layer_name = "units";
+    for (int i = 0; i < icons / 2; i++) {
+        layer.civilian_icons.push_back({int(random() % 40), coordinate(random), coordinate(random), i % 8 ? "" : "town " + std::to_string(i)});
+    }
+    for (int i = 0; i < icons - icons / 2; i++) {
+        MilitaryIconSnapshot icon = {int(random() % 60), int(random() % 30), int(random() % 5), coordinate(random), coordinate(random), float(random() % 360), "division", {}};
+        for (unsigned k = random() % 4; k > 0; k--) icon.decorators.push_back(int32_t(random() % 20));
+        layer.military_icons.push_back(icon);
+    }
+    for (int i = 0; i < shapes; i++) {
+        ShapeSnapshot shape = {uint8_t(random()), uint8_t(random()), uint8_t(random()), 255, {}};
+        ShapePoint point = {coordinate(random), coordinate(random)};
+        for (int k = 0; k < points; k++) {
+            point.x += float(int(random() % 9) - 4);
+            point.y += float(int(random() % 9) - 4);
+            shape.points.push_back(point);
+        }
+        layer.shapes.push_back(shape);
+    }
+    return layer;
+}
+
+// How write_icon_layer looked before: one stream call per field
+static void legacy_write(std::ostream& out, const IconLayerSnapshot& layer) {
+    int32_t lnameLen = layer.layer_name.size();
+    out.write(reinterpret_cast<char*>(&lnameLen), sizeof(lnameLen));
+    out.write(layer.layer_name.data(), lnameLen);
+
+    int32_t num_civilian_icons = layer.civilian_icons.size();
+    out.write(reinterpret_cast<char*>(&num_civilian_icons), sizeof(num_civilian_icons));
+    for (auto& icon : layer.civilian_icons) {
+        out.write(reinterpret_cast<const char*>(&icon.icon_id), sizeof(icon.icon_id));
+        out.write(reinterpret_cast<const char*>(&icon.x), sizeof(icon.x));
+        out.write(reinterpret_cast<const char*>(&icon.y), sizeof(icon.y));
+        std::uint64_t description_size = icon.description.size();
+        out.write(reinterpret_cast<const char*>(&description_size), sizeof(description_size));
+        out.write(icon.description.data(), description_size);
+    }
+
+    int32_t num_military_icons = layer.military_icons.size();
+    out.write(reinterpret_cast<char*>(&num_military_icons), sizeof(num_military_icons));
+    for (auto& icon : layer.military_icons) {
+        out.write(reinterpret_cast<const char*>(&icon.icon_id), sizeof(icon.icon_id));
+        out.write(reinterpret_cast<const char*>(&icon.angle), sizeof(icon.angle));
+        out.write(reinterpret_cast<const char*>(&icon.country_id), sizeof(icon.country_id));
+        out.write(reinterpret_cast<const char*>(&icon.quality), sizeof(icon.quality));
+        out.write(reinterpret_cast<const char*>(&icon.x), sizeof(icon.x));
+        out.write(reinterpret_cast<const char*>(&icon.y), sizeof(icon.y));
+        std::uint64_t description_size = icon.description.size();
+        out.write(reinterpret_cast<const char*>(&description_size), sizeof(description_size));
+        out.write(icon.description.data(), description_size);
+        int32_t num_decorators = icon.decorators.size();
+        out.write(reinterpret_cast<char*>(&num_decorators), sizeof(num_decorators));
+        for (auto& decorator_id : icon.decorators) {
+            out.write(reinterpret_cast<const char*>(&decorator_id), sizeof(decorator_id));
+        }
+    }
+
+    int32_t num_shapes = layer.shapes.size();
+    out.write(reinterpret_cast<char*>(&num_shapes), sizeof(num_shapes));
+    for (auto& shape : layer.shapes) {
+        out.write(reinterpret_cast<const char*>(&shape.r), sizeof(shape.r));
+        out.write(reinterpret_cast<const char*>(&shape.g), sizeof(shape.g));
+        out.write(reinterpret_cast<const char*>(&shape.b), sizeof(shape.b));
+        out.write(reinterpret_cast<const char*>(&shape.a), sizeof(shape.a));
+        int32_t num_points = shape.points.size();
+        out.write(reinterpret_cast<char*>(&num_points), sizeof(num_points));
+        for (auto& point : shape.points) {
+            out.write(reinterpret_cast<const char*>(&point.x), sizeof(point.x));
+            out.write(reinterpret_cast<const char*>(&point.y), sizeof(point.y));
+        }
+    }
+}
+
+// Same layout through ByteWriter, as write_icon_layer did for version 5 sections
+static void buffered_write(ByteWriter& out, const IconLayerSnapshot& layer) {
+    out.write_string<int32_t>(layer.layer_name);
+
+    out.write(int32_t(layer.civilian_icons.size()));
+    for (auto& icon : layer.civilian_icons) {
+        out.write(int32_t(icon.icon_id));
+        out.write(icon.x);
+        out.write(icon.y);
+        out.write_string<uint64_t>(icon.description);
+    }
+
+    out.write(int32_t(layer.military_icons.size()));
+    for (auto& icon : layer.military_icons) {
+        out.write(int32_t(icon.icon_id));
+        out.write(icon.angle);
+        out.write(int32_t(icon.country_id));
+        out.write(int32_t(icon.quality));
+        out.write(icon.x);
+        out.write(icon.y);
+        out.write_string<uint64_t>(icon.description);
+        out.write(int32_t(icon.decorators.size()));
+        out.write_array(icon.decorators.data(), icon.decorators.size());
+    }
+
+    out.write(int32_t(layer.shapes.size()));
+    for (auto& shape : layer.shapes) {
+        out.write(shape.r);
+        out.write(shape.g);
+        out.write(shape.b);
+        out.write(shape.a);
+        out.write(int32_t(shape.points.size()));
+        out.write_array(reinterpret_cast<const float*>(shape.points.data()), shape.points.size() * 2);
+    }
+}
+
+// Parses a version 5 section back the way read_icon_layer first did (one read per float) or
+// later did (decorators and points in one read_array each), into plain structs instead of
+// icons with textures.
+static bool parse_layer(ByteReader in, bool bulk, IconLayerSnapshot& layer) {
+    layer = IconLayerSnapshot();
+    std::vector<int32_t> decorators;
+    std::vector<float> coordinates;
+    in.read_string<int32_t>(layer.layer_name, in.remaining());
+
+    int32_t num_civilian_icons = 0;
+    in.read(num_civilian_icons);
+    for (int j = 0; j < num_civilian_icons && in; j++) {
+        CivilianIconSnapshot icon;
+        in.read(icon.icon_id);
+        in.read(icon.x);
+        in.read(icon.y);
+        in.read_string<uint64_t>(icon.description, in.remaining());
+        layer.civilian_icons.push_back(icon);
+    }
+
+    int32_t num_military_icons = 0;
+    in.read(num_military_icons);
+    for (int j = 0; j < num_military_icons && in; j++) {
+        MilitaryIconSnapshot icon;
+        in.read(icon.icon_id);
+        in.read(icon.angle);
+        in.read(icon.country_id);
+        in.read(icon.quality);
+        in.read(icon.x);
+        in.read(icon.y);
+        in.read_string<uint64_t>(icon.description, in.remaining());
+        int32_t num_decorators = 0;
+        in.read(num_decorators);
+        if (bulk) {
+            if (num_decorators < 0 || !in.read_array(decorators, uint64_t(num_decorators))) break;
+            icon.decorators.assign(decorators.begin(), decorators.end());
+        } else {
+            for (int k = 0; k < num_decorators && in; k++) {
+                int32_t decorator_id;
+                in.read(decorator_id);
+                icon.decorators.push_back(decorator_id);
+            }
+        }
+        layer.military_icons.push_back(icon);
+    }
+
+    int32_t num_shapes = 0;
+    in.read(num_shapes);
+    for (int j = 0; j < num_shapes && in; j++) {
+        ShapeSnapshot shape;
+        in.read(shape.r);
+        in.read(shape.g);
+        in.read(shape.b);
+        in.read(shape.a);
+        int32_t num_points = 0;
+        in.read(num_points);
+        if (bulk) {
+            if (num_points < 0 || !in.read_array(coordinates, uint64_t(num_points) * 2)) break;
+            shape.points.resize(size_t(num_points));
+            std::memcpy(shape.points.data(), coordinates.data(), coordinates.size() * sizeof(float));
+        } else {
+            for (int k = 0; k < num_points && in; k++) {
+                ShapePoint point;
+                in.read(point.x);
+                in.read(point.y);
+                shape.points.push_back(point);
+            }
+        }
+        layer.shapes.push_back(shape);
+    }
+    return bool(in);
+}
+
+static double measure(const std::function<void()>& run) {
+    double best = 1e30;
+    for (int repeat = 0; repeat < 5; repeat++) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best * 1000.0;
+}
+
+int main(int argc, char* argv[]) {
+    int icons = argc > 1 ? std::atoi(argv[1]) : 50000;
+    int shapes = argc > 2 ? std::atoi(argv[2]) : 2000;
+    int points = argc > 3 ? std::atoi(argv[3]) : 500;
+    const char* filename = "nw_icon_serialize_benchmark.tmp";
+
+    std::mt19937 random(1234);
+    IconLayerSnapshot layer = make_layer(icons, shapes, points, random);
+    std::printf("%d icons, %d shapes of %d points\n", icons, shapes, points);
+
+    double legacy_ms = measure([&]() {
+        std::ofstream out(filename, std::ios::binary);
+        legacy_write(out, layer);
+    });
+
+    ByteWriter writer;
+    double buffered_ms = measure([&]() {
+        writer.clear();
+        buffered_write(writer, layer);
+        std::ofstream out(filename, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(writer.data()), writer.size());
+    });
+
+    std::ostringstream legacy_bytes(std::ios::binary);
+    legacy_write(legacy_bytes, layer);
+    std::string expected = legacy_bytes.str();
+    bool same = expected.size() == writer.size() && std::equal(expected.begin(), expected.end(), reinterpret_cast<const char*>(writer.data()));
+
+    std::printf("  save  per-field writes  %8.2f ms\n", legacy_ms);
+    std::printf("  save  ByteWriter        %8.2f ms  %5.2fx%s  (%zu bytes)\n", buffered_ms, legacy_ms / buffered_ms, same ? "" : "  MISMATCH", writer.size());
+
+    IconLayerSnapshot parsed;
+    ByteReader in(writer.data(), writer.size());
+    double per_field_ms = measure([&]() { parse_layer(in, false, parsed); });
+    double bulk_ms = measure([&]() { parse_layer(in, true, parsed); });
+    ByteWriter reparsed;
+    buffered_write(reparsed, parsed);
+    same = reparsed.size() == writer.size() && std::equal(writer.data(), writer.data() + writer.size(), reparsed.data());
+    std::printf("  load  per-field reads   %8.2f ms\n", per_field_ms);
+    std::printf("  load  read_array        %8.2f ms  %5.2fx%s\n", bulk_ms, per_field_ms / bulk_ms, same ? "" : "  MISMATCH");
+
+    ByteWriter columns;
+    double columnar_ms = measure([&]() {
+        columns.clear();
+        write_icon_layer(columns, layer);
+        std::ofstream out(filename, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(columns.data()), columns.size());
+    });
+    double columnar_load_ms = measure([&]() {
+        ByteReader columns_in(columns.data(), columns.size());
+        parsed = IconLayerSnapshot();
+        columns_in.read_string<int32_t>(parsed.layer_name, SAVE_MAX_NAME_LENGTH);
+        read_icon_layer(columns_in, parsed, true);
+    });
+    reparsed.clear();
+    buffered_write(reparsed, parsed);
+    same = reparsed.size() == writer.size() && std::equal(writer.data(), writer.data() + writer.size(), reparsed.data());
+    std::printf("  save  columns           %8.2f ms  %5.2fx  (%zu bytes, %.2fx smaller)\n", columnar_ms, legacy_ms / columnar_ms, columns.size(), double(writer.size()) / columns.size());
+    std::printf("  load  columns           %8.2f ms  %5.2fx%s\n", columnar_load_ms, per_field_ms / columnar_load_ms, same ? "" : "  MISMATCH");
+
+    std::remove(filename);
+    return 0;
+}
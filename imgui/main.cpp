@@ -21,11 +21,88 @@
 #include "stb_image.h"
 #include <queue>
 #include <deque>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <ctime>
+#include "nw_codec.h"
+#include "nw_crc32c.h"
+#include "nw_file_watch.h"
+#include "nw_mapped_file.h"
+#include "nw_serialize.h"
+#include "nw_hash.h"
+#include "nw_hash_tree.h"
+#include "nw_palette.h"
+#include "nw_parallel.h"
+#include "nw_savefile.h"
+#include "nw_simd.h"
+#include "nw_sparse_ids.h"
 
 // --- CONFIG ---
 
 bool ENABLE_TIPS = true;
 bool ENABLE_DEBUG = true;
+bool VERIFY_SAVEFILES = true; // check local savefiles against their checksums before loading, downloads always are
+bool KEEP_SAVE_HISTORY = true; // record every full save in the deduplicated history store
+bool LOSSLESS_ICON_POSITIONS = false; // save icon and shape positions as exact floats instead of rounding them
+
+// --- EDIT JOURNAL ---
+// Saves between full saves only append what changed to "<savefile>.journal":
+// a header naming the save id it applies on top of, then batches of records closed by a commit record.
+// Every record is [u32 type][u64 payload length][payload], a batch without its commit is ignored.
+
+const char JOURNAL_MAGIC[4] = {'N', 'W', 'J', 'L'};
+const uint32_t JOURNAL_VERSION = 1;
+
+enum JournalRecordType : uint32_t {
+    JOURNAL_RASTER_TILES = 1, // painted tiles of one world/political layer, encoded like the savefile tiles
+    JOURNAL_ICON_LAYER = 2, // an icon layer that changed, written whole like a version 5 savefile section
+    JOURNAL_COMMIT = 3,
+    JOURNAL_ICON_COLUMNS = 4, // an icon layer that changed, written whole like its savefile section now
+};
+
+const Uint64 AUTOSAVE_INTERVAL_MS = 60 * 1000;
+const double JOURNAL_COMPACT_RATIO = 0.25; // a journal this big compared to its savefile is folded into a full save
+const uint64_t JOURNAL_COMPACT_MIN_SIZE = 256 * 1024; // but small journals are always kept
+
+// --- SAVE PATCHES ---
+// "<savefile>.nwpatch" rebuilds a shared savefile from the previous upload of it, so players who
+// have last turn only download what changed. A patch names the exact base and result by size and
+// CRC32C, then lists ops whose output put together is the new file byte for byte.
+
+const char PATCH_MAGIC[4] = {'N', 'W', 'P', 'T'};
+const uint32_t PATCH_VERSION = 1;
+const char* SHARED_SAVES_DIRECTORY = "saves/shared/"; // last uploaded/downloaded version of every shared save
+
+enum PatchOp : uint8_t {
+    PATCH_LITERAL = 1, // [u64 length][bytes]
+    PATCH_COPY = 2, // [u64 base offset][u64 length]
+    PATCH_TILES = 3, // tile table and payload of a raster, tiles copied from the base raster or given
+};
+
+enum PatchTileRun : uint8_t {
+    PATCH_TILES_COPY = 0, // [u32 first base tile][u32 count]
+    PATCH_TILES_LITERAL = 1, // [u32 count][u32 length per tile][tile bytes]
+};
+
+// --- SAVE HISTORY ---
+// Every full save is split into blobs (sections, and every tile of the rasters) that are stored
+// once in "saves/history/blobs.pack". "saves/history/<savefile>/<save time>.nwm" lists the blobs
+// of one save: [magic][u32 version][i64 save time][u64 size][u32 crc32c][name][u32 pieces][pieces],
+// a piece is [u8 HISTORY_BLOB][u64 key] or [u8 HISTORY_TILES][u32 count][u64 key per tile].
+
+const char HISTORY_MAGIC[4] = {'N', 'W', 'H', 'M'};
+const uint32_t HISTORY_VERSION = 1;
+const char* HISTORY_DIRECTORY = "saves/history/";
+
+enum HistoryPiece : uint8_t {
+    HISTORY_BLOB = 1,
+    HISTORY_TILES = 2, // the tile table isn't stored, it follows from the tile lengths
+};
 
 // function to find all savefiles in the current directory
 std::vector<std::string> find_savefiles(const std::string& directory) {
@@ -65,21 +142,16 @@ std::vector<std::string> find_savefiles_internet() {
 
 struct IDmap {
     std::unordered_map<int, std::tuple<int, int, int, std::string>> id_map;
-    std::vector<uint8_t> id_LUT; 
-    Uint32 px_LUT[256]; // id_map as a lookup table
+    Uint32 px_LUT[256]; // id_map as a lookup table, ids it doesn't list are transparent
     std::string name;
+    std::string filename; // file in ids/ the palette was read from
+    SDL_Palette* palette = nullptr; // px_LUT for INDEX8 layer textures, made with the first of them
 
     void buildFastLUT() {
-        id_LUT.assign(1 << 24, 0xFF); // 0xFF = "not mapped"
-        for (auto& [id, rgb] : id_map) {
-            auto [r, g, b, text] = rgb;
-            uint32_t key = (r << 16) | (g << 8) | b;
-            id_LUT[key] = static_cast<uint8_t>(id);
-        }
-
         SDL_PixelFormat format = SDL_PIXELFORMAT_RGBA8888;
         const SDL_PixelFormatDetails* fmt = SDL_GetPixelFormatDetails(format);
         for (int i = 0; i < 256; i++) {
+            px_LUT[i] = 0;
             auto it = id_map.find(i);
             if (it != id_map.end()) {
                 Uint8 r, g, b;
@@ -95,6 +167,34 @@ struct IDmap {
     }
 };
 
+// Index of an IDmap in World::IDmaps. IDmaps are only ever appended, so a handle stays valid
+// and layers resolve their idmap_name to one once instead of comparing names on every use.
+using IDmapHandle = uint32_t;
+constexpr IDmapHandle NO_IDMAP = UINT32_MAX;
+
+// Paint color of the selected tile, looked up again only when the IDmap or the tile changes
+struct BrushColor {
+    IDmapHandle idmap = NO_IDMAP;
+    int tile_id = -1;
+    bool found = false;
+    Uint32 color = 0; // RGBA8888, opaque
+
+    bool update(const IDmap& id_map, IDmapHandle handle, int selected_tile_id) {
+        if (handle == idmap && selected_tile_id == tile_id) return found;
+        idmap = handle;
+        tile_id = selected_tile_id;
+        auto it = id_map.id_map.find(tile_id);
+        found = it != id_map.id_map.end();
+        if (found) {
+            auto& [r, g, b, text] = it->second;
+            color = (Uint32(r & 0xFF) << 24) | (Uint32(g & 0xFF) << 16) | (Uint32(b & 0xFF) << 8) | Uint32(255);
+        } else {
+            std::cerr << "Tile ID " << tile_id << " not found in ID map: " << id_map.name << std::endl;
+        }
+        return found;
+    }
+};
+
 const ImVec4 info_color = {0.4f, 0.6f, 1.0f, 1.0f};
 const ImVec4 warning_color = {1.0f, 0.8f, 0.3f, 1.0f};
 const ImVec4 error_color = {1.0f, 0.3f, 0.3f, 1.0f};
@@ -128,54 +228,195 @@ inline void ClampRectToTexture(SDL_Rect& r, int textureWidth, int textureHeight)
     if (r.h < 0) r.h = 0;
 }
 
-inline Uint32 GetPixel(Uint32* pixels, int pitch, int x, int y) {
-    return pixels[y * (pitch / 4) + x];
-}
-
 inline void SetPixelGlobal(Uint32* pixels, int pitch, int x, int y, Uint8 r, Uint8 g, Uint8 b, Uint8 a) {
     Uint32 color = (Uint32(r) << 24) | (Uint32(g) << 16) | (Uint32(b) << 8) | Uint32(a);
     pixels[y * (pitch / 4) + x] = color;
 }
 
-void PaintBrush(Uint32* pixels, int pitch, int radius, Uint32 color)
-{
-    int rowPixels = pitch / 4; 
+// Longest side of one texture of a layer. Bigger layers are split into a grid of textures, which
+// lifts the 16384 limit of most renderers and lets draw_all skip the ones out of view. Tiles that
+// are all one id have no texture at all, the smaller they are the more of a layer that is.
+const int LAYER_TEXTURE_TILE_SIZE = 1024;
+
+// The texture of a layer, as a grid of tile_w x tile_h textures. Tiles are a whole number of
+// id blocks (see SparseIds), the ones on the right and bottom edge are smaller if the layer
+// doesn't divide evenly. A tile is only given a texture once its ids differ, until then it is
+// drawn as a rect of its one id.
+struct TiledTexture {
+    int w = 0, h = 0; // of the whole layer
+    int tile_w = 0, tile_h = 0;
+    int tiles_x = 0, tiles_y = 0;
+    SDL_PixelFormat format = SDL_PIXELFORMAT_UNKNOWN;
+    SDL_Renderer* renderer = nullptr; // tile textures are made as they are needed
+    SDL_Palette* palette = nullptr; // of the IDmap, for INDEX8 tiles
+    std::vector<SDL_Texture*> tiles; // row after row, null where the tile is all one id
+    std::vector<uint8_t> solid_ids; // the id of each tile without a texture
+
+    SDL_Rect tile_rect(int tx, int ty) const {
+        return {tx * tile_w, ty * tile_h, std::min(tile_w, w - tx * tile_w), std::min(tile_h, h - ty * tile_h)};
+    }
+};
 
-    for (int dy = -radius; dy <= radius; ++dy)
-    {
-        for (int dx = -radius; dx <= radius; ++dx)
-        {
-            if (dx*dx + dy*dy <= radius * radius)
-            {
-                int px = dx + radius;
-                int py = dy + radius;
+inline void destroy_tiled_texture(TiledTexture* texture) {
+    if (!texture) return;
+    for (SDL_Texture* tile : texture->tiles) {
+        if (tile) SDL_DestroyTexture(tile);
+    }
+    delete texture;
+}
+
+// Layer textures hold the ids and take their colors from the IDmap's palette where the renderer
+// draws INDEX8 textures, so recoloring a layer is a palette change. Otherwise (no palette) they
+// are RGBA8888 and the ids are expanded on the CPU.
+inline SDL_Texture* create_layer_texture(SDL_Renderer* renderer, int width, int height, SDL_Palette* palette) {
+    SDL_Texture* texture = nullptr;
+    if (palette) {
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_INDEX8, SDL_TEXTUREACCESS_STREAMING, width, height);
+        if (texture && SDL_SetTexturePalette(texture, palette)) {
+            SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND); // id 255 is transparent
+        } else {
+            std::cerr << "Failed to create indexed texture, falling back to RGBA: " << SDL_GetError() << std::endl;
+            if (texture) SDL_DestroyTexture(texture);
+            texture = nullptr;
+        }
+    }
+    if (!texture) texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+    if (texture) SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
+    return texture;
+}
+
+// Shows a rect of a layer's ids in its texture, lut giving the color of every id. INDEX8 tiles
+// take the ids as they are and get their colors from the IDmap's palette instead. Tiles the rect
+// leaves all one id drop their texture, the others get one if they had none.
+inline bool show_ids(TiledTexture* texture, const SparseIds& ids, const Uint32* lut, SDL_Rect rect) {
+    if (rect.w <= 0 || rect.h <= 0) return true;
+    int tx1 = std::min(texture->tiles_x - 1, (rect.x + rect.w - 1) / texture->tile_w);
+    int ty1 = std::min(texture->tiles_y - 1, (rect.y + rect.h - 1) / texture->tile_h);
+    std::vector<uint8_t> row_ids;
+    for (int ty = std::max(0, rect.y / texture->tile_h); ty <= ty1; ty++) {
+        for (int tx = std::max(0, rect.x / texture->tile_w); tx <= tx1; tx++) {
+            SDL_Rect tile = texture->tile_rect(tx, ty), part;
+            if (!SDL_GetRectIntersection(&rect, &tile, &part)) continue;
+            size_t index = size_t(ty) * texture->tiles_x + tx;
+            SDL_Texture*& tile_texture = texture->tiles[index];
+
+            if (ids.uniform(tile.x, tile.y, tile.w, tile.h, texture->solid_ids[index])) {
+                if (tile_texture) SDL_DestroyTexture(tile_texture);
+                tile_texture = nullptr;
+                continue;
+            }
+            if (!tile_texture) {
+                tile_texture = create_layer_texture(texture->renderer, tile.w, tile.h, texture->palette);
+                if (!tile_texture) {
+                    std::cerr << "Failed to create texture: " << SDL_GetError() << std::endl;
+                    return false;
+                }
+                if (tile_texture->format != SDL_PIXELFORMAT_INDEX8) texture->format = tile_texture->format; // recolors expand it
+                part = tile; // all of it is new
+            }
 
-                pixels[py * rowPixels + px] = color;
+            SDL_Rect local = {part.x - tile.x, part.y - tile.y, part.w, part.h};
+            void* pixels;
+            int pitch;
+            if (!SDL_LockTexture(tile_texture, &local, &pixels, &pitch)) {
+                std::cerr << "Failed to lock texture: " << SDL_GetError() << std::endl;
+                return false;
+            }
+            if (tile_texture->format == SDL_PIXELFORMAT_INDEX8) {
+                ids.read(part.x, part.y, part.w, part.h, (uint8_t*)pixels, size_t(pitch));
+            } else {
+                row_ids.resize(size_t(part.w));
+                for (int y = 0; y < part.h; y++) {
+                    ids.read(part.x, part.y + y, part.w, 1, row_ids.data(), row_ids.size());
+                    expand_indices(row_ids.data(), (Uint32*)((uint8_t*)pixels + size_t(y) * pitch), size_t(part.w), lut);
+                }
             }
+            SDL_UnlockTexture(tile_texture);
+        }
+    }
+    return true;
+}
+
+// Side of the blocks an RGBA layer is expanded again in after its IDmap changed colors.
+// Only the blocks that come into view are, a recolor doesn't repaint the whole layer.
+const int RECOLOR_BLOCK_SIZE = 512;
+
+// Expands the blocks of a layer that still show old colors and overlap view (texture pixels).
+// stale_blocks is emptied once none are left.
+inline void show_stale_blocks(TiledTexture* texture, const SparseIds& ids, const Uint32* lut,
+                              std::vector<uint8_t>& stale_blocks, const SDL_FRect* view) {
+    if (stale_blocks.empty() || ids.width() != texture->w || ids.height() != texture->h) return;
+    int blocks_x = (texture->w + RECOLOR_BLOCK_SIZE - 1) / RECOLOR_BLOCK_SIZE;
+    int blocks_y = (texture->h + RECOLOR_BLOCK_SIZE - 1) / RECOLOR_BLOCK_SIZE;
+    if (stale_blocks.size() != size_t(blocks_x) * blocks_y) {
+        stale_blocks.assign(size_t(blocks_x) * blocks_y, 1);
+    }
+
+    int x0 = 0, y0 = 0, x1 = blocks_x - 1, y1 = blocks_y - 1;
+    if (view) {
+        x0 = std::max(0, int(std::floor(view->x)) / RECOLOR_BLOCK_SIZE);
+        y0 = std::max(0, int(std::floor(view->y)) / RECOLOR_BLOCK_SIZE);
+        x1 = std::min(blocks_x - 1, int(std::ceil(view->x + view->w)) / RECOLOR_BLOCK_SIZE);
+        y1 = std::min(blocks_y - 1, int(std::ceil(view->y + view->h)) / RECOLOR_BLOCK_SIZE);
+    }
+    for (int by = y0; by <= y1; by++) {
+        for (int bx = x0; bx <= x1; bx++) {
+            uint8_t& stale = stale_blocks[size_t(by) * blocks_x + bx];
+            if (!stale) continue;
+            SDL_Rect rect = {bx * RECOLOR_BLOCK_SIZE, by * RECOLOR_BLOCK_SIZE, RECOLOR_BLOCK_SIZE, RECOLOR_BLOCK_SIZE};
+            ClampRectToTexture(rect, texture->w, texture->h);
+            show_ids(texture, ids, lut, rect);
+            stale = 0;
         }
     }
+    if (std::find(stale_blocks.begin(), stale_blocks.end(), 1) == stale_blocks.end()) stale_blocks.clear();
 }
 
-void PaintFill(Uint32* pixels, int pitch, int radius, Uint32 target_color, Uint32 color)
+// Colors a layer is shown in, all transparent when its IDmap is missing
+inline const Uint32* layer_colors(const IDmap* id_map) {
+    static const Uint32 no_colors[256] = {};
+    return id_map ? id_map->px_LUT : no_colors;
+}
+
+// Paints a disc of id around x, y into a layer's ids, clipped to the layer. Returns the rect
+// it covers, empty when the disc is off the layer.
+SDL_Rect PaintBrush(uint8_t* ids, int width, int height, int x, int y, int radius, uint8_t id)
 {
-    int rowPixels = pitch / 4;
+    SDL_Rect rect = {x - radius, y - radius, radius * 2 + 1, radius * 2 + 1};
+    ClampRectToTexture(rect, width, height);
 
-    for (int dy = -radius; dy <= radius; ++dy)
+    for (int py = rect.y; py < rect.y + rect.h; ++py)
     {
-        for (int dx = -radius; dx <= radius; ++dx)
+        for (int px = rect.x; px < rect.x + rect.w; ++px)
         {
+            int dx = px - x, dy = py - y;
             if (dx*dx + dy*dy <= radius * radius)
-            {
-                int px = dx + radius;
-                int py = dy + radius;
-                int idx = py * rowPixels + px;
+                ids[size_t(py) * width + px] = id;
+        }
+    }
+    return rect;
+}
 
-                if (pixels[idx] == target_color) {
-                    pixels[idx] = color;
-                }
-            }
+// Same disc, but only repaints the id under x, y
+SDL_Rect PaintFill(uint8_t* ids, int width, int height, int x, int y, int radius, uint8_t id)
+{
+    if (x < 0 || y < 0 || x >= width || y >= height) return SDL_Rect{0, 0, 0, 0};
+    uint8_t target_id = ids[size_t(y) * width + x];
+
+    SDL_Rect rect = {x - radius, y - radius, radius * 2 + 1, radius * 2 + 1};
+    ClampRectToTexture(rect, width, height);
+
+    for (int py = rect.y; py < rect.y + rect.h; ++py)
+    {
+        for (int px = rect.x; px < rect.x + rect.w; ++px)
+        {
+            int dx = px - x, dy = py - y;
+            uint8_t& tile = ids[size_t(py) * width + px];
+            if (dx*dx + dy*dy <= radius * radius && tile == target_id)
+                tile = id;
         }
     }
+    return rect;
 }
 
 inline void SetPixelLocal(Uint32* pixels, int pitch, Uint8 r, Uint8 g, Uint8 b, Uint8 a = 255) {
@@ -533,6 +774,24 @@ struct Shape {
         point_array[size++] = position;
     }
 
+    // Appends count points with at most one reallocation
+    void AddPoints(const SDL_FPoint* points, int count) {
+        if (count <= 0) return;
+        if (size + count > capacity) {
+            int new_capacity = capacity;
+            while (new_capacity < size + count) new_capacity *= 2;
+            SDL_FPoint* new_array = new SDL_FPoint[new_capacity];
+            std::copy(point_array, point_array + size, new_array);
+
+            delete[] point_array;
+            point_array = new_array;
+            capacity = new_capacity;
+        }
+
+        std::copy(points, points + count, point_array + size);
+        size += count;
+    }
+
     void RemovePointAtIndex(int index) {
         if (index < 0 || index >= size) return;
 
@@ -577,10 +836,12 @@ struct Shape {
 struct IconLayer{
     std::string layer_name;
     bool visible = true;
+    uint64_t saved_hash = 0; // hash of the layer as last saved, icon layers are journaled whole when it changes
 
     std::deque<IconCivilian> IconsCivilian;
     std::deque<IconMilitary> IconsMilitary;
     std::deque<Shape> Shapes;
+    IconLayerSnapshot outside_region; // icons of the savefile away from the loaded region, kept for saving
 
     IconCivilian& create_civilian_icon(SDL_Renderer* renderer, int icon_id, float pos_x, float pos_y, std::unordered_map<int, std::string>& idmap, std::string description = ""){
         IconCivilian icon;
@@ -635,60 +896,76 @@ struct IconLayer{
     }
 };
 
+// Where a raster that hasn't been decoded yet sits in its savefile
+struct PendingRaster {
+    std::string filename;
+    uint32_t version = 0;
+    uint64_t offset = 0; // start of the tile table
+    uint64_t length = 0; // tile table and tiles
+    int width = 0, height = 0;
+};
+
 struct WorldLayer{
     std::string layer_name;
     std::string idmap_name;
+    IDmapHandle idmap = NO_IDMAP; // idmap_name resolved when the layer is created
     bool visible = true;
     bool is_upper;
 
-    SDL_Texture* layer_texture;
+    TiledTexture* layer_texture; // shows ids, see show_ids
+
+    bool loaded = true; // hidden layers from a savefile stay on disk until shown
+    PendingRaster pending;
+    int rows_ready = -1; // rows uploaded so far while a load streams the layer in, -1 once it is complete
+
+    // The layer's tiles, one id per texture pixel. Painting, saving and loading all go through
+    // these, the texture only shows them (see show_ids). Empty while the layer is pending.
+    SparseIds ids;
+    // RECOLOR_BLOCK_SIZE blocks of an RGBA texture still showing colors its IDmap no longer has,
+    // empty when none are. INDEX8 textures never have any, their palette does the recolor.
+    std::vector<uint8_t> stale_blocks;
+
+    std::vector<uint8_t> dirty_tiles; // save tiles painted since the last save, see World::mark_dirty
 };
 
 struct PoliticalLayer{
     std::string layer_name;
     std::string idmap_name;
+    IDmapHandle idmap = NO_IDMAP;
     WorldLayer* world_layer;
     bool visible = true;
 
     //! Political layer will always be upper
     //? This is an intentional design decision
 
-    SDL_Texture* layer_texture;
+    TiledTexture* layer_texture;
     SDL_Texture* shadow_texture;
 
-    void update_texture(std::deque<IDmap> IDmaps){
-        if(!world_layer) return;
+    bool loaded = true;
+    PendingRaster pending;
+    int rows_ready = -1; // the shadow is only there once this is -1
 
-        IDmap* referenced_id_map = nullptr;
-        for (auto& id_map : IDmaps) {
-            if (id_map.name == world_layer->idmap_name) {
-                referenced_id_map = &id_map;
-                break;
-            }
-        }
+    SparseIds ids;
+    std::vector<uint8_t> stale_blocks;
+    std::vector<uint8_t> dirty_tiles;
+
+    void update_texture(){
+        if(!world_layer || world_layer->ids.empty()) return;
 
         void* shadow_pixels;
         int shadow_pitch;
-        void* world_pixels;
-        int world_pitch;
 
         if (!SDL_LockTexture(shadow_texture, nullptr, (void**)&shadow_pixels, &shadow_pitch)) {
             std::cerr << "Failed to lock texture: " << SDL_GetError() << "\n";
             return;
         }
-        if (!SDL_LockTexture(world_layer->layer_texture, nullptr, (void**)&world_pixels, &world_pitch)) {
-            std::cerr << "Failed to lock texture: " << SDL_GetError() << "\n";
-            return;
-        }
 
+        const int width = world_layer->layer_texture->w;
+        std::vector<uint8_t> row_ids(width);
         for(int i=0; i<world_layer->layer_texture->h; i++){
-            for(int j=0; j<world_layer->layer_texture->w; j++){
-                Uint32* world_px = (Uint32*)((Uint8*)world_pixels + i * world_pitch) + j;
-                Uint8 r = (*world_px >> 24) & 0xFF;
-                Uint8 g = (*world_px >> 16) & 0xFF;
-                Uint8 b = (*world_px >> 8)  & 0xFF;
-                uint32_t key = (r << 16) | (g << 8) | b;
-                uint8_t index = referenced_id_map->id_LUT[key];
+            world_layer->ids.read(0, i, width, 1, row_ids.data(), row_ids.size());
+            for(int j=0; j<width; j++){
+                uint8_t index = row_ids[j];
                 if(index == 0 || index == 0xFF){
                     SetPixelGlobal((Uint32*)shadow_pixels, shadow_pitch, j, i, 0, 0, 0, 100);
                 } else {
@@ -698,27 +975,16 @@ struct PoliticalLayer{
         }
 
         SDL_UnlockTexture(shadow_texture);
-        SDL_UnlockTexture(layer_texture);
-        SDL_UnlockTexture(world_layer->layer_texture);
     }
+};
 
-    void bake_texture(std::deque<IDmap> IDmaps){
-        void* layer_pixels;
-        int layer_pitch;
-
-        if (!SDL_LockTexture(layer_texture, nullptr, (void**)&layer_pixels, &layer_pitch)) {
-            std::cerr << "Failed to lock texture: " << SDL_GetError() << "\n";
-            return;
-        }
-        
-        for(int i=0; i<world_layer->layer_texture->h; i++){
-            for(int j=0; j<world_layer->layer_texture->w; j++){
-                SetPixelGlobal((Uint32*)layer_pixels, layer_pitch, j, i, 30, 30, 30, 255);
-            }
-        }
-
-        SDL_UnlockTexture(layer_texture);
-    }
+// The layer a stroke paints into, resolved from selected_layer on its first event so the motion
+// events after it don't look the layer up by name. Stale once World::layer_generation moves on.
+struct PaintTarget {
+    int layer_type = 0; // World::get_layer_type, 0 while unresolved
+    WorldLayer* world_layer = nullptr;
+    PoliticalLayer* political_layer = nullptr;
+    uint32_t generation = 0;
 };
 
 IconCivilian* FindClosestCivilianIcon(std::vector<IconCivilian>& vector_items, double targetX, double targetY) {
@@ -736,343 +1002,2996 @@ IconCivilian* FindClosestCivilianIcon(std::vector<IconCivilian>& vector_items, d
     return closest_icon;
 }
 
-class World{
-    private:
-    std::deque<IconLayer> IconLayers;
-    std::deque<WorldLayer> WorldLayers;
-    std::deque<PoliticalLayer> PoliticalLayers;
-    std::string last_created_layer_name = "name";
-
-    public:
-    bool WORLD_HAS_INITIALIZED = false;
-
-    int UPPER_WORLD_WIDTH=0; // number of chunks along the X-axis, i.e bigger sections of tiles
-    int UPPER_WORLD_HEIGHT=0; // number of chunks along the Y-axis, i.e bigger sections of tiles
-    int CHUNK_WIDTH=0; // Number of tiles in a chunk along the X-axis
-    int CHUNK_HEIGHT=0; // Number of tiles in a chunk along the Y-axis
-    int LOWER_WORLD_WIDTH=0; // Total number of tiles along the X-axis
-    int LOWER_WORLD_HEIGHT=0; // Total number of tiles along the Y-axis
-
-    std::deque<IDmap> IDmaps;
-    std::unordered_map<int, std::string> CivilianIdMap;
-    std::unordered_map<int, std::string> MilitaryIdMap;
-    std::unordered_map<int, std::string> MarkerIdMap;
-    std::unordered_map<int, std::string> DecoratorIdMap;
-    
-    IconBase* selected_world_icon = nullptr;
+struct RasterEncodeInput {
+    const SparseIds* ids;
+    TileGrid grid;
+};
 
-    bool HasInitializedCheck() {
-        if(UPPER_WORLD_HEIGHT>0 && CHUNK_WIDTH>0){
-            return true;
-        } else {
-            return false;
+// Encodes rasters on the worker pool, every band of tiles of every raster is a task of its own.
+// Bands are compressed into their own buffers and joined in file order afterwards, so the
+// output matches a single threaded encode.
+std::vector<EncodedRaster> encode_rasters(const std::vector<RasterEncodeInput>& inputs, std::atomic<uint64_t>* progress = nullptr) {
+    auto start_time = std::chrono::steady_clock::now();
+
+    struct Band {
+        size_t raster;
+        int tile_row;
+        std::vector<uint8_t> payload;
+        std::vector<uint64_t> offsets; // tile end offsets relative to the band payload
+        std::vector<uint64_t> hashes; // of the ids of every tile
+    };
+    std::vector<Band> bands;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        for (int ty = 0; ty < inputs[i].grid.tiles_y; ty++) {
+            bands.push_back({i, ty, {}, {}, {}});
         }
     }
 
-    void toggle_visibility_layer(const std::string& name_id) {
-        if(get_layer_type(name_id)==1){
-            WorldLayer& it = get_worldlayer(name_id);
-            it.visible = !it.visible;
-            std::cout<<"Debug::WorldLayer::Visibility::"<<it.visible<<std::endl;
-        }
-        if(get_layer_type(name_id)==2){
-            IconLayer& it = get_iconlayer(name_id);
-            it.visible = !it.visible;
-            std::cout<<"Debug::IconLayer::Visibility::"<<it.visible<<std::endl;
-        }
-        if(get_layer_type(name_id)==3){
-            PoliticalLayer& it = get_politicallayer(name_id);
-            it.visible = !it.visible;
-            std::cout<<"Debug::PoliticalLayer::Visibility::"<<it.visible<<std::endl;
-        }
+    std::atomic<uint64_t> busy_ns{0};
+    worker_pool().parallel_for(bands.size(), [&](size_t index) {
+        auto band_start = std::chrono::steady_clock::now();
+        Band& band = bands[index];
+        const RasterEncodeInput& input = inputs[band.raster];
+        const TileGrid& grid = input.grid;
+
+        int y0 = band.tile_row * grid.tile_h;
+        int band_height = std::min(grid.tile_h, grid.height - y0);
+        std::vector<uint8_t> ids(size_t(grid.width) * band_height);
+        input.ids->read(0, y0, grid.width, band_height, ids.data(), size_t(grid.width));
+        band.offsets.reserve(grid.tiles_x);
+        encode_tile_band(grid, band.tile_row, ids.data(), grid.width, band.payload, band.offsets);
+        hash_tile_band(grid, band.tile_row, ids.data(), grid.width, band.hashes);
+
+        if (progress) *progress += uint64_t(grid.width) * band_height;
+        busy_ns += uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - band_start).count());
+    });
+
+    std::vector<EncodedRaster> encoded(inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++) {
+        encoded[i].grid = inputs[i].grid;
+        encoded[i].offsets.reserve(inputs[i].grid.count() + 1);
+        encoded[i].offsets.push_back(0);
+    }
+    for (Band& band : bands) {
+        EncodedRaster& raster = encoded[band.raster];
+        uint64_t base = raster.payload.size();
+        for (uint64_t end : band.offsets) raster.offsets.push_back(base + end);
+        raster.payload.insert(raster.payload.end(), band.payload.begin(), band.payload.end());
+        raster.tile_hashes.insert(raster.tile_hashes.end(), band.hashes.begin(), band.hashes.end());
+        std::vector<uint8_t>().swap(band.payload);
     }
 
-    std::deque<IconLayer>& GetIconLayers() { return IconLayers; }
+    if (!bands.empty()) {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        double busy_seconds = double(busy_ns.load()) / 1e9;
+        double input_mb = 0.0;
+        for (auto& input : inputs) input_mb += double(input.grid.width) * input.grid.height / (1024.0 * 1024.0);
+        std::cout << "Debug::ParallelEncode::" << inputs.size() << " rasters, " << bands.size() << " bands, "
+                  << input_mb << " MB in " << seconds * 1000.0 << " ms on " << worker_pool().size() << " threads ("
+                  << busy_seconds * 1000.0 << " ms of work, " << (seconds > 0.0 ? busy_seconds / seconds : 1.0) << "x parallel)" << std::endl;
+    }
+    return encoded;
+}
 
-    std::deque<WorldLayer>& GetWorldLayers() { return WorldLayers; }
+// Everything a save needs, copied out of the World on the UI thread so the
+// encoding and writing can happen on a worker while editing goes on
+struct RasterSnapshot {
+    std::string layer_name;
+    std::string idmap_name;
+    std::string world_layer_name; // political layers only
+    bool visible = true;
+    bool is_upper = false;
+    int width = 0, height = 0;
+    TileGrid grid;
+    std::array<Uint32, 256> colors{}; // px_LUT of the layer's IDmap when the save started, it can be recolored meanwhile
+    bool loaded = true;
+    SparseIds ids; // copy of the layer's ids sharing its blocks, empty while the layer is still in its savefile
+    PendingRaster pending;
+};
 
-    std::deque<PoliticalLayer>& GetPoliticalLayers() { return PoliticalLayers; }
+// Painted tiles of one layer that a save took over
+struct DirtyTiles {
+    uint32_t type; // SECTION_WORLD_LAYER or SECTION_POLITICAL_LAYER
+    std::string layer_name;
+    std::vector<uint8_t> tiles;
+};
 
-    void MoveIconLayer(size_t index, bool down) {
-        if(down){
-            if (index == 0 || index >= IconLayers.size()) return;
-            std::swap(IconLayers[index], IconLayers[index - 1]);
-        } else {
-            if (index >= IconLayers.size() - 1) return;
-            std::swap(IconLayers[index], IconLayers[index + 1]);
-        }
-    }
+// What the World looked like when a full save was taken, the journal continues from it once the save succeeded
+struct SaveBaseline {
+    std::string structure; // World::structure_signature()
+    std::vector<std::pair<std::string, uint64_t>> icon_hashes;
+    std::vector<DirtyTiles> dirty; // handed back to the layers if the save fails
+};
 
-    void MoveWorldLayer(size_t index, bool down) {
-        if(down){
-            if (index == 0 || index >= WorldLayers.size()) return;
-            std::swap(WorldLayers[index], WorldLayers[index - 1]);
-        } else {
-            if (index >= WorldLayers.size() - 1) return;
-            std::swap(WorldLayers[index], WorldLayers[index + 1]);
-        }
+struct WorldSnapshot {
+    int32_t world_width = 0, world_height = 0;
+    int32_t chunk_width = 0, chunk_height = 0;
+    uint64_t save_id = 0;
+    int64_t save_time = 0;
+    std::vector<RasterSnapshot> world_layers;
+    std::vector<RasterSnapshot> political_layers;
+    std::vector<IconLayerSnapshot> icon_layers;
+    SaveBaseline baseline;
+
+    // Units of work for the progress bar, one per pixel and one per icon layer
+    uint64_t work_total() const {
+        uint64_t total = icon_layers.size();
+        for (auto& raster : world_layers) total += uint64_t(raster.width) * raster.height;
+        for (auto& raster : political_layers) total += uint64_t(raster.width) * raster.height;
+        return total;
     }
+};
 
-    void MovePoliticalLayer(size_t index, bool down) {
-        if(down){
-            if (index == 0 || index >= PoliticalLayers.size()) return;
-            std::swap(PoliticalLayers[index], PoliticalLayers[index - 1]);
-        } else {
-            if (index >= PoliticalLayers.size() - 1) return;
-            std::swap(PoliticalLayers[index], PoliticalLayers[index + 1]);
-        }
+// A hidden layer that was copied into the new savefile without being decoded
+struct MovedRaster {
+    uint32_t type; // SECTION_WORLD_LAYER or SECTION_POLITICAL_LAYER
+    std::string layer_name;
+    PendingRaster source; // where it was copied from
+    uint64_t offset; // where it starts in the new file
+};
+
+// Copies a raster that was never decoded straight from its savefile
+bool copy_pending_raster(std::ostream& out, const PendingRaster& pending) {
+    MappedFile file(pending.filename);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open file " << pending.filename << "\n";
+        return false;
     }
+    ByteReader in(file.data(), file.size());
+    in.seek(pending.offset);
 
-    void SaveWorld(std::string filename = "savename.nw", bool cloud = false) {
-        std::cout << "Debug::SaveWorld::" << filename << std::endl;
-        std::string full_filename = "saves/" + filename;
+    const uint8_t* raster = in.take(pending.length);
+    if (!raster) return false;
+    out.write(reinterpret_cast<const char*>(raster), std::streamsize(pending.length));
+    return true;
+}
 
-        std::ofstream out(full_filename, std::ios::binary);
-        if (!out) {
-            std::cerr << "Failed to open save file\n";
-            return;
+// Tile hashes of a raster that was never decoded. They come from the hash tree of its savefile
+// if that has one, otherwise (savefiles from before the hash tree) its tiles are decoded for them.
+bool hash_pending_raster(const PendingRaster& pending, uint32_t type, RasterHashTree& tree) {
+    MappedFile file(pending.filename);
+    if (!file.is_open()) return false;
+    ByteReader in(file.data(), file.size());
+    in.seek(pending.offset);
+    RasterDecodeJob job;
+    if (!parse_raster(in, pending.version, pending.width, pending.height, job)) return false;
+    tree.grid = job.grid;
+
+    // the stored tree lists rasters in the order of their sections, the pending one is in one of them
+    SaveHeader header;
+    WorldHashTree stored;
+    ByteReader header_reader(file.data(), file.size());
+    if (read_save_header(header_reader, header) && read_savefile_hash_tree(file.data(), file.size(), header, stored)) {
+        size_t index = 0;
+        for (auto& section : header.sections) {
+            if (section.type != type) continue;
+            if (pending.offset >= section.offset && pending.offset < section.offset + section.length) break;
+            index++;
         }
+        const RasterHashTree* stored_raster = nullptr;
+        for (auto& raster : stored.rasters) {
+            if (raster.type == type && index-- == 0) {
+                stored_raster = &raster;
+                break;
+            }
+        }
+        if (stored_raster && stored_raster->grid.width == job.grid.width && stored_raster->grid.height == job.grid.height &&
+            stored_raster->grid.tile_w == job.grid.tile_w && stored_raster->grid.tile_h == job.grid.tile_h) {
+            tree.build(stored_raster->levels[0]);
+            return true;
+        }
+    }
 
-        // Write world dimensions
-        int32_t world_width  = UPPER_WORLD_WIDTH;
-        int32_t world_height = UPPER_WORLD_HEIGHT;
-        int32_t chunk_width  = CHUNK_WIDTH;
-        int32_t chunk_height = CHUNK_HEIGHT;
-        out.write(reinterpret_cast<char*>(&world_width), sizeof(world_width));
-        out.write(reinterpret_cast<char*>(&world_height), sizeof(world_height));
-        out.write(reinterpret_cast<char*>(&chunk_width), sizeof(chunk_width));
-        out.write(reinterpret_cast<char*>(&chunk_height), sizeof(chunk_height));
-
-        // Number of layers
-        int32_t num_layers_world = WorldLayers.size();
-        out.write(reinterpret_cast<char*>(&num_layers_world), sizeof(num_layers_world));
+    std::vector<uint8_t> ids(size_t(pending.width) * pending.height);
+    if (!decode_raster_ids(job, ids.data(), size_t(pending.width))) return false;
+    tree.build(hash_raster_tiles(ids.data(), size_t(pending.width), job.grid));
+    return true;
+}
 
-        int32_t num_layers_political = PoliticalLayers.size();
-        out.write(reinterpret_cast<char*>(&num_layers_political), sizeof(num_layers_political));
+static_assert(sizeof(ShapePoint) == sizeof(SDL_FPoint), "shape points are copied as pairs of floats");
 
-        int32_t num_layers_icon = IconLayers.size();
-        out.write(reinterpret_cast<char*>(&num_layers_icon), sizeof(num_layers_icon));
+IconLayerSnapshot snapshot_icon_layer(const IconLayer& icon_layer) {
+    IconLayerSnapshot layer;
+    layer.layer_name = icon_layer.layer_name;
+    layer.visible = icon_layer.visible;
+    layer.lossless_positions = LOSSLESS_ICON_POSITIONS;
+    for (auto& icon : icon_layer.IconsCivilian) {
+        layer.civilian_icons.push_back({icon.icon_id, icon.position.x, icon.position.y, icon.description});
+    }
+    for (auto& icon : icon_layer.IconsMilitary) {
+        MilitaryIconSnapshot military_icon = {icon.icon_id, icon.country_id, icon.quality, icon.position.x, icon.position.y, icon.angle, icon.description, {}};
+        for (auto& decorator : icon.decorators) {
+            military_icon.decorators.push_back(decorator.id);
+        }
+        layer.military_icons.push_back(std::move(military_icon));
+    }
+    for (auto& shape : icon_layer.Shapes) {
+        ShapeSnapshot snapshot_shape = {shape.r, shape.g, shape.b, shape.a, {}};
+        snapshot_shape.points.resize(size_t(shape.size));
+        std::memcpy(snapshot_shape.points.data(), shape.point_array, snapshot_shape.points.size() * sizeof(ShapePoint));
+        layer.shapes.push_back(std::move(snapshot_shape));
+    }
 
-        // World layers
-        for (auto& world_layer : WorldLayers) {
-            // Find referenced IDmap
-            IDmap* referenced_id_map = nullptr;
-            for (auto& id_map : IDmaps) {
-                if (id_map.name == world_layer.idmap_name) {
-                    referenced_id_map = &id_map;
-                    break;
-                }
-            }
-            if (!referenced_id_map) {
-                std::cerr << "No IDmap found for layer " << world_layer.layer_name << "\n";
-                continue;
-            }
+    const IconLayerSnapshot& outside = icon_layer.outside_region;
+    layer.civilian_icons.insert(layer.civilian_icons.end(), outside.civilian_icons.begin(), outside.civilian_icons.end());
+    layer.military_icons.insert(layer.military_icons.end(), outside.military_icons.begin(), outside.military_icons.end());
+    layer.shapes.insert(layer.shapes.end(), outside.shapes.begin(), outside.shapes.end());
+    return layer;
+}
 
-            // Query texture
-            SDL_PixelFormat format = world_layer.layer_texture->format;
-            int width = world_layer.layer_texture->w; 
-            int height = world_layer.layer_texture->h;
-            const SDL_PixelFormatDetails* fmt = SDL_GetPixelFormatDetails(format);
+// Time per frame spent on building a world that streams in, the rest is left to the editor
+const double LOAD_FRAME_BUDGET_MS = 8.0;
+// Decoded rows waiting for upload, the loader pauses once this much is queued
+const size_t LOAD_QUEUE_MAX_BYTES = size_t(256) * 1024 * 1024;
+// Rows the loader aims to hand over at once, bands of tiles are grouped up to this size
+const size_t LOAD_BAND_BYTES = size_t(8) * 1024 * 1024;
+
+// Decodes a raster into a layer's ids straight from the mapped savefile, bands of tiles on the
+// worker pool. ids has to be width x height already. Up to LOAD_BAND_BYTES of rows are decoded
+// at a time, a layer that is mostly one id never is in memory whole.
+bool read_raster(ByteReader& in, uint32_t version, int width, int height, SparseIds& ids) {
+    auto start_time = std::chrono::steady_clock::now();
+    size_t start_pos = in.tell();
+
+    RasterDecodeJob job;
+    if (!parse_raster(in, version, width, height, job)) return false;
+    const TileGrid& grid = job.grid;
+    size_t tile_row_bytes = size_t(width) * grid.tile_h;
+    int group_rows = int(std::max<size_t>(worker_pool().size(), LOAD_BAND_BYTES / std::max<size_t>(tile_row_bytes, 1)));
+    std::vector<uint8_t> rows;
+    for (int tile_row = 0; tile_row < grid.tiles_y; tile_row += group_rows) {
+        int tile_rows = std::min(group_rows, grid.tiles_y - tile_row);
+        int y0 = tile_row * grid.tile_h;
+        int band_height = std::min(tile_rows * grid.tile_h, height - y0);
+        rows.resize(size_t(width) * band_height);
+        if (!decode_raster_rows(job, tile_row, tile_rows, rows.data(), size_t(width))) return false;
+        ids.write(0, y0, width, band_height, rows.data(), size_t(width));
+    }
 
-            // Lock texture
-            void* pixels;
-            int pitch;
-            if (!SDL_LockTexture(world_layer.layer_texture, nullptr, &pixels, &pitch)) {
-                std::cerr << "Failed to lock texture: " << SDL_GetError() << "\n";
-                continue;
-            }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    double output_mb = double(width) * height / (1024.0 * 1024.0);
+    std::cout << "Debug::RasterLoaded::" << width << "x" << height << " "
+              << (in.tell() - start_pos) << " bytes -> " << output_mb << " MB in " << seconds * 1000.0 << " ms ("
+              << (seconds > 0.0 ? output_mb / seconds : 0.0) << " MB/s), " << double(ids.memory_size()) / (1024.0 * 1024.0) << " MB held" << std::endl;
+    return true;
+}
 
-            // Metadata / header stuff
-            int32_t lnameLen = world_layer.layer_name.size();
-            out.write(reinterpret_cast<char*>(&lnameLen), sizeof(lnameLen));
-            out.write(world_layer.layer_name.data(), lnameLen);
+// A rectangle of the world in chunks, for loading only part of a savefile. Empty means all of it.
+struct WorldRegion {
+    int x = 0, y = 0;
+    int width = 0, height = 0;
 
-            int32_t idnameLen = world_layer.idmap_name.size();
-            out.write(reinterpret_cast<char*>(&idnameLen), sizeof(idnameLen));
-            out.write(world_layer.idmap_name.data(), idnameLen);
+    bool empty() const { return width <= 0 || height <= 0; }
+};
 
-            int32_t w = width, h = height;
-            out.write(reinterpret_cast<char*>(&w), sizeof(w));
-            out.write(reinterpret_cast<char*>(&h), sizeof(h));
+// Regions are widened to multiples of this many chunks, so the tiles saved from one never reach past its edge
+const int REGION_ALIGN_CHUNKS = 8;
+// Icons and shapes this many chunks around a region are loaded with it
+const int REGION_ICON_MARGIN_CHUNKS = 2;
+
+// Clamps a region to a world of world_width x world_height chunks and widens it to REGION_ALIGN_CHUNKS.
+// Empty if nothing of it is inside the world.
+WorldRegion align_region(const WorldRegion& region, int world_width, int world_height) {
+    int x0 = std::clamp(region.x, 0, world_width), y0 = std::clamp(region.y, 0, world_height);
+    int x1 = std::clamp(region.x + region.width, 0, world_width), y1 = std::clamp(region.y + region.height, 0, world_height);
+    if (x1 <= x0 || y1 <= y0) return WorldRegion();
+
+    x0 -= x0 % REGION_ALIGN_CHUNKS;
+    y0 -= y0 % REGION_ALIGN_CHUNKS;
+    x1 = std::min(world_width, (x1 + REGION_ALIGN_CHUNKS - 1) / REGION_ALIGN_CHUNKS * REGION_ALIGN_CHUNKS);
+    y1 = std::min(world_height, (y1 + REGION_ALIGN_CHUNKS - 1) / REGION_ALIGN_CHUNKS * REGION_ALIGN_CHUNKS);
+    return {x0, y0, x1 - x0, y1 - y0};
+}
 
-            uint8_t isUpper = world_layer.is_upper ? 1 : 0;
-            out.write(reinterpret_cast<char*>(&isUpper), sizeof(isUpper));
+// World pixels whose icons and shapes are loaded with a region, the region and its margin
+SDL_FRect region_icon_bounds(const WorldRegion& region, int chunk_width, int chunk_height) {
+    return {float((region.x - REGION_ICON_MARGIN_CHUNKS) * chunk_width), float((region.y - REGION_ICON_MARGIN_CHUNKS) * chunk_height),
+            float((region.width + 2 * REGION_ICON_MARGIN_CHUNKS) * chunk_width), float((region.height + 2 * REGION_ICON_MARGIN_CHUNKS) * chunk_height)};
+}
 
-            // Streaming pixel to file
-            std::vector<uint8_t> rowBuffer(width);
+// Moves the icons and shapes of icon_layer that lie outside bounds (world pixels) over to outside.
+// Shapes stay when their bounding box touches bounds.
+void split_icons_by_bounds(IconLayerSnapshot& icon_layer, const SDL_FRect& bounds, IconLayerSnapshot& outside) {
+    auto inside = [&](float x, float y) { return x >= bounds.x && y >= bounds.y && x < bounds.x + bounds.w && y < bounds.y + bounds.h; };
+    auto split = [&](auto& icons, auto& outside_icons) {
+        auto middle = std::stable_partition(icons.begin(), icons.end(), [&](const auto& icon) { return inside(icon.x, icon.y); });
+        std::move(middle, icons.end(), std::back_inserter(outside_icons));
+        icons.erase(middle, icons.end());
+    };
+    split(icon_layer.civilian_icons, outside.civilian_icons);
+    split(icon_layer.military_icons, outside.military_icons);
+
+    auto middle = std::stable_partition(icon_layer.shapes.begin(), icon_layer.shapes.end(), [&](const ShapeSnapshot& shape) {
+        if (shape.points.empty()) return false;
+        float min_x = shape.points[0].x, max_x = min_x;
+        float min_y = shape.points[0].y, max_y = min_y;
+        for (auto& point : shape.points) {
+            min_x = std::min(min_x, point.x);
+            max_x = std::max(max_x, point.x);
+            min_y = std::min(min_y, point.y);
+            max_y = std::max(max_y, point.y);
+        }
+        return max_x >= bounds.x && min_x < bounds.x + bounds.w && max_y >= bounds.y && min_y < bounds.y + bounds.h;
+    });
+    std::move(middle, icon_layer.shapes.end(), std::back_inserter(outside.shapes));
+    icon_layer.shapes.erase(middle, icon_layer.shapes.end());
+}
 
-            uint8_t* row = static_cast<uint8_t*>(pixels);
-            for (int y = 0; y < height; ++y) {
-                Uint32* px = reinterpret_cast<Uint32*>(row);
-                for (int x = 0; x < width; ++x) {
-                    Uint32 pixel = px[x];
+// A world or political layer of the savefile being loaded, planned from its section header
+struct LoadRaster {
+    uint32_t type = SECTION_WORLD_LAYER; // or SECTION_POLITICAL_LAYER
+    std::string layer_name;
+    std::string idmap_name;
+    std::string world_layer_name; // political layers only
+    bool is_upper = true;
+    bool visible = true;
+    int width = 0, height = 0;
+    SDL_Rect window{}; // part of the raster that is loaded, all of it unless a region is
+    uint64_t raster_offset = 0; // start of the tile table
+    bool decode = false; // false when it stays in the file until shown, or can't be loaded
+    bool pending = false;
+    PendingRaster pending_raster;
+    IDmapHandle idmap = NO_IDMAP; // a handle, IDmaps can be added and recolored during the load
+
+    // UI thread only, once the layer exists
+    TiledTexture* texture = nullptr;
+    int rows_done = 0;
+};
 
-                    Uint8 r = (pixel >> 24) & 0xFF;
-                    Uint8 g = (pixel >> 16) & 0xFF;
-                    Uint8 b = (pixel >> 8)  & 0xFF;
+// Rows of a raster decoded by the loader, waiting to be copied into its layer.
+// A band without rows ends its raster, failed if the rest of it couldn't be decoded.
+struct LoadedBand {
+    size_t raster = 0; // index into LoadJob::rasters
+    int y0 = 0, rows = 0;
+    bool failed = false;
+    std::vector<uint8_t> ids;
+};
 
-                    uint32_t key = (r << 16) | (g << 8) | b;
-                    uint8_t index = referenced_id_map->id_LUT[key];
-                    if (index == 0xFF) index = 255;
+// A load running on a worker thread. The worker checks the savefile, reads the icon layers and
+// decodes the rasters band by band, topmost layers first. The layers, textures and icons are
+// built from what it hands over back on the UI thread, a bit every frame.
+struct LoadJob {
+    std::string name;
+    std::unique_ptr<ByteSource> owned_source; // empty when the caller keeps the source alive
+    const ByteSource* source = nullptr;
+    SDL_Renderer* renderer = nullptr;
+    bool lazy = false;
+    bool verify = false;
+    std::string restore_savefile; // file in saves/ the source is written over once the world is built, see RestoreFromHistory
+    WorldRegion region; // chunks to load, all of the world when empty
+    SDL_FRect icon_bounds{}; // world pixels, the region and its margin
+    SaveHeader header;
+    std::vector<LoadRaster> rasters; // world layers then political layers, as in the file
+    std::vector<size_t> decode_order;
+    uint64_t icons_offset = 0; // where the first icon layer starts in files without a directory
+    std::vector<IconLayerSnapshot> icon_layers;
+    std::vector<IconLayerSnapshot> icons_outside; // per icon layer, what lies away from the region
+    std::string error;
+    std::chrono::steady_clock::time_point start_time;
+
+    std::atomic<bool> verified{false}; // checked and icon layers read, the world can be built
+    std::atomic<bool> failed{false};
+    std::atomic<bool> decoded{false};
+    std::atomic<bool> cancelled{false};
+
+    std::mutex mutex;
+    std::condition_variable queue_space;
+    std::deque<LoadedBand> bands;
+    size_t queued_bytes = 0;
+
+    // UI thread only
+    bool built = false;
+    size_t next_icon_layer = 0, next_icon = 0;
+    uint64_t progress_total = 0, progress_done = 0; // rows and icons
+    std::thread worker;
+};
 
-                    rowBuffer[x] = index;
-                }
-                out.write(reinterpret_cast<char*>(rowBuffer.data()), width); // flush row
-                row += pitch;
-            }
+// Hands a band over to the UI thread, waits while too much is queued already
+void push_loaded_band(LoadJob& job, LoadedBand band) {
+    size_t bytes = band.ids.size();
+    std::unique_lock<std::mutex> lock(job.mutex);
+    job.queue_space.wait(lock, [&]() { return job.cancelled || job.bands.empty() || job.queued_bytes + bytes <= LOAD_QUEUE_MAX_BYTES; });
+    job.queued_bytes += bytes;
+    job.bands.push_back(std::move(band));
+}
 
-            SDL_UnlockTexture(world_layer.layer_texture);
-            std::cout << "Debug::LayerSaved::" << world_layer.layer_name << std::endl;
-        }
+// Decodes the window of one raster of a load into bands of ids, a group of tile rows at a time
+// across the worker pool. Only the tiles the window overlaps are decoded.
+void decode_loaded_raster(LoadJob& job, size_t raster_index) {
+    const LoadRaster& raster = job.rasters[raster_index];
+    ByteReader in = job.source->reader();
+    RasterDecodeJob decode_job;
+    if (!in.seek(raster.raster_offset) || !parse_raster(in, job.header.version, raster.width, raster.height, decode_job)) {
+        push_loaded_band(job, {raster_index, 0, 0, true, {}});
+        return;
+    }
 
-        // Political layers
-        for (auto& political_layer : PoliticalLayers) {
-            // Find referenced IDmap
-            IDmap* referenced_id_map = nullptr;
-            for (auto& id_map : IDmaps) {
-                if (id_map.name == political_layer.idmap_name) {
-                    referenced_id_map = &id_map;
-                    break;
+    const TileGrid& grid = decode_job.grid;
+    const SDL_Rect& window = raster.window;
+    int first_tile_row = window.y / grid.tile_h;
+    int end_tile_row = (window.y + window.h + grid.tile_h - 1) / grid.tile_h;
+    size_t tile_row_bytes = size_t(window.w) * grid.tile_h;
+    int group_rows = int(std::max<size_t>(worker_pool().size(), LOAD_BAND_BYTES / std::max<size_t>(tile_row_bytes, 1)));
+    for (int group_row = first_tile_row; group_row < end_tile_row; group_row += group_rows) {
+        if (job.cancelled) return;
+        int tile_rows = std::min(group_rows, end_tile_row - group_row);
+        int band_top = std::max(group_row * grid.tile_h, window.y);
+        int band_bottom = std::min((group_row + tile_rows) * grid.tile_h, window.y + window.h);
+        LoadedBand band;
+        band.raster = raster_index;
+        band.y0 = band_top - window.y; // bands are in texture rows
+        band.rows = band_bottom - band_top;
+        band.ids.resize(size_t(window.w) * band.rows);
+
+        std::vector<uint8_t> band_ok(size_t(tile_rows), 1);
+        worker_pool().parallel_for(size_t(tile_rows), [&](size_t index) {
+            int tile_row = group_row + int(index);
+            int top = std::max(tile_row * grid.tile_h, band_top);
+            int rows = std::min((tile_row + 1) * grid.tile_h, band_bottom) - top;
+            uint8_t* out = band.ids.data() + size_t(top - band_top) * window.w;
+            if (decode_job.version == 1) {
+                for (int y = 0; y < rows; y++) {
+                    std::memcpy(out + size_t(y) * window.w, decode_job.payload + size_t(top + y) * grid.width + window.x, size_t(window.w));
                 }
+                return;
             }
-            if (!referenced_id_map) {
-                std::cerr << "No IDmap found for layer " << political_layer.layer_name << "\n";
-                continue;
+            std::vector<uint8_t> tile;
+            if (!decode_tile_band_window(grid, tile_row, decode_job.payload, decode_job.payload_size, decode_job.offsets.data(), window.x, top, window.w, rows,
+                                         out, size_t(window.w), tile)) {
+                band_ok[index] = 0;
             }
+        });
+
+        // rows before a damaged band are still good
+        size_t good_rows = 0;
+        while (good_rows < band_ok.size() && band_ok[good_rows]) good_rows++;
+        if (good_rows < band_ok.size()) {
+            band.rows = std::max(0, std::min(band_bottom, (group_row + int(good_rows)) * grid.tile_h) - band_top);
+            band.ids.resize(size_t(window.w) * band.rows);
+            if (band.rows > 0) push_loaded_band(job, std::move(band));
+            push_loaded_band(job, {raster_index, 0, 0, true, {}});
+            return;
+        }
+        push_loaded_band(job, std::move(band));
+    }
+    push_loaded_band(job, {raster_index, 0, 0, false, {}});
+}
 
-            // Query texture
-            SDL_PixelFormat format = political_layer.layer_texture->format;
-            int width = political_layer.layer_texture->w; 
-            int height = political_layer.layer_texture->h;
-            const SDL_PixelFormatDetails* fmt = SDL_GetPixelFormatDetails(format);
-
-            // Lock texture
-            void* pixels;
-            int pitch;
-            if (!SDL_LockTexture(political_layer.layer_texture, nullptr, &pixels, &pitch)) {
-                std::cerr << "Failed to lock texture: " << SDL_GetError() << "\n";
-                continue;
-            }
+void run_load_job(LoadJob& job) {
+    const ByteSource& source = *job.source;
+    if (job.verify && !verify_savefile(source.data(), source.size(), job.header, job.error)) {
+        job.failed = true;
+        return;
+    }
 
-            // Metadata / header stuff
-            int32_t lnameLen = political_layer.layer_name.size();
-            out.write(reinterpret_cast<char*>(&lnameLen), sizeof(lnameLen));
-            out.write(political_layer.layer_name.data(), lnameLen);
+    // icon layers are small next to the rasters, they are all read before the world is built
+    bool columnar = job.header.version >= SAVE_ICON_COLUMNS_VERSION;
+    ByteReader in = source.reader();
+    in.seek(job.icons_offset);
+    for (int i = 0; i < job.header.num_layers_icon && !job.cancelled; i++) {
+        const SaveSection* section = job.header.find_section(SECTION_ICON_LAYER, i);
+        if (section) in.seek(section->offset);
+
+        IconLayerSnapshot icon_layer;
+        icon_layer.visible = !section || (section->flags & SECTION_VISIBLE);
+        if (!in.read_string<int32_t>(icon_layer.layer_name, SAVE_MAX_NAME_LENGTH)) {
+            std::cerr << "Damaged layer header" << "\n";
+            break;
+        }
+        if (!read_icon_layer(in, icon_layer, columnar)) {
+            std::cerr << "Failed to read icon layer " << icon_layer.layer_name << "\n";
+        }
+        if (!job.region.empty()) {
+            IconLayerSnapshot outside;
+            split_icons_by_bounds(icon_layer, job.icon_bounds, outside);
+            job.icons_outside.push_back(std::move(outside));
+        }
+        job.icon_layers.push_back(std::move(icon_layer));
+    }
+    job.verified = true;
 
-            int32_t idnameLen = political_layer.idmap_name.size();
-            out.write(reinterpret_cast<char*>(&idnameLen), sizeof(idnameLen));
-            out.write(political_layer.idmap_name.data(), idnameLen);
+    for (size_t raster_index : job.decode_order) {
+        if (job.cancelled) break;
+        decode_loaded_raster(job, raster_index);
+    }
+    job.decoded = true;
+}
+
+// Preview block of a snapshot: icon counts and the visible layers composited in the order
+// draw_all stacks them
+void write_save_preview(std::ostream& out, const WorldSnapshot& snapshot) {
+    SavePreview preview;
+    preview.save_time = snapshot.save_time;
+    for (auto& icon_layer : snapshot.icon_layers) {
+        preview.civilian_icons += int32_t(icon_layer.civilian_icons.size());
+        preview.military_icons += int32_t(icon_layer.military_icons.size());
+        preview.shapes += int32_t(icon_layer.shapes.size());
+    }
+
+    start_save_thumbnail(preview, snapshot.world_width, snapshot.world_height);
+    auto draw = [&](const RasterSnapshot& raster) {
+        if (!raster.visible || raster.ids.empty()) return;
+        blend_save_thumbnail(preview, raster.width, raster.height, [&](int x, int y) { return raster.colors[raster.ids.at(x, y)]; });
+    };
+    for (auto& raster : snapshot.world_layers) draw(raster);
+    for (auto& raster : snapshot.political_layers) draw(raster);
+
+    write_save_preview(out, preview);
+}
+
+// Writes a snapshot as a savefile. Runs on the save worker, so it only touches the snapshot.
+// progress (if given) counts up to snapshot.work_total().
+bool write_world_snapshot(const WorldSnapshot& snapshot, const std::string& filename, std::vector<MovedRaster>& moved_rasters, std::atomic<uint64_t>* progress) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to open save file\n";
+        return false;
+    }
+    // everything goes through the writer, which checksums each section as it is written
+    SavefileWriter writer(file.rdbuf());
+    std::ostream& out = writer.stream();
+    writer.write_header(snapshot.world_width, snapshot.world_height, snapshot.chunk_width, snapshot.chunk_height);
+
+    // Every loaded raster is encoded up front across all cores, then written in file order
+    std::vector<RasterEncodeInput> encode_inputs;
+    for (auto* rasters : {&snapshot.world_layers, &snapshot.political_layers}) {
+        for (auto& raster : *rasters) {
+            if (raster.loaded) {
+                encode_inputs.push_back({&raster.ids, raster.grid});
+            }
+        }
+    }
+    std::vector<EncodedRaster> encoded = encode_rasters(encode_inputs, progress);
+    size_t next_encoded = 0;
+
+    // Tile hashes of every raster, written after the layers as the hash tree
+    WorldHashTree hash_tree;
+    hash_tree.world_width = snapshot.world_width;
+    hash_tree.world_height = snapshot.world_height;
+    hash_tree.chunk_width = snapshot.chunk_width;
+    hash_tree.chunk_height = snapshot.chunk_height;
+    bool hash_tree_complete = true;
+
+    auto write_raster = [&](uint32_t type, const RasterSnapshot& raster) {
+        RasterHashTree tree;
+        tree.type = type;
+        tree.layer_name = raster.layer_name;
+        tree.idmap_name = raster.idmap_name;
+        if (raster.loaded) {
+            write_encoded_raster(out, encoded[next_encoded]);
+            tree.grid = encoded[next_encoded].grid;
+            tree.build(std::move(encoded[next_encoded].tile_hashes));
+            encoded[next_encoded++] = EncodedRaster(); // written, free it
+        } else {
+            hash_tree_complete = hash_pending_raster(raster.pending, type, tree) && hash_tree_complete;
+            moved_rasters.push_back({type, raster.layer_name, raster.pending, writer.tell()});
+            if (!copy_pending_raster(out, raster.pending)) {
+                std::cerr << "Failed to copy hidden layer " << raster.layer_name << "\n";
+            }
+            if (progress) *progress += uint64_t(raster.width) * raster.height;
+        }
+        hash_tree.rasters.push_back(std::move(tree));
+    };
+
+    // Preview for the world browser, which only reads this far into the file
+    writer.begin_section(SECTION_PREVIEW, true, "");
+    write_save_preview(out, snapshot);
+    writer.end_section();
+
+    // Save id, an edit journal next to this file only applies if it names the same id
+    writer.begin_section(SECTION_SAVE_ID, true, "");
+    uint64_t save_id = snapshot.save_id;
+    out.write(reinterpret_cast<char*>(&save_id), sizeof(save_id));
+    writer.end_section();
+
+    // World layers
+    for (auto& world_layer : snapshot.world_layers) {
+        writer.begin_section(SECTION_WORLD_LAYER, world_layer.visible, world_layer.layer_name);
+        writer.write_raster_header(SECTION_WORLD_LAYER, {world_layer.layer_name, world_layer.idmap_name, "", world_layer.width, world_layer.height, world_layer.is_upper});
+        write_raster(SECTION_WORLD_LAYER, world_layer);
+        writer.end_section();
+        std::cout << "Debug::LayerSaved::" << world_layer.layer_name << std::endl;
+    }
+
+    // Political layers
+    for (auto& political_layer : snapshot.political_layers) {
+        writer.begin_section(SECTION_POLITICAL_LAYER, political_layer.visible, political_layer.layer_name);
+        writer.write_raster_header(SECTION_POLITICAL_LAYER, {political_layer.layer_name, political_layer.idmap_name, political_layer.world_layer_name,
+                                                             political_layer.width, political_layer.height, true});
+        write_raster(SECTION_POLITICAL_LAYER, political_layer);
+        writer.end_section();
+        std::cout << "Debug::LayerSaved::" << political_layer.layer_name << std::endl;
+    }
+
+    // Icon layers
+    for (auto& icon_layer : snapshot.icon_layers) {
+        writer.begin_section(SECTION_ICON_LAYER, icon_layer.visible, icon_layer.layer_name);
+
+        ByteWriter section;
+        write_icon_layer(section, icon_layer);
+        out.write(reinterpret_cast<const char*>(section.data()), section.size());
+        hash_tree.icon_layers.push_back({icon_layer.layer_name, nw_hash64(section.data(), section.size())});
+
+        writer.end_section();
+        if (progress) *progress += 1;
+    }
+
+    // Hash tree, left out if a hidden layer couldn't be hashed rather than written wrong
+    if (hash_tree_complete) {
+        hash_tree.finish();
+        writer.begin_section(SECTION_HASH_TREE, true, "");
+        ByteWriter section;
+        write_hash_tree(section, hash_tree);
+        out.write(reinterpret_cast<const char*>(section.data()), section.size());
+        writer.end_section();
+        std::cout << "Debug::HashTree::" << std::hex << hash_tree.root << std::dec << std::endl;
+    }
+
+    bool written = writer.finish();
+    file.close();
+    if (!written || !file) {
+        std::cerr << "Failed to write save file " << filename << "\n";
+        std::remove(filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+void upload_savefile(const std::string& filename) {
+    std::string command = "AWSupload.exe " + filename;
+    int AWSupload_exitcode = std::system(command.c_str());
+    if (AWSupload_exitcode == 0) {
+        std::cout << "AWSupload completed successfully: " << AWSupload_exitcode << std::endl;
+    } else {
+        std::cout << "AWSupload failed to upload: " << AWSupload_exitcode << std::endl;
+    }
+}
+
+// Fetches a shared savefile into memory. AWSdownload.exe can only write to a fixed file,
+// it is read back right away and deleted so loading works on the buffer alone.
+bool download_savefile(const std::string& filename, std::vector<uint8_t>& bytes) {
+    const char* download_filename = "saves/aws_temp_download.nw";
+    std::string command = "AWSdownload.exe " + filename;
+    int AWSdownload_exitcode = std::system(command.c_str());
+    if (AWSdownload_exitcode != 0) {
+        std::cout << "AWSdownload failed with exit code: " << AWSdownload_exitcode << std::endl;
+        return false;
+    }
+    std::cout << "AWSdownload completed successfully: " << AWSdownload_exitcode << std::endl;
+
+    std::ifstream in(download_filename, std::ios::binary | std::ios::ate);
+    std::streamoff length = in ? std::streamoff(in.tellg()) : -1;
+    if (length > 0) {
+        bytes.resize(size_t(length));
+        in.seekg(0);
+        in.read(reinterpret_cast<char*>(bytes.data()), length);
+    }
+    bool read_ok = length > 0 && bool(in);
+    in.close();
+
+    if (std::remove(download_filename) != 0) {
+        perror("Error deleting temporary savefile :(");
+    }
+    if (!read_ok) {
+        std::cerr << "Failed to open downloaded file" << "\n";
+        bytes.clear();
+    }
+    return read_ok;
+}
+
+// Writes a whole file next to its final name and renames it into place
+bool write_file_atomically(const std::string& filename, const uint8_t* data, size_t size) {
+    std::string temporary_filename = filename + ".tmp";
+    {
+        std::ofstream out(temporary_filename, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(data), std::streamsize(size));
+        out.close();
+        if (!out) {
+            std::remove(temporary_filename.c_str());
+            return false;
+        }
+    }
+    std::error_code rename_error;
+    std::filesystem::rename(temporary_filename, filename, rename_error);
+    if (rename_error) {
+        std::cerr << "Failed to replace " << filename << ": " << rename_error.message() << "\n";
+        std::remove(temporary_filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Where the tiles of a world/political layer section are
+struct RasterSectionLayout {
+    uint64_t table_offset = 0; // of tile_w, tile_h and the tile offsets, from the start of the file
+    TileGrid grid;
+    std::vector<uint64_t> offsets; // tile ends, relative to the payload
+
+    uint64_t payload_offset() const { return table_offset + 2 * sizeof(int32_t) + offsets.size() * sizeof(uint64_t); }
+};
+
+// Reads the fields in front of the tile table of a raster section, false if it isn't tiled
+bool read_raster_section_layout(const uint8_t* data, uint32_t version, const SaveSection& section, RasterSectionLayout& layout) {
+    if (version < SAVE_RASTER_VERSION) return false;
+    if (section.type != SECTION_WORLD_LAYER && section.type != SECTION_POLITICAL_LAYER) return false;
+
+    ByteReader in(data + section.offset, size_t(section.length));
+    SaveRasterHeader header;
+    if (!read_raster_header(in, section.type, header) || header.width <= 0 || header.height <= 0) return false;
+
+    size_t table_start = in.tell();
+    if (!read_tile_table(in, header.width, header.height, layout.grid, layout.offsets)) return false;
+    for (size_t i = 1; i < layout.offsets.size(); i++) {
+        if (layout.offsets[i] < layout.offsets[i - 1]) return false;
+    }
+    if (!in.skip(layout.offsets.back())) return false;
+    layout.table_offset = section.offset + table_start;
+    return true;
+}
+
+// Splits an icon layer section into byte ranges (offset, length) of every column, or of every
+// icon and shape before version 6 with the name and counts in between as ranges of their own
+bool split_icon_section(const uint8_t* data, uint32_t version, const SaveSection& section, std::vector<std::pair<uint64_t, uint64_t>>& records) {
+    ByteReader in(data + section.offset, size_t(section.length));
+    size_t start = 0;
+    auto record = [&]() {
+        records.push_back({section.offset + start, in.tell() - start});
+        start = in.tell();
+    };
+    std::string text;
+
+    if (version >= SAVE_ICON_COLUMNS_VERSION) {
+        in.read_string<int32_t>(text, SAVE_MAX_NAME_LENGTH);
+        uint8_t flags = 0;
+        uint64_t count = 0;
+        in.read(flags);
+        for (int i = 0; i < 3; i++) in.read_varint(count);
+        record();
+        while (in && in.remaining() > 0) {
+            uint64_t length = 0;
+            in.read_varint(length);
+            in.skip(length);
+            record();
+        }
+        return bool(in);
+    }
+
+    in.read_string<int32_t>(text, SAVE_MAX_NAME_LENGTH);
+    int32_t count = 0;
+    in.read(count);
+    record();
+    for (int32_t i = 0; i < count && in; i++) {
+        in.skip(sizeof(int32_t) + 2 * sizeof(float));
+        in.read_string<uint64_t>(text, in.remaining());
+        record();
+    }
+
+    in.read(count);
+    record();
+    for (int32_t i = 0; i < count && in; i++) {
+        in.skip(3 * sizeof(int32_t) + 3 * sizeof(float));
+        in.read_string<uint64_t>(text, in.remaining());
+        int32_t num_decorators = 0;
+        in.read(num_decorators);
+        if (num_decorators < 0) return false;
+        in.skip(uint64_t(num_decorators) * sizeof(int32_t));
+        record();
+    }
+
+    in.read(count);
+    record();
+    for (int32_t i = 0; i < count && in; i++) {
+        in.skip(4 * sizeof(uint8_t));
+        int32_t num_points = 0;
+        in.read(num_points);
+        if (num_points < 0) return false;
+        in.skip(uint64_t(num_points) * 2 * sizeof(float));
+        record();
+    }
+    return bool(in) && in.remaining() == 0;
+}
+
+// Collects patch ops, neighbouring copies are merged and copies too short to pay for
+// their op become literals
+class SavePatchBuilder {
+    public:
+    static constexpr uint64_t MIN_COPY = 32;
+
+    explicit SavePatchBuilder(const uint8_t* base) : base(base) {}
+
+    void literal(const uint8_t* bytes, uint64_t length) {
+        flush_copy();
+        literal_bytes.insert(literal_bytes.end(), bytes, bytes + length);
+    }
+
+    void copy(uint64_t base_offset, uint64_t length) {
+        if (copy_length > 0 && copy_offset + copy_length == base_offset) {
+            copy_length += length;
+            return;
+        }
+        flush_copy();
+        copy_offset = base_offset;
+        copy_length = length;
+    }
+
+    // the bytes at target are either a copy of the same length at base_offset or new
+    void copy_or_literal(const uint8_t* target, uint64_t length, uint64_t base_offset, uint64_t base_length) {
+        if (length == base_length && std::memcmp(target, base + base_offset, size_t(length)) == 0) {
+            copy(base_offset, length);
+        } else {
+            literal(target, length);
+        }
+    }
+
+    // Tile table and tiles of a raster whose grid matches the base raster, unchanged tiles are copied
+    void tiles(const uint8_t* target_data, const RasterSectionLayout& target, const RasterSectionLayout& base_layout) {
+        flush_copy();
+        flush_literal();
+
+        const uint8_t* target_payload = target_data + target.payload_offset();
+        const uint8_t* base_payload = base + base_layout.payload_offset();
+        int count = target.grid.count();
+        auto same_tile = [&](int i) {
+            uint64_t length = target.offsets[i + 1] - target.offsets[i];
+            return length == base_layout.offsets[i + 1] - base_layout.offsets[i] &&
+                   std::memcmp(target_payload + target.offsets[i], base_payload + base_layout.offsets[i], size_t(length)) == 0;
+        };
+
+        ByteWriter runs;
+        uint32_t run_count = 0;
+        for (int first = 0; first < count; run_count++) {
+            bool same = same_tile(first);
+            int end = first + 1;
+            while (end < count && same_tile(end) == same) end++;
+
+            runs.write(uint8_t(same ? PATCH_TILES_COPY : PATCH_TILES_LITERAL));
+            if (same) {
+                runs.write(uint32_t(first));
+                runs.write(uint32_t(end - first));
+                copied_tiles += uint64_t(end - first);
+            } else {
+                runs.write(uint32_t(end - first));
+                for (int i = first; i < end; i++) runs.write(uint32_t(target.offsets[i + 1] - target.offsets[i]));
+                runs.write_bytes(target_payload + target.offsets[first], size_t(target.offsets[end] - target.offsets[first]));
+                literal_tiles += uint64_t(end - first);
+            }
+            first = end;
+        }
+
+        ops.write(uint8_t(PATCH_TILES));
+        ops.write(base_layout.table_offset + 2 * sizeof(int32_t));
+        ops.write(uint32_t(base_layout.grid.count()));
+        ops.write(uint32_t(count));
+        ops.write(run_count);
+        ops.write_bytes(runs.data(), runs.size());
+        op_count++;
+    }
+
+    void finish() {
+        flush_copy();
+        flush_literal();
+    }
+
+    ByteWriter ops;
+    uint32_t op_count = 0;
+    uint64_t copied_tiles = 0, literal_tiles = 0;
+
+    private:
+    const uint8_t* base;
+    std::vector<uint8_t> literal_bytes;
+    uint64_t copy_offset = 0, copy_length = 0;
+
+    void flush_copy() {
+        if (copy_length == 0) return;
+        if (copy_length < MIN_COPY) {
+            literal_bytes.insert(literal_bytes.end(), base + copy_offset, base + copy_offset + copy_length);
+        } else {
+            flush_literal();
+            ops.write(uint8_t(PATCH_COPY));
+            ops.write(copy_offset);
+            ops.write(copy_length);
+            op_count++;
+        }
+        copy_length = 0;
+    }
+
+    void flush_literal() {
+        if (literal_bytes.empty()) return;
+        ops.write(uint8_t(PATCH_LITERAL));
+        ops.write(uint64_t(literal_bytes.size()));
+        ops.write_bytes(literal_bytes.data(), literal_bytes.size());
+        op_count++;
+        literal_bytes.clear();
+    }
+};
+
+struct SavePatchHeader {
+    uint64_t base_size = 0, target_size = 0;
+    uint32_t base_crc32c = 0, target_crc32c = 0;
+};
+
+bool read_save_patch_header(ByteReader& in, SavePatchHeader& header) {
+    const uint8_t* magic = in.take(sizeof(PATCH_MAGIC));
+    uint32_t version = 0;
+    in.read(version);
+    if (!magic || std::memcmp(magic, PATCH_MAGIC, sizeof(PATCH_MAGIC)) != 0 || version != PATCH_VERSION) return false;
+    in.read(header.base_size);
+    in.read(header.base_crc32c);
+    in.read(header.target_size);
+    in.read(header.target_crc32c);
+    return bool(in);
+}
+
+// Makes a patch that turns base into target. Layers are matched by name: tiles of a raster with
+// the same grid are compared one by one, icons and shapes by their id, position and the rest of
+// their fields, other sections are copied whole when they didn't change. base may be empty (or an
+// old save without a section directory), then the patch simply carries the whole target.
+bool make_save_patch(const uint8_t* base, size_t base_size, const uint8_t* target, size_t target_size, ByteWriter& patch, std::string& error) {
+    auto start = std::chrono::steady_clock::now();
+
+    SaveHeader target_header;
+    ByteReader target_reader(target, target_size);
+    if (!read_save_header(target_reader, target_header) || target_header.version < 3) {
+        error = "the new savefile has no section directory";
+        return false;
+    }
+    SaveHeader base_header;
+    ByteReader base_reader(base, base_size);
+    if (base_size == 0 || !read_save_header(base_reader, base_header)) base_header = SaveHeader();
+
+    auto find_base_section = [&](const SaveSection& section) -> const SaveSection* {
+        for (auto& candidate : base_header.sections) {
+            if (candidate.type == section.type && candidate.name == section.name) return &candidate;
+        }
+        return nullptr;
+    };
+
+    std::vector<const SaveSection*> sections;
+    for (auto& section : target_header.sections) sections.push_back(&section);
+    std::sort(sections.begin(), sections.end(), [](const SaveSection* a, const SaveSection* b) { return a->offset < b->offset; });
+
+    // icons of the base layer, by their bytes
+    std::unordered_multimap<uint64_t, std::pair<uint64_t, uint64_t>> base_records;
+
+    SavePatchBuilder builder(base);
+    uint64_t position = 0; // in the target
+    for (const SaveSection* section : sections) {
+        if (section->offset < position) {
+            error = "sections of the new savefile overlap";
+            return false;
+        }
+        builder.literal(target + position, section->offset - position); // header, gaps
+        position = section->offset + section->length;
+
+        const SaveSection* base_section = find_base_section(*section);
+        if (!base_section) {
+            builder.literal(target + section->offset, section->length);
+            continue;
+        }
+
+        RasterSectionLayout target_layout, base_layout;
+        if (read_raster_section_layout(target, target_header.version, *section, target_layout) &&
+            read_raster_section_layout(base, base_header.version, *base_section, base_layout) &&
+            target_layout.grid.width == base_layout.grid.width && target_layout.grid.height == base_layout.grid.height &&
+            target_layout.grid.tile_w == base_layout.grid.tile_w && target_layout.grid.tile_h == base_layout.grid.tile_h) {
+            // names and dimensions, then the tiles
+            uint64_t fields_length = target_layout.table_offset + 2 * sizeof(int32_t) - section->offset;
+            uint64_t base_fields_length = base_layout.table_offset + 2 * sizeof(int32_t) - base_section->offset;
+            builder.copy_or_literal(target + section->offset, fields_length, base_section->offset, base_fields_length);
+            builder.tiles(target, target_layout, base_layout);
+            continue;
+        }
+
+        std::vector<std::pair<uint64_t, uint64_t>> target_records, base_section_records;
+        if (section->type == SECTION_ICON_LAYER && split_icon_section(target, target_header.version, *section, target_records) &&
+            split_icon_section(base, base_header.version, *base_section, base_section_records)) {
+            base_records.clear();
+            for (auto& record : base_section_records) base_records.insert({nw_hash64(base + record.first, size_t(record.second)), record});
+            for (auto& record : target_records) {
+                const uint8_t* bytes = target + record.first;
+                auto range = base_records.equal_range(nw_hash64(bytes, size_t(record.second)));
+                const std::pair<uint64_t, uint64_t>* match = nullptr;
+                for (auto it = range.first; it != range.second && !match; ++it) {
+                    if (it->second.second == record.second && std::memcmp(base + it->second.first, bytes, size_t(record.second)) == 0) match = &it->second;
+                }
+                if (match) {
+                    builder.copy(match->first, match->second);
+                } else {
+                    builder.literal(bytes, record.second);
+                }
+            }
+            continue;
+        }
+
+        builder.copy_or_literal(target + section->offset, section->length, base_section->offset, base_section->length);
+    }
+    builder.literal(target + position, target_size - position); // directory
+    builder.finish();
+
+    patch.write_bytes(PATCH_MAGIC, sizeof(PATCH_MAGIC));
+    patch.write(PATCH_VERSION);
+    patch.write(uint64_t(base_size));
+    patch.write(nw_crc32c(base, base_size));
+    patch.write(uint64_t(target_size));
+    patch.write(nw_crc32c(target, target_size));
+    patch.write(builder.op_count);
+    patch.write_bytes(builder.ops.data(), builder.ops.size());
+
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Debug::Patch::Made::" << builder.op_count << " ops, " << builder.copied_tiles << " tiles kept, " << builder.literal_tiles
+              << " tiles changed, " << patch.size() << " bytes for a " << target_size << " byte savefile in " << milliseconds << " ms" << std::endl;
+    return true;
+}
+
+// Rebuilds the savefile a patch was made for from the base it was made against
+bool apply_save_patch(const uint8_t* base, size_t base_size, const uint8_t* patch, size_t patch_size, std::vector<uint8_t>& target, std::string& error) {
+    auto start = std::chrono::steady_clock::now();
+    ByteReader in(patch, patch_size);
+    SavePatchHeader header;
+    if (!read_save_patch_header(in, header)) {
+        error = "not a savefile patch";
+        return false;
+    }
+    if (header.base_size != base_size || header.base_crc32c != nw_crc32c(base, base_size)) {
+        error = "the patch was made for another version of the savefile";
+        return false;
+    }
+
+    uint32_t op_count = 0;
+    in.read(op_count);
+    target.clear();
+    target.reserve(size_t(std::min<uint64_t>(header.target_size, uint64_t(base_size) + patch_size)));
+    auto append = [&](const uint8_t* bytes, uint64_t length) {
+        if (length > header.target_size - target.size()) return false;
+        target.insert(target.end(), bytes, bytes + length);
+        return true;
+    };
+
+    bool ok = bool(in);
+    for (uint32_t op_index = 0; op_index < op_count && ok; op_index++) {
+        uint8_t op = 0;
+        in.read(op);
+        if (op == PATCH_LITERAL) {
+            uint64_t length = 0;
+            in.read(length);
+            const uint8_t* bytes = in.take(length);
+            ok = bytes && append(bytes, length);
+        } else if (op == PATCH_COPY) {
+            uint64_t offset = 0, length = 0;
+            in.read(offset);
+            in.read(length);
+            ok = in && offset <= base_size && length <= base_size - offset && append(base + offset, length);
+        } else if (op == PATCH_TILES) {
+            uint64_t base_table_offset = 0;
+            uint32_t base_count = 0, count = 0, run_count = 0;
+            in.read(base_table_offset);
+            in.read(base_count);
+            in.read(count);
+            in.read(run_count);
+
+            // tile ends of the base raster, checked so every copied tile lies inside the base
+            ByteReader base_in(base, base_size);
+            std::vector<uint64_t> base_offsets;
+            ok = in && base_in.seek(base_table_offset) && base_in.read_array(base_offsets, uint64_t(base_count) + 1) && base_offsets[0] == 0;
+            uint64_t base_payload = base_table_offset + (uint64_t(base_count) + 1) * sizeof(uint64_t);
+            for (uint32_t i = 1; ok && i <= base_count; i++) ok = base_offsets[i] >= base_offsets[i - 1];
+            ok = ok && base_offsets[base_count] <= base_size - base_payload;
+
+            // the table is filled in once the tile lengths are known
+            uint64_t table_size = (uint64_t(count) + 1) * sizeof(uint64_t);
+            size_t table_position = target.size();
+            ok = ok && table_size <= header.target_size - target.size();
+            if (ok) target.resize(target.size() + size_t(table_size));
+            std::vector<uint64_t> offsets(1, 0);
+
+            for (uint32_t run = 0; run < run_count && ok; run++) {
+                uint8_t kind = 0;
+                in.read(kind);
+                if (kind == PATCH_TILES_COPY) {
+                    uint32_t first = 0, tiles = 0;
+                    in.read(first);
+                    in.read(tiles);
+                    ok = in && first <= base_count && tiles <= base_count - first && tiles <= count - (offsets.size() - 1);
+                    if (!ok) break;
+                    for (uint32_t i = first; i < first + tiles; i++) offsets.push_back(offsets.back() + base_offsets[i + 1] - base_offsets[i]);
+                    ok = append(base + base_payload + base_offsets[first], base_offsets[first + tiles] - base_offsets[first]);
+                } else if (kind == PATCH_TILES_LITERAL) {
+                    uint32_t tiles = 0;
+                    in.read(tiles);
+                    std::vector<uint32_t> lengths;
+                    ok = in && tiles <= count - (offsets.size() - 1) && in.read_array(lengths, tiles);
+                    if (!ok) break;
+                    uint64_t total = 0;
+                    for (uint32_t length : lengths) {
+                        total += length;
+                        offsets.push_back(offsets.back() + length);
+                    }
+                    const uint8_t* bytes = in.take(total);
+                    ok = bytes && append(bytes, total);
+                } else {
+                    ok = false;
+                }
+            }
+            ok = ok && offsets.size() == size_t(count) + 1;
+            if (ok) {
+                for (auto& offset : offsets) offset = nw_little_endian(offset);
+                std::memcpy(target.data() + table_position, offsets.data(), size_t(table_size));
+            }
+        } else {
+            ok = false;
+        }
+    }
+
+    if (!ok || target.size() != header.target_size || nw_crc32c(target.data(), target.size()) != header.target_crc32c) {
+        error = "the patch is damaged";
+        target.clear();
+        return false;
+    }
+
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Debug::Patch::Applied::" << op_count << " ops, " << patch_size << " bytes -> " << target.size() << " byte savefile in " << milliseconds << " ms" << std::endl;
+    return true;
+}
+
+// Uploads a savefile together with a patch from the version uploaded before it, then keeps a copy
+// of it in SHARED_SAVES_DIRECTORY to make the next patch against. Without an earlier upload
+// the patch carries the whole savefile, so a patch on the server never belongs to an older turn.
+void publish_savefile(const std::string& filename) {
+    std::string full_filename = "saves/" + filename;
+    std::string shared_filename = SHARED_SAVES_DIRECTORY + filename;
+    std::string patch_name = filename + ".nwpatch";
+
+    bool patched = false;
+    {
+        FileSource base(shared_filename);
+        FileSource target(full_filename);
+        ByteWriter patch;
+        std::string error;
+        if (!target.is_open()) {
+            std::cerr << "Failed to open file " << full_filename << "\n";
+        } else if (make_save_patch(base.data(), base.size(), target.data(), target.size(), patch, error)) {
+            patched = write_file_atomically("saves/" + patch_name, patch.data(), patch.size());
+        } else {
+            std::cerr << "No patch for " << filename << ": " << error << "\n";
+        }
+    }
+
+    upload_savefile(filename);
+    if (patched) upload_savefile(patch_name);
+
+    std::error_code copy_error;
+    std::filesystem::create_directories(SHARED_SAVES_DIRECTORY, copy_error);
+    std::filesystem::copy_file(full_filename, shared_filename, std::filesystem::copy_options::overwrite_existing, copy_error);
+    if (copy_error) std::cerr << "Failed to keep " << shared_filename << ": " << copy_error.message() << "\n";
+}
+
+// Gets the current version of a shared savefile. With last turn in SHARED_SAVES_DIRECTORY only the
+// patch is downloaded, the whole savefile when there is no patch that fits. The result is kept
+// there for next turn.
+bool fetch_shared_savefile(const std::string& filename, std::vector<uint8_t>& bytes) {
+    std::string shared_filename = SHARED_SAVES_DIRECTORY + filename;
+    bool fetched = false;
+    {
+        FileSource cached(shared_filename);
+        std::vector<uint8_t> patch;
+        if (cached.is_open() && download_savefile(filename + ".nwpatch", patch)) {
+            ByteReader in(patch.data(), patch.size());
+            SavePatchHeader header;
+            std::string error;
+            if (read_save_patch_header(in, header) && header.target_size == cached.size() &&
+                header.target_crc32c == nw_crc32c(cached.data(), cached.size())) {
+                bytes.assign(cached.data(), cached.data() + cached.size()); // already the latest
+                std::cout << "Debug::Patch::" << filename << " is up to date" << std::endl;
+                return true;
+            }
+            fetched = apply_save_patch(cached.data(), cached.size(), patch.data(), patch.size(), bytes, error);
+            if (!fetched) std::cout << "Debug::Patch::" << error << ", downloading all of " << filename << std::endl;
+        }
+    }
+    if (!fetched && !download_savefile(filename, bytes)) return false;
+
+    std::error_code directory_error;
+    std::filesystem::create_directories(SHARED_SAVES_DIRECTORY, directory_error);
+    if (!write_file_atomically(shared_filename, bytes.data(), bytes.size())) {
+        std::cerr << "Failed to keep " << shared_filename << "\n";
+    }
+    return true;
+}
+
+// One piece of a savefile as the history stores it, a range of bytes or the tiles of a raster
+struct SavefilePiece {
+    uint64_t offset = 0, length = 0;
+    bool tiles = false;
+    RasterSectionLayout layout; // for tiles
+};
+
+// Cuts a savefile into the header and directory, whole sections, and for tiled rasters
+// their fields and every tile on its own. Saves without a directory are one piece.
+void split_savefile(const uint8_t* data, size_t size, std::vector<SavefilePiece>& pieces) {
+    SaveHeader header;
+    ByteReader in(data, size);
+    if (!read_save_header(in, header) || header.version < 3) {
+        pieces.push_back({0, size, false, {}});
+        return;
+    }
+
+    std::vector<const SaveSection*> sections;
+    for (auto& section : header.sections) sections.push_back(&section);
+    std::sort(sections.begin(), sections.end(), [](const SaveSection* a, const SaveSection* b) { return a->offset < b->offset; });
+
+    uint64_t position = 0;
+    for (const SaveSection* section : sections) {
+        if (section->offset < position) { // overlapping sections, keep the rest whole
+            break;
+        }
+        if (section->offset > position) pieces.push_back({position, section->offset - position, false, {}});
+        position = section->offset + section->length;
+
+        SavefilePiece tiles;
+        if (read_raster_section_layout(data, header.version, *section, tiles.layout)) {
+            uint64_t fields_end = tiles.layout.table_offset + 2 * sizeof(int32_t);
+            pieces.push_back({section->offset, fields_end - section->offset, false, {}});
+            tiles.offset = fields_end;
+            tiles.length = position - fields_end;
+            tiles.tiles = true;
+            pieces.push_back(std::move(tiles));
+        } else {
+            pieces.push_back({section->offset, section->length, false, {}});
+        }
+    }
+    if (position < size) pieces.push_back({position, size - position, false, {}});
+}
+
+// Every full save is also recorded here. Sections and raster tiles are blobs in one pack file,
+// each distinct blob stored once, and a manifest per save lists the blobs that make it up again.
+// Saves come in from the save worker, listing and restoring happen on the UI thread.
+class SaveHistory {
+    public:
+    struct Snapshot {
+        std::string savefile;
+        std::string manifest_filename;
+        int64_t save_time = 0;
+        uint64_t size = 0;
+        uint32_t crc32c = 0;
+    };
+
+    // Records a savefile, false if it couldn't be written. An identical save of the same file
+    // that is already recorded is left alone.
+    bool record(const std::string& savefile, const uint8_t* data, size_t size, int64_t save_time) {
+        auto start = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!open()) return false;
+
+        uint32_t crc32c = nw_crc32c(data, size);
+        for (auto& snapshot : list_locked()) {
+            if (snapshot.savefile == savefile && snapshot.size == size && snapshot.crc32c == crc32c) return true;
+        }
+
+        std::vector<SavefilePiece> pieces;
+        split_savefile(data, size, pieces);
+
+        ByteWriter new_blobs;
+        uint64_t new_blob_count = 0, blob_count = 0;
+        auto add_blob = [&](const uint8_t* bytes, uint64_t length) {
+            uint64_t key = nw_hash64(bytes, size_t(length), length);
+            blob_count++;
+            if (index.count(key)) return key;
+            BlobLocation location = {pack_end + new_blobs.size() + BLOB_HEADER_SIZE, uint32_t(length), nw_crc32c(bytes, size_t(length))};
+            new_blobs.write(key);
+            new_blobs.write(location.length);
+            new_blobs.write(location.crc32c);
+            new_blobs.write_bytes(bytes, size_t(length));
+            index[key] = location;
+            new_blob_count++;
+            return key;
+        };
+
+        ByteWriter manifest;
+        manifest.write_bytes(HISTORY_MAGIC, sizeof(HISTORY_MAGIC));
+        manifest.write(HISTORY_VERSION);
+        manifest.write(save_time);
+        manifest.write(uint64_t(size));
+        manifest.write(crc32c);
+        manifest.write_string<int32_t>(savefile);
+        manifest.write(uint32_t(pieces.size()));
+        std::vector<uint64_t> keys;
+        for (auto& piece : pieces) {
+            if (!piece.tiles) {
+                manifest.write(uint8_t(HISTORY_BLOB));
+                manifest.write(add_blob(data + piece.offset, piece.length));
+                continue;
+            }
+            const uint8_t* payload = data + piece.layout.payload_offset();
+            keys.clear();
+            for (size_t i = 0; i + 1 < piece.layout.offsets.size(); i++) {
+                keys.push_back(add_blob(payload + piece.layout.offsets[i], piece.layout.offsets[i + 1] - piece.layout.offsets[i]));
+            }
+            manifest.write(uint8_t(HISTORY_TILES));
+            manifest.write(uint32_t(keys.size()));
+            manifest.write_array(keys.data(), keys.size());
+        }
+
+        // blobs first, a manifest only ever names blobs that made it to disk
+        if (new_blobs.size() > 0) {
+            std::ofstream pack(pack_filename(), std::ios::binary | std::ios::app);
+            pack.write(reinterpret_cast<const char*>(new_blobs.data()), std::streamsize(new_blobs.size()));
+            pack.close();
+            if (!pack) {
+                std::cerr << "Failed to write " << pack_filename() << "\n";
+                opened = false; // the index may name blobs that aren't there, read it again
+                index.clear();
+                return false;
+            }
+            pack_end += new_blobs.size();
+        }
+
+        std::error_code directory_error;
+        std::string directory = HISTORY_DIRECTORY + savefile + "/";
+        std::filesystem::create_directories(directory, directory_error);
+        std::string manifest_filename = directory + std::to_string(save_time) + ".nwm";
+        for (int suffix = 1; std::filesystem::exists(manifest_filename); suffix++) {
+            manifest_filename = directory + std::to_string(save_time) + "_" + std::to_string(suffix) + ".nwm";
+        }
+        if (!write_file_atomically(manifest_filename, manifest.data(), manifest.size())) return false;
+        revision++;
+
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Debug::History::Recorded::" << savefile << " " << blob_count << " blobs, " << new_blob_count << " new ("
+                  << new_blobs.size() << " bytes) in " << milliseconds << " ms" << std::endl;
+        return true;
+    }
+
+    // Every recorded save, newest first
+    std::vector<Snapshot> list() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return list_locked();
+    }
+
+    // Rebuilds a recorded save byte for byte
+    bool restore(const Snapshot& snapshot, std::vector<uint8_t>& bytes, std::string& error) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!open()) {
+            error = "the history can't be read";
+            return false;
+        }
+
+        FileSource manifest_file(snapshot.manifest_filename);
+        FileSource pack(pack_filename());
+        ByteReader in = manifest_file.reader();
+        Snapshot header;
+        uint32_t piece_count = 0;
+        if (!manifest_file.is_open() || !read_manifest_header(in, header) || !in.read(piece_count)) {
+            error = "the manifest is damaged";
+            return false;
+        }
+
+        bytes.clear();
+        bytes.reserve(size_t(std::min<uint64_t>(header.size, pack.size())));
+        bool ok = true;
+        auto blob = [&](uint64_t key) -> const BlobLocation* {
+            auto found = index.find(key);
+            if (found == index.end() || found->second.offset + found->second.length > pack.size()) return nullptr;
+            return &found->second;
+        };
+        auto append = [&](const BlobLocation* location) {
+            if (!location || location->length > header.size - bytes.size()) return false;
+            bytes.insert(bytes.end(), pack.data() + location->offset, pack.data() + location->offset + location->length);
+            return true;
+        };
+
+        std::vector<uint64_t> keys;
+        for (uint32_t i = 0; i < piece_count && ok; i++) {
+            uint8_t kind = 0;
+            in.read(kind);
+            if (kind == HISTORY_BLOB) {
+                uint64_t key = 0;
+                ok = in.read(key) && append(blob(key));
+            } else if (kind == HISTORY_TILES) {
+                uint32_t count = 0;
+                ok = in.read(count) && in.read_array(keys, count);
+                // the tile table from the tile lengths, then the tiles
+                ByteWriter table;
+                uint64_t end = 0;
+                table.write(end);
+                for (size_t k = 0; k < keys.size() && ok; k++) {
+                    const BlobLocation* location = blob(keys[k]);
+                    ok = location != nullptr;
+                    if (ok) table.write(end += location->length);
+                }
+                ok = ok && table.size() <= header.size - bytes.size();
+                if (ok) bytes.insert(bytes.end(), table.data(), table.data() + table.size());
+                for (size_t k = 0; k < keys.size() && ok; k++) ok = append(blob(keys[k]));
+            } else {
+                ok = false;
+            }
+        }
+
+        if (!ok || bytes.size() != header.size || nw_crc32c(bytes.data(), bytes.size()) != header.crc32c) {
+            error = "blobs of this save are missing or damaged";
+            bytes.clear();
+            return false;
+        }
+        return true;
+    }
+
+    // Bytes the pack file takes on disk
+    uint64_t stored_size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return open() ? pack_end : 0;
+    }
+
+    // Goes up whenever a save is recorded, to know when a listing is out of date
+    std::atomic<uint64_t> revision{0};
+
+    private:
+    struct BlobLocation {
+        uint64_t offset; // of the bytes in the pack
+        uint32_t length;
+        uint32_t crc32c;
+    };
+
+    // pack entries are [u64 key][u32 length][u32 crc32c][bytes]
+    static constexpr uint64_t BLOB_HEADER_SIZE = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+
+    std::mutex mutex;
+    bool opened = false;
+    std::unordered_map<uint64_t, BlobLocation> index; // by hash of the bytes (seeded with their length)
+    uint64_t pack_end = 0;
+
+    static std::string pack_filename() { return std::string(HISTORY_DIRECTORY) + "blobs.pack"; }
+
+    // Reads the pack index on first use. A blob cut short by a crash is dropped from the end.
+    bool open() {
+        if (opened) return true;
+        std::error_code directory_error;
+        std::filesystem::create_directories(HISTORY_DIRECTORY, directory_error);
+
+        index.clear();
+        pack_end = 0;
+        uint64_t file_size = 0;
+        {
+            FileSource pack(pack_filename());
+            ByteReader in = pack.reader();
+            file_size = pack.size();
+            while (in.remaining() >= BLOB_HEADER_SIZE) {
+                uint64_t key;
+                BlobLocation location;
+                in.read(key);
+                in.read(location.length);
+                in.read(location.crc32c);
+                location.offset = in.tell();
+                if (!in.skip(location.length)) break;
+                index[key] = location;
+                pack_end = in.tell();
+            }
+        }
+        if (pack_end < file_size) {
+            std::error_code resize_error;
+            std::filesystem::resize_file(pack_filename(), pack_end, resize_error);
+            if (resize_error) {
+                std::cerr << "Failed to repair " << pack_filename() << ": " << resize_error.message() << "\n";
+                return false;
+            }
+        }
+        opened = true;
+        return true;
+    }
+
+    static bool read_manifest_header(ByteReader& in, Snapshot& snapshot) {
+        const uint8_t* magic = in.take(sizeof(HISTORY_MAGIC));
+        uint32_t version = 0;
+        in.read(version);
+        if (!magic || std::memcmp(magic, HISTORY_MAGIC, sizeof(HISTORY_MAGIC)) != 0 || version != HISTORY_VERSION) return false;
+        in.read(snapshot.save_time);
+        in.read(snapshot.size);
+        in.read(snapshot.crc32c);
+        return in.read_string<int32_t>(snapshot.savefile, SAVE_MAX_NAME_LENGTH);
+    }
+
+    std::vector<Snapshot> list_locked() {
+        std::vector<Snapshot> snapshots;
+        std::error_code iterate_error;
+        for (auto& directory : std::filesystem::directory_iterator(HISTORY_DIRECTORY, iterate_error)) {
+            if (!directory.is_directory()) continue;
+            for (auto& entry : std::filesystem::directory_iterator(directory.path(), iterate_error)) {
+                if (entry.path().extension() != ".nwm") continue;
+                // only the header is needed
+                std::ifstream file(entry.path(), std::ios::binary);
+                uint8_t head[256 + SAVE_MAX_NAME_LENGTH];
+                file.read(reinterpret_cast<char*>(head), sizeof(head));
+                ByteReader in(head, size_t(file.gcount()));
+                Snapshot snapshot;
+                if (!read_manifest_header(in, snapshot)) continue;
+                snapshot.manifest_filename = entry.path().string();
+                snapshots.push_back(snapshot);
+            }
+        }
+        // saves within the same second get numbered manifests, name_1 after name
+        std::sort(snapshots.begin(), snapshots.end(), [](const Snapshot& a, const Snapshot& b) {
+            return a.save_time != b.save_time ? a.save_time > b.save_time : a.manifest_filename > b.manifest_filename;
+        });
+        return snapshots;
+    }
+};
+
+inline SaveHistory& save_history() {
+    static SaveHistory history;
+    return history;
+}
+
+// A save running on a worker thread. The worker only writes the temporary file,
+// swapping it in and updating hidden layers happens back on the UI thread.
+struct SaveJob {
+    std::string filename;
+    bool cloud = false;
+    bool keep_history = false;
+    WorldSnapshot snapshot;
+    std::vector<MovedRaster> moved_rasters;
+    uint64_t progress_total = 0;
+    std::atomic<uint64_t> progress_done{0};
+    bool write_ok = false;
+    std::atomic<bool> written{false};
+    bool uploading = false;
+    std::atomic<bool> uploaded{false};
+    std::thread worker;
+};
+
+// id from the SECTION_SAVE_ID section, 0 for saves without one
+uint64_t read_save_id(ByteReader in, const SaveHeader& header) {
+    const SaveSection* section = header.find_section(SECTION_SAVE_ID, 0);
+    uint64_t save_id = 0;
+    if (section && in.seek(section->offset)) in.read(save_id);
+    return save_id;
+}
+
+void write_journal_record(std::ostream& out, uint32_t type, const std::string& payload) {
+    uint64_t length = payload.size();
+    out.write(reinterpret_cast<char*>(&type), sizeof(type));
+    out.write(reinterpret_cast<char*>(&length), sizeof(length));
+    out.write(payload.data(), payload.size());
+}
+
+// Walks an edit journal and hands every record of each committed batch to apply(type, payload reader).
+// Returns where the last committed batch ends, 0 if the journal is unreadable or belongs to another save.
+template <typename Apply>
+uint64_t scan_journal(ByteReader& in, uint64_t base_save_id, Apply apply) {
+    const uint8_t* magic = in.take(sizeof(JOURNAL_MAGIC));
+    uint32_t version = 0;
+    uint64_t save_id = 0;
+    in.read(version);
+    in.read(save_id);
+    if (!in || std::memcmp(magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0) return 0;
+    if (version != JOURNAL_VERSION || save_id != base_save_id) return 0;
+
+    uint64_t committed_end = in.tell();
+    std::vector<std::pair<uint32_t, ByteReader>> batch;
+    while (in.remaining() > 0) {
+        uint32_t type;
+        uint64_t length;
+        in.read(type);
+        in.read(length);
+        const uint8_t* payload = in.take(length);
+        if (!payload) break; // cut off while it was being written
+
+        if (type == JOURNAL_COMMIT) {
+            for (auto& [record_type, record] : batch) apply(record_type, record);
+            batch.clear();
+            committed_end = in.tell();
+        } else {
+            batch.push_back({type, ByteReader(payload, size_t(length))});
+        }
+    }
+    return committed_end;
+}
+
+class World{
+    private:
+    std::deque<IconLayer> IconLayers;
+    std::deque<WorldLayer> WorldLayers;
+    std::deque<PoliticalLayer> PoliticalLayers;
+    std::string last_created_layer_name = "name";
+    std::unique_ptr<SaveJob> save_job;
+    std::unique_ptr<LoadJob> load_job;
+    std::string saved_structure; // structure_signature() of the journal's base save
+    int indexed_textures = -1; // whether the renderer draws INDEX8 layer textures, asked with the first layer
+    std::vector<uint8_t> brush_ids; // the ids under a brush while paint_ids works on them
+    DirectoryWatcher ids_watcher; // palette files, see poll_ids
+
+    public:
+    bool WORLD_HAS_INITIALIZED = false;
+
+    int UPPER_WORLD_WIDTH=0; // number of chunks along the X-axis, i.e bigger sections of tiles
+    int UPPER_WORLD_HEIGHT=0; // number of chunks along the Y-axis, i.e bigger sections of tiles
+    int CHUNK_WIDTH=0; // Number of tiles in a chunk along the X-axis
+    int CHUNK_HEIGHT=0; // Number of tiles in a chunk along the Y-axis
+    int LOWER_WORLD_WIDTH=0; // Total number of tiles along the X-axis
+    int LOWER_WORLD_HEIGHT=0; // Total number of tiles along the Y-axis
+    // Only this part of the savefile's world is loaded, the sizes above are its size then. Empty when all of it is.
+    WorldRegion loaded_region;
+    int FULL_WORLD_WIDTH=0; // number of chunks of the whole savefile's world along the X-axis
+    int FULL_WORLD_HEIGHT=0; // number of chunks of the whole savefile's world along the Y-axis
+
+    std::deque<IDmap> IDmaps; // only appended to, IDmapHandle indexes it
+    std::unordered_map<int, std::string> CivilianIdMap;
+    std::unordered_map<int, std::string> MilitaryIdMap;
+    std::unordered_map<int, std::string> MarkerIdMap;
+    std::unordered_map<int, std::string> DecoratorIdMap;
+    
+    IconBase* selected_world_icon = nullptr;
+    uint32_t layer_generation = 0; // moves on whenever world or political layers are moved or removed
+
+    std::string save_status; // last save message for the UI
+    bool save_failed = false;
+    std::string load_status; // last load message for the UI
+    bool load_failed = false;
+    std::string current_savefile; // file in saves/ the edit journal appends to, empty until loaded or saved
+    uint64_t current_save_id = 0; // SECTION_SAVE_ID of that file, 0 if it has none
+
+    ~World() {
+        stop_load_worker();
+        wait_for_save();
+    }
+
+    bool HasInitializedCheck() {
+        if(UPPER_WORLD_HEIGHT>0 && CHUNK_WIDTH>0){
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    void toggle_visibility_layer(const std::string& name_id) {
+        if(get_layer_type(name_id)==1){
+            WorldLayer& it = get_worldlayer(name_id);
+            it.visible = !it.visible;
+            if(it.visible) ensure_loaded(it);
+            std::cout<<"Debug::WorldLayer::Visibility::"<<it.visible<<std::endl;
+        }
+        if(get_layer_type(name_id)==2){
+            IconLayer& it = get_iconlayer(name_id);
+            it.visible = !it.visible;
+            std::cout<<"Debug::IconLayer::Visibility::"<<it.visible<<std::endl;
+        }
+        if(get_layer_type(name_id)==3){
+            PoliticalLayer& it = get_politicallayer(name_id);
+            it.visible = !it.visible;
+            if(it.visible) ensure_loaded(it);
+            std::cout<<"Debug::PoliticalLayer::Visibility::"<<it.visible<<std::endl;
+        }
+    }
+
+    std::deque<IconLayer>& GetIconLayers() { return IconLayers; }
+
+    std::deque<WorldLayer>& GetWorldLayers() { return WorldLayers; }
+
+    std::deque<PoliticalLayer>& GetPoliticalLayers() { return PoliticalLayers; }
+
+    void MoveIconLayer(size_t index, bool down) {
+        if(down){
+            if (index == 0 || index >= IconLayers.size()) return;
+            std::swap(IconLayers[index], IconLayers[index - 1]);
+        } else {
+            if (index >= IconLayers.size() - 1) return;
+            std::swap(IconLayers[index], IconLayers[index + 1]);
+        }
+    }
+
+    void MoveWorldLayer(size_t index, bool down) {
+        if(down){
+            if (index == 0 || index >= WorldLayers.size()) return;
+            std::swap(WorldLayers[index], WorldLayers[index - 1]);
+        } else {
+            if (index >= WorldLayers.size() - 1) return;
+            std::swap(WorldLayers[index], WorldLayers[index + 1]);
+        }
+        layer_generation++;
+    }
+
+    void MovePoliticalLayer(size_t index, bool down) {
+        if(down){
+            if (index == 0 || index >= PoliticalLayers.size()) return;
+            std::swap(PoliticalLayers[index], PoliticalLayers[index - 1]);
+        } else {
+            if (index >= PoliticalLayers.size() - 1) return;
+            std::swap(PoliticalLayers[index], PoliticalLayers[index + 1]);
+        }
+        layer_generation++;
+    }
+
+    IDmapHandle find_idmap_handle(const std::string& name) const {
+        for (size_t i = 0; i < IDmaps.size(); i++) {
+            if (IDmaps[i].name == name) return IDmapHandle(i);
+        }
+        return NO_IDMAP;
+    }
+
+    const IDmap* idmap(IDmapHandle handle) const { return handle < IDmaps.size() ? &IDmaps[handle] : nullptr; }
+
+    IDmap* find_idmap(const std::string& name) {
+        IDmapHandle handle = find_idmap_handle(name);
+        return handle == NO_IDMAP ? nullptr : &IDmaps[handle];
+    }
+
+    PaintTarget find_paint_target(const std::string& name_id) {
+        PaintTarget target;
+        target.layer_type = get_layer_type(name_id);
+        if (target.layer_type == 1) target.world_layer = &get_worldlayer(name_id);
+        if (target.layer_type == 3) target.political_layer = &get_politicallayer(name_id);
+        target.generation = layer_generation;
+        return target;
+    }
+
+    // Decodes a raster the loader left in its savefile into the layer's ids, on first show/edit/save
+    bool load_pending_raster(TiledTexture* texture, SparseIds& ids, bool is_upper, const std::string& idmap_name, const PendingRaster& pending) {
+        IDmap* referenced_id_map = find_idmap(idmap_name);
+        if (!referenced_id_map) {
+            std::cerr << "IDmap not found: " << idmap_name << "\n";
+        }
+
+        bool read_ok = false;
+        ids.assign(save_tile_grid(pending.width, pending.height, is_upper), 0xFF);
+        MappedFile file(pending.filename);
+        if (!file.is_open()) {
+            std::cerr << "Failed to open file " << pending.filename << "\n";
+        } else {
+            ByteReader in(file.data(), file.size());
+            in.seek(pending.offset);
+            read_ok = referenced_id_map && read_raster(in, pending.version, pending.width, pending.height, ids);
+        }
+        if (!read_ok) {
+            // leave the layer empty rather than half decoded
+            ids.assign(save_tile_grid(pending.width, pending.height, is_upper), 0xFF);
+        }
+        show_ids(texture, ids, layer_colors(referenced_id_map), SDL_Rect{0, 0, pending.width, pending.height});
+        return read_ok;
+    }
+
+    void ensure_loaded(WorldLayer& layer) {
+        if (layer.loaded) return;
+        if (!load_pending_raster(layer.layer_texture, layer.ids, layer.is_upper, layer.idmap_name, layer.pending)) {
+            std::cerr << "Failed to load layer " << layer.layer_name << "\n";
+        }
+        layer.loaded = true;
+        std::cout << "Debug::LazyLoaded::WorldLayer::" << layer.layer_name << std::endl;
+    }
+
+    void ensure_loaded(PoliticalLayer& layer) {
+        if (layer.world_layer) ensure_loaded(*layer.world_layer);
+        if (layer.loaded) return;
+        if (!load_pending_raster(layer.layer_texture, layer.ids, true, layer.idmap_name, layer.pending)) {
+            std::cerr << "Failed to load layer " << layer.layer_name << "\n";
+        }
+        layer.loaded = true;
+        layer.update_texture();
+        std::cout << "Debug::LazyLoaded::PoliticalLayer::" << layer.layer_name << std::endl;
+    }
+
+    // Copies the layers and icons out for a save, the ids of every loaded layer are copied
+    // as they are. Runs on the UI thread.
+    WorldSnapshot snapshot_world() {
+        // Raw layers can only be copied if they are in the current format
+        for (auto& world_layer : WorldLayers) {
+            if (!world_layer.loaded && world_layer.pending.version < SAVE_RASTER_VERSION) ensure_loaded(world_layer);
+        }
+        for (auto& political_layer : PoliticalLayers) {
+            if (!political_layer.loaded && political_layer.pending.version < SAVE_RASTER_VERSION) ensure_loaded(political_layer);
+        }
+
+        WorldSnapshot snapshot;
+        snapshot.world_width = UPPER_WORLD_WIDTH;
+        snapshot.world_height = UPPER_WORLD_HEIGHT;
+        snapshot.chunk_width = CHUNK_WIDTH;
+        snapshot.chunk_height = CHUNK_HEIGHT;
+        snapshot.save_time = int64_t(std::time(nullptr));
+
+        auto snapshot_raster = [&](RasterSnapshot& raster, TiledTexture* texture, const SparseIds& ids, bool loaded, const PendingRaster& pending) {
+            raster.width = texture->w;
+            raster.height = texture->h;
+            raster.loaded = loaded;
+            if (!loaded) {
+                raster.pending = pending;
+                return true;
+            }
+            if (ids.width() != raster.width || ids.height() != raster.height) {
+                std::cerr << "Layer " << raster.layer_name << " has no ids to save\n";
+                return false;
+            }
+            raster.ids = ids;
+            return true;
+        };
+
+        for (auto& world_layer : WorldLayers) {
+            RasterSnapshot raster;
+            const IDmap* id_map = find_idmap(world_layer.idmap_name);
+            if (!id_map) {
+                std::cerr << "No IDmap found for layer " << world_layer.layer_name << "\n";
+                continue;
+            }
+            std::copy(std::begin(id_map->px_LUT), std::end(id_map->px_LUT), raster.colors.begin());
+            raster.layer_name = world_layer.layer_name;
+            raster.idmap_name = world_layer.idmap_name;
+            raster.visible = world_layer.visible;
+            raster.is_upper = world_layer.is_upper;
+            if (!snapshot_raster(raster, world_layer.layer_texture, world_layer.ids, world_layer.loaded, world_layer.pending)) continue;
+
+            raster.grid = save_tile_grid(raster.width, raster.height, world_layer.is_upper);
+            snapshot.world_layers.push_back(std::move(raster));
+        }
+
+        for (auto& political_layer : PoliticalLayers) {
+            RasterSnapshot raster;
+            const IDmap* id_map = find_idmap(political_layer.idmap_name);
+            if (!id_map) {
+                std::cerr << "No IDmap found for layer " << political_layer.layer_name << "\n";
+                continue;
+            }
+            std::copy(std::begin(id_map->px_LUT), std::end(id_map->px_LUT), raster.colors.begin());
+            raster.layer_name = political_layer.layer_name;
+            raster.idmap_name = political_layer.idmap_name;
+            raster.world_layer_name = political_layer.world_layer->layer_name;
+            raster.visible = political_layer.visible;
+            raster.is_upper = true;
+            if (!snapshot_raster(raster, political_layer.layer_texture, political_layer.ids, political_layer.loaded, political_layer.pending)) continue;
+
+            // Political layers are always upper
+            raster.grid = save_tile_grid(raster.width, raster.height, true);
+            snapshot.political_layers.push_back(std::move(raster));
+        }
+
+        for (auto& icon_layer : IconLayers) {
+            snapshot.icon_layers.push_back(snapshot_icon_layer(icon_layer));
+            snapshot.baseline.icon_hashes.push_back({icon_layer.layer_name, hash_icon_layer(snapshot.icon_layers.back())});
+        }
+
+        // Whatever was painted so far is in this save, later strokes go to the next one
+        snapshot.save_id = new_save_id();
+        snapshot.baseline.structure = structure_signature();
+        for (auto& world_layer : WorldLayers) {
+            if (world_layer.dirty_tiles.empty()) continue;
+            snapshot.baseline.dirty.push_back({SECTION_WORLD_LAYER, world_layer.layer_name, std::move(world_layer.dirty_tiles)});
+            world_layer.dirty_tiles.clear();
+        }
+        for (auto& political_layer : PoliticalLayers) {
+            if (political_layer.dirty_tiles.empty()) continue;
+            snapshot.baseline.dirty.push_back({SECTION_POLITICAL_LAYER, political_layer.layer_name, std::move(political_layer.dirty_tiles)});
+            political_layer.dirty_tiles.clear();
+        }
+
+        return snapshot;
+    }
+
+    // Swaps a finished temporary file in and points hidden layers at their copies in it,
+    // the new file becomes the base of the edit journal
+    bool finish_save(const std::string& filename, const std::vector<MovedRaster>& moved_rasters, uint64_t save_id, const SaveBaseline& baseline) {
+        std::string full_filename = "saves/" + filename;
+        std::string temporary_filename = full_filename + ".tmp";
+
+        std::error_code rename_error;
+        std::filesystem::rename(temporary_filename, full_filename, rename_error);
+        if (rename_error) {
+            std::cerr << "Failed to replace " << full_filename << ": " << rename_error.message() << "\n";
+            return false;
+        }
+
+        // Layers that were decoded or removed in the meantime no longer care
+        for (auto& moved : moved_rasters) {
+            PendingRaster* pending = nullptr;
+            if (moved.type == SECTION_WORLD_LAYER) {
+                for (auto& world_layer : WorldLayers) {
+                    if (world_layer.layer_name == moved.layer_name && !world_layer.loaded) pending = &world_layer.pending;
+                }
+            } else {
+                for (auto& political_layer : PoliticalLayers) {
+                    if (political_layer.layer_name == moved.layer_name && !political_layer.loaded) pending = &political_layer.pending;
+                }
+            }
+            if (pending && pending->filename == moved.source.filename && pending->offset == moved.source.offset) {
+                pending->filename = full_filename;
+                pending->offset = moved.offset;
+            }
+        }
+
+        // The old journal belonged to the file that was just replaced
+        std::error_code remove_error;
+        std::filesystem::remove(full_filename + ".journal", remove_error);
+        current_savefile = filename;
+        current_save_id = save_id;
+        saved_structure = baseline.structure;
+        for (auto& [layer_name, hash] : baseline.icon_hashes) {
+            for (auto& icon_layer : IconLayers) {
+                if (icon_layer.layer_name == layer_name) icon_layer.saved_hash = hash;
+            }
+        }
+
+        std::cout << "Debug::World saved successfully to " << filename << std::endl;
+        return true;
+    }
+
+    // A save that didn't make it to disk hands its painted tiles back
+    void abandon_save(const SaveBaseline& baseline) {
+        for (auto& dirty : baseline.dirty) {
+            std::vector<uint8_t>* tiles = nullptr;
+            if (dirty.type == SECTION_WORLD_LAYER) {
+                for (auto& world_layer : WorldLayers) {
+                    if (world_layer.layer_name == dirty.layer_name) tiles = &world_layer.dirty_tiles;
+                }
+            } else {
+                for (auto& political_layer : PoliticalLayers) {
+                    if (political_layer.layer_name == dirty.layer_name) tiles = &political_layer.dirty_tiles;
+                }
+            }
+            if (!tiles) continue;
+            if (tiles->size() < dirty.tiles.size()) tiles->resize(dirty.tiles.size(), 0);
+            for (size_t i = 0; i < dirty.tiles.size(); i++) {
+                (*tiles)[i] |= dirty.tiles[i];
+            }
+        }
+    }
+
+    // Saves on the calling thread
+    void SaveWorld(std::string filename = "savename.nw", bool cloud = false) {
+        if (load_job) {
+            std::cerr << "Can't save while a world is loading\n";
+            return;
+        }
+        if (!loaded_region.empty()) {
+            std::cerr << "Only changes can be saved while part of the world is loaded\n";
+            return;
+        }
+        std::cout << "Debug::SaveWorld::" << filename << std::endl;
+        // written next to the old save and swapped in at the end, hidden layers are copied out of the old one
+        std::string temporary_filename = "saves/" + filename + ".tmp";
+
+        WorldSnapshot snapshot = snapshot_world();
+        std::vector<MovedRaster> moved_rasters;
+        if (!write_world_snapshot(snapshot, temporary_filename, moved_rasters, nullptr) ||
+            !finish_save(filename, moved_rasters, snapshot.save_id, snapshot.baseline)) {
+            abandon_save(snapshot.baseline);
+            return;
+        }
+
+        if (KEEP_SAVE_HISTORY) {
+            FileSource saved("saves/" + filename);
+            if (saved.is_open()) save_history().record(filename, saved.data(), saved.size(), snapshot.save_time);
+        }
 
-            int32_t world_layer_name_len = political_layer.world_layer->layer_name.size();
-            out.write(reinterpret_cast<char*>(&world_layer_name_len), sizeof(world_layer_name_len));
-            out.write(political_layer.world_layer->layer_name.data(), world_layer_name_len);
+        if(cloud) {
+            publish_savefile(filename);
+        }
+    }
 
-            int32_t w = width, h = height;
-            out.write(reinterpret_cast<char*>(&w), sizeof(w));
-            out.write(reinterpret_cast<char*>(&h), sizeof(h));
+    // Takes a snapshot and leaves encoding, writing and uploading to a worker thread,
+    // poll_save() has to be called every frame to finish it. Only one save runs at a time.
+    bool SaveWorldAsync(const std::string& filename, bool cloud = false) {
+        if (save_job) {
+            std::cerr << "A save is already running\n";
+            return false;
+        }
+        if (load_job) {
+            std::cerr << "Can't save while a world is loading\n";
+            return false;
+        }
+        if (!loaded_region.empty()) {
+            std::cerr << "Only changes can be saved while part of the world is loaded\n";
+            save_status = "Only changes can be saved while part of the world is loaded";
+            save_failed = true;
+            return false;
+        }
+        std::cout << "Debug::SaveWorldAsync::" << filename << std::endl;
+
+        auto snapshot_start = std::chrono::steady_clock::now();
+        save_job = std::make_unique<SaveJob>();
+        SaveJob* job = save_job.get();
+        job->filename = filename;
+        job->cloud = cloud;
+        job->keep_history = KEEP_SAVE_HISTORY;
+        job->snapshot = snapshot_world();
+        job->progress_total = job->snapshot.work_total();
+        std::cout << "Debug::SaveSnapshot::" << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - snapshot_start).count() << " ms" << std::endl;
+
+        save_status = "Saving " + filename;
+        save_failed = false;
+        job->worker = std::thread([job]() {
+            job->write_ok = write_world_snapshot(job->snapshot, "saves/" + job->filename + ".tmp", job->moved_rasters, &job->progress_done);
+            if (job->write_ok && job->keep_history) {
+                // unmapped again before the UI thread renames the file
+                FileSource written("saves/" + job->filename + ".tmp");
+                if (written.is_open()) save_history().record(job->filename, written.data(), written.size(), job->snapshot.save_time);
+            }
+            // layer copies aren't needed past this point, the baseline is
+            job->snapshot.world_layers.clear();
+            job->snapshot.political_layers.clear();
+            job->snapshot.icon_layers.clear();
+            job->written = true;
+        });
+        return true;
+    }
 
-            // Streaming pixel to file
-            std::vector<uint8_t> rowBuffer(width);
+    void poll_save() {
+        if (!save_job) return;
+        SaveJob* job = save_job.get();
 
-            uint8_t* row = static_cast<uint8_t*>(pixels);
-            for (int y = 0; y < height; ++y) {
-                Uint32* px = reinterpret_cast<Uint32*>(row);
-                for (int x = 0; x < width; ++x) {
-                    Uint32 pixel = px[x];
+        if (job->uploading) {
+            if (!job->uploaded) return;
+            if (job->worker.joinable()) job->worker.join();
+            save_status = "Saved and uploaded " + job->filename;
+            save_job.reset();
+            return;
+        }
 
-                    Uint8 r = (pixel >> 24) & 0xFF;
-                    Uint8 g = (pixel >> 16) & 0xFF;
-                    Uint8 b = (pixel >> 8)  & 0xFF;
+        if (!job->written) return;
+        if (job->worker.joinable()) job->worker.join();
 
-                    uint32_t key = (r << 16) | (g << 8) | b;
-                    uint8_t index = referenced_id_map->id_LUT[key];
+        if (!job->write_ok || !finish_save(job->filename, job->moved_rasters, job->snapshot.save_id, job->snapshot.baseline)) {
+            abandon_save(job->snapshot.baseline);
+            save_status = "Failed to save " + job->filename;
+            save_failed = true;
+            save_job.reset();
+            return;
+        }
 
-                    rowBuffer[x] = index;
-                }
-                out.write(reinterpret_cast<char*>(rowBuffer.data()), width); // flush row
-                row += pitch;
+        if (job->cloud) {
+            save_status = "Uploading " + job->filename;
+            job->uploading = true;
+            job->worker = std::thread([job]() {
+                publish_savefile(job->filename);
+                job->uploaded = true;
+            });
+            return;
+        }
+
+        save_status = "Saved " + job->filename;
+        save_job.reset();
+    }
+
+    bool is_saving() const {
+        return save_job != nullptr;
+    }
+
+    float save_progress() const {
+        if (!save_job) return 0.0f;
+        if (save_job->written || save_job->progress_total == 0) return 1.0f;
+        return float(double(save_job->progress_done) / double(save_job->progress_total));
+    }
+
+    // Blocks until a running save (and upload) is done
+    void wait_for_save() {
+        while (save_job) {
+            if (save_job->worker.joinable()) save_job->worker.join();
+            poll_save();
+        }
+    }
+
+    // Tiles follow the chunk grid, on upper layers one pixel is one chunk. Within a region they span
+    // REGION_ALIGN_CHUNKS, so each of them is also a tile of the whole world's raster.
+    TileGrid save_tile_grid(int width, int height, bool is_upper) const {
+        if (!loaded_region.empty()) {
+            return is_upper ? make_tile_grid_sized(width, height, REGION_ALIGN_CHUNKS, REGION_ALIGN_CHUNKS)
+                            : make_tile_grid_sized(width, height, REGION_ALIGN_CHUNKS * CHUNK_WIDTH, REGION_ALIGN_CHUNKS * CHUNK_HEIGHT);
+        }
+        return is_upper ? make_tile_grid(width, height, 1, 1) : make_tile_grid(width, height, CHUNK_WIDTH, CHUNK_HEIGHT);
+    }
+
+    // Where the loaded part of the world lies in a raster of the whole world, in that raster's pixels
+    SDL_Rect loaded_window(bool is_upper) const {
+        int scale_x = is_upper ? 1 : CHUNK_WIDTH, scale_y = is_upper ? 1 : CHUNK_HEIGHT;
+        if (loaded_region.empty()) return {0, 0, UPPER_WORLD_WIDTH * scale_x, UPPER_WORLD_HEIGHT * scale_y};
+        return {loaded_region.x * scale_x, loaded_region.y * scale_y, loaded_region.width * scale_x, loaded_region.height * scale_y};
+    }
+
+    // Size of a raster of the whole world, even when only a region of it is loaded
+    SDL_Point whole_raster_size(bool is_upper) const {
+        int scale_x = is_upper ? 1 : CHUNK_WIDTH, scale_y = is_upper ? 1 : CHUNK_HEIGHT;
+        if (loaded_region.empty()) return {UPPER_WORLD_WIDTH * scale_x, UPPER_WORLD_HEIGHT * scale_y};
+        return {FULL_WORLD_WIDTH * scale_x, FULL_WORLD_HEIGHT * scale_y};
+    }
+
+    // Flags the save tiles under a brush so the next incremental save picks them up
+    void mark_dirty(std::vector<uint8_t>& dirty_tiles, TiledTexture* texture, bool is_upper, int x, int y, int radius) {
+        TileGrid grid = save_tile_grid(texture->w, texture->h, is_upper);
+        dirty_tiles.resize(grid.count(), 0);
+
+        int x0 = std::max(x - radius, 0);
+        int y0 = std::max(y - radius, 0);
+        int x1 = std::min(x + radius, grid.width - 1);
+        int y1 = std::min(y + radius, grid.height - 1);
+        if (x0 > x1 || y0 > y1) return;
+
+        for (int ty = y0 / grid.tile_h; ty <= y1 / grid.tile_h; ty++) {
+            for (int tx = x0 / grid.tile_w; tx <= x1 / grid.tile_w; tx++) {
+                dirty_tiles[size_t(ty) * grid.tiles_x + tx] = 1;
             }
+        }
+    }
+
+    void mark_dirty(WorldLayer& layer, int x, int y, int radius) {
+        mark_dirty(layer.dirty_tiles, layer.layer_texture, layer.is_upper, x, y, radius);
+    }
+
+    void mark_dirty(PoliticalLayer& layer, int x, int y, int radius) {
+        mark_dirty(layer.dirty_tiles, layer.layer_texture, true, x, y, radius);
+    }
+
+    // Paints into a layer's ids with a brush tool, 0 paints the whole disc and 1 only the id under
+    // x, y, then shows the rect it covers in the texture. The brush works on a copy of the ids
+    // under it, written back so only the blocks it touches are allocated.
+    SDL_Rect paint_ids(SparseIds& ids, TiledTexture* texture, const IDmap& id_map, int brush_tool, int x, int y, int radius, uint8_t id) {
+        SDL_Rect rect = {x - radius, y - radius, radius * 2 + 1, radius * 2 + 1};
+        if (ids.width() != texture->w || ids.height() != texture->h) return SDL_Rect{0, 0, 0, 0};
+        ClampRectToTexture(rect, texture->w, texture->h);
+        if (rect.w <= 0 || rect.h <= 0) return rect;
+
+        brush_ids.resize(size_t(rect.w) * rect.h);
+        ids.read(rect.x, rect.y, rect.w, rect.h, brush_ids.data(), size_t(rect.w));
+        SDL_Rect painted = {0, 0, 0, 0};
+        if (brush_tool == 0) painted = PaintBrush(brush_ids.data(), rect.w, rect.h, x - rect.x, y - rect.y, radius, id);
+        if (brush_tool == 1) painted = PaintFill(brush_ids.data(), rect.w, rect.h, x - rect.x, y - rect.y, radius, id);
+        if (painted.w <= 0 || painted.h <= 0) return SDL_Rect{0, 0, 0, 0};
+        ids.write(rect.x, rect.y, rect.w, rect.h, brush_ids.data(), size_t(rect.w));
+
+        show_ids(texture, ids, id_map.px_LUT, rect);
+        return rect;
+    }
+
+    void paint(WorldLayer& layer, const IDmap& id_map, int brush_tool, int x, int y, int radius, uint8_t id) {
+        paint_ids(layer.ids, layer.layer_texture, id_map, brush_tool, x, y, radius, id);
+        mark_dirty(layer, x, y, radius);
+    }
+
+    void paint(PoliticalLayer& layer, const IDmap& id_map, int brush_tool, int x, int y, int radius, uint8_t id) {
+        paint_ids(layer.ids, layer.layer_texture, id_map, brush_tool, x, y, radius, id);
+        mark_dirty(layer, x, y, radius);
+    }
 
-            SDL_UnlockTexture(political_layer.layer_texture);
-            std::cout << "Debug::LayerSaved::" << political_layer.layer_name << std::endl;
+    // Layer order, names, links and sizes. The journal only records contents, a change here needs a full save.
+    std::string structure_signature() const {
+        std::ostringstream signature;
+        signature << UPPER_WORLD_WIDTH << "x" << UPPER_WORLD_HEIGHT << "/" << CHUNK_WIDTH << "x" << CHUNK_HEIGHT;
+        for (auto& world_layer : WorldLayers) {
+            signature << "|W:" << world_layer.layer_name << ":" << world_layer.idmap_name << ":" << world_layer.is_upper;
+        }
+        for (auto& political_layer : PoliticalLayers) {
+            signature << "|P:" << political_layer.layer_name << ":" << political_layer.idmap_name << ":"
+                      << (political_layer.world_layer ? political_layer.world_layer->layer_name : "");
         }
+        for (auto& icon_layer : IconLayers) {
+            signature << "|I:" << icon_layer.layer_name;
+        }
+        return signature.str();
+    }
+
+    static uint64_t new_save_id() {
+        static std::mt19937_64 generator((uint64_t(std::random_device{}()) << 32) ^ uint64_t(std::chrono::steady_clock::now().time_since_epoch().count()));
+        uint64_t save_id;
+        do {
+            save_id = generator();
+        } while (save_id == 0);
+        return save_id;
+    }
 
-        // Icon layers
+    // What was just loaded is what the journal continues from
+    void reset_save_baseline() {
+        saved_structure = structure_signature();
+        for (auto& world_layer : WorldLayers) world_layer.dirty_tiles.clear();
+        for (auto& political_layer : PoliticalLayers) political_layer.dirty_tiles.clear();
         for (auto& icon_layer : IconLayers) {
-            // Layer name
-            int32_t lnameLen = icon_layer.layer_name.size();
-            out.write(reinterpret_cast<char*>(&lnameLen), sizeof(lnameLen));
-            out.write(icon_layer.layer_name.data(), lnameLen);
+            icon_layer.saved_hash = hash_icon_layer(snapshot_icon_layer(icon_layer));
+        }
+    }
+
+    // Encodes the dirty tiles of a layer as a JOURNAL_RASTER_TILES payload
+    bool encode_dirty_tiles(std::string& payload, uint32_t type, const std::string& layer_name, const SparseIds& ids,
+                            TiledTexture* texture, bool is_upper, const std::vector<uint8_t>& dirty_tiles) {
+        if (ids.width() != texture->w || ids.height() != texture->h) {
+            std::cerr << "Layer " << layer_name << " has no ids to save\n";
+            return false;
+        }
+
+        // tiles are numbered in the raster of the whole world, a region's tiles are some of them
+        TileGrid grid = save_tile_grid(texture->w, texture->h, is_upper);
+        SDL_Rect window = loaded_window(is_upper);
+        SDL_Point whole_size = whole_raster_size(is_upper);
+        TileGrid whole_grid = make_tile_grid_sized(whole_size.x, whole_size.y, grid.tile_w, grid.tile_h);
+        int tiles_offset_x = window.x / grid.tile_w, tiles_offset_y = window.y / grid.tile_h;
+        uint32_t tile_count = 0;
+        for (size_t i = 0; i < dirty_tiles.size() && i < size_t(grid.count()); i++) {
+            if (dirty_tiles[i]) tile_count++;
+        }
 
-            // Civilian icons
-            int32_t num_civilian_icons = icon_layer.IconsCivilian.size();
-            out.write(reinterpret_cast<char*>(&num_civilian_icons), sizeof(num_civilian_icons));
+        std::ostringstream out(std::ios::binary);
+        int32_t nameLen = layer_name.size();
+        int32_t width = whole_grid.width, height = whole_grid.height, tile_w = grid.tile_w, tile_h = grid.tile_h;
+        out.write(reinterpret_cast<char*>(&type), sizeof(type));
+        out.write(reinterpret_cast<char*>(&nameLen), sizeof(nameLen));
+        out.write(layer_name.data(), nameLen);
+        out.write(reinterpret_cast<char*>(&width), sizeof(width));
+        out.write(reinterpret_cast<char*>(&height), sizeof(height));
+        out.write(reinterpret_cast<char*>(&tile_w), sizeof(tile_w));
+        out.write(reinterpret_cast<char*>(&tile_h), sizeof(tile_h));
+        out.write(reinterpret_cast<char*>(&tile_count), sizeof(tile_count));
+
+        std::vector<uint8_t> tile(grid.max_tile_size());
+        std::vector<uint8_t> encoded;
+        for (uint32_t index = 0; index < uint32_t(grid.count()) && index < dirty_tiles.size(); index++) {
+            if (!dirty_tiles[index]) continue;
+
+            int x0 = int(index % grid.tiles_x) * grid.tile_w;
+            int y0 = int(index / grid.tiles_x) * grid.tile_h;
+            SDL_Rect rect = {x0, y0, std::min(grid.tile_w, grid.width - x0), std::min(grid.tile_h, grid.height - y0)};
+            ids.read(x0, y0, rect.w, rect.h, tile.data(), size_t(rect.w));
+
+            encoded.clear();
+            encode_tile(tile.data(), size_t(rect.w) * rect.h, encoded);
+            uint32_t encoded_size = encoded.size();
+            uint32_t whole_index = uint32_t(int(index / grid.tiles_x) + tiles_offset_y) * uint32_t(whole_grid.tiles_x) + uint32_t(int(index % grid.tiles_x) + tiles_offset_x);
+            out.write(reinterpret_cast<char*>(&whole_index), sizeof(whole_index));
+            out.write(reinterpret_cast<char*>(&encoded_size), sizeof(encoded_size));
+            out.write(reinterpret_cast<char*>(encoded.data()), encoded.size());
+        }
 
-            for (auto& icon : icon_layer.IconsCivilian) {
-                out.write(reinterpret_cast<char*>(&icon.icon_id), sizeof(icon.icon_id));
-                out.write(reinterpret_cast<char*>(&icon.position.x), sizeof(icon.position.x));
-                out.write(reinterpret_cast<char*>(&icon.position.y), sizeof(icon.position.y));
+        payload = out.str();
+        return true;
+    }
 
-                std::uint64_t description_size = icon.description.size();
-                out.write(reinterpret_cast<const char*>(&description_size), sizeof(description_size));
-                out.write(icon.description.data(), description_size);
+    // Appends a committed batch, the journal is started over if it is missing,
+    // damaged or belongs to an older save. A batch cut off by a crash is dropped first.
+    bool append_journal(const std::string& journal_filename, const std::string& batch) {
+        uint64_t committed_end = 0;
+        uint64_t journal_size = 0;
+        {
+            MappedFile file(journal_filename);
+            if (file.is_open()) {
+                ByteReader in(file.data(), file.size());
+                committed_end = scan_journal(in, current_save_id, [](uint32_t, ByteReader&) {});
+                journal_size = file.size();
             }
+        }
+
+        if (committed_end == 0) {
+            std::ofstream out(journal_filename, std::ios::binary | std::ios::trunc);
+            uint32_t version = JOURNAL_VERSION;
+            uint64_t save_id = current_save_id;
+            out.write(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+            out.write(reinterpret_cast<char*>(&version), sizeof(version));
+            out.write(reinterpret_cast<char*>(&save_id), sizeof(save_id));
+            if (!out) return false;
+        } else if (committed_end < journal_size) {
+            std::error_code resize_error;
+            std::filesystem::resize_file(journal_filename, committed_end, resize_error);
+            if (resize_error) return false;
+        }
+
+        std::ofstream out(journal_filename, std::ios::binary | std::ios::app);
+        out.write(batch.data(), batch.size());
+        out.flush();
+        return bool(out);
+    }
+
+    // Appends the tiles painted and the icon layers changed since the last save to the journal of the
+    // current savefile. Falls back to a full save when there is no journal base or it grew too big,
+    // unless only a region is loaded: its changes always go to the journal.
+    void SaveWorldIncremental() {
+        if (save_job) return; // a running full save either takes the changes along or hands them back
+        if (load_job) return; // the world isn't complete yet
+
+        bool region = !loaded_region.empty();
+        if (region && (current_savefile.empty() || current_save_id == 0 || structure_signature() != saved_structure)) {
+            save_status = "Changes to the layers of a region can't be saved, load the whole world for that";
+            save_failed = true;
+            return;
+        }
+        if (current_savefile.empty() || current_save_id == 0 || structure_signature() != saved_structure) {
+            SaveWorldAsync(current_savefile.empty() ? "autosave.nw" : current_savefile);
+            return;
+        }
+
+        std::string full_filename = "saves/" + current_savefile;
+        std::string journal_filename = full_filename + ".journal";
+        std::error_code size_error;
+        uint64_t savefile_size = std::filesystem::file_size(full_filename, size_error);
+        if (size_error) {
+            SaveWorldAsync(current_savefile);
+            return;
+        }
+        uint64_t journal_size = std::filesystem::file_size(journal_filename, size_error);
+        if (size_error) journal_size = 0;
+        if (!region && journal_size > JOURNAL_COMPACT_MIN_SIZE && journal_size > savefile_size * JOURNAL_COMPACT_RATIO) {
+            std::cout << "Debug::Journal::Compacting::" << journal_filename << std::endl;
+            SaveWorldAsync(current_savefile);
+            return;
+        }
+
+        auto start_time = std::chrono::steady_clock::now();
+        std::ostringstream batch(std::ios::binary);
+        int changed_layers = 0;
+
+        auto has_dirty_tiles = [](const std::vector<uint8_t>& dirty_tiles) {
+            return std::find(dirty_tiles.begin(), dirty_tiles.end(), 1) != dirty_tiles.end();
+        };
+        for (auto& world_layer : WorldLayers) {
+            if (!has_dirty_tiles(world_layer.dirty_tiles)) continue;
+            std::string payload;
+            if (!encode_dirty_tiles(payload, SECTION_WORLD_LAYER, world_layer.layer_name, world_layer.ids, world_layer.layer_texture, world_layer.is_upper, world_layer.dirty_tiles)) continue;
+            write_journal_record(batch, JOURNAL_RASTER_TILES, payload);
+            changed_layers++;
+        }
+        for (auto& political_layer : PoliticalLayers) {
+            if (!has_dirty_tiles(political_layer.dirty_tiles)) continue;
+            std::string payload;
+            if (!encode_dirty_tiles(payload, SECTION_POLITICAL_LAYER, political_layer.layer_name, political_layer.ids, political_layer.layer_texture, true, political_layer.dirty_tiles)) continue;
+            write_journal_record(batch, JOURNAL_RASTER_TILES, payload);
+            changed_layers++;
+        }
+
+        std::vector<std::pair<IconLayer*, uint64_t>> icon_hashes;
+        for (auto& icon_layer : IconLayers) {
+            ByteWriter out;
+            write_icon_layer(out, snapshot_icon_layer(icon_layer));
+            std::string payload(reinterpret_cast<const char*>(out.data()), out.size());
+            uint64_t hash = nw_hash64(payload.data(), payload.size());
+            if (hash == icon_layer.saved_hash) continue;
+            write_journal_record(batch, JOURNAL_ICON_COLUMNS, payload);
+            icon_hashes.push_back({&icon_layer, hash});
+            changed_layers++;
+        }
+
+        if (changed_layers == 0) {
+            save_status = "No changes since the last save";
+            save_failed = false;
+            return;
+        }
+        write_journal_record(batch, JOURNAL_COMMIT, std::string());
+
+        std::string batch_bytes = batch.str();
+        if (!append_journal(journal_filename, batch_bytes)) {
+            std::cerr << "Failed to write journal " << journal_filename << "\n";
+            save_status = "Failed to save changes to " + current_savefile;
+            save_failed = true;
+            return;
+        }
 
-            // Military icons
-            int32_t num_military_icons = icon_layer.IconsMilitary.size();
-            out.write(reinterpret_cast<char*>(&num_military_icons), sizeof(num_military_icons));
+        for (auto& world_layer : WorldLayers) world_layer.dirty_tiles.clear();
+        for (auto& political_layer : PoliticalLayers) political_layer.dirty_tiles.clear();
+        for (auto& [icon_layer, hash] : icon_hashes) icon_layer->saved_hash = hash;
 
-            for (auto& icon : icon_layer.IconsMilitary) {
-                out.write(reinterpret_cast<char*>(&icon.icon_id), sizeof(icon.icon_id));
-                out.write(reinterpret_cast<char*>(&icon.angle), sizeof(icon.angle));
-                out.write(reinterpret_cast<char*>(&icon.country_id), sizeof(icon.country_id));
-                out.write(reinterpret_cast<char*>(&icon.quality), sizeof(icon.quality));
-                out.write(reinterpret_cast<char*>(&icon.position.x), sizeof(icon.position.x));
-                out.write(reinterpret_cast<char*>(&icon.position.y), sizeof(icon.position.y));
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+        std::cout << "Debug::Journal::Appended::" << changed_layers << " layers, " << batch_bytes.size() << " bytes in " << milliseconds << " ms" << std::endl;
+        save_status = "Saved changes to " + current_savefile + " (" + std::to_string(batch_bytes.size() / 1024 + 1) + " KB)";
+        save_failed = false;
+    }
 
-                std::uint64_t description_size = icon.description.size();
-                out.write(reinterpret_cast<const char*>(&description_size), sizeof(description_size));
-                out.write(icon.description.data(), description_size);
+    void apply_journal_tiles(ByteReader& in) {
+        uint32_t type;
+        std::string layer_name;
+        int32_t width, height, tile_w, tile_h;
+        uint32_t tile_count;
+        in.read(type);
+        in.read_string<int32_t>(layer_name, SAVE_MAX_NAME_LENGTH);
+        in.read(width);
+        in.read(height);
+        in.read(tile_w);
+        in.read(tile_h);
+        in.read(tile_count);
+        if (!in || checked_tile_count(width, height, tile_w, tile_h) == 0) return;
+
+        TiledTexture* texture = nullptr;
+        SparseIds* ids = nullptr;
+        std::string idmap_name;
+        bool is_upper = true;
+        if (type == SECTION_WORLD_LAYER) {
+            for (auto& world_layer : WorldLayers) {
+                if (world_layer.layer_name != layer_name) continue;
+                ensure_loaded(world_layer);
+                texture = world_layer.layer_texture;
+                ids = &world_layer.ids;
+                idmap_name = world_layer.idmap_name;
+                is_upper = world_layer.is_upper;
+            }
+        } else {
+            for (auto& political_layer : PoliticalLayers) {
+                if (political_layer.layer_name != layer_name) continue;
+                ensure_loaded(political_layer);
+                texture = political_layer.layer_texture;
+                ids = &political_layer.ids;
+                idmap_name = political_layer.idmap_name;
+            }
+        }
+        // tiles cover the raster of the whole world, only what falls in the loaded window is kept
+        SDL_Point whole_size = whole_raster_size(is_upper);
+        SDL_Rect window = loaded_window(is_upper);
+        if (!texture || whole_size.x != width || whole_size.y != height || texture->w != window.w || texture->h != window.h ||
+            ids->width() != window.w || ids->height() != window.h) {
+            std::cerr << "Journal layer doesn't match the world: " << layer_name << "\n";
+            return;
+        }
+        const Uint32* lut = layer_colors(find_idmap(idmap_name));
+
+        TileGrid grid = make_tile_grid_sized(width, height, tile_w, tile_h);
+        std::vector<uint8_t> tile(grid.max_tile_size());
+        for (uint32_t i = 0; i < tile_count; i++) {
+            uint32_t index, encoded_size;
+            in.read(index);
+            in.read(encoded_size);
+            const uint8_t* encoded = in.take(encoded_size);
+            if (!encoded || index >= uint32_t(grid.count())) return;
+
+            int x0 = int(index % grid.tiles_x) * tile_w;
+            int y0 = int(index / grid.tiles_x) * tile_h;
+            SDL_Rect rect = {x0, y0, std::min(tile_w, width - x0), std::min(tile_h, height - y0)};
+            SDL_Rect visible;
+            if (!SDL_GetRectIntersection(&rect, &window, &visible)) continue;
+            if (!decode_tile(encoded, encoded_size, tile.data(), size_t(rect.w) * rect.h)) return;
+
+            SDL_Rect layer_rect = {visible.x - window.x, visible.y - window.y, visible.w, visible.h};
+            ids->write(layer_rect.x, layer_rect.y, layer_rect.w, layer_rect.h, tile.data() + size_t(visible.y - y0) * rect.w + (visible.x - x0), size_t(rect.w));
+            show_ids(texture, *ids, lut, layer_rect);
+        }
+    }
 
-                int32_t num_decorators = icon.decorators.size();
-                out.write(reinterpret_cast<char*>(&num_decorators), sizeof(num_decorators));
-                for (auto& decorator : icon.decorators) {
-                    out.write(reinterpret_cast<char*>(&decorator.id), sizeof(decorator.id));
+    // Creates the icons and shapes of a snapshot from index next on, until deadline passes.
+    // Returns true once all of them are created.
+    bool add_icons(IconLayer& icon_layer, const IconLayerSnapshot& snapshot, SDL_Renderer* renderer, size_t& next,
+                   std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max()) {
+        size_t civilian_end = snapshot.civilian_icons.size();
+        size_t military_end = civilian_end + snapshot.military_icons.size();
+        size_t shape_end = military_end + snapshot.shapes.size();
+        for (; next < shape_end; next++) {
+            if ((next & 63) == 0 && std::chrono::steady_clock::now() > deadline) return false;
+            if (next < civilian_end) {
+                const CivilianIconSnapshot& icon = snapshot.civilian_icons[next];
+                icon_layer.create_civilian_icon(renderer, icon.icon_id, icon.x, icon.y, CivilianIdMap, icon.description);
+            } else if (next < military_end) {
+                const MilitaryIconSnapshot& icon = snapshot.military_icons[next - civilian_end];
+                auto& created_icon = icon_layer.create_military_icon(renderer, icon.icon_id, icon.x, icon.y, MilitaryIdMap, icon.description);
+                created_icon.angle = icon.angle;
+                created_icon.country_id = icon.country_id;
+                created_icon.quality = icon.quality;
+                for (int32_t decorator_id : icon.decorators) {
+                    created_icon.add_decorator(renderer, decorator_id, DecoratorIdMap);
                 }
+            } else {
+                const ShapeSnapshot& snapshot_shape = snapshot.shapes[next - military_end];
+                Shape shape;
+                shape.AddPoints(reinterpret_cast<const SDL_FPoint*>(snapshot_shape.points.data()), int(snapshot_shape.points.size()));
+                icon_layer.create_shape(shape, snapshot_shape.r, snapshot_shape.g, snapshot_shape.b, snapshot_shape.a);
             }
+        }
+        return true;
+    }
+
+    void apply_journal_icon_layer(ByteReader& in, SDL_Renderer* renderer, bool columnar) {
+        std::string layer_name;
+        if (!in.read_string<int32_t>(layer_name, SAVE_MAX_NAME_LENGTH)) return;
+
+        for (auto& icon_layer : IconLayers) {
+            if (icon_layer.layer_name != layer_name) continue;
+            selected_world_icon = nullptr; // may point into the replaced icons
+            icon_layer.IconsCivilian.clear();
+            icon_layer.IconsMilitary.clear();
+            icon_layer.Shapes.clear();
+            IconLayerSnapshot snapshot;
+            read_icon_layer(in, snapshot, columnar);
+            icon_layer.outside_region = IconLayerSnapshot();
+            if (!loaded_region.empty()) split_icons_by_bounds(snapshot, region_icon_bounds(loaded_region, CHUNK_WIDTH, CHUNK_HEIGHT), icon_layer.outside_region);
+            size_t next = 0;
+            add_icons(icon_layer, snapshot, renderer, next);
+            icon_layer.saved_hash = hash_icon_layer(snapshot_icon_layer(icon_layer)); // the journal has it already
+            return;
+        }
+    }
+
+    // Applies the committed batches of the current savefile's journal on top of the freshly loaded save
+    void replay_journal(SDL_Renderer* renderer) {
+        std::string journal_filename = "saves/" + current_savefile + ".journal";
+        MappedFile file(journal_filename);
+        if (!file.is_open()) return;
+        if (current_save_id == 0) {
+            std::cerr << "Ignoring journal of a save without an id: " << journal_filename << "\n";
+            return;
+        }
+
+        auto start_time = std::chrono::steady_clock::now();
+        ByteReader in(file.data(), file.size());
+        int records = 0;
+        uint64_t committed_end = scan_journal(in, current_save_id, [&](uint32_t type, ByteReader& record) {
+            if (type == JOURNAL_RASTER_TILES) apply_journal_tiles(record);
+            if (type == JOURNAL_ICON_LAYER || type == JOURNAL_ICON_COLUMNS) apply_journal_icon_layer(record, renderer, type == JOURNAL_ICON_COLUMNS);
+            records++;
+        });
+        if (committed_end == 0) {
+            std::cerr << "Ignoring journal that belongs to another save: " << journal_filename << "\n";
+            return;
+        }
 
-            // Shapes
-            int32_t num_shapes = icon_layer.Shapes.size();
-            out.write(reinterpret_cast<char*>(&num_shapes), sizeof(num_shapes));
+        // Shadows follow the world layers they were computed from
+        for (auto& political_layer : PoliticalLayers) {
+            if (political_layer.loaded && political_layer.world_layer && political_layer.world_layer->loaded) {
+                political_layer.update_texture();
+            }
+        }
 
-            for (auto& shape : icon_layer.Shapes) {
-                out.write(reinterpret_cast<char*>(&shape.r), sizeof(shape.r));
-                out.write(reinterpret_cast<char*>(&shape.g), sizeof(shape.g));
-                out.write(reinterpret_cast<char*>(&shape.b), sizeof(shape.b));
-                out.write(reinterpret_cast<char*>(&shape.a), sizeof(shape.a));
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+        std::cout << "Debug::Journal::Replayed::" << records << " records from " << journal_filename << " in " << milliseconds << " ms" << std::endl;
+    }
 
-                int32_t num_points = shape.GetSize();
-                out.write(reinterpret_cast<char*>(&num_points), sizeof(num_points));
+    // Starts loading a save from the history, it is put back in saves/ once the world is built.
+    // What is in saves/ under that name now is recorded first, so a restore can be undone by
+    // restoring that again.
+    bool RestoreFromHistory(const SaveHistory::Snapshot& snapshot, SDL_Renderer* renderer) {
+        if (save_job || load_job) {
+            std::cerr << "A save or load is already running\n";
+            return false;
+        }
+        std::vector<uint8_t> bytes;
+        std::string error;
+        if (!save_history().restore(snapshot, bytes, error)) {
+            std::cerr << "Failed to restore " << snapshot.savefile << ": " << error << "\n";
+            return false;
+        }
 
-                for (int i = 0; i < num_points; ++i) {
-                    out.write(reinterpret_cast<char*>(&shape.point_array[i].x), sizeof(shape.point_array[i].x));
-                    out.write(reinterpret_cast<char*>(&shape.point_array[i].y), sizeof(shape.point_array[i].y));
+        std::string full_filename = "saves/" + snapshot.savefile;
+        {
+            FileSource current(full_filename);
+            if (current.is_open()) {
+                SavePreview preview;
+                int64_t save_time = read_save_preview(full_filename, preview) && preview.save_time != 0 ? preview.save_time : int64_t(std::time(nullptr));
+                if (!save_history().record(snapshot.savefile, current.data(), current.size(), save_time)) {
+                    std::cerr << "Not restoring " << snapshot.savefile << ", the current file couldn't be kept in the history\n";
+                    return false;
                 }
             }
         }
+        // saves/ only changes once the world is built from these bytes, until then the open world
+        // may still read hidden layers and journal edits from the file there
+        if (!LoadWorldAsync(std::make_unique<MemorySource>(std::move(bytes)), snapshot.savefile, renderer)) return false;
+        load_job->restore_savefile = snapshot.savefile;
+        std::cout << "Debug::History::Restoring::" << snapshot.savefile << " from " << snapshot.manifest_filename << std::endl;
+        return true;
+    }
 
-        std::cout << "Debug::World saved successfully to " << filename << std::endl;
-        out.close();
+    // Writes a restored save over its file in saves/ once the world from before is gone
+    bool write_restored_save(const LoadJob& job) {
+        std::string full_filename = "saves/" + job.restore_savefile;
+        if (!write_file_atomically(full_filename, job.source->data(), job.source->size())) {
+            std::cerr << "Failed to write " << full_filename << "\n";
+            return false;
+        }
+        // edits journaled against the replaced file don't apply to this one
+        std::error_code remove_error;
+        std::filesystem::remove(full_filename + ".journal", remove_error);
+        std::cout << "Debug::History::Restored::" << job.restore_savefile << std::endl;
+        return true;
+    }
 
-        if(cloud) {
-            std::string command = "AWSupload.exe " + filename;
-            int AWSupload_exitcode = std::system(command.c_str());
-            if (AWSupload_exitcode == 0) {
-                std::cout << "AWSupload completed successfully: " << AWSupload_exitcode << std::endl;
+    // Reads the layer headers of a savefile into the plan of a load, nothing in the World changes yet
+    bool plan_load(LoadJob& job) {
+        ByteReader in = job.source->reader();
+        if (!read_save_header(in, job.header)) {
+            job.error = "Unsupported or damaged savefile";
+            return false;
+        }
+        const SaveHeader& save_header = job.header;
+        uint32_t save_version = save_header.version;
+        int upper_width = save_header.world_width, upper_height = save_header.world_height;
+        int lower_width = upper_width * save_header.chunk_width, lower_height = upper_height * save_header.chunk_height;
+
+        if (!job.region.empty()) {
+            WorldRegion requested = job.region;
+            job.region = align_region(requested, upper_width, upper_height);
+            if (job.region.empty()) {
+                job.error = "The region is outside the world";
+                return false;
+            }
+            job.icon_bounds = region_icon_bounds(job.region, save_header.chunk_width, save_header.chunk_height);
+            std::cout << "Debug::LoadingRegion::" << job.region.x << "," << job.region.y << " " << job.region.width << "x" << job.region.height
+                      << " chunks (asked for " << requested.x << "," << requested.y << " " << requested.width << "x" << requested.height << ")\n";
+        }
+
+        std::cout << "Debug::Loading " << save_header.num_layers_world << " world layers\n";
+
+        // where the raster a layer header ends in is, and whether it is read now, later or not at all
+        auto plan_raster = [&](LoadRaster& raster, const SaveSection* section, int expected_width, int expected_height) {
+            raster.raster_offset = uint64_t(in.tell());
+            raster.window = {0, 0, raster.width, raster.height};
+            if (!job.region.empty()) {
+                int scale_x = expected_width / upper_width, scale_y = expected_height / upper_height;
+                raster.window = {job.region.x * scale_x, job.region.y * scale_y, job.region.width * scale_x, job.region.height * scale_y};
+            }
+            raster.idmap = find_idmap_handle(raster.idmap_name);
+            if (raster.width != expected_width || raster.height != expected_height) {
+                std::cerr << "Layer size doesn't match the world: " << raster.layer_name << "\n";
+            } else if (!raster.visible && section && job.lazy && job.region.empty()) {
+                // hidden layers are decoded when they are first shown, or right away with the rest of a region
+                raster.pending = true;
+                raster.pending_raster = {job.source->path(), save_version, raster.raster_offset, section->offset + section->length - raster.raster_offset, raster.width, raster.height};
+            } else if (raster.idmap == NO_IDMAP) {
+                std::cerr << "IDmap not found: " << raster.idmap_name << "\n";
+            } else {
+                raster.decode = true;
+            }
+            // without a directory the next header follows the raster
+            if (!section) skip_raster(in, save_version, raster.width, raster.height);
+        };
+
+        for (int i = 0; i < save_header.num_layers_world; i++) {
+            const SaveSection* section = save_header.find_section(SECTION_WORLD_LAYER, i);
+            if (section) in.seek(section->offset);
+
+            LoadRaster raster;
+            raster.type = SECTION_WORLD_LAYER;
+            raster.visible = !section || (section->flags & SECTION_VISIBLE);
+            SaveRasterHeader header;
+            bool header_ok = read_raster_header(in, SECTION_WORLD_LAYER, header);
+
+            std::cout << "Debug::LoadingLayer::" << header.layer_name
+                    << " (" << header.width << "x" << header.height << ") "
+                    << "IDmap=" << header.idmap_name
+                    << " Upper=" << (int)header.is_upper << "\n";
+
+            if (!header_ok) {
+                std::cerr << "Damaged layer header" << "\n";
+                break;
+            }
+
+            raster.layer_name = header.layer_name;
+            raster.idmap_name = header.idmap_name;
+            raster.width = header.width;
+            raster.height = header.height;
+            raster.is_upper = header.is_upper;
+            plan_raster(raster, section, raster.is_upper ? upper_width : lower_width, raster.is_upper ? upper_height : lower_height);
+            job.rasters.push_back(std::move(raster));
+        }
+        size_t num_rasters_world = job.rasters.size();
+
+        for (int i = 0; i < save_header.num_layers_political; i++) {
+            const SaveSection* section = save_header.find_section(SECTION_POLITICAL_LAYER, i);
+            if (section) in.seek(section->offset);
+
+            LoadRaster raster;
+            raster.type = SECTION_POLITICAL_LAYER;
+            raster.visible = !section || (section->flags & SECTION_VISIBLE);
+            SaveRasterHeader header;
+            bool header_ok = read_raster_header(in, SECTION_POLITICAL_LAYER, header);
+
+            std::cout << "Debug::LoadingLayer::" << header.layer_name
+                    << " (" << header.width << "x" << header.height << ") "
+                    << "IDmap=" << header.idmap_name << "\n";
+
+            if (!header_ok) {
+                std::cerr << "Damaged layer header" << "\n";
+                break;
+            }
+
+            raster.layer_name = header.layer_name;
+            raster.idmap_name = header.idmap_name;
+            raster.world_layer_name = header.world_layer_name;
+            raster.width = header.width;
+            raster.height = header.height;
+            plan_raster(raster, section, upper_width, upper_height);
+
+            auto linked_world_layer = std::find_if(job.rasters.begin(), job.rasters.begin() + num_rasters_world,
+                                                   [&](const LoadRaster& world_raster) { return world_raster.layer_name == raster.world_layer_name; });
+            if (linked_world_layer == job.rasters.begin() + num_rasters_world) {
+                std::cerr << "World layer not found: " << raster.world_layer_name << "\n";
+                continue;
+            }
+            if (!raster.pending && linked_world_layer->pending) {
+                // shown political layers are shaded from their world layer
+                linked_world_layer->pending = false;
+                linked_world_layer->decode = linked_world_layer->idmap != NO_IDMAP;
+            }
+            job.rasters.push_back(std::move(raster));
+        }
+        job.icons_offset = in.tell();
+
+        // draw_all stacks political layers over world layers, later ones over earlier ones
+        for (size_t i = job.rasters.size(); i-- > 0;) {
+            if (!job.rasters[i].decode) continue;
+            job.decode_order.push_back(i);
+            job.progress_total += uint64_t(job.rasters[i].window.h);
+        }
+        return true;
+    }
+
+    // Starts loading a savefile on a worker thread, poll_load() has to be called every frame to
+    // build the world from it. The current world stays as it is until the savefile checks out.
+    bool start_load(const ByteSource& source, std::unique_ptr<ByteSource> owned_source, const std::string& name, SDL_Renderer* renderer,
+                    const WorldRegion& region) {
+        if (save_job || load_job) {
+            std::cerr << "A save or load is already running\n";
+            return false;
+        }
+        std::cout << "Debug::LoadWorldAsync::" << name << std::endl;
+
+        auto job = std::make_unique<LoadJob>();
+        job->name = name;
+        job->source = &source;
+        job->owned_source = std::move(owned_source);
+        job->renderer = renderer;
+        job->lazy = !source.path().empty();
+        job->verify = VERIFY_SAVEFILES || !job->lazy;
+        job->region = region;
+        job->start_time = std::chrono::steady_clock::now();
+        if (!plan_load(*job)) {
+            std::cerr << job->error << " in " << name << "\n";
+            load_status = "Failed to load " + name + ": " + job->error;
+            load_failed = true;
+            return false;
+        }
+
+        LoadJob* started_job = job.get();
+        job->worker = std::thread([started_job]() { run_load_job(*started_job); });
+        load_job = std::move(job);
+        load_status = "Loading " + name;
+        load_failed = false;
+        return true;
+    }
+
+    // Loads a savefile from wherever its bytes are. name is the savefile in saves/ when the
+    // source is a file there, then hidden layers stay in the file until they are shown and
+    // the edit journal next to it is replayed. Buffers are decoded completely. With a region only
+    // that part of the world is loaded, see WorldRegion.
+    bool LoadWorldAsync(std::unique_ptr<ByteSource> source, const std::string& name, SDL_Renderer* renderer, const WorldRegion& region = WorldRegion()) {
+        const ByteSource& borrowed_source = *source;
+        return start_load(borrowed_source, std::move(source), name, renderer, region);
+    }
+
+    // Same as LoadWorldAsync, but returns once the world is built. source only has to live until then.
+    bool LoadWorld(const ByteSource& source, const std::string& name, SDL_Renderer* renderer, const WorldRegion& region = WorldRegion()) {
+        if (!start_load(source, nullptr, name, renderer, region)) return false;
+        while (load_job) {
+            poll_load(std::numeric_limits<double>::infinity());
+            if (load_job) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return !load_failed;
+    }
+
+    // Drops every layer and its textures before a loaded world takes their place
+    void clear_layers() {
+        for (auto& world_layer : WorldLayers) destroy_tiled_texture(world_layer.layer_texture);
+        for (auto& political_layer : PoliticalLayers) {
+            destroy_tiled_texture(political_layer.layer_texture);
+            SDL_DestroyTexture(political_layer.shadow_texture);
+        }
+        WorldLayers.clear();
+        PoliticalLayers.clear();
+        IconLayers.clear();
+        selected_world_icon = nullptr;
+        layer_generation++;
+    }
+
+    // Replaces the world with the empty layers of the savefile being loaded
+    void build_loaded_world(LoadJob& job) {
+        clear_layers();
+        loaded_region = job.region;
+        FULL_WORLD_WIDTH = job.header.world_width;
+        FULL_WORLD_HEIGHT = job.header.world_height;
+        if (loaded_region.empty()) set_world_size(job.header.world_width, job.header.world_height);
+        else set_world_size(loaded_region.width, loaded_region.height);
+        set_chunk_size(job.header.chunk_width, job.header.chunk_height);
+
+        for (auto& raster : job.rasters) {
+            if (raster.type == SECTION_WORLD_LAYER) {
+                WorldLayer& loaded_layer = create_worldlayer(job.renderer, raster.layer_name, raster.is_upper, raster.idmap_name);
+                loaded_layer.visible = raster.visible;
+                loaded_layer.loaded = !raster.pending;
+                if (raster.pending) {
+                    loaded_layer.pending = raster.pending_raster;
+                    loaded_layer.ids.clear();
+                }
+                if (raster.decode) loaded_layer.rows_ready = 0;
+                raster.texture = loaded_layer.layer_texture;
             } else {
-                std::cout << "AWSupload failed to upload: " << AWSupload_exitcode << std::endl;
+                PoliticalLayer& loaded_layer = create_politicallayer(job.renderer, raster.layer_name, raster.idmap_name, get_worldlayer(raster.world_layer_name));
+                loaded_layer.visible = raster.visible;
+                loaded_layer.loaded = !raster.pending;
+                if (raster.pending) {
+                    loaded_layer.pending = raster.pending_raster;
+                    loaded_layer.ids.clear();
+                }
+                if (raster.decode) loaded_layer.rows_ready = 0;
+                raster.texture = loaded_layer.layer_texture;
+            }
+        }
+
+        std::cout << "Debug::Loading " << job.icon_layers.size() << " icon layers\n";
+        for (size_t i = 0; i < job.icon_layers.size(); i++) {
+            const IconLayerSnapshot& snapshot = job.icon_layers[i];
+            IconLayer& icon_layer = create_iconlayer(snapshot.layer_name);
+            icon_layer.visible = snapshot.visible;
+            if (i < job.icons_outside.size()) icon_layer.outside_region = std::move(job.icons_outside[i]);
+            job.progress_total += snapshot.civilian_icons.size() + snapshot.military_icons.size() + snapshot.shapes.size();
+        }
+        reset_save_baseline();
+        job.built = true;
+    }
+
+    // Row counter and ids of the layer that owns a texture, nullptr if the layer was removed meanwhile
+    int* streaming_rows(TiledTexture* texture, SparseIds*& ids) {
+        for (auto& world_layer : WorldLayers) {
+            if (world_layer.layer_texture != texture) continue;
+            ids = &world_layer.ids;
+            return &world_layer.rows_ready;
+        }
+        for (auto& political_layer : PoliticalLayers) {
+            if (political_layer.layer_texture != texture) continue;
+            ids = &political_layer.ids;
+            return &political_layer.rows_ready;
+        }
+        return nullptr;
+    }
+
+    // Political layers that are all there get their shadow once their world layer is complete too
+    void shade_streamed_layers() {
+        for (auto& political_layer : PoliticalLayers) {
+            if (political_layer.rows_ready != political_layer.layer_texture->h) continue;
+            if (political_layer.world_layer && political_layer.world_layer->rows_ready >= 0) continue;
+            political_layer.update_texture();
+            political_layer.rows_ready = -1;
+        }
+    }
+
+    void upload_loaded_band(LoadJob& job, LoadedBand& band) {
+        LoadRaster& raster = job.rasters[band.raster];
+        SparseIds* ids = nullptr;
+        int* rows_ready = streaming_rows(raster.texture, ids);
+
+        if (band.rows == 0) {
+            job.progress_done += uint64_t(raster.window.h - raster.rows_done);
+            if (band.failed) std::cerr << "Failed to read layer " << raster.layer_name << "\n";
+            if (!rows_ready) return;
+            // what never arrived is left empty, as the layer was created
+            *rows_ready = raster.type == SECTION_WORLD_LAYER ? -1 : raster.window.h;
+            shade_streamed_layers();
+            return;
+        }
+
+        job.progress_done += uint64_t(band.rows);
+        raster.rows_done = band.y0 + band.rows;
+        if (!rows_ready) return;
+        ids->write(0, band.y0, raster.window.w, band.rows, band.ids.data(), size_t(raster.window.w));
+        show_ids(raster.texture, *ids, layer_colors(idmap(raster.idmap)), SDL_Rect{0, band.y0, raster.window.w, band.rows});
+        *rows_ready = raster.rows_done;
+    }
+
+    // Builds what the loader has handed over so far, for at most budget_ms. Returns true when the
+    // world was replaced or cleared, the UI then picks up its size and drops its layer selection.
+    bool poll_load(double budget_ms = LOAD_FRAME_BUDGET_MS) {
+        if (!load_job) return false;
+        LoadJob& job = *load_job;
+        auto deadline = std::chrono::steady_clock::time_point::max();
+        if (std::isfinite(budget_ms)) deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(int64_t(budget_ms * 1000.0));
+
+        bool rebuilt = false;
+        if (!job.built) {
+            if (job.failed) {
+                if (job.worker.joinable()) job.worker.join();
+                std::cerr << "Damaged savefile " << job.name << ": " << job.error << "\n";
+                load_status = "Failed to load " + job.name + ": " + job.error;
+                load_failed = true;
+                load_job.reset();
+                return false;
+            }
+            if (!job.verified) return false;
+            build_loaded_world(job);
+            rebuilt = true;
+            if (!job.restore_savefile.empty() && !write_restored_save(job)) job.restore_savefile.clear();
+        }
+
+        // icons first, they are drawn over every raster
+        while (job.next_icon_layer < job.icon_layers.size()) {
+            const IconLayerSnapshot& snapshot = job.icon_layers[job.next_icon_layer];
+            size_t icons = snapshot.civilian_icons.size() + snapshot.military_icons.size() + snapshot.shapes.size();
+            size_t created_before = job.next_icon;
+            IconLayer* icon_layer = nullptr;
+            for (auto& layer : IconLayers) {
+                if (layer.layer_name == snapshot.layer_name) {
+                    icon_layer = &layer;
+                    break;
+                }
+            }
+            if (icon_layer && !add_icons(*icon_layer, snapshot, job.renderer, job.next_icon, deadline)) {
+                job.progress_done += job.next_icon - created_before;
+                return rebuilt;
             }
+            job.progress_done += icons - created_before;
+            if (icon_layer) icon_layer->saved_hash = hash_icon_layer(snapshot_icon_layer(*icon_layer));
+            job.next_icon_layer++;
+            job.next_icon = 0;
+        }
+
+        while (std::chrono::steady_clock::now() < deadline) {
+            LoadedBand band;
+            {
+                std::lock_guard<std::mutex> lock(job.mutex);
+                if (job.bands.empty()) break;
+                band = std::move(job.bands.front());
+                job.bands.pop_front();
+                job.queued_bytes -= band.ids.size();
+            }
+            job.queue_space.notify_one();
+            upload_loaded_band(job, band);
+        }
+
+        if (!job.decoded) return rebuilt;
+        {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            if (!job.bands.empty()) return rebuilt;
+        }
+        finish_load();
+        return rebuilt;
+    }
+
+    void finish_load() {
+        LoadJob& job = *load_job;
+        if (job.worker.joinable()) job.worker.join();
+
+        if (job.lazy) {
+            // Edits saved after this file was written
+            current_savefile = job.name;
+            current_save_id = read_save_id(job.source->reader(), job.header);
+            replay_journal(job.renderer);
+        } else if (!job.restore_savefile.empty()) {
+            // decoded from memory, the same bytes are in saves/ now and its journal is gone
+            current_savefile = job.restore_savefile;
+            current_save_id = read_save_id(job.source->reader(), job.header);
+        } else {
+            // Nothing on disk to append to, the next save starts a new local file
+            current_savefile.clear();
+            current_save_id = 0;
+        }
+
+        double load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - job.start_time).count();
+        double load_mb = job.source->size() / (1024.0 * 1024.0);
+        std::cout << "Debug::WorldLoaded::" << job.name << " " << load_mb << " MB in "
+                  << load_seconds * 1000.0 << " ms (" << load_mb / std::max(load_seconds, 1e-9) << " MB/s)" << std::endl;
+        load_status = "Loaded " + job.name;
+        load_failed = false;
+        load_job.reset();
+    }
+
+    void stop_load_worker() {
+        if (!load_job) return;
+        {
+            std::lock_guard<std::mutex> lock(load_job->mutex);
+            load_job->cancelled = true;
         }
+        load_job->queue_space.notify_all();
+        if (load_job->worker.joinable()) load_job->worker.join();
+    }
+
+    // Stops a running load. Returns true when the world it had started building was cleared,
+    // the world from before is already gone by then.
+    bool cancel_load() {
+        if (!load_job) return false;
+        bool built = load_job->built;
+        std::string name = load_job->name;
+        stop_load_worker();
+        load_job.reset();
+        load_status = "Cancelled loading " + name;
+        load_failed = false;
+        if (!built) return false;
+
+        clear_layers();
+        loaded_region = WorldRegion();
+        set_world_size(0, 0);
+        set_chunk_size(0, 0);
+        current_savefile.clear();
+        current_save_id = 0;
+        reset_save_baseline();
+        return true;
+    }
+
+    bool is_loading() const {
+        return load_job != nullptr;
+    }
+
+    // Negative while the savefile is still being checked and nothing is built yet
+    float load_progress() const {
+        if (!load_job) return 0.0f;
+        if (!load_job->built) return -1.0f;
+        if (load_job->progress_total == 0) return 1.0f;
+        return float(double(load_job->progress_done) / double(load_job->progress_total));
     }
 
     void discover_icons() {
@@ -1148,66 +4067,170 @@ class World{
     }
 
     void discover_ids() {
-        for (const auto &entry : std::filesystem::directory_iterator("ids")) {
-            if (!entry.is_regular_file())
-                continue;
-
-            std::ifstream file(entry.path());
-            if (!file.is_open()) {
-                std::cerr<<"Debug::OpenFile::Error::"<<entry.path().filename().string()<<std::endl;
-                continue;
-            }
-
-            std::string line;
-            IDmap temporary_map;
-            bool inSection = false;
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator("ids", error)) {
+            if (!entry.is_regular_file()) continue;
+            std::vector<PaletteFile> palettes;
+            read_palette_file(entry.path(), palettes);
+            apply_palettes(entry.path().filename().string(), palettes);
+        }
+        if (!ids_watcher.open("ids")) {
+            std::cerr << "Debug::IdsWatch::Error::ids" << std::endl;
+        }
+    }
 
-            while (std::getline(file, line)) {
-                if (line.rfind("...", 0) == 0) {
-                    if (line == "...;") {
-                        if (inSection) {
-                            temporary_map.buildFastLUT();
-                            IDmaps.push_back(temporary_map);
-                            temporary_map = IDmap();
-                            inSection = false;
-                        }
-                    } else {
-                        temporary_map = IDmap();
-                        temporary_map.name = line.substr(3);
-                        inSection = true;
-                    }
-                    continue;
+    // Takes the palettes read from one file in ids/. New ones become IDmaps, known ones get their
+    // new entries and only the layers using them are recolored. An IDmap stays when its palette
+    // is gone from the file, layers may still use it.
+    void apply_palettes(const std::string& filename, const std::vector<PaletteFile>& palettes) {
+        for (auto& palette : palettes) {
+            IDmapHandle handle = find_idmap_handle(palette.name);
+            if (handle == NO_IDMAP) {
+                IDmap temporary_map;
+                temporary_map.name = palette.name;
+                temporary_map.filename = filename;
+                for (auto& entry : palette.entries) {
+                    temporary_map.id_map[entry.id] = std::make_tuple(entry.r, entry.g, entry.b, entry.text);
                 }
+                temporary_map.buildFastLUT();
+                IDmaps.push_back(temporary_map);
+                continue;
+            }
 
-                if (!inSection)
-                    continue;
-
-                std::istringstream iss(line);
-                int id, r, g, b;
-                std::string text;
+            IDmap& id_map = IDmaps[handle];
+            Uint32 old_colors[256];
+            std::memcpy(old_colors, id_map.px_LUT, sizeof(old_colors));
+            id_map.filename = filename;
+            id_map.id_map.clear();
+            for (auto& entry : palette.entries) {
+                id_map.id_map[entry.id] = std::make_tuple(entry.r, entry.g, entry.b, entry.text);
+            }
+            id_map.buildFastLUT();
+            if (std::memcmp(old_colors, id_map.px_LUT, sizeof(old_colors)) != 0) recolor_idmap(handle);
+        }
 
-                if (!(iss >> id >> r >> g >> b)) {
-                    std::cerr << "Debug::MalformedLine => " << line << std::endl;
-                    continue;
-                }
+        for (auto& id_map : IDmaps) {
+            if (id_map.filename != filename) continue;
+            bool still_there = std::any_of(palettes.begin(), palettes.end(), [&](const PaletteFile& palette) { return palette.name == id_map.name; });
+            if (!still_there) std::cout << "Debug::IdsReload::Gone::" << id_map.name << "::Kept" << std::endl;
+        }
+    }
 
-                std::getline(iss, text);
-                if (!text.empty() && text[0] == ' ')
-                    text.erase(0, 1);
+    // Reloads the files in ids/ that changed on disk. Returns true if any did, colors looked up
+    // from the IDmaps before (BrushColor) are stale then.
+    bool poll_ids() {
+        std::vector<std::string> changed = ids_watcher.poll();
+        for (auto& name : changed) {
+            std::filesystem::path path = std::filesystem::path(ids_watcher.path()) / name;
+            std::vector<PaletteFile> palettes;
+            std::error_code error;
+            if (std::filesystem::is_regular_file(path, error)) read_palette_file(path, palettes);
+            std::cout << "Debug::IdsReload::" << name << "::" << palettes.size() << " palettes" << std::endl;
+            apply_palettes(name, palettes);
+        }
+        return !changed.empty();
+    }
 
-                temporary_map.id_map[id] = std::make_tuple(r, g, b, text);
+    // Palette of an IDmap for INDEX8 textures, one shared by all of its layers
+    SDL_Palette* idmap_palette(IDmapHandle handle) {
+        if (handle >= IDmaps.size()) return nullptr;
+        IDmap& id_map = IDmaps[handle];
+        if (!id_map.palette) {
+            id_map.palette = SDL_CreatePalette(256);
+            if (!id_map.palette) {
+                std::cerr << "Failed to create palette: " << SDL_GetError() << std::endl;
+                return nullptr;
             }
+            update_palette(id_map);
+        }
+        return id_map.palette;
+    }
 
-            if (inSection) {
-                temporary_map.buildFastLUT();
-                IDmaps.push_back(temporary_map);
+    static void update_palette(IDmap& id_map) {
+        if (!id_map.palette) return;
+        SDL_Color colors[256];
+        for (int i = 0; i < 256; i++) {
+            Uint32 color = id_map.px_LUT[i];
+            colors[i] = {Uint8(color >> 24), Uint8(color >> 16), Uint8(color >> 8), Uint8(color)};
+        }
+        SDL_SetPaletteColors(id_map.palette, colors, 0, 256);
+    }
+
+    bool renderer_draws_indexed(SDL_Renderer* renderer) {
+        if (indexed_textures < 0) {
+            indexed_textures = 0;
+            auto* formats = static_cast<const SDL_PixelFormat*>(
+                SDL_GetPointerProperty(SDL_GetRendererProperties(renderer), SDL_PROP_RENDERER_TEXTURE_FORMATS_POINTER, nullptr));
+            for (; formats && *formats != SDL_PIXELFORMAT_UNKNOWN; formats++) {
+                if (*formats == SDL_PIXELFORMAT_INDEX8) indexed_textures = 1;
             }
+            std::cout << "Debug::LayerTextures::" << (indexed_textures ? "INDEX8" : "RGBA8888") << std::endl;
+        }
+        return indexed_textures == 1;
+    }
+
+    // Texture of a layer of width x height, split into tiles of at most LAYER_TEXTURE_TILE_SIZE that
+    // are a whole number of unit_w x unit_h (the id blocks of the layer). The tiles only get their
+    // textures from show_ids, a new layer is all 255 and has none.
+    TiledTexture* create_tiled_texture(SDL_Renderer* renderer, int width, int height, int unit_w, int unit_h, IDmapHandle handle) {
+        auto* texture = new TiledTexture();
+        texture->w = width;
+        texture->h = height;
+        texture->tile_w = std::min(width, std::max(unit_w, LAYER_TEXTURE_TILE_SIZE / unit_w * unit_w));
+        texture->tile_h = std::min(height, std::max(unit_h, LAYER_TEXTURE_TILE_SIZE / unit_h * unit_h));
+        texture->tiles_x = (width + texture->tile_w - 1) / texture->tile_w;
+        texture->tiles_y = (height + texture->tile_h - 1) / texture->tile_h;
+        texture->renderer = renderer;
+        texture->palette = renderer_draws_indexed(renderer) ? idmap_palette(handle) : nullptr;
+        texture->format = texture->palette ? SDL_PIXELFORMAT_INDEX8 : SDL_PIXELFORMAT_RGBA8888;
+        texture->tiles.assign(size_t(texture->tiles_x) * texture->tiles_y, nullptr);
+        texture->solid_ids.assign(texture->tiles.size(), 0xFF);
+        return texture;
+    }
 
-            file.close();
+    // Shows the layers of an IDmap in its current px_LUT colors. Indexed layers get the new palette
+    // right away, RGBA ones are expanded again a block at a time as draw_all comes across them.
+    void recolor_idmap(IDmapHandle handle) {
+        if (handle >= IDmaps.size()) return;
+        auto start_time = std::chrono::steady_clock::now();
+        IDmap& id_map = IDmaps[handle];
+        update_palette(id_map);
+
+        int indexed = 0, stale = 0;
+        auto recolor = [&](TiledTexture* texture, std::vector<uint8_t>& stale_blocks) {
+            for (SDL_Texture* tile : texture->tiles) {
+                if (tile && tile->format == SDL_PIXELFORMAT_INDEX8) SDL_SetTexturePalette(tile, id_map.palette);
+            }
+            if (texture->format == SDL_PIXELFORMAT_INDEX8) {
+                indexed++;
+            } else {
+                stale_blocks.assign(1, 1); // sized to the layer by show_stale_blocks
+                stale++;
+            }
+        };
+        for (auto& world_layer : WorldLayers) {
+            if (world_layer.idmap == handle) recolor(world_layer.layer_texture, world_layer.stale_blocks);
         }
-        // for (auto& map : IDmaps) {
-        //     std::cout << "ID Map: " << map.name << std::endl;
-        // }
+        for (auto& political_layer : PoliticalLayers) {
+            if (political_layer.idmap == handle) recolor(political_layer.layer_texture, political_layer.stale_blocks);
+        }
+
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+        std::cout << "Debug::Recolor::" << id_map.name << "::" << indexed << " indexed, " << stale << " to expand in "
+                  << milliseconds << " ms" << std::endl;
+    }
+
+    // Gives a tile of an IDmap a new color, every layer using the IDmap shows it
+    void set_tile_color(IDmapHandle handle, int tile_id, int r, int g, int b) {
+        if (handle >= IDmaps.size()) return;
+        IDmap& id_map = IDmaps[handle];
+        auto it = id_map.id_map.find(tile_id);
+        if (it == id_map.id_map.end()) return;
+        std::get<0>(it->second) = r;
+        std::get<1>(it->second) = g;
+        std::get<2>(it->second) = b;
+        id_map.buildFastLUT();
+        recolor_idmap(handle);
     }
 
     WorldLayer& create_worldlayer(SDL_Renderer* renderer, const std::string& name_id, bool is_upper, std::string selected_idmap) {
@@ -1225,16 +4248,11 @@ class World{
             throw std::runtime_error("Layer not found");
         }
 
-        SDL_Texture *layer_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, width, height);
-
-        if (!layer_texture) {
-            SDL_Log("Failed to create texture '%s': %s", name_id.c_str(), SDL_GetError());
-            throw std::runtime_error("Layer not found");
-        }
-
-        SDL_SetTextureScaleMode(layer_texture, SDL_SCALEMODE_NEAREST);
-
         WorldLayer world_layer;
+        world_layer.ids.assign(save_tile_grid(width, height, is_upper), 0xFF);
+        const TileGrid& blocks = world_layer.ids.block_grid();
+        TiledTexture *layer_texture = create_tiled_texture(renderer, width, height, blocks.tile_w, blocks.tile_h, find_idmap_handle(selected_idmap));
+
         world_layer.is_upper = is_upper;
         if(name_id.length()!=0){
             world_layer.layer_name = name_id;
@@ -1243,10 +4261,11 @@ class World{
         }
         world_layer.layer_texture = layer_texture;
         world_layer.idmap_name = selected_idmap;
+        world_layer.idmap = find_idmap_handle(selected_idmap);
 
-        WorldLayers.push_back(world_layer);
-        std::cout<<"Debug::Created::WorldLayer::"<<world_layer.layer_name<<std::endl;
-        last_created_layer_name = world_layer.layer_name;
+        WorldLayers.push_back(std::move(world_layer));
+        std::cout<<"Debug::Created::WorldLayer::"<<WorldLayers.back().layer_name<<std::endl;
+        last_created_layer_name = WorldLayers.back().layer_name;
         return WorldLayers.back();
     }
 
@@ -1259,18 +4278,19 @@ class World{
             throw std::runtime_error("Layer not found");
         }
 
-        SDL_Texture *layer_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, width, height);
         SDL_Texture *shadow_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, width, height);
 
-        if (!layer_texture || !shadow_texture) {
+        if (!shadow_texture) {
             SDL_Log("Failed to create texture '%s': %s", name_id.c_str(), SDL_GetError());
             throw std::runtime_error("Layer not found");
         }
 
-        SDL_SetTextureScaleMode(layer_texture, SDL_SCALEMODE_NEAREST);
         SDL_SetTextureScaleMode(shadow_texture, SDL_SCALEMODE_NEAREST);
 
         PoliticalLayer political_layer;
+        political_layer.ids.assign(save_tile_grid(width, height, true), 0xFF);
+        const TileGrid& blocks = political_layer.ids.block_grid();
+        TiledTexture *layer_texture = create_tiled_texture(renderer, width, height, blocks.tile_w, blocks.tile_h, find_idmap_handle(selected_idmap));
         political_layer.world_layer = &linked_world_layer;
         if(name_id.length()!=0){
             political_layer.layer_name = name_id;
@@ -1280,10 +4300,11 @@ class World{
         political_layer.layer_texture = layer_texture;
         political_layer.shadow_texture = shadow_texture;
         political_layer.idmap_name = selected_idmap;
+        political_layer.idmap = find_idmap_handle(selected_idmap);
 
-        PoliticalLayers.push_back(political_layer);
-        std::cout<<"Debug::Created::PoliticalLayer::"<<political_layer.layer_name<<std::endl;
-        last_created_layer_name = political_layer.layer_name;
+        PoliticalLayers.push_back(std::move(political_layer));
+        std::cout<<"Debug::Created::PoliticalLayer::"<<PoliticalLayers.back().layer_name<<std::endl;
+        last_created_layer_name = PoliticalLayers.back().layer_name;
         return PoliticalLayers.back();
     }
 
@@ -1333,8 +4354,10 @@ class World{
     void remove_worldlayer(const std::string& name_id) {
         for (auto it = WorldLayers.begin(); it != WorldLayers.end(); ) {
             if (it->layer_name == name_id) {
-                it = WorldLayers.erase(it);
                 std::cout<<"Debug::Erased::Worldlayer::"<<it->layer_name<<std::endl;
+                destroy_tiled_texture(it->layer_texture);
+                it = WorldLayers.erase(it);
+                layer_generation++;
             } else {
                 std::cout<<"Debug::CheckingVector::CurrentVectorIterator::"<<it->layer_name<<std::endl;
                 ++it;
@@ -1414,25 +4437,84 @@ class World{
         }
     }
 
+    // Draws source (layer pixels, all of it if null) of a layer to output (all of the target if
+    // null), only the rows a streaming load has uploaded and only the tiles that are in view.
+    // Tiles without a texture are a rect in the lut color of their id.
+    static void render_loaded_rows(SDL_Renderer* renderer, const TiledTexture* texture, const Uint32* lut, int rows_ready, const SDL_FRect* source, const SDL_FRect* output) {
+        SDL_FRect loaded_source = source ? *source : SDL_FRect{0.0f, 0.0f, float(texture->w), float(texture->h)};
+        SDL_FRect loaded_output;
+        if (output) {
+            loaded_output = *output;
+        } else {
+            int target_w = 0, target_h = 0;
+            SDL_GetCurrentRenderOutputSize(renderer, &target_w, &target_h);
+            loaded_output = {0.0f, 0.0f, float(target_w), float(target_h)};
+        }
+        if (loaded_source.w <= 0.0f || loaded_source.h <= 0.0f) return;
+        if (rows_ready >= 0) {
+            float bottom = std::min(loaded_source.y + loaded_source.h, float(rows_ready));
+            if (bottom <= loaded_source.y) return;
+            loaded_output.h *= (bottom - loaded_source.y) / loaded_source.h;
+            loaded_source.h = bottom - loaded_source.y;
+        }
+
+        float scale_x = loaded_output.w / loaded_source.w;
+        float scale_y = loaded_output.h / loaded_source.h;
+        Uint8 r_, g_, b_, a_;
+        SDL_GetRenderDrawColor(renderer, &r_, &g_, &b_, &a_);
+        int tx0 = std::max(0, int(loaded_source.x) / texture->tile_w);
+        int ty0 = std::max(0, int(loaded_source.y) / texture->tile_h);
+        int tx1 = std::min(texture->tiles_x - 1, int(std::ceil(loaded_source.x + loaded_source.w)) / texture->tile_w);
+        int ty1 = std::min(texture->tiles_y - 1, int(std::ceil(loaded_source.y + loaded_source.h)) / texture->tile_h);
+        for (int ty = ty0; ty <= ty1; ty++) {
+            for (int tx = tx0; tx <= tx1; tx++) {
+                SDL_Rect tile = texture->tile_rect(tx, ty);
+                SDL_FRect tile_rect = {float(tile.x), float(tile.y), float(tile.w), float(tile.h)}, part;
+                if (!SDL_GetRectIntersectionFloat(&loaded_source, &tile_rect, &part)) continue;
+                SDL_FRect tile_source = {part.x - tile_rect.x, part.y - tile_rect.y, part.w, part.h};
+                SDL_FRect tile_output = {loaded_output.x + (part.x - loaded_source.x) * scale_x, loaded_output.y + (part.y - loaded_source.y) * scale_y,
+                                         part.w * scale_x, part.h * scale_y};
+                size_t index = size_t(ty) * texture->tiles_x + tx;
+                if (texture->tiles[index]) {
+                    SDL_RenderTexture(renderer, texture->tiles[index], &tile_source, &tile_output);
+                    continue;
+                }
+                Uint32 color = lut[texture->solid_ids[index]];
+                if ((color & 0xFF) == 0) continue; // 255 and ids the IDmap doesn't list
+                SDL_SetRenderDrawColor(renderer, Uint8(color >> 24), Uint8(color >> 16), Uint8(color >> 8), Uint8(color));
+                SDL_RenderFillRect(renderer, &tile_output);
+            }
+        }
+        SDL_SetRenderDrawColor(renderer, r_, g_, b_, a_);
+    }
+
     void draw_all(SDL_Renderer* renderer, SDL_FRect* input_viewport_lower, SDL_FRect* input_viewport_upper, SDL_FRect* output_viewport, float scale_offset, float pan_offset_x, float pan_offset_y) {
         for (auto& layer : WorldLayers) {
-            SDL_Texture* texture = layer.layer_texture;
+            TiledTexture* texture = layer.layer_texture;
 
-            if(layer.visible){
+            if(layer.visible && layer.loaded){
+                const Uint32* lut = layer_colors(idmap(layer.idmap));
+                if(!layer.stale_blocks.empty()){
+                    show_stale_blocks(texture, layer.ids, lut, layer.stale_blocks, layer.is_upper ? input_viewport_upper : input_viewport_lower);
+                }
                 if(layer.is_upper){
-                    SDL_RenderTexture(renderer, texture, input_viewport_upper, output_viewport);
+                    render_loaded_rows(renderer, texture, lut, layer.rows_ready, input_viewport_upper, output_viewport);
                 } else {
-                    SDL_RenderTexture(renderer, texture, input_viewport_lower, output_viewport);
+                    render_loaded_rows(renderer, texture, lut, layer.rows_ready, input_viewport_lower, output_viewport);
                 }
             }
         };
         for (auto& layer : PoliticalLayers) {
-            SDL_Texture* texture = layer.layer_texture;
+            TiledTexture* texture = layer.layer_texture;
             SDL_Texture* shadow_texture = layer.shadow_texture;
 
-            if(layer.visible){
-                SDL_RenderTexture(renderer, texture, input_viewport_upper, output_viewport);
-                SDL_RenderTexture(renderer, shadow_texture, input_viewport_upper, output_viewport);
+            if(layer.visible && layer.loaded){
+                const Uint32* lut = layer_colors(idmap(layer.idmap));
+                if(!layer.stale_blocks.empty()){
+                    show_stale_blocks(texture, layer.ids, lut, layer.stale_blocks, input_viewport_upper);
+                }
+                render_loaded_rows(renderer, texture, lut, layer.rows_ready, input_viewport_upper, output_viewport);
+                if(layer.rows_ready < 0) SDL_RenderTexture(renderer, shadow_texture, input_viewport_upper, output_viewport);
             }
         };
         for (auto& icon_layer : IconLayers) {
@@ -1531,9 +4613,6 @@ int main(int argc, char* args[]) {
     float main_scale = SDL_GetDisplayContentScale(SDL_GetPrimaryDisplay());
     // ---
 
-    Uint32* pixels;
-    int pitch;
-
     World world;
     world.discover_icons();
     world.discover_ids();
@@ -1613,6 +4692,9 @@ int main(int argc, char* args[]) {
     std::string selected_layer;
     std::string selected_linetool;
     std::string selected_idmap;
+    IDmapHandle selected_idmap_handle = NO_IDMAP; // selected_idmap resolved, set along with it
+    BrushColor brush_color;
+    PaintTarget paint_target;
     ImVec4 line_color;
     Shape temporary_shape;
     SDL_FPoint last_clicked_position = {0, 0};
@@ -1633,8 +4715,67 @@ int main(int argc, char* args[]) {
     int brush_radius = 10;
 
     SDL_FRect texture_rect = {0, 0, (float)world_width_lower, (float)world_height_lower};
+
+    // Previews of the savefiles in the world browser, read again when a file changes
+    struct SavePreviewEntry {
+        std::filesystem::file_time_type modified;
+        uintmax_t size = 0;
+        bool checked = false;
+        bool readable = false;
+        SavePreview preview;
+        SDL_Texture* thumbnail = nullptr;
+    };
+    std::unordered_map<std::string, SavePreviewEntry> save_previews;
+
+    // Listing of the save history, read again when something new is recorded
+    std::vector<SaveHistory::Snapshot> history_snapshots;
+    uint64_t history_revision = UINT64_MAX;
+    uint64_t history_stored_size = 0;
+
+    auto get_save_preview = [&](const std::string& filename) -> SavePreviewEntry& {
+        std::string full_filename = "saves/" + filename;
+        std::error_code error;
+        auto modified = std::filesystem::last_write_time(full_filename, error);
+        uintmax_t size = std::filesystem::file_size(full_filename, error);
+
+        SavePreviewEntry& entry = save_previews[filename];
+        if (entry.checked && entry.modified == modified && entry.size == size) return entry;
+
+        if (entry.thumbnail) SDL_DestroyTexture(entry.thumbnail);
+        entry = SavePreviewEntry();
+        entry.modified = modified;
+        entry.size = size;
+        entry.checked = true;
+        entry.readable = read_save_preview(full_filename, entry.preview);
+
+        const SavePreview& preview = entry.preview;
+        if (!preview.thumbnail.empty()) {
+            entry.thumbnail = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STATIC, preview.thumbnail_width, preview.thumbnail_height);
+            if (entry.thumbnail) {
+                SDL_UpdateTexture(entry.thumbnail, nullptr, preview.thumbnail.data(), preview.thumbnail_width * int(sizeof(Uint32)));
+                SDL_SetTextureScaleMode(entry.thumbnail, SDL_SCALEMODE_NEAREST);
+            }
+        }
+        return entry;
+    };
+
+    // Picks up the world dimensions after a world is created or loaded
+    auto sync_world_size = [&]() {
+        auto [world_width_lower_intermitent, world_height_lower_intermitent] = world.get_world_size(false);
+        auto [world_width_upper_intermitent, world_height_upper_intermitent] = world.get_world_size(true);
+        auto [chunk_width_intermitent, chunk_height_intermitent] = world.get_chunk_size();
+        world_width_lower = world_width_lower_intermitent;
+        world_height_lower = world_height_lower_intermitent;
+        world_width_upper = world_width_upper_intermitent;
+        world_height_upper = world_height_upper_intermitent;
+        chunk_width = chunk_width_intermitent;
+        chunk_height = chunk_height_intermitent;
+        texture_rect.x = float(world.loaded_region.x * chunk_width);
+        texture_rect.y = float(world.loaded_region.y * chunk_height);
+        texture_rect.w = world_width_lower;
+        texture_rect.h = world_height_lower;
+    };
     SDL_FRect intersect;
-    SDL_Rect lockRect;
     SDL_FRect viewport_output_bounded;
     SDL_FRect viewport_source_lower;
     SDL_FRect viewport_source_upper;
@@ -1646,6 +4787,11 @@ int main(int argc, char* args[]) {
 
     // Main loop
     bool quit = false;
+    bool quit_requested = false; // waiting for the quicksave before closing
+    bool quicksave_started = false;
+    bool quit_save_failed = false; // the save on quit failed, asks before closing without it
+    bool autosave_enabled = true; // journal the changes every AUTOSAVE_INTERVAL_MS
+    Uint64 last_autosave = SDL_GetTicks();
     SDL_Event e;
 
     while (!quit) {
@@ -1655,8 +4801,8 @@ int main(int argc, char* args[]) {
             // ---
 
             if (e.type == SDL_EVENT_QUIT || (e.type == SDL_EVENT_KEY_DOWN && e.key.scancode == SDL_SCANCODE_ESCAPE)) {
-                world.SaveWorld("quicksave.nw", false);
-                quit = true;
+                // the quicksave runs in the background too, the window closes once it is written
+                quit_requested = true;
             }
 
             // <float> mouse coordinates in screen space
@@ -1667,47 +4813,40 @@ int main(int argc, char* args[]) {
             mouse_worldX = static_cast<float>((mouse_screenX / zoom_offset) + pan_offset_x);
             mouse_worldY = static_cast<float>((mouse_screenY / zoom_offset) + pan_offset_y);
 
-            int textureX = static_cast<int>(std::floor(mouse_worldX));
-            int textureY = static_cast<int>(std::floor(mouse_worldY));
+            int worldX = static_cast<int>(std::floor(mouse_worldX));
+            int worldY = static_cast<int>(std::floor(mouse_worldY));
+
+            // textures only hold the loaded region, which starts at texture_rect.x/y in the world
+            int textureX = worldX - static_cast<int>(texture_rect.x);
+            int textureY = worldY - static_cast<int>(texture_rect.y);
 
-            int upper_textureX = static_cast<int>(mouse_worldX / chunk_width);
-            int upper_textureY = static_cast<int>(mouse_worldY / chunk_height);
+            int upper_textureX = static_cast<int>(mouse_worldX / chunk_width) - world.loaded_region.x;
+            int upper_textureY = static_cast<int>(mouse_worldY / chunk_height) - world.loaded_region.y;
 
             int paint_color_r, paint_color_g, paint_color_b;
-            std::string txt;
 
             // Handle mouse button down events
             if (e.type == SDL_EVENT_MOUSE_BUTTON_DOWN) {
                 int selected_layer_type;
 
+                paint_target = PaintTarget();
                 if(!selected_layer.empty()){
-                    selected_layer_type = world.get_layer_type(selected_layer);
+                    paint_target = world.find_paint_target(selected_layer);
+                    selected_layer_type = paint_target.layer_type;
                 }
 
                 if (const auto& io = ImGui::GetIO(); e.button.button == SDL_BUTTON_LEFT && !io.WantCaptureMouse) {
                     if(!selected_layer.empty()){
                         if(selected_layer_type==1){ // IS WORLD_LAYER
                             if(editing_map){
-                                WorldLayer& referenced_layer = world.get_worldlayer(selected_layer);
+                                WorldLayer& referenced_layer = *paint_target.world_layer;
+                                world.ensure_loaded(referenced_layer);
                                 bool is_upper_layer = referenced_layer.is_upper;
 
-                                IDmap* referenced_idmap = nullptr;
-                                for (auto& id_map : world.IDmaps) {
-                                    if (id_map.name == referenced_layer.idmap_name) {
-                                        if (selected_idmap == referenced_layer.idmap_name) {
-                                            referenced_idmap = &id_map;
-                                            break;
-                                        }
-                                    }
-                                }
-
-                                if (referenced_idmap) {
-                                    auto it = referenced_idmap->id_map.find(selected_tile_id);
-                                    if (it != referenced_idmap->id_map.end()) {
-                                        std::tie(paint_color_r, paint_color_g, paint_color_b, txt) = it->second;
-                                    } else {
-                                        std::cerr << "Tile ID " << selected_tile_id << " not found in ID map: " << referenced_layer.idmap_name << std::endl;
-                                    }
+                                // the tile picked in the toolkit, as long as it is from the layer's IDmap
+                                const IDmap* referenced_idmap = referenced_layer.idmap == selected_idmap_handle ? world.idmap(referenced_layer.idmap) : nullptr;
+                                if (referenced_idmap && !brush_color.update(*referenced_idmap, referenced_layer.idmap, selected_tile_id)) {
+                                    referenced_idmap = nullptr;
                                 }
 
                                 int locking_coordinate_x, locking_coordinate_y;
@@ -1728,59 +4867,26 @@ int main(int argc, char* args[]) {
                                 }
 
                                 if(referenced_idmap){
-                                    lockRect = { locking_coordinate_x - brush_radius, locking_coordinate_y - brush_radius, brush_radius*2+1, brush_radius*2+1 };
-                                    if(is_upper_layer){ClampRectToTexture(lockRect, world_width_upper, world_height_upper);}else{ClampRectToTexture(lockRect, world_width_lower, world_height_lower);};
-                                    SDL_Texture* referenced_texture = referenced_layer.layer_texture;
-                                    SDL_LockTexture(referenced_texture, &lockRect, (void**)&pixels, &pitch);
-                                    Uint32 color = (Uint32(paint_color_r) << 24) | (Uint32(paint_color_g) << 16) | (Uint32(paint_color_b) << 8) | Uint32(255);
-                                    if(brush_tool==0) PaintBrush(pixels, pitch, brush_radius, color);
-                                    if(brush_tool==1) {
-                                        Uint32 gotten_target_color = GetPixel(pixels, pitch, brush_radius, brush_radius);
-                                        PaintFill(pixels, pitch, brush_radius, gotten_target_color, color);
-                                    }
-
-                                    SDL_UnlockTexture(referenced_texture);
+                                    world.paint(referenced_layer, *referenced_idmap, brush_tool, locking_coordinate_x, locking_coordinate_y, brush_radius, uint8_t(brush_color.tile_id));
                                 } else {
                                     std::cout<<"Debug::ReferencedIDmap::Invalid/None"<<std::endl;
                                 }
                             }
                         } else if(selected_layer_type==3){
                             if(editing_map){
-                                PoliticalLayer referenced_layer = world.get_politicallayer(selected_layer);
-                                IDmap* referenced_idmap = nullptr;
-                                for (auto& id_map : world.IDmaps) {
-                                    if (id_map.name == referenced_layer.idmap_name) {
-                                        if (selected_idmap == referenced_layer.idmap_name) {
-                                            referenced_idmap = &id_map;
-                                            break;
-                                        }
-                                    }
-                                }
-                                if (referenced_idmap) {
-                                    auto it = referenced_idmap->id_map.find(selected_tile_id);
-                                    if (it != referenced_idmap->id_map.end()) {
-                                        std::tie(paint_color_r, paint_color_g, paint_color_b, txt) = it->second;
-                                    } else {
-                                        std::cerr << "Tile ID " << selected_tile_id << " not found in ID map: " << referenced_layer.idmap_name << std::endl;
-                                    }
+                                PoliticalLayer& referenced_layer = *paint_target.political_layer;
+                                world.ensure_loaded(referenced_layer);
+                                // the tile picked in the toolkit, as long as it is from the layer's IDmap
+                                const IDmap* referenced_idmap = referenced_layer.idmap == selected_idmap_handle ? world.idmap(referenced_layer.idmap) : nullptr;
+                                if (referenced_idmap && !brush_color.update(*referenced_idmap, referenced_layer.idmap, selected_tile_id)) {
+                                    referenced_idmap = nullptr;
                                 }
                                 if (upper_textureX < 0 || upper_textureX >= world_width_upper || upper_textureY < 0 || upper_textureY >= world_height_upper) {
                                     printf("Debug::LeftClick::OutOfBounds::(%d, %d)\n", upper_textureX, upper_textureY);
                                     continue;
                                 }
                                 if(referenced_idmap){
-                                    lockRect = { upper_textureX - brush_radius, upper_textureY - brush_radius, brush_radius*2+1, brush_radius*2+1 };
-                                    ClampRectToTexture(lockRect, upper_textureX, upper_textureY);
-                                    SDL_Texture* referenced_texture = referenced_layer.layer_texture;
-                                    SDL_LockTexture(referenced_texture, &lockRect, (void**)&pixels, &pitch);
-                                    Uint32 color = (Uint32(paint_color_r) << 24) | (Uint32(paint_color_g) << 16) | (Uint32(paint_color_b) << 8) | Uint32(255);
-                                    if(brush_tool==0) PaintBrush(pixels, pitch, brush_radius, color);
-                                    if(brush_tool==1) {
-                                        Uint32 gotten_target_color = GetPixel(pixels, pitch, brush_radius, brush_radius);
-                                        PaintFill(pixels, pitch, brush_radius, gotten_target_color, color);
-                                    }
-
-                                    SDL_UnlockTexture(referenced_texture);
+                                    world.paint(referenced_layer, *referenced_idmap, brush_tool, upper_textureX, upper_textureY, brush_radius, uint8_t(brush_color.tile_id));
                                 } else {
                                     std::cout<<"Debug::ReferencedIDmap::Invalid/None"<<std::endl;
                                 }
@@ -1828,7 +4934,7 @@ int main(int argc, char* args[]) {
                         // ---
                         for (auto& layer : world.GetIconLayers()) {
                             for (auto& CivilianLayerIcon : layer.IconsCivilian) {
-                                double distance = distanceSquared(CivilianLayerIcon.position.x, CivilianLayerIcon.position.y, textureX, textureY);
+                                double distance = distanceSquared(CivilianLayerIcon.position.x, CivilianLayerIcon.position.y, worldX, worldY);
                                 if(distance < MinDist){
                                     MinDist = distance;
                                     closest_civilian = &CivilianLayerIcon;
@@ -1836,7 +4942,7 @@ int main(int argc, char* args[]) {
                                 }
                             }
                             for (auto& MilitaryLayerIcon : layer.IconsMilitary) {
-                                double distance = distanceSquared(MilitaryLayerIcon.position.x, MilitaryLayerIcon.position.y, textureX, textureY);
+                                double distance = distanceSquared(MilitaryLayerIcon.position.x, MilitaryLayerIcon.position.y, worldX, worldY);
                                 if(distance < MinDist){
                                     MinDist = distance;
                                     closest_civilian = nullptr;
@@ -1884,21 +4990,11 @@ int main(int argc, char* args[]) {
                         if(selected_layer_type==2){
                             if(pressed_first_line){
                                 IconLayer& referenced_layer = world.get_iconlayer(selected_layer);
-                                IDmap* referenced_idmap = nullptr;
-                                for (auto& id_map : world.IDmaps) {
-                                    if (id_map.name == selected_idmap) {
-                                        referenced_idmap = &id_map;
-                                        break;
-                                    }
-                                }
-
-                                if (referenced_idmap) {
-                                    auto it = referenced_idmap->id_map.find(selected_tile_id);
-                                    if (it != referenced_idmap->id_map.end()) {
-                                        std::tie(paint_color_r, paint_color_g, paint_color_b, txt) = it->second;
-                                    } else {
-                                        std::cerr << "Tile ID " << selected_tile_id << " not found in ID map: " << selected_idmap << std::endl;
-                                    }
+                                const IDmap* referenced_idmap = world.idmap(selected_idmap_handle);
+                                if (referenced_idmap && brush_color.update(*referenced_idmap, selected_idmap_handle, selected_tile_id)) {
+                                    paint_color_r = int(brush_color.color >> 24);
+                                    paint_color_g = int((brush_color.color >> 16) & 0xFF);
+                                    paint_color_b = int((brush_color.color >> 8) & 0xFF);
                                 }
                                 referenced_layer.create_shape(temporary_shape, paint_color_r, paint_color_g, paint_color_b, 255);
                                 pressed_first_line = false;
@@ -1923,29 +5019,20 @@ int main(int argc, char* args[]) {
             if (e.type == SDL_EVENT_MOUSE_MOTION) {
                 if (const auto& io = ImGui::GetIO(); e.button.button == SDL_BUTTON_LEFT && !io.WantCaptureMouse) {
                     if(!selected_layer.empty()){
-                        int selected_layer_type = world.get_layer_type(selected_layer);
+                        if (paint_target.layer_type == 0 || paint_target.generation != world.layer_generation) {
+                            paint_target = world.find_paint_target(selected_layer);
+                        }
+                        int selected_layer_type = paint_target.layer_type;
                         if(selected_layer_type==1){ // IS WORLD_LAYER
                             if(editing_map){
-                                WorldLayer referenced_layer = world.get_worldlayer(selected_layer);
+                                WorldLayer& referenced_layer = *paint_target.world_layer;
+                                world.ensure_loaded(referenced_layer);
                                 bool is_upper_layer = referenced_layer.is_upper;
 
-                                IDmap* referenced_idmap = nullptr;
-                                for (auto& id_map : world.IDmaps) {
-                                    if (id_map.name == referenced_layer.idmap_name) {
-                                        if (selected_idmap == referenced_layer.idmap_name) {
-                                            referenced_idmap = &id_map;
-                                            break;
-                                        }
-                                    }
-                                }
-
-                                if (referenced_idmap) {
-                                    auto it = referenced_idmap->id_map.find(selected_tile_id);
-                                    if (it != referenced_idmap->id_map.end()) {
-                                        std::tie(paint_color_r, paint_color_g, paint_color_b, txt) = it->second;
-                                    } else {
-                                        std::cerr << "Tile ID " << selected_tile_id << " not found in ID map: " << referenced_layer.idmap_name << std::endl;
-                                    }
+                                // the tile picked in the toolkit, as long as it is from the layer's IDmap
+                                const IDmap* referenced_idmap = referenced_layer.idmap == selected_idmap_handle ? world.idmap(referenced_layer.idmap) : nullptr;
+                                if (referenced_idmap && !brush_color.update(*referenced_idmap, referenced_layer.idmap, selected_tile_id)) {
+                                    referenced_idmap = nullptr;
                                 }
 
                                 int locking_coordinate_x, locking_coordinate_y;
@@ -1966,59 +5053,26 @@ int main(int argc, char* args[]) {
                                 }
 
                                 if(referenced_idmap){
-                                    lockRect = { locking_coordinate_x - brush_radius, locking_coordinate_y - brush_radius, brush_radius*2+1, brush_radius*2+1 };
-                                    if(is_upper_layer){ClampRectToTexture(lockRect, world_width_upper, world_height_upper);}else{ClampRectToTexture(lockRect, world_width_lower, world_height_lower);};
-                                    SDL_Texture* referenced_texture = referenced_layer.layer_texture;
-                                    SDL_LockTexture(referenced_texture, &lockRect, (void**)&pixels, &pitch);
-                                    Uint32 color = (Uint32(paint_color_r) << 24) | (Uint32(paint_color_g) << 16) | (Uint32(paint_color_b) << 8) | Uint32(255);
-                                    if(brush_tool==0) PaintBrush(pixels, pitch, brush_radius, color);
-                                    if(brush_tool==1) {
-                                        Uint32 gotten_target_color = GetPixel(pixels, pitch, brush_radius, brush_radius);
-                                        PaintFill(pixels, pitch, brush_radius, gotten_target_color, color);
-                                    }
-
-                                    SDL_UnlockTexture(referenced_texture);
+                                    world.paint(referenced_layer, *referenced_idmap, brush_tool, locking_coordinate_x, locking_coordinate_y, brush_radius, uint8_t(brush_color.tile_id));
                                 } else {
                                     std::cout<<"Debug::ReferencedIDmap::Invalid/None "<<brush_tool<<std::endl;
                                 }
                             }
                         } else if(selected_layer_type==3){
                             if(editing_map){
-                                PoliticalLayer referenced_layer = world.get_politicallayer(selected_layer);
-                                IDmap* referenced_idmap = nullptr;
-                                for (auto& id_map : world.IDmaps) {
-                                    if (id_map.name == referenced_layer.idmap_name) {
-                                        if (selected_idmap == referenced_layer.idmap_name) {
-                                            referenced_idmap = &id_map;
-                                            break;
-                                        }
-                                    }
-                                }
-                                if (referenced_idmap) {
-                                    auto it = referenced_idmap->id_map.find(selected_tile_id);
-                                    if (it != referenced_idmap->id_map.end()) {
-                                        std::tie(paint_color_r, paint_color_g, paint_color_b, txt) = it->second;
-                                    } else {
-                                        std::cerr << "Tile ID " << selected_tile_id << " not found in ID map: " << referenced_layer.idmap_name << std::endl;
-                                    }
+                                PoliticalLayer& referenced_layer = *paint_target.political_layer;
+                                world.ensure_loaded(referenced_layer);
+                                // the tile picked in the toolkit, as long as it is from the layer's IDmap
+                                const IDmap* referenced_idmap = referenced_layer.idmap == selected_idmap_handle ? world.idmap(referenced_layer.idmap) : nullptr;
+                                if (referenced_idmap && !brush_color.update(*referenced_idmap, referenced_layer.idmap, selected_tile_id)) {
+                                    referenced_idmap = nullptr;
                                 }
                                 if (upper_textureX < 0 || upper_textureX >= world_width_upper || upper_textureY < 0 || upper_textureY >= world_height_upper) {
                                     printf("Debug::LeftClick::OutOfBounds::(%d, %d)\n", upper_textureX, upper_textureY);
                                     continue;
                                 }
                                 if(referenced_idmap){
-                                    lockRect = { upper_textureX - brush_radius, upper_textureY - brush_radius, brush_radius*2+1, brush_radius*2+1 };
-                                    ClampRectToTexture(lockRect, upper_textureX, upper_textureY);
-                                    SDL_Texture* referenced_texture = referenced_layer.layer_texture;
-                                    SDL_LockTexture(referenced_texture, &lockRect, (void**)&pixels, &pitch);
-                                    Uint32 color = (Uint32(paint_color_r) << 24) | (Uint32(paint_color_g) << 16) | (Uint32(paint_color_b) << 8) | Uint32(255);
-                                    if(brush_tool==0) PaintBrush(pixels, pitch, brush_radius, color);
-                                    if(brush_tool==1) {
-                                        Uint32 gotten_target_color = GetPixel(pixels, pitch, brush_radius, brush_radius);
-                                        PaintFill(pixels, pitch, brush_radius, gotten_target_color, color);
-                                    }
-
-                                    SDL_UnlockTexture(referenced_texture);
+                                    world.paint(referenced_layer, *referenced_idmap, brush_tool, upper_textureX, upper_textureY, brush_radius, uint8_t(brush_color.tile_id));
                                 } else {
                                     std::cout<<"Debug::ReferencedIDmap::Invalid/None"<<std::endl;
                                 }
@@ -2047,6 +5101,7 @@ int main(int argc, char* args[]) {
 
             // Handle mouse button up events
             if (e.type == SDL_EVENT_MOUSE_BUTTON_UP) {
+                paint_target = PaintTarget(); // the stroke ended, the next one resolves the layer again
                 // if (e.button.button == SDL_BUTTON_RIGHT) {
                 //     popup = false;
                 // }
@@ -2096,6 +5151,43 @@ int main(int argc, char* args[]) {
             }
         }
 
+        world.poll_save();
+        if (world.poll_ids()) brush_color = BrushColor();
+        if (world.poll_load()) {
+            selected_layer.clear();
+            sync_world_size();
+        }
+        if (autosave_enabled && !quit_requested && world.HasInitializedCheck() && SDL_GetTicks() - last_autosave >= AUTOSAVE_INTERVAL_MS) {
+            last_autosave = SDL_GetTicks();
+            world.SaveWorldIncremental();
+        }
+        if (quit_requested) {
+            // a world that is still coming in isn't worth a quicksave
+            if (world.cancel_load()) {
+                selected_layer.clear();
+                sync_world_size();
+            }
+            if (!world.loaded_region.empty()) {
+                // a region can't be written as a whole world, its changes go to the journal instead
+                if (!world.is_saving()) {
+                    world.SaveWorldIncremental();
+                    quit = !world.save_failed;
+                    quit_save_failed = world.save_failed;
+                }
+            } else if (!quicksave_started && !world.is_saving()) {
+                quicksave_started = world.SaveWorldAsync("quicksave.nw", false);
+                quit_save_failed = !quicksave_started;
+            } else if (quicksave_started && !world.is_saving()) {
+                quit = !world.save_failed;
+                quit_save_failed = world.save_failed;
+            }
+            if (quit_save_failed) {
+                // the window stays open until the user decides, the edits aren't anywhere else
+                quit_requested = false;
+                quicksave_started = false;
+            }
+        }
+
         // IMGUI
         ImGui_ImplSDLRenderer3_NewFrame();
         ImGui_ImplSDL3_NewFrame();
@@ -2113,6 +5205,24 @@ int main(int argc, char* args[]) {
             static char chunk_width_buffer[6] = "20";
             static char chunk_height_buffer[6] = "20";
 
+            static bool load_region = false;
+            static WorldRegion region_to_load = {0, 0, 64, 64};
+
+            if (world.is_loading()) {
+                ImGui::Separator();
+                ImGui::TextColored(ImVec4(0.3f, 1.0f, 0.3f, 1.0f), "World loading");
+                float load_progress = world.load_progress();
+                // a negative fraction makes the bar sweep while the savefile is checked
+                ImGui::ProgressBar(load_progress < 0.0f ? -1.0f * float(ImGui::GetTime()) : load_progress, ImVec2(-FLT_MIN, 0.0f), world.load_status.c_str());
+                if (ImGui::Button("Cancel loading") && world.cancel_load()) {
+                    selected_layer.clear();
+                    sync_world_size();
+                }
+                ImGui::Separator();
+            } else if (world.load_failed) {
+                ImGui::TextColored(error_color, "%s", world.load_status.c_str());
+            }
+
             if(!world.HasInitializedCheck()){
                 ImGui::Separator();
                 ImGui::TextColored(ImVec4(0.3f, 1.0f, 0.3f, 1.0f), "World creation");
@@ -2125,30 +5235,26 @@ int main(int argc, char* args[]) {
                 ImGui::InputText("chunk height", chunk_height_buffer, sizeof(chunk_height_buffer));
 
                 ImGui::Text("Will result in lower world size of %d %d", atoi(world_width_buffer)*atoi(chunk_width_buffer), atoi(world_height_buffer)*atoi(chunk_height_buffer));
-                if(atoi(world_width_buffer)*atoi(chunk_width_buffer)>=16384 || atoi(world_height_buffer)*atoi(chunk_height_buffer)>=16384){
-                    ImGui::TextColored(warning_color, "Warning! Max texture(layer) size is 16384, \nexpect a crash or buggy behaviour.");
-                    ImGui::TextColored(info_color, "Note: Expected to implement bigger worlds later.");
+                double lower_layer_mb = double(atoi(world_width_buffer)) * atoi(chunk_width_buffer) * atoi(world_height_buffer) * atoi(chunk_height_buffer) / (1024.0 * 1024.0);
+                if(lower_layer_mb >= 256.0){
+                    // ids plus a texture that is 1 (indexed) to 4 bytes per tile, only where they aren't all one id
+                    ImGui::TextColored(warning_color, "A lower layer painted all over takes %.0f to %.0f MB,\nareas of a single tile cost next to nothing.", lower_layer_mb * 2.0, lower_layer_mb * 5.0);
                 }
 
+                ImGui::BeginDisabled(world.is_loading());
                 if(ImGui::Button("Create world")){
+                    world.loaded_region = WorldRegion();
                     world.set_world_size(atoi(world_width_buffer), atoi(world_height_buffer));
                     world.set_chunk_size(atoi(chunk_width_buffer), atoi(chunk_height_buffer));
-                    auto [world_width_lower_intermitent, world_height_lower_intermitent] = world.get_world_size(false);
-                    auto [world_width_upper_intermitent, world_height_upper_intermitent] = world.get_world_size(true);
-                    auto [chunk_width_intermitent, chunk_height_intermitent] = world.get_chunk_size();
-                    world_width_lower = world_width_lower_intermitent;
-                    world_height_lower = world_height_lower_intermitent;
-                    world_width_upper = world_width_upper_intermitent;
-                    world_height_upper = world_height_upper_intermitent;
-                    chunk_width = chunk_width_intermitent;
-                    chunk_height = chunk_height_intermitent;
-                    texture_rect.w = world_width_lower;
-                    texture_rect.h = world_height_lower;
+                    sync_world_size();
                 }
+                ImGui::EndDisabled();
 
                 ImGui::Separator();
                 ImGui::TextColored(ImVec4(0.3f, 1.0f, 0.3f, 1.0f), "World selection");
 
+                // loading replaces layers a running save may still have to update
+                ImGui::BeginDisabled(world.is_saving() || world.is_loading());
                 if (ImGui::BeginListBox("##worldlist", ImVec2(-FLT_MIN, 10 * ImGui::GetTextLineHeightWithSpacing()))) {
                     std::vector<std::string> discovered_worlds = find_savefiles("saves/");
                     std::vector<std::string> discovered_worlds_internet = find_savefiles_internet();
@@ -2156,253 +5262,43 @@ int main(int argc, char* args[]) {
                         ImGui::TextColored(error_color, "No savefiles found in current directory.");
                     } else {
                         for (const auto& filename : discovered_worlds) {
+                            SavePreviewEntry& preview_entry = get_save_preview(filename);
+                            const SavePreview& preview = preview_entry.preview;
+                            if (preview_entry.thumbnail) {
+                                float thumbnail_height = 2 * ImGui::GetFrameHeightWithSpacing();
+                                float thumbnail_width = thumbnail_height * preview.thumbnail_width / preview.thumbnail_height;
+                                ImGui::Image((ImTextureID)(intptr_t)preview_entry.thumbnail, ImVec2(thumbnail_width, thumbnail_height));
+                                ImGui::SameLine();
+                            }
+                            ImGui::BeginGroup();
                             std::string button_filename = "local / " + filename;
-                            if(ImGui::Button(button_filename.c_str())){
-                                std::string full_filename = "saves/" + filename;
-                                std::ifstream in(full_filename, std::ios::binary);
-                                if (!in) {
-                                    std::cerr << "Failed to open file " << full_filename << "\n";
-                                    continue;
-                                }
-
-                                int32_t world_width_loaded, world_height_loaded, chunk_width_loaded, chunk_height_loaded;
-                                in.read(reinterpret_cast<char*>(&world_width_loaded), sizeof(world_width_loaded));
-                                in.read(reinterpret_cast<char*>(&world_height_loaded), sizeof(world_height_loaded));
-                                in.read(reinterpret_cast<char*>(&chunk_width_loaded), sizeof(chunk_width_loaded));
-                                in.read(reinterpret_cast<char*>(&chunk_height_loaded), sizeof(chunk_height_loaded));
-                                world.set_world_size(world_width_loaded, world_height_loaded);
-                                world.set_chunk_size(chunk_width_loaded, chunk_height_loaded);
-                                auto [world_width_lower_intermitent, world_height_lower_intermitent] = world.get_world_size(false);
-                                auto [world_width_upper_intermitent, world_height_upper_intermitent] = world.get_world_size(true);
-                                auto [chunk_width_intermitent, chunk_height_intermitent] = world.get_chunk_size();
-                                world_width_lower = world_width_lower_intermitent;
-                                world_height_lower = world_height_lower_intermitent;
-                                world_width_upper = world_width_upper_intermitent;
-                                world_height_upper = world_height_upper_intermitent;
-                                chunk_width = chunk_width_intermitent;
-                                chunk_height = chunk_height_intermitent;
-                                texture_rect.w = world_width_lower;
-                                texture_rect.h = world_height_lower;
-                                
-                                int32_t num_layers_world, num_layers_icon, num_layers_political;
-                                in.read(reinterpret_cast<char*>(&num_layers_world), sizeof(num_layers_world));
-                                in.read(reinterpret_cast<char*>(&num_layers_political), sizeof(num_layers_political));
-                                in.read(reinterpret_cast<char*>(&num_layers_icon), sizeof(num_layers_icon));
-
-                                std::cout << "Debug::Loading " << num_layers_world << " world layers\n";
-                                
-                                for (int i = 0; i < num_layers_world; i++) {
-                                    // Layer name
-                                    int32_t lnameLen;
-                                    in.read(reinterpret_cast<char*>(&lnameLen), sizeof(lnameLen));
-                                    std::string layer_name(lnameLen, '\0');
-                                    in.read(layer_name.data(), lnameLen);
-
-                                    // IDmap name
-                                    int32_t idnameLen;
-                                    in.read(reinterpret_cast<char*>(&idnameLen), sizeof(idnameLen));
-                                    std::string idmap_name(idnameLen, '\0');
-                                    in.read(idmap_name.data(), idnameLen);
-
-                                    // Dimensions
-                                    int32_t width, height;
-                                    in.read(reinterpret_cast<char*>(&width), sizeof(width));
-                                    in.read(reinterpret_cast<char*>(&height), sizeof(height));
-
-                                    // Upper flag
-                                    uint8_t isUpper;
-                                    in.read(reinterpret_cast<char*>(&isUpper), sizeof(isUpper));
-
-                                    std::cout << "Debug::LoadingLayer::" << layer_name 
-                                            << " (" << width << "x" << height << ") "
-                                            << "IDmap=" << idmap_name 
-                                            << " Upper=" << (int)isUpper << "\n";
-
-                                    WorldLayer loaded_layer = world.create_worldlayer(renderer, layer_name, isUpper, idmap_name);
-                                    IDmap* referenced_id_map = nullptr;
-                                    for (auto& id_map : world.IDmaps) {
-                                        if (id_map.name == idmap_name) {
-                                            referenced_id_map = &id_map;
-                                            break;
-                                        }
-                                    }
-                                    if (!referenced_id_map) {
-                                        std::cerr << "IDmap not found: " << idmap_name << "\n";
-                                        continue;
-                                    }
-
-                                    void* texPixels;
-                                    int pitch;
-                                    if (!SDL_LockTexture(loaded_layer.layer_texture, nullptr, &texPixels, &pitch)) {
-                                        std::cerr << "Failed to lock texture: " << SDL_GetError() << "\n";
-                                        continue;
-                                    }
-
-                                    Uint32* rowOut = reinterpret_cast<Uint32*>(texPixels);
-                                    std::vector<uint8_t> rowBuf(width);
-
-                                    for (int y = 0; y < height; y++) {
-                                        in.read(reinterpret_cast<char*>(rowBuf.data()), width);
-
-                                        for (int x = 0; x < width; x++) {
-                                            uint8_t idx = rowBuf[x];
-                                            rowOut[x] = referenced_id_map->px_LUT[idx];
-                                        }
-
-                                        rowOut = reinterpret_cast<Uint32*>(reinterpret_cast<uint8_t*>(rowOut) + pitch);
-                                    }
-
-                                    SDL_UnlockTexture(loaded_layer.layer_texture);
-                                }
-
-                                for (int i = 0; i < num_layers_political; i++) {
-                                    // Layer name
-                                    int32_t lnameLen;
-                                    in.read(reinterpret_cast<char*>(&lnameLen), sizeof(lnameLen));
-                                    std::string layer_name(lnameLen, '\0');
-                                    in.read(layer_name.data(), lnameLen);
-
-                                    // IDmap name
-                                    int32_t idnameLen;
-                                    in.read(reinterpret_cast<char*>(&idnameLen), sizeof(idnameLen));
-                                    std::string idmap_name(idnameLen, '\0');
-                                    in.read(idmap_name.data(), idnameLen);
-
-                                    int32_t lworldlayernameLen;
-                                    in.read(reinterpret_cast<char*>(&lworldlayernameLen), sizeof(lworldlayernameLen));
-                                    std::string world_layer_name(lworldlayernameLen, '\0');
-                                    in.read(world_layer_name.data(), lworldlayernameLen);
-                                    WorldLayer& linked_world_layer = world.get_worldlayer(world_layer_name);
-
-                                    // Dimensions
-                                    int32_t width, height;
-                                    in.read(reinterpret_cast<char*>(&width), sizeof(width));
-                                    in.read(reinterpret_cast<char*>(&height), sizeof(height));
-
-                                    std::cout << "Debug::LoadingLayer::" << layer_name 
-                                            << " (" << width << "x" << height << ") "
-                                            << "IDmap=" << idmap_name << "\n";
-
-                                    PoliticalLayer loaded_layer = world.create_politicallayer(renderer, layer_name, idmap_name, linked_world_layer);
-                                    loaded_layer.update_texture(world.IDmaps);
-                                    IDmap* referenced_id_map = nullptr;
-                                    for (auto& id_map : world.IDmaps) {
-                                        if (id_map.name == idmap_name) {
-                                            referenced_id_map = &id_map;
-                                            break;
-                                        }
-                                    }
-                                    if (!referenced_id_map) {
-                                        std::cerr << "IDmap not found: " << idmap_name << "\n";
-                                        continue;
-                                    }
-
-                                    void* texPixels;
-                                    int pitch;
-                                    if (!SDL_LockTexture(loaded_layer.layer_texture, nullptr, &texPixels, &pitch)) {
-                                        std::cerr << "Failed to lock texture: " << SDL_GetError() << "\n";
-                                        continue;
-                                    }
-
-                                    Uint32* rowOut = reinterpret_cast<Uint32*>(texPixels);
-                                    std::vector<uint8_t> rowBuf(width);
-
-                                    for (int y = 0; y < height; y++) {
-                                        in.read(reinterpret_cast<char*>(rowBuf.data()), width);
-
-                                        for (int x = 0; x < width; x++) {
-                                            uint8_t idx = rowBuf[x];
-                                            rowOut[x] = referenced_id_map->px_LUT[idx];
-                                        }
-
-                                        rowOut = reinterpret_cast<Uint32*>(reinterpret_cast<uint8_t*>(rowOut) + pitch);
-                                    }
-
-                                    SDL_UnlockTexture(loaded_layer.layer_texture);
+                            bool load_clicked = ImGui::Button(button_filename.c_str());
+                            if (!preview_entry.readable) {
+                                ImGui::TextColored(error_color, "Unsupported or damaged savefile");
+                            } else {
+                                const SaveHeader& header = preview.header;
+                                std::string details = std::to_string(header.world_width) + "x" + std::to_string(header.world_height) +
+                                                      " (chunks " + std::to_string(header.chunk_width) + "x" + std::to_string(header.chunk_height) + "), " +
+                                                      std::to_string(header.num_layers_world) + " world / " + std::to_string(header.num_layers_political) + " political / " +
+                                                      std::to_string(header.num_layers_icon) + " icon layers";
+                                std::time_t save_time = std::time_t(preview.save_time);
+                                std::tm* save_tm = preview.save_time != 0 ? std::localtime(&save_time) : nullptr;
+                                if (save_tm) {
+                                    char saved_at[32];
+                                    std::strftime(saved_at, sizeof(saved_at), "%Y-%m-%d %H:%M", save_tm);
+                                    details += ", " + std::to_string(preview.civilian_icons + preview.military_icons) + " icons, " +
+                                               std::to_string(preview.shapes) + " shapes, saved " + saved_at;
                                 }
-
-                                std::cout << "Debug::Loading " << num_layers_icon << " icon layers\n";
-                                
-                                for (int i = 0; i < num_layers_icon; i++) {
-                                    int32_t lnamelen;
-                                    in.read(reinterpret_cast<char*>(&lnamelen), sizeof(lnamelen));
-                                    std::string layer_name(lnamelen, '\0');
-                                    in.read(layer_name.data(), lnamelen);
-
-                                    int32_t num_civilian_icons, num_military_icons, num_shapes;
-                                    IconLayer& icon_layer = world.create_iconlayer(layer_name);
-
-                                    in.read(reinterpret_cast<char*>(&num_civilian_icons), sizeof(num_civilian_icons));
-                                    for (int j = 0; j < num_civilian_icons; j++) {
-                                        int32_t icon_id;
-                                        float pos_x, pos_y;
-                                        in.read(reinterpret_cast<char*>(&icon_id), sizeof(icon_id));
-                                        in.read(reinterpret_cast<char*>(&pos_x), sizeof(pos_x));
-                                        in.read(reinterpret_cast<char*>(&pos_y), sizeof(pos_y));
-
-                                        std::uint64_t description_size;
-                                        in.read(reinterpret_cast<char*>(&description_size), sizeof(description_size));
-
-                                        std::string description(description_size, '\0');
-                                        in.read(description.data(), description_size);
-                                        
-                                        icon_layer.create_civilian_icon(renderer, icon_id, pos_x, pos_y, world.CivilianIdMap, description);
-                                    }
-
-                                    in.read(reinterpret_cast<char*>(&num_military_icons), sizeof(num_military_icons));
-                                    for (int j = 0; j < num_military_icons; j++) {
-                                        int32_t icon_id, country_id, quality;
-                                        float pos_x, pos_y, angle;
-                                        in.read(reinterpret_cast<char*>(&icon_id), sizeof(icon_id));
-                                        in.read(reinterpret_cast<char*>(&angle), sizeof(angle));
-                                        in.read(reinterpret_cast<char*>(&country_id), sizeof(country_id));
-                                        in.read(reinterpret_cast<char*>(&quality), sizeof(quality));
-                                        in.read(reinterpret_cast<char*>(&pos_x), sizeof(pos_x));
-                                        in.read(reinterpret_cast<char*>(&pos_y), sizeof(pos_y));
-
-                                        std::uint64_t description_size;
-                                        in.read(reinterpret_cast<char*>(&description_size), sizeof(description_size));
-
-                                        std::string description(description_size, '\0');
-                                        in.read(description.data(), description_size);
-
-                                        icon_layer.create_military_icon(renderer, icon_id, pos_x, pos_y, world.MilitaryIdMap, description);
-                                        auto& created_icon = icon_layer.IconsMilitary.back();
-                                        created_icon.angle = angle;
-
-                                        int32_t num_decorators;
-                                        in.read(reinterpret_cast<char*>(&num_decorators), sizeof(num_decorators));
-                                        for (int k = 0; k < num_decorators; k++) {
-                                            int32_t decorator_id;
-                                            in.read(reinterpret_cast<char*>(&decorator_id), sizeof(decorator_id));
-                                            created_icon.add_decorator(renderer, decorator_id, world.DecoratorIdMap);
-                                        }
-                                    }
-
-                                    in.read(reinterpret_cast<char*>(&num_shapes), sizeof(num_shapes));
-                                    for(int j = 0; j<num_shapes; j++){
-                                        int8_t r, g, b, a;
-                                        in.read(reinterpret_cast<char*>(&r), sizeof(r));
-                                        in.read(reinterpret_cast<char*>(&g), sizeof(g));
-                                        in.read(reinterpret_cast<char*>(&b), sizeof(b));
-                                        in.read(reinterpret_cast<char*>(&a), sizeof(a));
-
-                                        int32_t num_points;
-                                        in.read(reinterpret_cast<char*>(&num_points), sizeof(num_points));
-
-                                        Shape loaded_shape;
-                                        for(int k = 0; k<num_points; k++){
-                                            float point_x, point_y;
-                                            in.read(reinterpret_cast<char*>(&point_x), sizeof(point_x));
-                                            in.read(reinterpret_cast<char*>(&point_y), sizeof(point_y));
-                                            SDL_FPoint point = {point_x, point_y};
-                                            loaded_shape.AddPoint(point);
-                                        }
-                                        icon_layer.create_shape(loaded_shape, r, g, b, a);
-                                    }
+                                ImGui::TextDisabled("%s", details.c_str());
+                            }
+                            ImGui::EndGroup();
+                            if(load_clicked){
+                                auto source = std::make_unique<FileSource>("saves/" + filename);
+                                if (!source->is_open()) {
+                                    std::cerr << "Failed to open file " << "saves/" + filename << "\n";
+                                    continue;
                                 }
-
-                                in.close();
+                                world.LoadWorldAsync(std::move(source), filename, renderer, load_region ? region_to_load : WorldRegion());
                             }
                         }
                     }
@@ -2413,276 +5309,84 @@ int main(int argc, char* args[]) {
                         for (const auto& filename : discovered_worlds_internet) {
                             std::string button_filename = "internet / " + filename;
                             if(ImGui::Button(button_filename.c_str())){
-                                std::string command = "AWSdownload.exe " + filename;
-                                int AWSdownload_exitcode = std::system(command.c_str());
-                                if (AWSdownload_exitcode == 0) {
-                                    std::cout << "AWSdownload completed successfully: " << AWSdownload_exitcode << std::endl;
-
-                                    std::ifstream in("saves/aws_temp_download.nw", std::ios::binary);
-                                    if (!in) {
-                                        std::cerr << "Failed to open downloaded file" << "\n";
-                                        continue;
-                                    }
-
-                                    int32_t world_width_loaded, world_height_loaded, chunk_width_loaded, chunk_height_loaded;
-                                    in.read(reinterpret_cast<char*>(&world_width_loaded), sizeof(world_width_loaded));
-                                    in.read(reinterpret_cast<char*>(&world_height_loaded), sizeof(world_height_loaded));
-                                    in.read(reinterpret_cast<char*>(&chunk_width_loaded), sizeof(chunk_width_loaded));
-                                    in.read(reinterpret_cast<char*>(&chunk_height_loaded), sizeof(chunk_height_loaded));
-                                    world.set_world_size(world_width_loaded, world_height_loaded);
-                                    world.set_chunk_size(chunk_width_loaded, chunk_height_loaded);
-                                    auto [world_width_lower_intermitent, world_height_lower_intermitent] = world.get_world_size(false);
-                                    auto [world_width_upper_intermitent, world_height_upper_intermitent] = world.get_world_size(true);
-                                    auto [chunk_width_intermitent, chunk_height_intermitent] = world.get_chunk_size();
-                                    world_width_lower = world_width_lower_intermitent;
-                                    world_height_lower = world_height_lower_intermitent;
-                                    world_width_upper = world_width_upper_intermitent;
-                                    world_height_upper = world_height_upper_intermitent;
-                                    chunk_width = chunk_width_intermitent;
-                                    chunk_height = chunk_height_intermitent;
-                                    texture_rect.w = world_width_lower;
-                                    texture_rect.h = world_height_lower;
-                                    
-                                    int32_t num_layers_world, num_layers_icon, num_layers_political;
-                                    in.read(reinterpret_cast<char*>(&num_layers_world), sizeof(num_layers_world));
-                                    in.read(reinterpret_cast<char*>(&num_layers_political), sizeof(num_layers_political));
-                                    in.read(reinterpret_cast<char*>(&num_layers_icon), sizeof(num_layers_icon));
-
-                                    std::cout << "Debug::Loading " << num_layers_world << " world layers\n";
-                                    
-                                    for (int i = 0; i < num_layers_world; i++) {
-                                        // Layer name
-                                        int32_t lnameLen;
-                                        in.read(reinterpret_cast<char*>(&lnameLen), sizeof(lnameLen));
-                                        std::string layer_name(lnameLen, '\0');
-                                        in.read(layer_name.data(), lnameLen);
-
-                                        // IDmap name
-                                        int32_t idnameLen;
-                                        in.read(reinterpret_cast<char*>(&idnameLen), sizeof(idnameLen));
-                                        std::string idmap_name(idnameLen, '\0');
-                                        in.read(idmap_name.data(), idnameLen);
-
-                                        // Dimensions
-                                        int32_t width, height;
-                                        in.read(reinterpret_cast<char*>(&width), sizeof(width));
-                                        in.read(reinterpret_cast<char*>(&height), sizeof(height));
-
-                                        // Upper flag
-                                        uint8_t isUpper;
-                                        in.read(reinterpret_cast<char*>(&isUpper), sizeof(isUpper));
-
-                                        std::cout << "Debug::LoadingLayer::" << layer_name 
-                                                << " (" << width << "x" << height << ") "
-                                                << "IDmap=" << idmap_name 
-                                                << " Upper=" << (int)isUpper << "\n";
-
-                                        WorldLayer loaded_layer = world.create_worldlayer(renderer, layer_name, isUpper, idmap_name);
-                                        IDmap* referenced_id_map = nullptr;
-                                        for (auto& id_map : world.IDmaps) {
-                                            if (id_map.name == idmap_name) {
-                                                referenced_id_map = &id_map;
-                                                break;
-                                            }
-                                        }
-                                        if (!referenced_id_map) {
-                                            std::cerr << "IDmap not found: " << idmap_name << "\n";
-                                            continue;
-                                        }
-
-                                        void* texPixels;
-                                        int pitch;
-                                        if (!SDL_LockTexture(loaded_layer.layer_texture, nullptr, &texPixels, &pitch)) {
-                                            std::cerr << "Failed to lock texture: " << SDL_GetError() << "\n";
-                                            continue;
-                                        }
-
-                                        Uint32* rowOut = reinterpret_cast<Uint32*>(texPixels);
-                                        std::vector<uint8_t> rowBuf(width);
-
-                                        for (int y = 0; y < height; y++) {
-                                            in.read(reinterpret_cast<char*>(rowBuf.data()), width);
-
-                                            for (int x = 0; x < width; x++) {
-                                                uint8_t idx = rowBuf[x];
-                                                rowOut[x] = referenced_id_map->px_LUT[idx];
-                                            }
-
-                                            rowOut = reinterpret_cast<Uint32*>(reinterpret_cast<uint8_t*>(rowOut) + pitch);
-                                        }
-
-                                        SDL_UnlockTexture(loaded_layer.layer_texture);
-                                    }
-
-                                    for (int i = 0; i < num_layers_political; i++) {
-                                        // Layer name
-                                        int32_t lnameLen;
-                                        in.read(reinterpret_cast<char*>(&lnameLen), sizeof(lnameLen));
-                                        std::string layer_name(lnameLen, '\0');
-                                        in.read(layer_name.data(), lnameLen);
-
-                                        // IDmap name
-                                        int32_t idnameLen;
-                                        in.read(reinterpret_cast<char*>(&idnameLen), sizeof(idnameLen));
-                                        std::string idmap_name(idnameLen, '\0');
-                                        in.read(idmap_name.data(), idnameLen);
-
-                                        int32_t lworldlayernameLen;
-                                        in.read(reinterpret_cast<char*>(&lworldlayernameLen), sizeof(lworldlayernameLen));
-                                        std::string world_layer_name(lworldlayernameLen, '\0');
-                                        in.read(world_layer_name.data(), lworldlayernameLen);
-                                        WorldLayer& linked_world_layer = world.get_worldlayer(world_layer_name);
-
-                                        // Dimensions
-                                        int32_t width, height;
-                                        in.read(reinterpret_cast<char*>(&width), sizeof(width));
-                                        in.read(reinterpret_cast<char*>(&height), sizeof(height));
-
-                                        std::cout << "Debug::LoadingLayer::" << layer_name 
-                                                << " (" << width << "x" << height << ") "
-                                                << "IDmap=" << idmap_name << "\n";
-
-                                        PoliticalLayer loaded_layer = world.create_politicallayer(renderer, layer_name, idmap_name, linked_world_layer);
-                                        loaded_layer.update_texture(world.IDmaps);
-                                        IDmap* referenced_id_map = nullptr;
-                                        for (auto& id_map : world.IDmaps) {
-                                            if (id_map.name == idmap_name) {
-                                                referenced_id_map = &id_map;
-                                                break;
-                                            }
-                                        }
-                                        if (!referenced_id_map) {
-                                            std::cerr << "IDmap not found: " << idmap_name << "\n";
-                                            continue;
-                                        }
+                                std::vector<uint8_t> download;
+                                if (!fetch_shared_savefile(filename, download)) continue;
 
-                                        void* texPixels;
-                                        int pitch;
-                                        if (!SDL_LockTexture(loaded_layer.layer_texture, nullptr, &texPixels, &pitch)) {
-                                            std::cerr << "Failed to lock texture: " << SDL_GetError() << "\n";
-                                            continue;
-                                        }
-
-                                        Uint32* rowOut = reinterpret_cast<Uint32*>(texPixels);
-                                        std::vector<uint8_t> rowBuf(width);
-
-                                        for (int y = 0; y < height; y++) {
-                                            in.read(reinterpret_cast<char*>(rowBuf.data()), width);
-
-                                            for (int x = 0; x < width; x++) {
-                                                uint8_t idx = rowBuf[x];
-                                                rowOut[x] = referenced_id_map->px_LUT[idx];
-                                            }
-
-                                            rowOut = reinterpret_cast<Uint32*>(reinterpret_cast<uint8_t*>(rowOut) + pitch);
-                                        }
-
-                                        SDL_UnlockTexture(loaded_layer.layer_texture);
-                                    }
-
-                                    std::cout << "Debug::Loading " << num_layers_icon << " icon layers\n";
-                                    
-                                    for (int i = 0; i < num_layers_icon; i++) {
-                                        int32_t lnamelen;
-                                        in.read(reinterpret_cast<char*>(&lnamelen), sizeof(lnamelen));
-                                        std::string layer_name(lnamelen, '\0');
-                                        in.read(layer_name.data(), lnamelen);
-
-                                        int32_t num_civilian_icons, num_military_icons, num_shapes;
-                                        IconLayer& icon_layer = world.create_iconlayer(layer_name);
-
-                                        in.read(reinterpret_cast<char*>(&num_civilian_icons), sizeof(num_civilian_icons));
-                                        for (int j = 0; j < num_civilian_icons; j++) {
-                                            int32_t icon_id;
-                                            float pos_x, pos_y;
-                                            in.read(reinterpret_cast<char*>(&icon_id), sizeof(icon_id));
-                                            in.read(reinterpret_cast<char*>(&pos_x), sizeof(pos_x));
-                                            in.read(reinterpret_cast<char*>(&pos_y), sizeof(pos_y));
-
-                                            std::uint64_t description_size;
-                                            in.read(reinterpret_cast<char*>(&description_size), sizeof(description_size));
-
-                                            std::string description(description_size, '\0');
-                                            in.read(description.data(), description_size);
-                                            
-                                            icon_layer.create_civilian_icon(renderer, icon_id, pos_x, pos_y, world.CivilianIdMap, description);
-                                        }
-
-                                        in.read(reinterpret_cast<char*>(&num_military_icons), sizeof(num_military_icons));
-                                        for (int j = 0; j < num_military_icons; j++) {
-                                            int32_t icon_id, country_id, quality;
-                                            float pos_x, pos_y, angle;
-                                            in.read(reinterpret_cast<char*>(&icon_id), sizeof(icon_id));
-                                            in.read(reinterpret_cast<char*>(&angle), sizeof(angle));
-                                            in.read(reinterpret_cast<char*>(&country_id), sizeof(country_id));
-                                            in.read(reinterpret_cast<char*>(&quality), sizeof(quality));
-                                            in.read(reinterpret_cast<char*>(&pos_x), sizeof(pos_x));
-                                            in.read(reinterpret_cast<char*>(&pos_y), sizeof(pos_y));
-
-                                            std::uint64_t description_size;
-                                            in.read(reinterpret_cast<char*>(&description_size), sizeof(description_size));
-
-                                            std::string description(description_size, '\0');
-                                            in.read(description.data(), description_size);
-                                            
-                                            icon_layer.create_military_icon(renderer, icon_id, pos_x, pos_y, world.MilitaryIdMap, description);
-                                            auto& created_icon = icon_layer.IconsMilitary.back();
-                                            created_icon.angle = angle;
-
-                                            int32_t num_decorators;
-                                            in.read(reinterpret_cast<char*>(&num_decorators), sizeof(num_decorators));
-                                            for (int k = 0; k < num_decorators; k++) {
-                                                int32_t decorator_id;
-                                                in.read(reinterpret_cast<char*>(&decorator_id), sizeof(decorator_id));
-                                                created_icon.add_decorator(renderer, decorator_id, world.DecoratorIdMap);
-                                            }
-                                        }
-
-                                        in.read(reinterpret_cast<char*>(&num_shapes), sizeof(num_shapes));
-                                        for(int j = 0; j<num_shapes; j++){
-                                            int8_t r, g, b, a;
-                                            in.read(reinterpret_cast<char*>(&r), sizeof(r));
-                                            in.read(reinterpret_cast<char*>(&g), sizeof(g));
-                                            in.read(reinterpret_cast<char*>(&b), sizeof(b));
-                                            in.read(reinterpret_cast<char*>(&a), sizeof(a));
-
-                                            int32_t num_points;
-                                            in.read(reinterpret_cast<char*>(&num_points), sizeof(num_points));
-
-                                            Shape loaded_shape;
-                                            for(int k = 0; k<num_points; k++){
-                                                float point_x, point_y;
-                                                in.read(reinterpret_cast<char*>(&point_x), sizeof(point_x));
-                                                in.read(reinterpret_cast<char*>(&point_y), sizeof(point_y));
-                                                SDL_FPoint point = {point_x, point_y};
-                                                loaded_shape.AddPoint(point);
-                                            }
-                                            icon_layer.create_shape(loaded_shape, r, g, b, a);
-                                        }
-                                    }
-
-                                    in.close();
-                                    
-                                    int status = std::remove("saves/aws_temp_download.nw");
-                                    if (status != 0) {
-                                        perror("Error deleting temporary savefile :(");
-                                    }
-                                    else {
-                                        std::cout << "Temporary savefile successfully deleted" << std::endl;
-                                    }
-                                } else {
-                                    std::cout << "AWSdownload failed with exit code: " << AWSdownload_exitcode << std::endl;
-                                }
+                                world.LoadWorldAsync(std::make_unique<MemorySource>(std::move(download)), filename, renderer, load_region ? region_to_load : WorldRegion());
                             }
                         }
                     }
 
                     ImGui::EndListBox();
                 }
+                ImGui::EndDisabled();
+                ImGui::Checkbox("Verify savefiles before loading", &VERIFY_SAVEFILES);
+                if(ENABLE_TIPS){
+                    ImGui::SameLine();
+                    HelpMarker("Checks every layer of a local savefile against the checksums stored with it before loading.\nDownloaded savefiles are always checked.");
+                }
+                ImGui::Checkbox("Load only a region", &load_region);
+                if(ENABLE_TIPS){
+                    ImGui::SameLine();
+                    HelpMarker("Reads only a rectangle of the world, in chunks, and the icons and shapes in and around it.\nIt is widened to multiples of 8 chunks.\nChanges to a region are saved to the journal of its savefile, a full save needs the whole world.");
+                }
+                if (load_region) {
+                    ImGui::InputInt("region x", &region_to_load.x);
+                    ImGui::InputInt("region y", &region_to_load.y);
+                    ImGui::InputInt("region width", &region_to_load.width);
+                    ImGui::InputInt("region height", &region_to_load.height);
+                }
 
                 ImGui::Separator();
             }
 
+            ImGui::TextColored(ImVec4(0.3f, 1.0f, 0.3f, 1.0f), "Save history");
+            ImGui::Checkbox("Keep save history", &KEEP_SAVE_HISTORY);
+            if(ENABLE_TIPS){
+                ImGui::SameLine();
+                HelpMarker("Every full save is also kept in saves/history/.\nLayers and tiles that didn't change between saves are stored once.\nRestoring puts the save back in saves/ and loads it, the file it replaces is kept too.");
+            }
+            if (history_revision != save_history().revision && !world.is_saving()) {
+                history_revision = save_history().revision;
+                history_snapshots = save_history().list();
+                history_stored_size = save_history().stored_size();
+            }
+            uint64_t history_saves_size = 0;
+            for (auto& snapshot : history_snapshots) history_saves_size += snapshot.size;
+            ImGui::Text("%zu saves (%.1f MB) stored in %.1f MB", history_snapshots.size(), history_saves_size / (1024.0 * 1024.0), history_stored_size / (1024.0 * 1024.0));
+
+            // restoring loads a world, the same as picking one from the list
+            ImGui::BeginDisabled(world.is_saving() || world.is_loading());
+            if (ImGui::Button("Add savefiles to history")) {
+                for (const auto& filename : find_savefiles("saves/")) {
+                    SavePreview preview;
+                    FileSource source("saves/" + filename);
+                    if (!source.is_open()) continue;
+                    int64_t save_time = read_save_preview("saves/" + filename, preview) && preview.save_time != 0 ? preview.save_time : int64_t(std::time(nullptr));
+                    save_history().record(filename, source.data(), source.size(), save_time);
+                }
+            }
+            if (!history_snapshots.empty() && ImGui::BeginListBox("##historylist", ImVec2(-FLT_MIN, 6 * ImGui::GetTextLineHeightWithSpacing()))) {
+                for (size_t i = 0; i < history_snapshots.size(); i++) {
+                    const SaveHistory::Snapshot& snapshot = history_snapshots[i];
+                    std::time_t save_time = std::time_t(snapshot.save_time);
+                    std::tm* save_tm = std::localtime(&save_time);
+                    char saved_at[32] = "?";
+                    if (save_tm) std::strftime(saved_at, sizeof(saved_at), "%Y-%m-%d %H:%M:%S", save_tm);
+
+                    ImGui::PushID(int(i));
+                    if (ImGui::SmallButton("Restore")) {
+                        world.RestoreFromHistory(snapshot, renderer);
+                    }
+                    ImGui::PopID();
+                    ImGui::SameLine();
+                    ImGui::Text("%s  %s  %.1f MB", snapshot.savefile.c_str(), saved_at, snapshot.size / (1024.0 * 1024.0));
+                }
+                ImGui::EndListBox();
+            }
+            ImGui::EndDisabled();
+            ImGui::Separator();
+
             if(ENABLE_TIPS==true){
                 ImGui::TextColored(warning_color, "Disable tips?");
                 ImGui::SameLine();
@@ -2768,6 +5472,7 @@ int main(int argc, char* args[]) {
                         for (const auto& idmap : world.IDmaps) {
                             if (ImGui::Selectable(idmap.name.c_str(), selected_idmap == idmap.name)) {
                                 selected_idmap = idmap.name;
+                                selected_idmap_handle = world.find_idmap_handle(idmap.name);
                                 std::cout << "Debug::SelectedIDmap::" << selected_idmap << std::endl;
                             }
                         }
@@ -2825,8 +5530,7 @@ int main(int argc, char* args[]) {
                         } else {
                             WorldLayer& referenced_layer = world.get_worldlayer(selected_layer);
                             PoliticalLayer& returned_layer = world.create_politicallayer(renderer,buffer,selected_idmap,referenced_layer);
-                            returned_layer.bake_texture(world.IDmaps);
-                            returned_layer.update_texture(world.IDmaps);
+                            returned_layer.update_texture();
                         }
                         ImGui::CloseCurrentPopup();
                     }
@@ -2852,6 +5556,7 @@ int main(int argc, char* args[]) {
                         for (const auto& idmap : world.IDmaps) {
                             if (ImGui::Selectable(idmap.name.c_str(), selected_idmap == idmap.name)) {
                                 selected_idmap = idmap.name;
+                                selected_idmap_handle = world.find_idmap_handle(idmap.name);
                                 std::cout << "Debug::SelectedIDmap::" << selected_idmap << std::endl;
                             }
                         }
@@ -2920,7 +5625,7 @@ int main(int argc, char* args[]) {
                                 world.toggle_visibility_layer(layer_name);
                                 // Make a non-const reference to call non-const member function
                                 PoliticalLayer& nonconst_layer = const_cast<PoliticalLayer&>(*it);
-                                nonconst_layer.update_texture(world.IDmaps);
+                                nonconst_layer.update_texture();
                                 std::cout << "Debug::ToggledVisibility::PoliticalLayer::" << layer_name << std::endl;
                             }
                             ImGui::SameLine();
@@ -3034,9 +5739,39 @@ int main(int argc, char* args[]) {
                 ImGui::Separator();
                 ImGui::TextColored(ImVec4(0.3f, 1.0f, 0.3f, 1.0f), "World saving");
 
+                if (world.is_saving()) {
+                    ImGui::ProgressBar(world.save_progress(), ImVec2(-FLT_MIN, 0.0f), world.save_status.c_str());
+                } else if (!world.save_status.empty()) {
+                    ImGui::TextColored(world.save_failed ? error_color : info_color, "%s", world.save_status.c_str());
+                }
+
+                if (!world.loaded_region.empty()) {
+                    const WorldRegion& region = world.loaded_region;
+                    ImGui::TextColored(info_color, "Region %d,%d %dx%d of a %dx%d world is loaded", region.x, region.y, region.width, region.height,
+                                       world.FULL_WORLD_WIDTH, world.FULL_WORLD_HEIGHT);
+                }
+                ImGui::BeginDisabled(!world.loaded_region.empty());
                 if(ImGui::Button("Save World")){
                     ImGui::OpenPopup("SaveWorldModal");
                 }
+                ImGui::EndDisabled();
+                ImGui::SameLine();
+                ImGui::BeginDisabled(world.is_saving() || world.is_loading());
+                if(ImGui::Button("Save Changes")){
+                    world.SaveWorldIncremental();
+                    last_autosave = SDL_GetTicks();
+                }
+                ImGui::EndDisabled();
+                if(ENABLE_TIPS){
+                    ImGui::SameLine();
+                    HelpMarker("Appends only what changed since the last save to a journal next to the savefile.\nThe journal is folded into a full save once it gets big.");
+                }
+                ImGui::Checkbox("Autosave every minute", &autosave_enabled);
+                ImGui::Checkbox("Exact icon positions", &LOSSLESS_ICON_POSITIONS);
+                if(ENABLE_TIPS){
+                    ImGui::SameLine();
+                    HelpMarker("Saves icon and shape positions as exact floats.\nOtherwise they are rounded to 1/16 of a pixel, which makes icon layers several times smaller.");
+                }
 
                 ImVec2 center = ImGui::GetMainViewport()->GetCenter();
                 ImGui::SetNextWindowPos(center, ImGuiCond_Appearing, ImVec2(0.5f, 0.5f));
@@ -3053,10 +5788,11 @@ int main(int argc, char* args[]) {
                     }
 
                     ImGui::Separator();
+                    ImGui::BeginDisabled(world.is_saving() || world.is_loading());
                     if(ImGui::Button("Save to File"))
                     {
                         std::string filename = std::string(buffer) + ".nw";
-                        world.SaveWorld(filename, false);
+                        world.SaveWorldAsync(filename, false);
                         
                     ImGui::CloseCurrentPopup();
                     }
@@ -3067,11 +5803,12 @@ int main(int argc, char* args[]) {
                         if(ImGui::Button("Save & Upload"))
                         {
                             std::string filename = std::string(buffer) + ".nw";
-                            world.SaveWorld(filename, true);
+                            world.SaveWorldAsync(filename, true);
 
                         ImGui::CloseCurrentPopup();
                         }
                     }
+                    ImGui::EndDisabled();
 
                     ImGui::SameLine();
                     if (ImGui::Button("Close")) {
@@ -3083,6 +5820,27 @@ int main(int argc, char* args[]) {
 
             ImGui::End();
         }
+
+        if (quit_save_failed) {
+            ImGui::OpenPopup("QuitUnsavedModal");
+            quit_save_failed = false;
+        }
+        ImGui::SetNextWindowPos(ImGui::GetMainViewport()->GetCenter(), ImGuiCond_Appearing, ImVec2(0.5f, 0.5f));
+        if (ImGui::BeginPopupModal("QuitUnsavedModal", NULL, ImGuiWindowFlags_AlwaysAutoResize))
+        {
+            ImGui::TextColored(error_color, "The world couldn't be saved before closing:");
+            ImGui::TextUnformatted(world.save_status.empty() ? "Failed to save" : world.save_status.c_str());
+            ImGui::Separator();
+            if (ImGui::Button("Quit without saving")) {
+                quit = true;
+                ImGui::CloseCurrentPopup();
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Keep editing")) {
+                ImGui::CloseCurrentPopup();
+            }
+            ImGui::EndPopup();
+        }
  
         if (popup==true)
         {
@@ -3119,6 +5877,7 @@ int main(int argc, char* args[]) {
                                                 printf("Debug::SetID::%d\n", i); 
                                                 selected_tile_id = i; 
                                                 selected_idmap = id_map.name; 
+                                                selected_idmap_handle = world.find_idmap_handle(id_map.name);
                                             } 
                                             if(!text.empty())
                                             { 
@@ -3129,6 +5888,18 @@ int main(int argc, char* args[]) {
                                     } 
                                 ImGui::EndListBox();
                                 }
+                                auto selected_it = id_map.id_map.find(selected_tile_id);
+                                if (selected_idmap == id_map.name && selected_it != id_map.id_map.end() && selected_tile_id != 255)
+                                {
+                                    auto& [r, g, b, text] = selected_it->second;
+                                    float tile_color[3] = {r / 255.0f, g / 255.0f, b / 255.0f};
+                                    if (ImGui::ColorEdit3(("tile color" + local_id).c_str(), tile_color))
+                                    {
+                                        world.set_tile_color(selected_idmap_handle, selected_tile_id, int(tile_color[0] * 255.0f + 0.5f),
+                                                             int(tile_color[1] * 255.0f + 0.5f), int(tile_color[2] * 255.0f + 0.5f));
+                                        brush_color = BrushColor();
+                                    }
+                                }
                             ImGui::EndTabItem(); 
                             }
                         }
@@ -3373,7 +6144,14 @@ int main(int argc, char* args[]) {
                 SDL_RenderFillRect(renderer, &viewport_output_bounded);
                 
                 SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-                world.draw_all(renderer, &viewport_source_lower, &viewport_source_upper, &viewport_output_bounded, zoom_offset, pan_offset_x, pan_offset_y);
+                // layer textures start at the loaded region, icons are drawn in world coordinates
+                SDL_FRect texture_source_lower = viewport_source_lower;
+                SDL_FRect texture_source_upper = viewport_source_upper;
+                texture_source_lower.x -= texture_rect.x;
+                texture_source_lower.y -= texture_rect.y;
+                texture_source_upper.x -= float(world.loaded_region.x);
+                texture_source_upper.y -= float(world.loaded_region.y);
+                world.draw_all(renderer, &texture_source_lower, &texture_source_upper, &viewport_output_bounded, zoom_offset, pan_offset_x, pan_offset_y);
             }
         }
 
@@ -3391,6 +6169,9 @@ int main(int argc, char* args[]) {
     // ---
 
     // Cleanup
+    for (auto& [filename, preview_entry] : save_previews) {
+        if (preview_entry.thumbnail) SDL_DestroyTexture(preview_entry.thumbnail);
+    }
     SDL_Quit();
 
     // "-o",
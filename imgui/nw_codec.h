@@ -0,0 +1,374 @@
+#pragma once
+
+// Tile codecs for the .nw raster sections.
+// Rasters are split into chunk-aligned tiles and every tile is compressed on its own,
+// so single tiles can be decoded (or replaced) without touching the rest of the layer.
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+enum TileCodec : uint8_t {
+    TILE_RAW = 0, // plain index bytes
+    TILE_RLE = 1, // [value][varint run-1] pairs, used for flat tiles
+    TILE_LZ  = 2, // LZ77 with 16-bit offsets, used for everything else
+};
+
+// Tiles are at least this many pixels wide/high, rounded up to whole chunks
+const int TILE_MIN_EXTENT = 64;
+
+struct TileGrid {
+    int width = 0, height = 0; // raster size in pixels
+    int tile_w = 0, tile_h = 0; // tile size in pixels
+    int tiles_x = 0, tiles_y = 0;
+
+    int count() const { return tiles_x * tiles_y; }
+    // Bytes of the biggest tile, a tile is never bigger than the raster
+    size_t max_tile_size() const { return size_t(std::min(tile_w, width)) * size_t(std::min(tile_h, height)); }
+};
+
+// chunk_w/chunk_h are the size of one chunk in pixels of this raster (1 for upper layers)
+inline TileGrid make_tile_grid(int width, int height, int chunk_w, int chunk_h) {
+    TileGrid grid;
+    grid.width = width;
+    grid.height = height;
+    chunk_w = std::max(chunk_w, 1);
+    chunk_h = std::max(chunk_h, 1);
+    grid.tile_w = chunk_w * ((TILE_MIN_EXTENT + chunk_w - 1) / chunk_w);
+    grid.tile_h = chunk_h * ((TILE_MIN_EXTENT + chunk_h - 1) / chunk_h);
+    grid.tiles_x = (width + grid.tile_w - 1) / grid.tile_w;
+    grid.tiles_y = (height + grid.tile_h - 1) / grid.tile_h;
+    return grid;
+}
+
+// Widest or highest raster in pixels a loader accepts, sizes read from a file are checked
+// against it before anything is multiplied
+const int RASTER_MAX_EXTENT = 1 << 20;
+
+// Tiles of a grid whose sizes come from a file, counted in 64 bits. 0 when a size of the raster
+// or its tiles isn't positive, is too big or the count doesn't fit count().
+inline uint64_t checked_tile_count(int width, int height, int tile_w, int tile_h) {
+    if (width <= 0 || height <= 0 || tile_w <= 0 || tile_h <= 0) return 0;
+    if (width > RASTER_MAX_EXTENT || height > RASTER_MAX_EXTENT) return 0;
+    if (tile_w > RASTER_MAX_EXTENT || tile_h > RASTER_MAX_EXTENT) return 0;
+    uint64_t tiles = ((uint64_t(width) + tile_w - 1) / tile_w) * ((uint64_t(height) + tile_h - 1) / tile_h);
+    return tiles <= uint64_t(INT32_MAX) ? tiles : 0;
+}
+
+inline TileGrid make_tile_grid_sized(int width, int height, int tile_w, int tile_h) {
+    TileGrid grid;
+    grid.width = width;
+    grid.height = height;
+    grid.tile_w = tile_w;
+    grid.tile_h = tile_h;
+    grid.tiles_x = tile_w > 0 ? int((int64_t(width) + tile_w - 1) / tile_w) : 0;
+    grid.tiles_y = tile_h > 0 ? int((int64_t(height) + tile_h - 1) / tile_h) : 0;
+    return grid;
+}
+
+inline void put_varint(std::vector<uint8_t>& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+inline bool get_varint(const uint8_t*& src, const uint8_t* end, uint32_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (src >= end) return false;
+        uint8_t byte = *src++;
+        value |= uint32_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+inline size_t varint_size(uint32_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+// --- RLE ---
+
+inline size_t rle_compressed_size(const uint8_t* src, size_t n) {
+    size_t size = 0;
+    size_t i = 0;
+    while (i < n) {
+        size_t run = 1;
+        while (i + run < n && src[i + run] == src[i]) run++;
+        size += 1 + varint_size(static_cast<uint32_t>(run - 1));
+        i += run;
+    }
+    return size;
+}
+
+inline void rle_compress(const uint8_t* src, size_t n, std::vector<uint8_t>& out) {
+    size_t i = 0;
+    while (i < n) {
+        size_t run = 1;
+        while (i + run < n && src[i + run] == src[i]) run++;
+        out.push_back(src[i]);
+        put_varint(out, static_cast<uint32_t>(run - 1));
+        i += run;
+    }
+}
+
+inline bool rle_decompress(const uint8_t* src, size_t src_n, uint8_t* dst, size_t dst_n) {
+    const uint8_t* end = src + src_n;
+    size_t written = 0;
+    while (src < end) {
+        uint8_t value = *src++;
+        uint32_t run;
+        if (!get_varint(src, end, run)) return false;
+        if (written + run + 1 > dst_n) return false;
+        std::memset(dst + written, value, size_t(run) + 1);
+        written += size_t(run) + 1;
+    }
+    return written == dst_n;
+}
+
+// --- LZ ---
+// Sequence: token (literal length << 4 | match length - 4), extra length bytes (255 = continue),
+// literals, 16-bit little-endian offset, extra match length bytes.
+// The last sequence carries literals only.
+
+const int LZ_MIN_MATCH = 4;
+const int LZ_HASH_BITS = 12;
+
+inline uint32_t lz_hash(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+inline void lz_put_length(std::vector<uint8_t>& out, size_t length) {
+    while (length >= 255) {
+        out.push_back(255);
+        length -= 255;
+    }
+    out.push_back(static_cast<uint8_t>(length));
+}
+
+inline void lz_compress(const uint8_t* src, size_t n, std::vector<uint8_t>& out) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    std::fill(std::begin(table), std::end(table), UINT32_MAX);
+
+    size_t anchor = 0;
+    size_t i = 0;
+    while (n >= LZ_MIN_MATCH && i + LZ_MIN_MATCH <= n) {
+        uint32_t h = lz_hash(src + i);
+        uint32_t candidate = table[h];
+        table[h] = static_cast<uint32_t>(i);
+
+        if (candidate == UINT32_MAX || i - candidate > 0xFFFF || std::memcmp(src + candidate, src + i, LZ_MIN_MATCH) != 0) {
+            i++;
+            continue;
+        }
+
+        size_t match = LZ_MIN_MATCH;
+        while (i + match < n && src[candidate + match] == src[i + match]) match++;
+
+        size_t literals = i - anchor;
+        size_t match_code = match - LZ_MIN_MATCH;
+        uint8_t token = static_cast<uint8_t>((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(match_code, 15));
+        out.push_back(token);
+        if (literals >= 15) lz_put_length(out, literals - 15);
+        out.insert(out.end(), src + anchor, src + i);
+
+        uint16_t offset = static_cast<uint16_t>(i - candidate);
+        out.push_back(static_cast<uint8_t>(offset & 0xFF));
+        out.push_back(static_cast<uint8_t>(offset >> 8));
+        if (match_code >= 15) lz_put_length(out, match_code - 15);
+
+        i += match;
+        anchor = i;
+    }
+
+    size_t literals = n - anchor;
+    out.push_back(static_cast<uint8_t>(std::min<size_t>(literals, 15) << 4));
+    if (literals >= 15) lz_put_length(out, literals - 15);
+    out.insert(out.end(), src + anchor, src + n);
+}
+
+inline bool lz_get_length(const uint8_t*& src, const uint8_t* end, size_t& length) {
+    uint8_t byte;
+    do {
+        if (src >= end) return false;
+        byte = *src++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+inline bool lz_decompress(const uint8_t* src, size_t src_n, uint8_t* dst, size_t dst_n) {
+    const uint8_t* end = src + src_n;
+    size_t written = 0;
+    while (src < end) {
+        uint8_t token = *src++;
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !lz_get_length(src, end, literals)) return false;
+        if (literals > size_t(end - src) || written + literals > dst_n) return false;
+        if (literals) std::memcpy(dst + written, src, literals);
+        src += literals;
+        written += literals;
+
+        if (src == end) break; // last sequence
+
+        if (end - src < 2) return false;
+        size_t offset = size_t(src[0]) | (size_t(src[1]) << 8);
+        src += 2;
+        size_t match = token & 0x0F;
+        if (match == 15 && !lz_get_length(src, end, match)) return false;
+        match += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > written || written + match > dst_n) return false;
+        // byte by byte on purpose, overlapping matches encode runs
+        const uint8_t* from = dst + written - offset;
+        for (size_t k = 0; k < match; k++) {
+            dst[written + k] = from[k];
+        }
+        written += match;
+    }
+    return written == dst_n;
+}
+
+// --- Tiles ---
+
+// Appends [codec byte][payload] for one tile of n index bytes, picking the smallest codec
+inline void encode_tile(const uint8_t* tile, size_t n, std::vector<uint8_t>& out) {
+    size_t start = out.size();
+    size_t rle_size = rle_compressed_size(tile, n);
+
+    // flat or nearly flat tiles, not worth running LZ on
+    if (rle_size <= n / 16) {
+        out.push_back(TILE_RLE);
+        rle_compress(tile, n, out);
+        return;
+    }
+
+    out.push_back(TILE_LZ);
+    lz_compress(tile, n, out);
+    size_t lz_size = out.size() - start - 1;
+
+    if (rle_size < lz_size && rle_size < n) {
+        out.resize(start);
+        out.push_back(TILE_RLE);
+        rle_compress(tile, n, out);
+    } else if (lz_size >= n) {
+        out.resize(start);
+        out.push_back(TILE_RAW);
+        out.insert(out.end(), tile, tile + n);
+    }
+}
+
+inline bool decode_tile(const uint8_t* src, size_t src_n, uint8_t* dst, size_t n) {
+    if (src_n < 1) return false;
+    uint8_t codec = src[0];
+    src++;
+    src_n--;
+
+    switch (codec) {
+        case TILE_RAW:
+            if (src_n != n) return false;
+            std::memcpy(dst, src, n);
+            return true;
+        case TILE_RLE:
+            return rle_decompress(src, src_n, dst, n);
+        case TILE_LZ:
+            return lz_decompress(src, src_n, dst, n);
+        default:
+            return false;
+    }
+}
+
+// Copies one tile out of a band of rows (band_pitch bytes per row) into a tight buffer
+inline void gather_tile(const uint8_t* band, size_t band_pitch, int x0, int w, int h, uint8_t* tile) {
+    for (int y = 0; y < h; y++) {
+        std::memcpy(tile + size_t(y) * w, band + size_t(y) * band_pitch + x0, w);
+    }
+}
+
+inline void scatter_tile(const uint8_t* tile, int x0, int w, int h, uint8_t* band, size_t band_pitch) {
+    for (int y = 0; y < h; y++) {
+        std::memcpy(band + size_t(y) * band_pitch + x0, tile + size_t(y) * w, w);
+    }
+}
+
+// Encodes one band (one row of tiles) and appends tile end offsets relative to the payload start
+inline void encode_tile_band(const TileGrid& grid, int tile_row, const uint8_t* band, size_t band_pitch,
+                             std::vector<uint8_t>& payload, std::vector<uint64_t>& offsets) {
+    int y0 = tile_row * grid.tile_h;
+    int h = std::min(grid.tile_h, grid.height - y0);
+    std::vector<uint8_t> tile(grid.max_tile_size());
+
+    for (int tx = 0; tx < grid.tiles_x; tx++) {
+        int x0 = tx * grid.tile_w;
+        int w = std::min(grid.tile_w, grid.width - x0);
+        gather_tile(band, band_pitch, x0, w, h, tile.data());
+        encode_tile(tile.data(), size_t(w) * h, payload);
+        offsets.push_back(payload.size());
+    }
+}
+
+// Decodes one band of tiles into rows of band_pitch bytes.
+// offsets holds count()+1 entries, tile i spans [offsets[i], offsets[i+1]) of payload.
+inline bool decode_tile_band(const TileGrid& grid, int tile_row, const uint8_t* payload, size_t payload_size,
+                             const uint64_t* offsets, uint8_t* band, size_t band_pitch) {
+    int y0 = tile_row * grid.tile_h;
+    int h = std::min(grid.tile_h, grid.height - y0);
+    std::vector<uint8_t> tile(grid.max_tile_size());
+
+    for (int tx = 0; tx < grid.tiles_x; tx++) {
+        size_t index = size_t(tile_row) * grid.tiles_x + tx;
+        uint64_t begin = offsets[index];
+        uint64_t end = offsets[index + 1];
+        if (begin > end || end > payload_size) return false;
+
+        int x0 = tx * grid.tile_w;
+        int w = std::min(grid.tile_w, grid.width - x0);
+        if (!decode_tile(payload + begin, size_t(end - begin), tile.data(), size_t(w) * h)) return false;
+        scatter_tile(tile.data(), x0, w, h, band, band_pitch);
+    }
+    return true;
+}
+
+// Decodes the tiles of one band that overlap the window [x0, x0 + w) x [y0, y0 + h) of the raster.
+// Their ids land in rows of out_pitch bytes, out being the top-left pixel of the window.
+// Tiles left of, right of or outside the window aren't decoded at all.
+inline bool decode_tile_band_window(const TileGrid& grid, int tile_row, const uint8_t* payload, size_t payload_size,
+                                    const uint64_t* offsets, int x0, int y0, int w, int h, uint8_t* out, size_t out_pitch,
+                                    std::vector<uint8_t>& tile) {
+    int band_y0 = tile_row * grid.tile_h;
+    int band_h = std::min(grid.tile_h, grid.height - band_y0);
+    int row_begin = std::max(band_y0, y0);
+    int row_end = std::min(band_y0 + band_h, y0 + h);
+    if (row_begin >= row_end || w <= 0) return true;
+    tile.resize(grid.max_tile_size());
+
+    for (int tx = std::max(x0, 0) / grid.tile_w; tx < grid.tiles_x && tx * grid.tile_w < x0 + w; tx++) {
+        size_t index = size_t(tile_row) * grid.tiles_x + tx;
+        uint64_t begin = offsets[index];
+        uint64_t end = offsets[index + 1];
+        if (begin > end || end > payload_size) return false;
+
+        int tile_x0 = tx * grid.tile_w;
+        int tile_w = std::min(grid.tile_w, grid.width - tile_x0);
+        if (!decode_tile(payload + begin, size_t(end - begin), tile.data(), size_t(tile_w) * band_h)) return false;
+
+        int col_begin = std::max(tile_x0, x0);
+        int col_end = std::min(tile_x0 + tile_w, x0 + w);
+        for (int y = row_begin; y < row_end; y++) {
+            std::memcpy(out + size_t(y - y0) * out_pitch + (col_begin - x0), tile.data() + size_t(y - band_y0) * tile_w + (col_begin - tile_x0),
+                        size_t(col_end - col_begin));
+        }
+    }
+    return true;
+}
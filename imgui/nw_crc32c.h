@@ -0,0 +1,184 @@
+#pragma once
+
+// CRC32C (Castagnoli) for checking savefile sections. Uses the SSE4.2 crc32 instruction on x86
+// and the CRC32 extension on ARMv8 when the CPU has them, slicing-by-8 tables otherwise.
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <streambuf>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NW_CRC32C_X86 1
+#include <nmmintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define NW_TARGET_SSE42
+#else
+#define NW_TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define NW_CRC32C_ARM 1
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <arm64intr.h>
+#include <windows.h>
+#define NW_TARGET_CRC
+#else
+#include <arm_acle.h>
+#define NW_TARGET_CRC __attribute__((target("+crc")))
+#if defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#endif
+#endif
+
+// Tables for the software version, table[k][b] is the CRC of byte b followed by k zero bytes
+struct Crc32cTables {
+    uint32_t table[8][256];
+
+    Crc32cTables() {
+        for (uint32_t b = 0; b < 256; b++) {
+            uint32_t crc = b;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+            }
+            table[0][b] = crc;
+        }
+        for (uint32_t b = 0; b < 256; b++) {
+            for (int k = 1; k < 8; k++) {
+                table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+            }
+        }
+    }
+};
+
+inline uint32_t nw_crc32c_software(uint32_t crc, const uint8_t* p, size_t n) {
+    static const Crc32cTables tables;
+    const auto& t = tables.table;
+    while (n >= 8) {
+        uint32_t low, high;
+        std::memcpy(&low, p, 4);
+        std::memcpy(&high, p + 4, 4);
+        low ^= crc;
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+              t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+        p += 8;
+        n -= 8;
+    }
+    while (n--) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef NW_CRC32C_X86
+NW_TARGET_SSE42 inline uint32_t nw_crc32c_hardware(uint32_t crc, const uint8_t* p, size_t n) {
+#if defined(__x86_64__) || defined(_M_X64)
+    uint64_t crc64 = crc;
+    while (n >= 8) {
+        uint64_t value;
+        std::memcpy(&value, p, 8);
+        crc64 = _mm_crc32_u64(crc64, value);
+        p += 8;
+        n -= 8;
+    }
+    crc = uint32_t(crc64);
+#endif
+    while (n >= 4) {
+        uint32_t value;
+        std::memcpy(&value, p, 4);
+        crc = _mm_crc32_u32(crc, value);
+        p += 4;
+        n -= 4;
+    }
+    while (n--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+inline bool nw_crc32c_hardware_available() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#elif defined(NW_CRC32C_ARM)
+NW_TARGET_CRC inline uint32_t nw_crc32c_hardware(uint32_t crc, const uint8_t* p, size_t n) {
+    while (n >= 8) {
+        uint64_t value;
+        std::memcpy(&value, p, 8);
+        crc = __crc32cd(crc, value);
+        p += 8;
+        n -= 8;
+    }
+    while (n--) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+
+inline bool nw_crc32c_hardware_available() {
+#if defined(__ARM_FEATURE_CRC32) || defined(__APPLE__)
+    return true;
+#elif defined(_MSC_VER) && !defined(__clang__)
+    return IsProcessorFeaturePresent(PF_ARM_V8_CRC32_INSTRUCTIONS_AVAILABLE) != 0;
+#elif defined(__linux__) && defined(HWCAP_CRC32)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    return false;
+#endif
+}
+#endif
+
+// CRC of size bytes, continuing from crc (the CRC of everything before them, 0 to start)
+inline uint32_t nw_crc32c(const void* data, size_t size, uint32_t crc = 0) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+#if defined(NW_CRC32C_X86) || defined(NW_CRC32C_ARM)
+    static const bool hardware = nw_crc32c_hardware_available();
+    if (hardware) return ~nw_crc32c_hardware(crc, p, size);
+#endif
+    return ~nw_crc32c_software(crc, p, size);
+}
+
+// Passes writes on to another stream buffer and keeps the CRC32C of everything written since
+// the last reset, so sections can be checksummed while they are streamed out
+class Crc32cStreamBuf : public std::streambuf {
+    public:
+    explicit Crc32cStreamBuf(std::streambuf* target) : target(target) {}
+
+    void reset(uint32_t seed = 0) { crc = seed; }
+    uint32_t value() const { return crc; }
+
+    protected:
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        crc = nw_crc32c(s, size_t(n), crc);
+        return target->sputn(s, n);
+    }
+
+    int_type overflow(int_type ch) override {
+        if (traits_type::eq_int_type(ch, traits_type::eof())) return traits_type::not_eof(ch);
+        char c = traits_type::to_char_type(ch);
+        crc = nw_crc32c(&c, 1, crc);
+        return target->sputc(c);
+    }
+
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+        return target->pubseekoff(off, dir, which);
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+        return target->pubseekpos(pos, which);
+    }
+
+    int sync() override { return target->pubsync(); }
+
+    private:
+    std::streambuf* target;
+    uint32_t crc = 0;
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+// Notices files of one directory being written, created, moved in or removed. Uses inotify on
+// Linux, elsewhere (or when inotify can't be set up) the directory is listed again every so
+// often and the sizes and write times of its files compared. Never blocks, meant to be polled
+// once a frame.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// How often the fallback lists the directory again
+const std::chrono::milliseconds WATCH_SCAN_INTERVAL(1000);
+
+class DirectoryWatcher {
+    public:
+    DirectoryWatcher() = default;
+    ~DirectoryWatcher() { close(); }
+
+    DirectoryWatcher(const DirectoryWatcher&) = delete;
+    DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+    bool open(const std::string& path) {
+        close();
+        std::error_code error;
+        if (!std::filesystem::is_directory(path, error)) return false;
+        directory = path;
+#ifdef __linux__
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd >= 0 && inotify_add_watch(fd, path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE) >= 0) {
+            return true;
+        }
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        files = scan();
+        next_scan = std::chrono::steady_clock::now() + WATCH_SCAN_INTERVAL;
+        return true;
+    }
+
+    void close() {
+#ifdef __linux__
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        directory.clear();
+        files.clear();
+    }
+
+    bool is_open() const { return !directory.empty(); }
+    const std::string& path() const { return directory; }
+
+    // Names (not paths) of the files that changed since the last call, each once
+    std::vector<std::string> poll() {
+        std::vector<std::string> changed;
+        if (directory.empty()) return changed;
+#ifdef __linux__
+        if (fd >= 0) {
+            alignas(inotify_event) char buffer[4096];
+            ssize_t length;
+            while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+                for (char* at = buffer; at < buffer + length;) {
+                    auto* event = reinterpret_cast<inotify_event*>(at);
+                    // IN_CREATE alone is an empty file still being written, IN_CLOSE_WRITE follows
+                    if (event->len > 0 && !(event->mask & (IN_ISDIR | IN_CREATE))) add_name(changed, event->name);
+                    at += sizeof(inotify_event) + event->len;
+                }
+            }
+            return changed;
+        }
+#endif
+        auto now = std::chrono::steady_clock::now();
+        if (now < next_scan) return changed;
+        next_scan = now + WATCH_SCAN_INTERVAL;
+
+        std::unordered_map<std::string, FileState> current = scan();
+        for (auto& [name, state] : current) {
+            auto it = files.find(name);
+            if (it == files.end() || it->second.size != state.size || it->second.time != state.time) add_name(changed, name);
+        }
+        for (auto& [name, state] : files) {
+            if (!current.count(name)) add_name(changed, name);
+        }
+        files = std::move(current);
+        return changed;
+    }
+
+    private:
+    struct FileState {
+        std::filesystem::file_time_type time;
+        uintmax_t size = 0;
+    };
+
+    std::string directory;
+#ifdef __linux__
+    int fd = -1;
+#endif
+    std::unordered_map<std::string, FileState> files; // what the fallback saw on its last scan
+    std::chrono::steady_clock::time_point next_scan;
+
+    static void add_name(std::vector<std::string>& names, const std::string& name) {
+        if (std::find(names.begin(), names.end(), name) == names.end()) names.push_back(name);
+    }
+
+    std::unordered_map<std::string, FileState> scan() const {
+        std::unordered_map<std::string, FileState> found;
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+            if (!entry.is_regular_file(error)) continue;
+            FileState state;
+            state.time = entry.last_write_time(error);
+            state.size = entry.file_size(error);
+            found[entry.path().filename().string()] = state;
+        }
+        return found;
+    }
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+// 64-bit content hash (the XXH64 algorithm) for telling saved data apart cheaply.
+// Not used for anything security related.
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+const uint64_t NW_HASH_PRIME1 = 0x9E3779B185EBCA87ULL;
+const uint64_t NW_HASH_PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t NW_HASH_PRIME3 = 0x165667B19E3779F9ULL;
+const uint64_t NW_HASH_PRIME4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t NW_HASH_PRIME5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t nw_hash_rotl(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t nw_hash_read64(const uint8_t* p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint32_t nw_hash_read32(const uint8_t* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint64_t nw_hash_round(uint64_t acc, uint64_t input) {
+    acc += input * NW_HASH_PRIME2;
+    acc = nw_hash_rotl(acc, 31);
+    return acc * NW_HASH_PRIME1;
+}
+
+inline uint64_t nw_hash_merge(uint64_t acc, uint64_t value) {
+    acc ^= nw_hash_round(0, value);
+    return acc * NW_HASH_PRIME1 + NW_HASH_PRIME4;
+}
+
+inline uint64_t nw_hash64(const void* data, size_t size, uint64_t seed = 0) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const uint8_t* end = p + size;
+    uint64_t hash;
+
+    if (size >= 32) {
+        uint64_t v1 = seed + NW_HASH_PRIME1 + NW_HASH_PRIME2;
+        uint64_t v2 = seed + NW_HASH_PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - NW_HASH_PRIME1;
+        const uint8_t* limit = end - 32;
+        do {
+            v1 = nw_hash_round(v1, nw_hash_read64(p));
+            v2 = nw_hash_round(v2, nw_hash_read64(p + 8));
+            v3 = nw_hash_round(v3, nw_hash_read64(p + 16));
+            v4 = nw_hash_round(v4, nw_hash_read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        hash = nw_hash_rotl(v1, 1) + nw_hash_rotl(v2, 7) + nw_hash_rotl(v3, 12) + nw_hash_rotl(v4, 18);
+        hash = nw_hash_merge(hash, v1);
+        hash = nw_hash_merge(hash, v2);
+        hash = nw_hash_merge(hash, v3);
+        hash = nw_hash_merge(hash, v4);
+    } else {
+        hash = seed + NW_HASH_PRIME5;
+    }
+
+    hash += static_cast<uint64_t>(size);
+
+    while (p + 8 <= end) {
+        hash ^= nw_hash_round(0, nw_hash_read64(p));
+        hash = nw_hash_rotl(hash, 27) * NW_HASH_PRIME1 + NW_HASH_PRIME4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        hash ^= uint64_t(nw_hash_read32(p)) * NW_HASH_PRIME1;
+        hash = nw_hash_rotl(hash, 23) * NW_HASH_PRIME2 + NW_HASH_PRIME3;
+        p += 4;
+    }
+    while (p < end) {
+        hash ^= uint64_t(*p) * NW_HASH_PRIME5;
+        hash = nw_hash_rotl(hash, 11) * NW_HASH_PRIME1;
+        p++;
+    }
+
+    hash ^= hash >> 33;
+    hash *= NW_HASH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= NW_HASH_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
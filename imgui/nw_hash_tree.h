@@ -0,0 +1,300 @@
+#pragma once
+
+// Hash tree over the tiles of every raster of a world, stored in the savefile as SECTION_HASH_TREE.
+// Two worlds are the same when their roots are, and where they aren't, the tiles that differ are
+// found by walking down only the branches whose hashes don't match.
+// Leaves are nw_hash64 of the ids of one tile, every node above hashes up to 2x2 nodes of the level
+// below, so each branch covers a square block of tiles. A raster's root also covers its size, tile
+// size and IDmap, the world root covers the dimensions, every raster root and every icon layer.
+// The section is [u64 world root][u32 raster count], per raster [u32 type][name][IDmap name]
+// [i32 width, height, tile_w, tile_h][u64 tile hashes], then [u32 icon layer count] and per icon
+// layer [name][u64 hash_icon_layer]. Only the leaves are stored, the nodes are rebuilt when read.
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "nw_codec.h"
+#include "nw_hash.h"
+#include "nw_savefile.h"
+#include "nw_serialize.h"
+
+// Appends the hash of the ids of every tile of one band, band holding its rows
+inline void hash_tile_band(const TileGrid& grid, int tile_row, const uint8_t* band, size_t band_pitch, std::vector<uint64_t>& hashes) {
+    int y0 = tile_row * grid.tile_h;
+    int h = std::min(grid.tile_h, grid.height - y0);
+    std::vector<uint8_t> tile(grid.max_tile_size());
+
+    for (int tx = 0; tx < grid.tiles_x; tx++) {
+        int x0 = tx * grid.tile_w;
+        int w = std::min(grid.tile_w, grid.width - x0);
+        gather_tile(band, band_pitch, x0, w, h, tile.data());
+        hashes.push_back(nw_hash64(tile.data(), size_t(w) * h));
+    }
+}
+
+// Tile hashes of a whole raster of ids, bands of tiles on the worker pool
+inline std::vector<uint64_t> hash_raster_tiles(const uint8_t* ids, size_t pitch, const TileGrid& grid) {
+    std::vector<std::vector<uint64_t>> bands(size_t(grid.tiles_y));
+    worker_pool().parallel_for(bands.size(), [&](size_t tile_row) {
+        hash_tile_band(grid, int(tile_row), ids + tile_row * grid.tile_h * pitch, pitch, bands[tile_row]);
+    });
+    std::vector<uint64_t> hashes;
+    hashes.reserve(size_t(grid.count()));
+    for (auto& band : bands) hashes.insert(hashes.end(), band.begin(), band.end());
+    return hashes;
+}
+
+struct RasterHashTree {
+    uint32_t type = SECTION_WORLD_LAYER; // or SECTION_POLITICAL_LAYER
+    std::string layer_name;
+    std::string idmap_name;
+    TileGrid grid;
+    std::vector<std::vector<uint64_t>> levels; // levels[0] are the tiles in row order, the last one the top node
+    uint64_t root = 0;
+
+    int level_width(size_t level) const { return level_extent(grid.tiles_x, level); }
+    int level_height(size_t level) const { return level_extent(grid.tiles_y, level); }
+
+    // Builds the levels above the tile hashes and the root
+    void build(std::vector<uint64_t> tile_hashes) {
+        levels.assign(1, std::move(tile_hashes));
+        while (level_width(levels.size() - 1) > 1 || level_height(levels.size() - 1) > 1) {
+            size_t below = levels.size() - 1;
+            int width = level_width(below + 1), height = level_height(below + 1);
+            std::vector<uint64_t> level(size_t(width) * height);
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    uint64_t children[4];
+                    int count = 0;
+                    for_children(below, x, y, [&](size_t index) { children[count++] = levels[below][index]; });
+                    level[size_t(y) * width + x] = nw_hash64(children, count * sizeof(uint64_t));
+                }
+            }
+            levels.push_back(std::move(level));
+        }
+
+        ByteWriter fields;
+        fields.write(uint64_t(levels.back().empty() ? 0 : levels.back()[0]));
+        fields.write(int32_t(grid.width));
+        fields.write(int32_t(grid.height));
+        fields.write(int32_t(grid.tile_w));
+        fields.write(int32_t(grid.tile_h));
+        fields.write_string<int32_t>(idmap_name);
+        root = nw_hash64(fields.data(), fields.size());
+    }
+
+    // Calls visit(index) for the nodes of level - 1 under node x, y of level, level > 0
+    template <typename Visit>
+    void for_children(size_t below, int x, int y, Visit visit) const {
+        int width = level_width(below), height = level_height(below);
+        for (int cy = 2 * y; cy < std::min(2 * y + 2, height); cy++) {
+            for (int cx = 2 * x; cx < std::min(2 * x + 2, width); cx++) visit(size_t(cy) * width + cx);
+        }
+    }
+
+    private:
+    static int level_extent(int tiles, size_t level) {
+        for (size_t i = 0; i < level; i++) tiles = (tiles + 1) / 2;
+        return tiles;
+    }
+};
+
+struct WorldHashTree {
+    int32_t world_width = 0, world_height = 0, chunk_width = 0, chunk_height = 0;
+    std::vector<RasterHashTree> rasters;
+    std::vector<std::pair<std::string, uint64_t>> icon_layers; // name, hash_icon_layer
+    uint64_t root = 0;
+
+    // The world root, once every raster is built
+    void finish() {
+        ByteWriter fields;
+        for (int32_t field : {world_width, world_height, chunk_width, chunk_height}) fields.write(field);
+        for (auto& raster : rasters) {
+            fields.write(raster.type);
+            fields.write_string<int32_t>(raster.layer_name);
+            fields.write(raster.root);
+        }
+        for (auto& [name, hash] : icon_layers) {
+            fields.write_string<int32_t>(name);
+            fields.write(hash);
+        }
+        root = nw_hash64(fields.data(), fields.size());
+    }
+
+    const RasterHashTree* find(uint32_t type, const std::string& layer_name) const {
+        for (auto& raster : rasters) {
+            if (raster.type == type && raster.layer_name == layer_name) return &raster;
+        }
+        return nullptr;
+    }
+};
+
+inline void write_hash_tree(ByteWriter& out, const WorldHashTree& tree) {
+    out.write(tree.root);
+    out.write(uint32_t(tree.rasters.size()));
+    for (auto& raster : tree.rasters) {
+        out.write(raster.type);
+        out.write_string<int32_t>(raster.layer_name);
+        out.write_string<int32_t>(raster.idmap_name);
+        for (int32_t field : {raster.grid.width, raster.grid.height, raster.grid.tile_w, raster.grid.tile_h}) out.write(field);
+        out.write_array(raster.levels[0].data(), raster.levels[0].size());
+    }
+    out.write(uint32_t(tree.icon_layers.size()));
+    for (auto& [name, hash] : tree.icon_layers) {
+        out.write_string<int32_t>(name);
+        out.write(hash);
+    }
+}
+
+// Reads a hash tree section and rebuilds its nodes, false if it is damaged or its root doesn't
+// match the tiles. The world dimensions are left to the caller, they are in the header.
+inline bool read_hash_tree(ByteReader& in, WorldHashTree& tree) {
+    uint64_t stored_root = 0;
+    uint32_t raster_count = 0, icon_count = 0;
+    in.read(stored_root);
+    in.read(raster_count);
+    for (uint32_t i = 0; i < raster_count && in; i++) {
+        RasterHashTree raster;
+        int32_t width = 0, height = 0, tile_w = 0, tile_h = 0;
+        in.read(raster.type);
+        in.read_string<int32_t>(raster.layer_name, SAVE_MAX_NAME_LENGTH);
+        in.read_string<int32_t>(raster.idmap_name, SAVE_MAX_NAME_LENGTH);
+        in.read(width);
+        in.read(height);
+        in.read(tile_w);
+        in.read(tile_h);
+        if (!in || checked_tile_count(width, height, tile_w, tile_h) == 0) return false;
+        raster.grid = make_tile_grid_sized(width, height, tile_w, tile_h);
+
+        std::vector<uint64_t> tile_hashes;
+        if (!in.read_array(tile_hashes, uint64_t(raster.grid.count()))) return false;
+        raster.build(std::move(tile_hashes));
+        tree.rasters.push_back(std::move(raster));
+    }
+    in.read(icon_count);
+    for (uint32_t i = 0; i < icon_count && in; i++) {
+        std::string name;
+        uint64_t hash = 0;
+        in.read_string<int32_t>(name, SAVE_MAX_NAME_LENGTH);
+        in.read(hash);
+        tree.icon_layers.push_back({name, hash});
+    }
+    if (!in) return false;
+    tree.finish();
+    return tree.root == stored_root;
+}
+
+// Finds the hash tree of a savefile, false if it has none. root_only skips the tiles, the world
+// root is all it takes to tell whether two savefiles hold the same world.
+inline bool read_savefile_hash_tree(const uint8_t* data, size_t size, const SaveHeader& header, WorldHashTree& tree, bool root_only = false) {
+    const SaveSection* section = header.find_section(SECTION_HASH_TREE, 0);
+    if (!section || section->offset > size || section->length > size - section->offset) return false;
+
+    tree = WorldHashTree();
+    tree.world_width = header.world_width;
+    tree.world_height = header.world_height;
+    tree.chunk_width = header.chunk_width;
+    tree.chunk_height = header.chunk_height;
+    ByteReader in(data + section->offset, size_t(section->length));
+    if (root_only) return in.read(tree.root);
+    return read_hash_tree(in, tree);
+}
+
+// A block of chunks, x, y, width and height in chunks of the world
+struct ChunkRect {
+    int x = 0, y = 0, width = 0, height = 0;
+};
+
+struct RasterDifference {
+    uint32_t type = SECTION_WORLD_LAYER;
+    std::string layer_name;
+    bool missing = false; // only one of the worlds has the layer, or the rasters can't be compared tile by tile
+    std::vector<ChunkRect> chunks; // the tiles that differ
+};
+
+struct WorldDifference {
+    bool same = false;
+    bool dimensions_differ = false;
+    std::vector<RasterDifference> rasters;
+    std::vector<std::string> icon_layers; // differ or only in one of the worlds
+    size_t nodes_compared = 0;
+};
+
+// Tiles of two rasters of the same grid that differ, visiting only the branches whose hashes don't match
+inline void diff_raster_trees(const RasterHashTree& a, const RasterHashTree& b, const WorldHashTree& world, RasterDifference& difference,
+                              size_t& nodes_compared) {
+    // chunks per tile depend on whether the raster is the size of the lower or of the upper world
+    int scale_x = std::max(1, a.grid.width / std::max(1, world.world_width));
+    int scale_y = std::max(1, a.grid.height / std::max(1, world.world_height));
+
+    std::vector<std::pair<int, int>> stack = {{0, 0}};
+    std::vector<std::pair<int, int>> next;
+    for (size_t level = a.levels.size(); level-- > 0;) {
+        next.clear();
+        int width = a.level_width(level);
+        for (auto [x, y] : stack) {
+            size_t index = size_t(y) * width + x;
+            nodes_compared++;
+            if (a.levels[level][index] == b.levels[level][index]) continue;
+            if (level == 0) {
+                int x0 = x * a.grid.tile_w, y0 = y * a.grid.tile_h;
+                int x1 = std::min(x0 + a.grid.tile_w, a.grid.width), y1 = std::min(y0 + a.grid.tile_h, a.grid.height);
+                difference.chunks.push_back({x0 / scale_x, y0 / scale_y, (x1 - x0 + scale_x - 1) / scale_x, (y1 - y0 + scale_y - 1) / scale_y});
+                continue;
+            }
+            int below_width = a.level_width(level - 1);
+            a.for_children(level - 1, x, y, [&](size_t child) { next.push_back({int(child % below_width), int(child / below_width)}); });
+        }
+        stack.swap(next);
+    }
+}
+
+// Compares two worlds by their hash trees. When the roots match nothing else is looked at.
+inline WorldDifference diff_hash_trees(const WorldHashTree& a, const WorldHashTree& b) {
+    WorldDifference difference;
+    difference.nodes_compared = 1;
+    if (a.root == b.root) {
+        difference.same = true;
+        return difference;
+    }
+    difference.dimensions_differ = a.world_width != b.world_width || a.world_height != b.world_height || a.chunk_width != b.chunk_width ||
+                                   a.chunk_height != b.chunk_height;
+
+    for (auto& raster : a.rasters) {
+        const RasterHashTree* other = b.find(raster.type, raster.layer_name);
+        difference.nodes_compared++;
+        if (other && other->root == raster.root) continue;
+
+        RasterDifference layer;
+        layer.type = raster.type;
+        layer.layer_name = raster.layer_name;
+        bool comparable = other && !difference.dimensions_differ && other->idmap_name == raster.idmap_name && other->grid.width == raster.grid.width &&
+                          other->grid.height == raster.grid.height && other->grid.tile_w == raster.grid.tile_w && other->grid.tile_h == raster.grid.tile_h;
+        if (comparable) {
+            diff_raster_trees(raster, *other, a, layer, difference.nodes_compared);
+        } else {
+            layer.missing = true;
+        }
+        difference.rasters.push_back(std::move(layer));
+    }
+    for (auto& raster : b.rasters) {
+        if (!a.find(raster.type, raster.layer_name)) difference.rasters.push_back({raster.type, raster.layer_name, true, {}});
+    }
+
+    auto find_icon_layer = [](const WorldHashTree& tree, const std::string& name) -> const uint64_t* {
+        for (auto& icon_layer : tree.icon_layers) {
+            if (icon_layer.first == name) return &icon_layer.second;
+        }
+        return nullptr;
+    };
+    for (auto& [name, hash] : a.icon_layers) {
+        const uint64_t* other = find_icon_layer(b, name);
+        if (!other || *other != hash) difference.icon_layers.push_back(name);
+    }
+    for (auto& icon_layer : b.icon_layers) {
+        if (!find_icon_layer(a, icon_layer.first)) difference.icon_layers.push_back(icon_layer.first);
+    }
+    return difference;
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+// Read-only memory mapped files, parsed in place with the ByteReader from nw_serialize.h.
+// Savefiles are parsed straight from the mapped pages, nothing is copied through stream buffers.
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "nw_serialize.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class MappedFile {
+    public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string& path) { open(path); }
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept : data_(other.data_), size_(other.size_) {
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            close();
+            data_ = other.data_;
+            size_ = other.size_;
+            other.data_ = nullptr;
+            other.size_ = 0;
+        }
+        return *this;
+    }
+
+    // Empty files can't be mapped and count as failures, a savefile is never empty
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart <= 0) {
+            CloseHandle(file);
+            return false;
+        }
+
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!mapping) return false;
+
+        // the view keeps the mapping alive after its handle is closed
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (!view) return false;
+
+        data_ = static_cast<const uint8_t*>(view);
+        size_ = static_cast<size_t>(file_size.QuadPart);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+
+        void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (view == MAP_FAILED) return false;
+        madvise(view, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+
+        data_ = static_cast<const uint8_t*>(view);
+        size_ = static_cast<size_t>(st.st_size);
+#endif
+        return true;
+    }
+
+    void close() {
+        if (!data_) return;
+#ifdef _WIN32
+        UnmapViewOfFile(data_);
+#else
+        munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool is_open() const { return data_ != nullptr; }
+
+    private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Where the bytes of a savefile come from. Loading parses them in place, so every source
+// hands out one contiguous block.
+class ByteSource {
+    public:
+    virtual ~ByteSource() = default;
+    virtual const uint8_t* data() const = 0;
+    virtual size_t size() const = 0;
+    // File the bytes can be read from again later, empty if they only exist in memory
+    virtual const std::string& path() const = 0;
+
+    ByteReader reader() const { return ByteReader(data(), size()); }
+};
+
+// A file on disk, memory mapped where possible and read into memory otherwise
+class FileSource : public ByteSource {
+    public:
+    FileSource() = default;
+    explicit FileSource(const std::string& path) { open(path); }
+
+    bool open(const std::string& path) {
+        close();
+        if (!file.open(path)) {
+            std::error_code error;
+            if (!std::filesystem::is_regular_file(path, error)) return false; // a directory opens as a stream too
+            std::ifstream in(path, std::ios::binary | std::ios::ate);
+            if (!in) return false;
+            std::streamoff length = in.tellg();
+            if (length <= 0) return false;
+            buffer.resize(static_cast<size_t>(length));
+            in.seekg(0);
+            if (!in.read(reinterpret_cast<char*>(buffer.data()), length)) {
+                buffer.clear();
+                return false;
+            }
+        }
+        path_ = path;
+        return true;
+    }
+
+    // Files have to be unmapped before they can be replaced or deleted on Windows
+    void close() {
+        file.close();
+        std::vector<uint8_t>().swap(buffer);
+        path_.clear();
+    }
+
+    bool is_open() const { return size() != 0; }
+    const uint8_t* data() const override { return file.is_open() ? file.data() : buffer.data(); }
+    size_t size() const override { return file.is_open() ? file.size() : buffer.size(); }
+    const std::string& path() const override { return path_; }
+
+    private:
+    MappedFile file;
+    std::vector<uint8_t> buffer;
+    std::string path_;
+};
+
+// Bytes that were never written to disk, e.g. a downloaded savefile
+class MemorySource : public ByteSource {
+    public:
+    MemorySource() = default;
+    explicit MemorySource(std::vector<uint8_t> bytes) : bytes(std::move(bytes)) {}
+
+    const uint8_t* data() const override { return bytes.data(); }
+    size_t size() const override { return bytes.size(); }
+    const std::string& path() const override { return no_path; }
+
+    private:
+    std::vector<uint8_t> bytes;
+    std::string no_path;
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+// IDmap palette files from ids/. "...name" starts a palette, every "id r g b text" line after it
+// is one entry and "...;" ends it. Parsed without SDL so the editor and nwtool read them alike.
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct PaletteEntry {
+    int id = 0;
+    int r = 0, g = 0, b = 0;
+    std::string text;
+};
+
+struct PaletteFile {
+    std::string name;
+    std::vector<PaletteEntry> entries;
+};
+
+// Appends every palette in a file. Malformed lines are reported and skipped, a palette
+// missing its "...;" ends with the file.
+inline void parse_palettes(std::istream& in, std::vector<PaletteFile>& palettes) {
+    std::string line;
+    PaletteFile palette;
+    bool inSection = false;
+
+    while (std::getline(in, line)) {
+        if (line.rfind("...", 0) == 0) {
+            if (line == "...;") {
+                if (inSection) {
+                    palettes.push_back(std::move(palette));
+                    palette = PaletteFile();
+                    inSection = false;
+                }
+            } else {
+                palette = PaletteFile();
+                palette.name = line.substr(3);
+                inSection = true;
+            }
+            continue;
+        }
+
+        if (!inSection)
+            continue;
+
+        std::istringstream iss(line);
+        PaletteEntry entry;
+        if (!(iss >> entry.id >> entry.r >> entry.g >> entry.b)) {
+            std::cerr << "Debug::MalformedLine => " << line << std::endl;
+            continue;
+        }
+
+        std::getline(iss, entry.text);
+        if (!entry.text.empty() && entry.text[0] == ' ')
+            entry.text.erase(0, 1);
+
+        palette.entries.push_back(std::move(entry));
+    }
+
+    if (inSection) palettes.push_back(std::move(palette));
+}
+
+// Reads the palettes of one file, false if it can't be opened
+inline bool read_palette_file(const std::filesystem::path& path, std::vector<PaletteFile>& palettes) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Debug::OpenFile::Error::" << path.filename().string() << std::endl;
+        return false;
+    }
+    parse_palettes(file, palettes);
+    return true;
+}
+
+// Reads the palettes of every file in a directory
+inline void read_palette_directory(const std::string& directory, std::vector<PaletteFile>& palettes) {
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        if (!entry.is_regular_file())
+            continue;
+        read_palette_file(entry.path(), palettes);
+    }
+}
+
+// RGBA8888 color of every id, ids the palette doesn't list and id 255 are transparent
+inline void palette_colors(const PaletteFile& palette, uint32_t colors[256]) {
+    for (int i = 0; i < 256; i++) colors[i] = 0;
+    for (auto& entry : palette.entries) {
+        if (entry.id < 0 || entry.id > 254) continue;
+        colors[entry.id] = (uint32_t(entry.r & 0xFF) << 24) | (uint32_t(entry.g & 0xFF) << 16) | (uint32_t(entry.b & 0xFF) << 8) | 0xFF;
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+// A pool of worker threads for splitting save/load work (layers, bands of tiles) across all cores.
+// Several threads may run parallel_for at the same time, e.g. a background save while a layer loads.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool {
+    public:
+    explicit WorkerPool(unsigned thread_count = std::max(1u, std::thread::hardware_concurrency())) {
+        // the thread calling parallel_for works too
+        for (unsigned i = 1; i < thread_count; i++) {
+            threads.emplace_back([this]() { work(); });
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) thread.join();
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    unsigned size() const { return unsigned(threads.size()) + 1; }
+
+    // Runs fn(i) for every i in [0, count) and returns once all of them are done
+    void parallel_for(size_t count, const std::function<void(size_t)>& fn) {
+        if (count == 0) return;
+        if (count == 1 || threads.empty()) {
+            for (size_t i = 0; i < count; i++) fn(i);
+            return;
+        }
+
+        auto batch = std::make_shared<Batch>();
+        batch->count = count;
+        batch->fn = &fn;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batches.push_back(batch);
+        }
+        wake.notify_all();
+
+        run(*batch);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&]() { return batch->done == batch->count; });
+    }
+
+    private:
+    struct Batch {
+        size_t count = 0;
+        const std::function<void(size_t)>* fn = nullptr;
+        std::atomic<size_t> next{0};
+        size_t done = 0; // guarded by the pool mutex
+    };
+
+    std::vector<std::thread> threads;
+    std::deque<std::shared_ptr<Batch>> batches;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    bool stopping = false;
+
+    // Takes indices of a batch until there are none left
+    void run(Batch& batch) {
+        size_t completed = 0;
+        for (size_t i = batch.next++; i < batch.count; i = batch.next++) {
+            (*batch.fn)(i);
+            completed++;
+        }
+        if (completed == 0) return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        batch.done += completed;
+        if (batch.done == batch.count) finished.notify_all();
+    }
+
+    void work() {
+        for (;;) {
+            std::shared_ptr<Batch> batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return stopping || !batches.empty(); });
+                if (stopping) return;
+                batch = batches.front();
+                // every index is handed out, the owner waits for the rest to finish
+                if (batch->next >= batch->count) {
+                    batches.pop_front();
+                    continue;
+                }
+            }
+            run(*batch);
+        }
+    }
+};
+
+// Size of the shared pool, every hardware thread unless NW_THREADS says otherwise
+// (NW_THREADS=1 gives the single threaded timings to compare the speedup against)
+inline unsigned worker_pool_threads() {
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    if (const char* value = std::getenv("NW_THREADS")) {
+        int requested = std::atoi(value);
+        if (requested > 0) threads = unsigned(requested);
+    }
+    return threads;
+}
+
+inline WorkerPool& worker_pool() {
+    static WorkerPool pool(worker_pool_threads());
+    return pool;
+}
@@ -0,0 +1,862 @@
+#pragma once
+
+// The .nw savefile format: header, section directory, preview block, tiled rasters and columnar
+// icon layers. Nothing in here needs SDL, so the editor and the headless nwtool share it.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "nw_codec.h"
+#include "nw_crc32c.h"
+#include "nw_hash.h"
+#include "nw_parallel.h"
+#include "nw_serialize.h"
+
+const char SAVE_MAGIC[4] = {'N', 'W', 'S', 'V'}; // version 1 saves have no magic and start with the world width
+const int32_t SAVE_MAX_NAME_LENGTH = 4096; // longest layer/IDmap name a loader accepts
+const uint32_t SAVE_VERSION = 6; // 2: rasters stored as compressed chunk-aligned tiles, 3: section directory, 4: preview block, 5: CRC32C per section, 6: columnar icon layers
+const uint32_t SAVE_RASTER_VERSION = 2; // oldest version whose rasters are stored the way they still are
+const uint32_t SAVE_ICON_COLUMNS_VERSION = 6; // oldest version whose icon layers are stored the way they still are
+const uint64_t SAVE_PREVIEW_OFFSET = 48; // the preview block follows the header at this offset, version 4 on
+const int SAVE_THUMBNAIL_MAX_WIDTH = 160;
+const int SAVE_THUMBNAIL_MAX_HEIGHT = 96;
+const uint32_t SAVE_PREVIEW_MAX_LENGTH = 1024 * 1024;
+
+enum SaveSectionType : uint32_t {
+    SECTION_WORLD_LAYER = 1,
+    SECTION_POLITICAL_LAYER = 2,
+    SECTION_ICON_LAYER = 3,
+    SECTION_SAVE_ID = 4, // random u64 written with every full save, ties the edit journal to it
+    SECTION_PREVIEW = 5, // thumbnail and metadata for the world browser, always at SAVE_PREVIEW_OFFSET
+    SECTION_HASH_TREE = 6, // tile hashes of every raster and the roots above them, see nw_hash_tree.h
+};
+
+const uint32_t SECTION_VISIBLE = 1 << 0; // section flags
+
+// Icon layer sections are, after the layer name, [u8 flags][varint civilian, military and shape counts]
+// and then one column per field, each [varint length][bytes]. Ids and counts are (zigzag) varints,
+// positions and shape points are zigzag varint deltas from the previous one in 1/ICON_POSITION_STEPS
+// pixel steps, or plain floats with ICON_COLUMNS_LOSSLESS. Before version 6 every icon was written whole.
+const int ICON_POSITION_STEPS = 16;
+const uint8_t ICON_COLUMNS_LOSSLESS = 1 << 0;
+
+// One entry of the section directory at the end of the savefile
+struct SaveSection {
+    uint32_t type = 0;
+    uint32_t flags = 0;
+    uint64_t offset = 0; // from the start of the file
+    uint64_t length = 0;
+    uint32_t crc32c = 0; // of the section bytes, version 5 on
+    std::string name;
+};
+
+struct SaveHeader {
+    uint32_t version = 0;
+    int32_t world_width = 0, world_height = 0, chunk_width = 0, chunk_height = 0;
+    int32_t num_layers_world = 0, num_layers_political = 0, num_layers_icon = 0;
+    std::vector<SaveSection> sections; // empty before version 3, layers then simply follow each other
+
+    // index-th section of a type, nullptr for saves without a directory
+    const SaveSection* find_section(uint32_t type, int index) const {
+        for (auto& section : sections) {
+            if (section.type == type && index-- == 0) return &section;
+        }
+        return nullptr;
+    }
+};
+
+// Icons and shapes as plain values, for saves and for icons that aren't created as textures
+struct CivilianIconSnapshot {
+    int icon_id;
+    float x, y;
+    std::string description;
+};
+
+struct MilitaryIconSnapshot {
+    int icon_id, country_id, quality;
+    float x, y, angle;
+    std::string description;
+    std::vector<int32_t> decorators;
+};
+
+struct ShapePoint {
+    float x, y;
+};
+
+struct ShapeSnapshot {
+    uint8_t r = 255, g = 255, b = 255, a = 255;
+    std::vector<ShapePoint> points;
+};
+
+struct IconLayerSnapshot {
+    std::string layer_name;
+    bool visible = true;
+    bool lossless_positions = false; // LOSSLESS_ICON_POSITIONS when the snapshot was taken
+    std::vector<CivilianIconSnapshot> civilian_icons;
+    std::vector<MilitaryIconSnapshot> military_icons;
+    std::vector<ShapeSnapshot> shapes;
+};
+
+// A raster ready to be written: tile table plus compressed tiles
+struct EncodedRaster {
+    TileGrid grid;
+    std::vector<uint64_t> offsets;
+    std::vector<uint8_t> payload;
+    std::vector<uint64_t> tile_hashes; // of the ids of every tile, the leaves of the hash tree
+};
+
+// Writes a raster as a tile table followed by the compressed tiles
+inline void write_encoded_raster(std::ostream& out, const EncodedRaster& raster) {
+    int32_t tile_w = raster.grid.tile_w, tile_h = raster.grid.tile_h;
+    out.write(reinterpret_cast<const char*>(&tile_w), sizeof(tile_w));
+    out.write(reinterpret_cast<const char*>(&tile_h), sizeof(tile_h));
+    out.write(reinterpret_cast<const char*>(raster.offsets.data()), raster.offsets.size() * sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(raster.payload.data()), raster.payload.size());
+
+    std::cout << "Debug::RasterSaved::" << raster.grid.count() << " tiles, " << size_t(raster.grid.width) * raster.grid.height << " -> " << raster.payload.size() << " bytes" << std::endl;
+}
+
+// Returns the savefile version and leaves the reader at the world dimensions, 0 if unreadable
+inline uint32_t read_save_version(ByteReader& in) {
+    const uint8_t* magic = in.take(sizeof(SAVE_MAGIC));
+    if (!magic) return 0;
+
+    if (std::memcmp(magic, SAVE_MAGIC, sizeof(SAVE_MAGIC)) != 0) {
+        in.seek(0);
+        return 1;
+    }
+
+    uint32_t version = 0;
+    return in.read(version) ? version : 0;
+}
+
+// Reads the fixed size part of the header, the reader is left where the directory location
+// would be for version 3 on. Doesn't look past the first SAVE_PREVIEW_OFFSET bytes.
+inline bool read_save_header_fields(ByteReader& in, SaveHeader& header) {
+    header.version = read_save_version(in);
+    if (header.version == 0 || header.version > SAVE_VERSION) return false;
+
+    in.read(header.world_width);
+    in.read(header.world_height);
+    in.read(header.chunk_width);
+    in.read(header.chunk_height);
+    in.read(header.num_layers_world);
+    in.read(header.num_layers_political);
+    in.read(header.num_layers_icon);
+    if (!in) return false;
+
+    // layers are as big as the world in chunks times the chunk size, that has to fit an int.
+    // A world that was never given a size is saved as 0x0.
+    if (header.world_width < 0 || header.world_height < 0 || header.chunk_width < 0 || header.chunk_height < 0) return false;
+    if (int64_t(header.world_width) * header.chunk_width > RASTER_MAX_EXTENT) return false;
+    if (int64_t(header.world_height) * header.chunk_height > RASTER_MAX_EXTENT) return false;
+    return header.num_layers_world >= 0 && header.num_layers_political >= 0 && header.num_layers_icon >= 0;
+}
+
+// Reads everything up to the first layer, for version 3 also the section directory
+inline bool read_save_header(ByteReader& in, SaveHeader& header) {
+    if (!read_save_header_fields(in, header)) return false;
+    if (header.version < 3) return true;
+
+    uint64_t directory_offset;
+    uint32_t section_count;
+    in.read(directory_offset);
+    in.read(section_count);
+    if (!in) return false;
+    size_t first_layer = in.tell();
+
+    in.seek(directory_offset);
+    for (uint32_t i = 0; i < section_count; i++) {
+        SaveSection section;
+        in.read(section.type);
+        in.read(section.flags);
+        in.read(section.offset);
+        in.read(section.length);
+        if (header.version >= 5) in.read(section.crc32c);
+        if (!in.read_string<int32_t>(section.name, SAVE_MAX_NAME_LENGTH)) return false;
+        // a truncated file ends before the sections it lists
+        if (section.offset > in.size || section.length > in.size - section.offset) return false;
+        header.sections.push_back(section);
+    }
+
+    // Version 5 closes the directory with a CRC32C of the fixed header and the directory
+    if (header.version >= 5) {
+        size_t directory_end = in.tell();
+        uint32_t stored_crc;
+        if (!in.read(stored_crc) || directory_offset < SAVE_PREVIEW_OFFSET) return false;
+        uint32_t crc = nw_crc32c(in.data, SAVE_PREVIEW_OFFSET);
+        crc = nw_crc32c(in.data + directory_offset, directory_end - directory_offset, crc);
+        if (crc != stored_crc) return false;
+    }
+
+    in.seek(first_layer);
+    return bool(in);
+}
+
+// Checks every section of a version 5 savefile against its CRC32C, the header and directory
+// were checked by read_save_header already. Reads the whole file but builds nothing, so a
+// damaged or truncated download is turned away before any layer exists.
+inline bool verify_savefile(const uint8_t* data, size_t size, const SaveHeader& header, std::string& error) {
+    if (header.version < 5) return true; // nothing to check against
+
+    auto start = std::chrono::steady_clock::now();
+
+    // biggest first so one huge lower layer doesn't start last
+    std::vector<const SaveSection*> sections;
+    uint64_t total_bytes = 0;
+    for (auto& section : header.sections) {
+        sections.push_back(&section);
+        total_bytes += section.length;
+    }
+    std::sort(sections.begin(), sections.end(), [](const SaveSection* a, const SaveSection* b) { return a->length > b->length; });
+
+    std::vector<uint8_t> section_ok(sections.size(), 0);
+    worker_pool().parallel_for(sections.size(), [&](size_t i) {
+        const SaveSection& section = *sections[i];
+        section_ok[i] = section.offset <= size && section.length <= size - section.offset &&
+                        nw_crc32c(data + section.offset, size_t(section.length)) == section.crc32c;
+    });
+
+    for (size_t i = 0; i < sections.size(); i++) {
+        if (!section_ok[i]) {
+            error = "section " + std::to_string(sections[i]->type) + (sections[i]->name.empty() ? "" : " (" + sections[i]->name + ")") + " is damaged";
+            return false;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double megabytes = double(total_bytes) / (1024.0 * 1024.0);
+    std::cout << "Debug::Verified::" << sections.size() << " sections, " << megabytes << " MB in " << seconds * 1000.0 << " ms ("
+              << (seconds > 0.0 ? megabytes / seconds : 0.0) << " MB/s)" << std::endl;
+    return true;
+}
+
+// What the world browser shows for a savefile without loading it
+struct SavePreview {
+    SaveHeader header; // dimensions and layer counts, without the directory
+    int64_t save_time = 0; // seconds since the epoch, 0 before version 4
+    int32_t civilian_icons = 0, military_icons = 0, shapes = 0;
+    int thumbnail_width = 0, thumbnail_height = 0;
+    std::vector<uint32_t> thumbnail; // RGBA8888, empty before version 4
+};
+
+// Reads the header and the preview block, a few kilobytes at the start of the file.
+// Older saves only have the header, a damaged preview block is left out the same way.
+inline bool read_save_preview(const std::string& filename, SavePreview& preview) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) return false;
+
+    uint8_t head[SAVE_PREVIEW_OFFSET + sizeof(uint32_t)] = {};
+    file.read(reinterpret_cast<char*>(head), sizeof(head));
+    ByteReader in(head, size_t(file.gcount()));
+    if (!read_save_header_fields(in, preview.header)) return false;
+    if (preview.header.version < 4) return true;
+
+    uint32_t block_length = 0;
+    in.seek(SAVE_PREVIEW_OFFSET);
+    if (!in.read(block_length) || block_length > SAVE_PREVIEW_MAX_LENGTH) return true;
+    std::vector<uint8_t> block(block_length);
+    if (!file.read(reinterpret_cast<char*>(block.data()), block_length)) return true;
+
+    ByteReader body(block.data(), block.size());
+    body.read(preview.save_time);
+    body.read(preview.civilian_icons);
+    body.read(preview.military_icons);
+    body.read(preview.shapes);
+
+    uint16_t width = 0, height = 0;
+    uint32_t encoded_length = 0;
+    body.read(width);
+    body.read(height);
+    body.read(encoded_length);
+    const uint8_t* encoded = body.take(encoded_length);
+    if (!encoded || width == 0 || height == 0 || width > SAVE_THUMBNAIL_MAX_WIDTH || height > SAVE_THUMBNAIL_MAX_HEIGHT) return true;
+
+    std::vector<uint8_t> rgb(size_t(width) * height * 3);
+    if (!decode_tile(encoded, encoded_length, rgb.data(), rgb.size())) return true;
+
+    preview.thumbnail.resize(size_t(width) * height);
+    for (size_t i = 0; i < preview.thumbnail.size(); i++) {
+        preview.thumbnail[i] = (uint32_t(rgb[i * 3]) << 24) | (uint32_t(rgb[i * 3 + 1]) << 16) | (uint32_t(rgb[i * 3 + 2]) << 8) | 0xFF;
+    }
+    preview.thumbnail_width = width;
+    preview.thumbnail_height = height;
+    return true;
+}
+
+// Sizes the thumbnail of a world_width x world_height world to fit SAVE_THUMBNAIL_MAX_WIDTH x
+// SAVE_THUMBNAIL_MAX_HEIGHT and fills it with the background, layers are blended on top of it
+inline void start_save_thumbnail(SavePreview& preview, int world_width, int world_height) {
+    double scale = std::min({1.0, double(SAVE_THUMBNAIL_MAX_WIDTH) / std::max(1, world_width),
+                             double(SAVE_THUMBNAIL_MAX_HEIGHT) / std::max(1, world_height)});
+    preview.thumbnail_width = std::max(1, int(world_width * scale + 0.5));
+    preview.thumbnail_height = std::max(1, int(world_height * scale + 0.5));
+    preview.thumbnail.assign(size_t(preview.thumbnail_width) * preview.thumbnail_height, 0x202020FF);
+}
+
+// Blends a layer of width x height pixels over the thumbnail, sample(x, y) returns its RGBA8888
+// pixel. Only the pixels under thumbnail pixel centers are sampled, lower and upper layers cover
+// the same world.
+template <typename Sample>
+void blend_save_thumbnail(SavePreview& preview, int width, int height, Sample sample) {
+    int thumbnail_width = preview.thumbnail_width, thumbnail_height = preview.thumbnail_height;
+    for (int y = 0; y < thumbnail_height; y++) {
+        int source_y = int(int64_t(2 * y + 1) * height / (2 * thumbnail_height));
+        for (int x = 0; x < thumbnail_width; x++) {
+            uint32_t src = sample(int(int64_t(2 * x + 1) * width / (2 * thumbnail_width)), source_y);
+            uint32_t alpha = src & 0xFF;
+            if (alpha == 0) continue;
+
+            uint32_t& dst = preview.thumbnail[size_t(y) * thumbnail_width + x];
+            uint32_t blended = 0xFF;
+            for (int shift = 8; shift <= 24; shift += 8) {
+                uint32_t s = (src >> shift) & 0xFF, d = (dst >> shift) & 0xFF;
+                blended |= ((s * alpha + d * (255 - alpha)) / 255) << shift;
+            }
+            dst = blended;
+        }
+    }
+}
+
+// Writes the preview block: its length, save time, icon counts and the compressed thumbnail
+inline void write_save_preview(std::ostream& out, const SavePreview& preview) {
+    std::vector<uint8_t> rgb(preview.thumbnail.size() * 3);
+    for (size_t i = 0; i < preview.thumbnail.size(); i++) {
+        rgb[i * 3] = uint8_t(preview.thumbnail[i] >> 24);
+        rgb[i * 3 + 1] = uint8_t(preview.thumbnail[i] >> 16);
+        rgb[i * 3 + 2] = uint8_t(preview.thumbnail[i] >> 8);
+    }
+    std::vector<uint8_t> encoded;
+    encode_tile(rgb.data(), rgb.size(), encoded);
+
+    ByteWriter block;
+    block.write(preview.save_time);
+    block.write(preview.civilian_icons);
+    block.write(preview.military_icons);
+    block.write(preview.shapes);
+    block.write(uint16_t(preview.thumbnail_width));
+    block.write(uint16_t(preview.thumbnail_height));
+    block.write(uint32_t(encoded.size()));
+    block.write_bytes(encoded.data(), encoded.size());
+
+    uint32_t block_length = nw_little_endian(uint32_t(block.size()));
+    out.write(reinterpret_cast<const char*>(&block_length), sizeof(block_length));
+    out.write(reinterpret_cast<const char*>(block.data()), std::streamsize(block.size()));
+}
+
+inline bool read_tile_table(ByteReader& in, int width, int height, TileGrid& grid, std::vector<uint64_t>& offsets) {
+    int32_t tile_w, tile_h;
+    in.read(tile_w);
+    in.read(tile_h);
+    if (!in) return false;
+
+    // count() + 1 offsets have to be in the file, a bigger count is damage and nothing to allocate
+    uint64_t tiles = checked_tile_count(width, height, tile_w, tile_h);
+    if (tiles == 0 || tiles >= in.remaining() / sizeof(uint64_t)) return false;
+
+    grid = make_tile_grid_sized(width, height, tile_w, tile_h);
+    size_t table_size = (size_t(grid.count()) + 1) * sizeof(uint64_t);
+    const uint8_t* table = in.take(table_size);
+    if (!table) return false;
+
+    // the table isn't 8-byte aligned in the file
+    offsets.resize(size_t(grid.count()) + 1);
+    std::memcpy(offsets.data(), table, table_size);
+    return offsets[0] == 0;
+}
+
+// A raster found in a mapped savefile, waiting to be decoded into a layer's ids
+struct RasterDecodeJob {
+    uint32_t version = 0;
+    TileGrid grid; // version 1 rasters aren't tiled, they get full width bands to split the work
+    std::vector<uint64_t> offsets;
+    const uint8_t* payload = nullptr; // points into the mapped savefile
+    size_t payload_size = 0;
+};
+
+// Rows per band of an untiled version 1 raster
+const int RASTER_V1_BAND_ROWS = 64;
+
+// Reads the tile table of a raster and moves the reader past its tiles without decoding them
+inline bool parse_raster(ByteReader& in, uint32_t version, int width, int height, RasterDecodeJob& job) {
+    job.version = version;
+    if (version == 1) {
+        job.grid = make_tile_grid_sized(width, height, width, RASTER_V1_BAND_ROWS);
+        job.payload_size = size_t(width) * height;
+        job.payload = in.take(job.payload_size);
+        return job.payload != nullptr;
+    }
+
+    if (!read_tile_table(in, width, height, job.grid, job.offsets)) return false;
+    job.payload_size = size_t(job.offsets.back());
+    job.payload = in.take(job.offsets.back());
+    return job.payload != nullptr;
+}
+
+// Moves the reader past a raster that can't be loaded
+inline bool skip_raster(ByteReader& in, uint32_t version, int width, int height) {
+    if (version == 1) {
+        return in.skip(uint64_t(width) * height);
+    }
+
+    TileGrid grid;
+    std::vector<uint64_t> offsets;
+    if (!read_tile_table(in, width, height, grid, offsets)) return false;
+    return in.skip(offsets.back());
+}
+
+// Decodes tile_rows rows of tiles of a raster found by parse_raster, from first_tile_row on, into
+// rows of pitch bytes, ids being the top row of first_tile_row. Bands of tiles are tasks on the
+// worker pool. Returns false if any tile is damaged.
+inline bool decode_raster_rows(const RasterDecodeJob& job, int first_tile_row, int tile_rows, uint8_t* ids, size_t pitch) {
+    const TileGrid& grid = job.grid;
+    std::vector<uint8_t> band_ok(size_t(std::max(0, tile_rows)), 1);
+    worker_pool().parallel_for(band_ok.size(), [&](size_t index) {
+        int tile_row = first_tile_row + int(index);
+        int y0 = tile_row * grid.tile_h;
+        uint8_t* band = ids + size_t(index) * grid.tile_h * pitch;
+        if (job.version == 1) {
+            int band_height = std::min(grid.tile_h, grid.height - y0);
+            for (int y = 0; y < band_height; y++) {
+                std::memcpy(band + size_t(y) * pitch, job.payload + size_t(y0 + y) * grid.width, size_t(grid.width));
+            }
+            return;
+        }
+        band_ok[index] = decode_tile_band(grid, tile_row, job.payload, job.payload_size, job.offsets.data(), band, pitch);
+    });
+    return std::find(band_ok.begin(), band_ok.end(), 0) == band_ok.end();
+}
+
+// Decodes a whole raster found by parse_raster into ids, rows of pitch bytes
+inline bool decode_raster_ids(const RasterDecodeJob& job, uint8_t* ids, size_t pitch) {
+    return decode_raster_rows(job, 0, job.grid.tiles_y, ids, pitch);
+}
+
+// The fields in front of the raster of a world or political layer section
+struct SaveRasterHeader {
+    std::string layer_name;
+    std::string idmap_name;
+    std::string world_layer_name; // political layers only
+    int32_t width = 0, height = 0;
+    bool is_upper = true; // stored for world layers only, political layers always are
+};
+
+// Reads a layer header of type SECTION_WORLD_LAYER or SECTION_POLITICAL_LAYER, the reader is
+// left at the raster
+inline bool read_raster_header(ByteReader& in, uint32_t type, SaveRasterHeader& header) {
+    in.read_string<int32_t>(header.layer_name, SAVE_MAX_NAME_LENGTH);
+    in.read_string<int32_t>(header.idmap_name, SAVE_MAX_NAME_LENGTH);
+    if (type == SECTION_POLITICAL_LAYER) in.read_string<int32_t>(header.world_layer_name, SAVE_MAX_NAME_LENGTH);
+    in.read(header.width);
+    in.read(header.height);
+    if (type == SECTION_WORLD_LAYER) {
+        uint8_t is_upper = 0;
+        in.read(is_upper);
+        header.is_upper = is_upper != 0;
+    }
+    if (!in) return false;
+    return header.width > 0 && header.height > 0 && header.width <= RASTER_MAX_EXTENT && header.height <= RASTER_MAX_EXTENT;
+}
+
+// Nearest 1/ICON_POSITION_STEPS pixel step, halves away from zero like llround without calling into libm
+inline int64_t to_position_steps(float value) {
+    double scaled = double(value) * ICON_POSITION_STEPS;
+    return int64_t(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+}
+
+// Writes an icon layer section body, also used for icon layers in the edit journal
+inline void write_icon_layer(ByteWriter& out, const IconLayerSnapshot& icon_layer) {
+    // positions too far out for the steps to fit 32 bits (or not numbers) are kept as floats
+    bool lossless = icon_layer.lossless_positions;
+    auto fits = [](float value) { return std::isfinite(value) && std::fabs(value) < float(1 << 30) / ICON_POSITION_STEPS; };
+    for (auto& icon : icon_layer.civilian_icons) lossless = lossless || !fits(icon.x) || !fits(icon.y);
+    for (auto& icon : icon_layer.military_icons) lossless = lossless || !fits(icon.x) || !fits(icon.y);
+    for (auto& shape : icon_layer.shapes) {
+        for (auto& point : shape.points) lossless = lossless || !fits(point.x) || !fits(point.y);
+    }
+
+    out.write_string<int32_t>(icon_layer.layer_name);
+    out.write(uint8_t(lossless ? ICON_COLUMNS_LOSSLESS : 0));
+    out.write_varint(icon_layer.civilian_icons.size());
+    out.write_varint(icon_layer.military_icons.size());
+    out.write_varint(icon_layer.shapes.size());
+
+    ByteWriter column;
+    auto end_column = [&]() {
+        out.write_varint(column.size());
+        out.write_bytes(column.data(), column.size());
+        column.clear();
+    };
+    int64_t last_x = 0, last_y = 0; // in steps, every position column starts from 0, 0
+    auto write_position = [&](float x, float y) {
+        if (lossless) {
+            column.write(x);
+            column.write(y);
+            return;
+        }
+        int64_t step_x = to_position_steps(x);
+        int64_t step_y = to_position_steps(y);
+        column.write_zigzag(step_x - last_x);
+        column.write_zigzag(step_y - last_y);
+        last_x = step_x;
+        last_y = step_y;
+    };
+    auto write_description = [&](const std::string& description) {
+        column.write_varint(description.size());
+        column.write_bytes(description.data(), description.size());
+    };
+
+    // Civilian icons: ids, positions, descriptions
+    for (auto& icon : icon_layer.civilian_icons) column.write_zigzag(icon.icon_id);
+    end_column();
+    last_x = last_y = 0;
+    for (auto& icon : icon_layer.civilian_icons) write_position(icon.x, icon.y);
+    end_column();
+    for (auto& icon : icon_layer.civilian_icons) write_description(icon.description);
+    end_column();
+
+    // Military icons: ids, countries, qualities, angles, positions, descriptions, decorators
+    for (auto& icon : icon_layer.military_icons) column.write_zigzag(icon.icon_id);
+    end_column();
+    for (auto& icon : icon_layer.military_icons) column.write_zigzag(icon.country_id);
+    end_column();
+    for (auto& icon : icon_layer.military_icons) column.write_zigzag(icon.quality);
+    end_column();
+    for (auto& icon : icon_layer.military_icons) column.write(icon.angle);
+    end_column();
+    last_x = last_y = 0;
+    for (auto& icon : icon_layer.military_icons) write_position(icon.x, icon.y);
+    end_column();
+    for (auto& icon : icon_layer.military_icons) write_description(icon.description);
+    end_column();
+    for (auto& icon : icon_layer.military_icons) {
+        column.write_varint(icon.decorators.size());
+        for (int32_t decorator_id : icon.decorators) column.write_zigzag(decorator_id);
+    }
+    end_column();
+
+    // Shapes: colors, point counts, points following on from the previous shape's last point
+    for (auto& shape : icon_layer.shapes) {
+        uint8_t color[4] = {shape.r, shape.g, shape.b, shape.a};
+        column.write_bytes(color, sizeof(color));
+    }
+    end_column();
+    for (auto& shape : icon_layer.shapes) column.write_varint(shape.points.size());
+    end_column();
+    last_x = last_y = 0;
+    for (auto& shape : icon_layer.shapes) {
+        for (auto& point : shape.points) write_position(point.x, point.y);
+    }
+    end_column();
+}
+
+// Hash of an icon layer as it would be written, tells whether it changed since the last save
+inline uint64_t hash_icon_layer(const IconLayerSnapshot& icon_layer) {
+    ByteWriter out;
+    write_icon_layer(out, icon_layer);
+    return nw_hash64(out.data(), out.size());
+}
+
+// Reads the columns of an icon layer section, after its name
+inline bool read_icon_columns(ByteReader& in, IconLayerSnapshot& icon_layer) {
+    uint8_t flags = 0;
+    uint64_t num_civilian_icons = 0, num_military_icons = 0, num_shapes = 0;
+    in.read(flags);
+    in.read_varint(num_civilian_icons);
+    in.read_varint(num_military_icons);
+    in.read_varint(num_shapes);
+    auto next_column = [&]() {
+        uint64_t length = 0;
+        in.read_varint(length);
+        return in.slice(length);
+    };
+
+    bool lossless = flags & ICON_COLUMNS_LOSSLESS;
+    icon_layer.lossless_positions = lossless;
+    int64_t last_x = 0, last_y = 0;
+    auto read_position = [&](ByteReader& column, float& x, float& y) {
+        if (lossless) return column.read(x) && column.read(y);
+        int64_t delta_x = 0, delta_y = 0;
+        column.read_zigzag(delta_x);
+        column.read_zigzag(delta_y);
+        last_x += delta_x;
+        last_y += delta_y;
+        x = float(double(last_x) / ICON_POSITION_STEPS);
+        y = float(double(last_y) / ICON_POSITION_STEPS);
+        return bool(column);
+    };
+    auto read_id = [](ByteReader& column, int& id) {
+        int64_t value = 0;
+        column.read_zigzag(value);
+        id = int(value);
+        return bool(column);
+    };
+    auto read_description = [](ByteReader& column, std::string& description) {
+        uint64_t length = 0;
+        column.read_varint(length);
+        const uint8_t* bytes = column.take(length);
+        if (!bytes) return false;
+        description.assign(reinterpret_cast<const char*>(bytes), size_t(length));
+        return true;
+    };
+
+    // every icon takes at least a byte of its id column, a damaged count fails before anything is reserved
+    ByteReader ids = next_column(), positions = next_column(), descriptions = next_column();
+    if (num_civilian_icons <= ids.remaining()) icon_layer.civilian_icons.reserve(size_t(num_civilian_icons));
+    for (uint64_t j = 0; j < num_civilian_icons; j++) {
+        CivilianIconSnapshot icon;
+        if (!read_id(ids, icon.icon_id) || !read_position(positions, icon.x, icon.y) || !read_description(descriptions, icon.description)) {
+            in.failed = true;
+            break;
+        }
+        icon_layer.civilian_icons.push_back(std::move(icon));
+    }
+
+    ids = next_column();
+    ByteReader countries = next_column(), qualities = next_column(), angles = next_column();
+    positions = next_column();
+    descriptions = next_column();
+    ByteReader decorators = next_column();
+    last_x = last_y = 0;
+    if (num_military_icons <= ids.remaining()) icon_layer.military_icons.reserve(size_t(num_military_icons));
+    for (uint64_t j = 0; j < num_military_icons; j++) {
+        MilitaryIconSnapshot icon;
+        uint64_t num_decorators = 0;
+        if (!read_id(ids, icon.icon_id) || !read_id(countries, icon.country_id) || !read_id(qualities, icon.quality) || !angles.read(icon.angle) ||
+            !read_position(positions, icon.x, icon.y) || !read_description(descriptions, icon.description) || !decorators.read_varint(num_decorators) ||
+            num_decorators > decorators.remaining()) {
+            in.failed = true;
+            break;
+        }
+        icon.decorators.resize(size_t(num_decorators));
+        for (auto& decorator_id : icon.decorators) {
+            int id = 0;
+            read_id(decorators, id);
+            decorator_id = id;
+        }
+        if (!decorators) {
+            in.failed = true;
+            break;
+        }
+        icon_layer.military_icons.push_back(std::move(icon));
+    }
+
+    ByteReader colors = next_column(), point_counts = next_column();
+    positions = next_column();
+    last_x = last_y = 0;
+    for (uint64_t j = 0; j < num_shapes; j++) {
+        const uint8_t* color = colors.take(4);
+        uint64_t num_points = 0;
+        // every point takes at least two bytes, a damaged count fails before anything is allocated
+        if (!color || !point_counts.read_varint(num_points) || num_points > positions.remaining() / 2 || num_points > uint64_t(INT32_MAX)) {
+            in.failed = true;
+            break;
+        }
+        ShapeSnapshot shape;
+        shape.r = color[0];
+        shape.g = color[1];
+        shape.b = color[2];
+        shape.a = color[3];
+        shape.points.resize(size_t(num_points));
+        for (auto& point : shape.points) {
+            if (!read_position(positions, point.x, point.y)) break;
+        }
+        if (!positions) {
+            in.failed = true;
+            break;
+        }
+        icon_layer.shapes.push_back(std::move(shape));
+    }
+    return bool(in);
+}
+
+// Reads the icons and shapes of an icon layer section after its name. Nothing is created
+// from them here, so it can run on the loader thread. columnar is false for sections from
+// before version 6 and JOURNAL_ICON_LAYER records.
+inline bool read_icon_layer(ByteReader& in, IconLayerSnapshot& icon_layer, bool columnar) {
+    if (columnar) return read_icon_columns(in, icon_layer);
+
+    int32_t num_civilian_icons = 0, num_military_icons = 0, num_shapes = 0;
+    std::vector<float> point_coordinates; // x, y pairs
+
+    in.read(num_civilian_icons);
+    for (int j = 0; j < num_civilian_icons; j++) {
+        CivilianIconSnapshot icon;
+        int32_t icon_id;
+        in.read(icon_id);
+        in.read(icon.x);
+        in.read(icon.y);
+        in.read_string<std::uint64_t>(icon.description, in.remaining());
+        if (!in) break;
+        icon.icon_id = icon_id;
+        icon_layer.civilian_icons.push_back(std::move(icon));
+    }
+
+    in.read(num_military_icons);
+    for (int j = 0; j < num_military_icons; j++) {
+        MilitaryIconSnapshot icon;
+        int32_t icon_id, country_id, quality;
+        in.read(icon_id);
+        in.read(icon.angle);
+        in.read(country_id);
+        in.read(quality);
+        in.read(icon.x);
+        in.read(icon.y);
+        in.read_string<std::uint64_t>(icon.description, in.remaining());
+        if (!in) break;
+
+        int32_t num_decorators;
+        in.read(num_decorators);
+        if (!in || num_decorators < 0 || !in.read_array(icon.decorators, uint64_t(num_decorators))) break;
+
+        icon.icon_id = icon_id;
+        icon.country_id = country_id;
+        icon.quality = quality;
+        icon_layer.military_icons.push_back(std::move(icon));
+    }
+
+    in.read(num_shapes);
+    for(int j = 0; j<num_shapes; j++){
+        uint8_t r, g, b, a;
+        in.read(r);
+        in.read(g);
+        in.read(b);
+        in.read(a);
+
+        int32_t num_points;
+        in.read(num_points);
+        if (!in || num_points < 0 || !in.read_array(point_coordinates, uint64_t(num_points) * 2)) break;
+
+        ShapeSnapshot shape;
+        shape.r = r;
+        shape.g = g;
+        shape.b = b;
+        shape.a = a;
+        shape.points.resize(size_t(num_points));
+        for (int32_t k = 0; k < num_points; k++) shape.points[k] = {point_coordinates[2 * k], point_coordinates[2 * k + 1]};
+        icon_layer.shapes.push_back(std::move(shape));
+    }
+    return bool(in);
+}
+
+// Writes a savefile of the current version. Sections are checksummed as they stream through,
+// the layer counts and the section directory are filled in by finish().
+class SavefileWriter {
+    public:
+    explicit SavefileWriter(std::streambuf* target) : crc_buf(target), out(&crc_buf) {}
+
+    std::ostream& stream() { return out; }
+    uint64_t tell() { return static_cast<uint64_t>(out.tellp()); }
+
+    void write_header(int32_t world_width, int32_t world_height, int32_t chunk_width, int32_t chunk_height) {
+        out.write(SAVE_MAGIC, sizeof(SAVE_MAGIC));
+        fields[0] = int32_t(SAVE_VERSION);
+        fields[1] = world_width;
+        fields[2] = world_height;
+        fields[3] = chunk_width;
+        fields[4] = chunk_height;
+        for (int i = 0; i < 5; i++) write(fields[i]);
+
+        // layer counts and the directory location, filled in by finish()
+        counts_position = out.tellp();
+        write_counts();
+    }
+
+    void begin_section(uint32_t type, bool visible, const std::string& name) {
+        SaveSection section;
+        section.type = type;
+        section.flags = visible ? SECTION_VISIBLE : 0;
+        section.offset = tell();
+        section.name = name;
+        sections.push_back(section);
+        crc_buf.reset();
+    }
+
+    void end_section() {
+        SaveSection& section = sections.back();
+        section.length = tell() - section.offset;
+        section.crc32c = crc_buf.value();
+        if (section.type == SECTION_WORLD_LAYER) num_layers_world++;
+        if (section.type == SECTION_POLITICAL_LAYER) num_layers_political++;
+        if (section.type == SECTION_ICON_LAYER) num_layers_icon++;
+    }
+
+    void write_string(const std::string& value) {
+        write(int32_t(value.size()));
+        out.write(value.data(), std::streamsize(value.size()));
+    }
+
+    // The header read_raster_header expects in front of a raster of a type section
+    void write_raster_header(uint32_t type, const SaveRasterHeader& header) {
+        write_string(header.layer_name);
+        write_string(header.idmap_name);
+        if (type == SECTION_POLITICAL_LAYER) write_string(header.world_layer_name);
+        write(header.width);
+        write(header.height);
+        if (type == SECTION_WORLD_LAYER) write(uint8_t(header.is_upper ? 1 : 0));
+    }
+
+    // Writes the section directory and goes back to fill in the header, false if any write failed
+    bool finish() {
+        directory_offset = tell();
+        section_count = uint32_t(sections.size());
+
+        // The directory CRC also covers the header, whose counts are only known now
+        ByteWriter header_fields;
+        header_fields.write_bytes(SAVE_MAGIC, sizeof(SAVE_MAGIC));
+        for (int32_t field : fields) header_fields.write(field);
+        header_fields.write(num_layers_world);
+        header_fields.write(num_layers_political);
+        header_fields.write(num_layers_icon);
+        header_fields.write(directory_offset);
+        header_fields.write(section_count);
+        crc_buf.reset(nw_crc32c(header_fields.data(), header_fields.size()));
+
+        for (auto& section : sections) {
+            write(section.type);
+            write(section.flags);
+            write(section.offset);
+            write(section.length);
+            write(section.crc32c);
+            write_string(section.name);
+        }
+        write(crc_buf.value());
+
+        out.seekp(counts_position);
+        write_counts();
+        out.flush();
+        return bool(out);
+    }
+
+    private:
+    Crc32cStreamBuf crc_buf;
+    std::ostream out;
+    std::streamoff counts_position = 0;
+    int32_t fields[5] = {}; // version, world and chunk dimensions
+    int32_t num_layers_world = 0, num_layers_political = 0, num_layers_icon = 0;
+    uint64_t directory_offset = 0;
+    uint32_t section_count = 0;
+    std::vector<SaveSection> sections;
+
+    template <typename T>
+    void write(T value) {
+        value = nw_little_endian(value);
+        out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void write_counts() {
+        write(num_layers_world);
+        write(num_layers_political);
+        write(num_layers_icon);
+        write(directory_offset);
+        write(section_count);
+    }
+};
@@ -0,0 +1,216 @@
+#pragma once
+
+// Little-endian serializer/deserializer pair for savefile sections. ByteWriter appends to a
+// growable buffer that is written out in one go, ByteReader parses bytes in place.
+// Arrays of plain values (shape points, decorator ids) are copied in bulk, small integers
+// can be written as varints (LEB128, 7 bits per byte) and signed ones zigzag encoded first.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define NW_BIG_ENDIAN 1
+#endif
+
+// Reverses the bytes of a plain value on big-endian hosts, so the file is little-endian everywhere
+template <typename T>
+inline T nw_little_endian(T value) {
+#ifdef NW_BIG_ENDIAN
+    uint8_t bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    for (size_t i = 0; i < sizeof(T) / 2; i++) std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+    std::memcpy(&value, bytes, sizeof(T));
+#endif
+    return value;
+}
+
+class ByteWriter {
+    public:
+    const uint8_t* data() const { return bytes.data(); }
+    size_t size() const { return length; }
+    void reserve(size_t capacity) {
+        if (capacity > bytes.size()) bytes.resize(capacity);
+    }
+    void clear() { length = 0; }
+
+    template <typename T>
+    void write(T value) {
+        static_assert(std::is_arithmetic<T>::value, "ByteWriter::write needs a number");
+        value = nw_little_endian(value);
+        append(&value, sizeof(T));
+    }
+
+    void write_bytes(const void* data, size_t n) { append(data, n); }
+
+    void write_varint(uint64_t value) {
+        if (value < 0x80 && length < bytes.size()) { // most are a single byte
+            bytes[length++] = uint8_t(value);
+            return;
+        }
+        if (bytes.size() - length < 10) grow(10);
+        uint8_t* out = bytes.data() + length;
+        while (value >= 0x80) {
+            *out++ = uint8_t(value) | 0x80;
+            value >>= 7;
+        }
+        *out++ = uint8_t(value);
+        length = size_t(out - bytes.data());
+    }
+
+    // Small values of either sign stay small: 0, -1, 1, -2 ... become 0, 1, 2, 3 ...
+    void write_zigzag(int64_t value) { write_varint((uint64_t(value) << 1) ^ uint64_t(value >> 63)); }
+
+    // Length-prefixed string, Length is the prefix type the reader expects
+    template <typename Length>
+    void write_string(const std::string& value) {
+        write(static_cast<Length>(value.size()));
+        append(value.data(), value.size());
+    }
+
+    // count numbers back to back without a prefix
+    template <typename T>
+    void write_array(const T* values, size_t count) {
+        static_assert(std::is_arithmetic<T>::value, "ByteWriter::write_array needs numbers");
+#ifdef NW_BIG_ENDIAN
+        for (size_t i = 0; i < count; i++) write(values[i]);
+#else
+        append(values, count * sizeof(T));
+#endif
+    }
+
+    private:
+    std::vector<uint8_t> bytes; // capacity, the first length bytes are written
+    size_t length = 0;
+
+    void grow(size_t n) { bytes.resize(std::max(bytes.size() * 2, std::max<size_t>(length + n, 256))); }
+
+    void append(const void* data, size_t n) {
+        if (n == 0) return;
+        if (bytes.size() - length < n) grow(n);
+        std::memcpy(bytes.data() + length, data, n);
+        length += n;
+    }
+};
+
+// Cursor over bytes that are already in memory. Reading past the end marks the reader
+// as failed and every later read fails too, like the failbit of a stream.
+struct ByteReader {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+    bool failed = false;
+
+    ByteReader() = default;
+    ByteReader(const uint8_t* data, size_t size) : data(data), size(size) {}
+
+    explicit operator bool() const { return !failed; }
+    size_t tell() const { return pos; }
+    size_t remaining() const { return failed ? 0 : size - pos; }
+
+    bool seek(uint64_t offset) {
+        if (failed || offset > size) {
+            failed = true;
+            return false;
+        }
+        pos = static_cast<size_t>(offset);
+        return true;
+    }
+
+    // Returns the next n bytes in place and moves past them, nullptr if there aren't that many
+    const uint8_t* take(uint64_t n) {
+        if (failed || n > size - pos) {
+            failed = true;
+            return nullptr;
+        }
+        const uint8_t* bytes = data + pos;
+        pos += static_cast<size_t>(n);
+        return bytes;
+    }
+
+    bool skip(uint64_t n) { return take(n) != nullptr; }
+
+    // Reader over the next n bytes, which this one moves past. Failed if there aren't that many.
+    ByteReader slice(uint64_t n) {
+        const uint8_t* bytes = take(n);
+        ByteReader sliced(bytes, bytes ? static_cast<size_t>(n) : 0);
+        sliced.failed = bytes == nullptr;
+        return sliced;
+    }
+
+    bool read_varint(uint64_t& value) {
+        if (!failed && pos < size && data[pos] < 0x80) { // most are a single byte
+            value = data[pos++];
+            return true;
+        }
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (failed || pos == size) break;
+            uint8_t byte = data[pos++];
+            value |= uint64_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        failed = true; // ran off the end or longer than 10 bytes
+        value = 0;
+        return false;
+    }
+
+    bool read_zigzag(int64_t& value) {
+        uint64_t encoded;
+        bool ok = read_varint(encoded);
+        value = int64_t(encoded >> 1) ^ -int64_t(encoded & 1);
+        return ok;
+    }
+
+    // Fields are stored little-endian, unaligned
+    template <typename T>
+    bool read(T& value) {
+        static_assert(std::is_trivially_copyable<T>::value, "ByteReader::read needs a plain value");
+        const uint8_t* bytes = take(sizeof(T));
+        if (!bytes) {
+            value = T();
+            return false;
+        }
+        std::memcpy(&value, bytes, sizeof(T));
+        value = nw_little_endian(value);
+        return true;
+    }
+
+    // Length-prefixed string, Length is the prefix type the writer used
+    template <typename Length>
+    bool read_string(std::string& value, uint64_t max_length) {
+        Length length;
+        if (!read(length)) return false;
+        if (length < 0 || static_cast<uint64_t>(length) > max_length) {
+            failed = true;
+            return false;
+        }
+        const uint8_t* bytes = take(static_cast<uint64_t>(length));
+        if (!bytes) return false;
+        value.assign(reinterpret_cast<const char*>(bytes), static_cast<size_t>(length));
+        return true;
+    }
+
+    // count numbers written by ByteWriter::write_array, checked against what is left before
+    // anything is copied so a damaged count can't run off or allocate wildly
+    template <typename T>
+    bool read_array(std::vector<T>& values, uint64_t count) {
+        static_assert(std::is_arithmetic<T>::value, "ByteReader::read_array needs numbers");
+        if (failed || count > (size - pos) / sizeof(T)) {
+            failed = true;
+            values.clear();
+            return false;
+        }
+        values.resize(static_cast<size_t>(count));
+        const uint8_t* bytes = take(count * sizeof(T));
+        if (count) std::memcpy(values.data(), bytes, static_cast<size_t>(count) * sizeof(T));
+#ifdef NW_BIG_ENDIAN
+        for (auto& value : values) value = nw_little_endian(value);
+#endif
+        return true;
+    }
+};
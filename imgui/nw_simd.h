@@ -0,0 +1,123 @@
+#pragma once
+
+// Id -> color kernels for layer textures that can't be indexed and show their ids as colors.
+// Pixels are RGBA8888 (r << 24 | g << 16 | b << 8 | a), ids are bytes.
+// Every kernel has a scalar version, SSE2 and AVX2 versions are picked at runtime on x86.
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NW_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define NW_TARGET_AVX2
+#else
+#define NW_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NW_SIMD_SSE2 1
+#endif
+#endif
+
+enum SimdLevel {
+    SIMD_SCALAR = 0,
+    SIMD_SSE2 = 1,
+    SIMD_AVX2 = 2,
+};
+
+inline const char* simd_level_name(SimdLevel level) {
+    switch (level) {
+        case SIMD_AVX2: return "avx2";
+        case SIMD_SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+inline SimdLevel detect_simd_level() {
+    SimdLevel level = SIMD_SCALAR;
+#ifdef NW_SIMD_SSE2
+    level = SIMD_SSE2;
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] >= 7) {
+        __cpuid(info, 1);
+        bool os_saves_ymm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+        __cpuidex(info, 7, 0);
+        if (os_saves_ymm && (info[1] & (1 << 5))) level = SIMD_AVX2;
+    }
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) level = SIMD_AVX2;
+#endif
+#endif
+    return level;
+}
+
+// The best level this CPU has, NW_SIMD=scalar|sse2|avx2 can lower it for comparing kernels
+inline SimdLevel simd_level() {
+    static SimdLevel level = []() {
+        SimdLevel detected = detect_simd_level();
+        if (const char* value = std::getenv("NW_SIMD")) {
+            std::string requested = value;
+            SimdLevel cap = requested == "scalar" ? SIMD_SCALAR : requested == "sse2" ? SIMD_SSE2 : SIMD_AVX2;
+            if (cap < detected) detected = cap;
+        }
+        return detected;
+    }();
+    return level;
+}
+
+inline void expand_indices_scalar(const uint8_t* src, uint32_t* dst, size_t n, const uint32_t* lut) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = lut[src[i]];
+    }
+}
+
+#ifdef NW_SIMD_SSE2
+// Without a gather the palette is read one entry at a time, the gain is in the wide stores
+inline void expand_indices_sse2(const uint8_t* src, uint32_t* dst, size_t n, const uint32_t* lut) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i lo = _mm_set_epi32(int(lut[src[i + 3]]), int(lut[src[i + 2]]), int(lut[src[i + 1]]), int(lut[src[i]]));
+        __m128i hi = _mm_set_epi32(int(lut[src[i + 7]]), int(lut[src[i + 6]]), int(lut[src[i + 5]]), int(lut[src[i + 4]]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), hi);
+    }
+    expand_indices_scalar(src + i, dst + i, n - i, lut);
+}
+#endif
+
+#ifdef NW_SIMD_X86
+NW_TARGET_AVX2 inline void expand_indices_avx2(const uint8_t* src, uint32_t* dst, size_t n, const uint32_t* lut) {
+    const int* palette = reinterpret_cast<const int*>(lut);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i ids = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m128i lo = _mm256_castsi256_si128(ids);
+        __m128i hi = _mm256_extracti128_si256(ids, 1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_i32gather_epi32(palette, _mm256_cvtepu8_epi32(lo), 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 8), _mm256_i32gather_epi32(palette, _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)), 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 16), _mm256_i32gather_epi32(palette, _mm256_cvtepu8_epi32(hi), 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 24), _mm256_i32gather_epi32(palette, _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)), 4));
+    }
+    expand_indices_scalar(src + i, dst + i, n - i, lut);
+}
+#endif
+
+// Turns ids into colors, lut holds 256 entries
+inline void expand_indices(const uint8_t* src, uint32_t* dst, size_t n, const uint32_t* lut) {
+    switch (simd_level()) {
+#ifdef NW_SIMD_X86
+        case SIMD_AVX2: expand_indices_avx2(src, dst, n, lut); return;
+#endif
+#ifdef NW_SIMD_SSE2
+        case SIMD_SSE2: expand_indices_sse2(src, dst, n, lut); return;
+#endif
+        default: expand_indices_scalar(src, dst, n, lut); return;
+    }
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+// The ids of a layer, kept in blocks of whole chunks. A block that is all one id is only that id,
+// its bytes are allocated when something different is written into it and dropped again once it
+// is all one id. Ocean and empty (255) parts of a layer cost a byte per block instead of one per
+// pixel. Only whole blocks hold a single id, an allocated block always has more than one.
+// Copies share the allocated blocks, a block is copied when it is written while shared, so the
+// save snapshot of a layer costs a pointer per block.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "nw_codec.h"
+
+class SparseIds {
+    public:
+    // A layer of grid.width x grid.height that is all id, in blocks of grid.tile_w x grid.tile_h
+    void assign(const TileGrid& block_grid, uint8_t id) {
+        grid = block_grid;
+        fill.assign(size_t(grid.count()), id);
+        blocks.clear();
+        blocks.resize(size_t(grid.count()));
+    }
+
+    // Drops everything, for layers still waiting in their savefile
+    void clear() {
+        grid = TileGrid();
+        std::vector<uint8_t>().swap(fill);
+        std::vector<std::shared_ptr<uint8_t[]>>().swap(blocks);
+    }
+
+    bool empty() const { return fill.empty(); }
+    int width() const { return grid.width; }
+    int height() const { return grid.height; }
+    const TileGrid& block_grid() const { return grid; }
+
+    uint8_t at(int x, int y) const {
+        int bx = x / grid.tile_w, by = y / grid.tile_h;
+        size_t index = size_t(by) * grid.tiles_x + bx;
+        if (!blocks[index]) return fill[index];
+        return blocks[index][size_t(y - by * grid.tile_h) * block_width(bx) + (x - bx * grid.tile_w)];
+    }
+
+    // Copies the ids of a rect (inside the layer) into rows of out_pitch bytes
+    void read(int x, int y, int w, int h, uint8_t* out, size_t out_pitch) const {
+        for_blocks(x, y, w, h, [&](size_t index, int bx, int by, int x0, int y0, int x1, int y1) {
+            int block_w = block_width(bx);
+            for (int py = y0; py < y1; py++) {
+                uint8_t* row = out + size_t(py - y) * out_pitch + (x0 - x);
+                if (!blocks[index]) std::memset(row, fill[index], size_t(x1 - x0));
+                else std::memcpy(row, &blocks[index][size_t(py - by * grid.tile_h) * block_w + (x0 - bx * grid.tile_w)], size_t(x1 - x0));
+            }
+        });
+    }
+
+    // Writes rows of in_pitch bytes into a rect (inside the layer). Blocks that end up all one id
+    // are dropped, ones that get a second id are allocated.
+    void write(int x, int y, int w, int h, const uint8_t* in, size_t in_pitch) {
+        for_blocks(x, y, w, h, [&](size_t index, int bx, int by, int x0, int y0, int x1, int y1) {
+            int block_w = block_width(bx);
+            if (!blocks[index]) {
+                bool same = true;
+                for (int py = y0; py < y1 && same; py++) {
+                    const uint8_t* row = in + size_t(py - y) * in_pitch + (x0 - x);
+                    same = std::all_of(row, row + (x1 - x0), [&](uint8_t id) { return id == fill[index]; });
+                }
+                if (same) return;
+                size_t size = block_size(int(index));
+                blocks[index].reset(new uint8_t[size]);
+                std::memset(blocks[index].get(), fill[index], size);
+            } else if (blocks[index].use_count() > 1) {
+                // a copy still reads it
+                size_t size = block_size(int(index));
+                std::shared_ptr<uint8_t[]> own(new uint8_t[size]);
+                std::memcpy(own.get(), blocks[index].get(), size);
+                blocks[index] = std::move(own);
+            }
+            uint8_t* block = blocks[index].get();
+            for (int py = y0; py < y1; py++) {
+                std::memcpy(block + size_t(py - by * grid.tile_h) * block_w + (x0 - bx * grid.tile_w), in + size_t(py - y) * in_pitch + (x0 - x),
+                            size_t(x1 - x0));
+            }
+            size_t size = block_size(int(index));
+            if (std::all_of(block, block + size, [&](uint8_t id) { return id == block[0]; })) {
+                fill[index] = block[0];
+                blocks[index].reset();
+            }
+        });
+    }
+
+    // True when a rect (inside the layer) is all one id, which is left in id
+    bool uniform(int x, int y, int w, int h, uint8_t& id) const {
+        if (w <= 0 || h <= 0) return false;
+        id = at(x, y);
+        bool same = true;
+        for_blocks(x, y, w, h, [&](size_t index, int bx, int by, int x0, int y0, int x1, int y1) {
+            if (!same) return;
+            if (!blocks[index]) {
+                same = fill[index] == id;
+                return;
+            }
+            // an allocated block never is all one id, only part of one can be
+            if (x0 == bx * grid.tile_w && y0 == by * grid.tile_h && x1 - x0 == block_width(bx) && y1 - y0 == block_height(by)) {
+                same = false;
+                return;
+            }
+            int block_w = block_width(bx);
+            for (int py = y0; py < y1 && same; py++) {
+                const uint8_t* row = &blocks[index][size_t(py - by * grid.tile_h) * block_w + (x0 - bx * grid.tile_w)];
+                same = std::all_of(row, row + (x1 - x0), [&](uint8_t value) { return value == id; });
+            }
+        });
+        return same;
+    }
+
+    // Bytes held, the allocated blocks and a byte per block. Blocks shared with a copy count for both.
+    size_t memory_size() const {
+        size_t size = fill.size() + blocks.size() * sizeof(blocks[0]);
+        for (size_t i = 0; i < blocks.size(); i++) {
+            if (blocks[i]) size += block_size(int(i));
+        }
+        return size;
+    }
+
+    private:
+    TileGrid grid; // the blocks are its tiles
+    std::vector<uint8_t> fill; // id of every block that isn't allocated
+    std::vector<std::shared_ptr<uint8_t[]>> blocks; // row after row, null while all one id, maybe shared with copies
+
+    int block_width(int bx) const { return std::min(grid.tile_w, grid.width - bx * grid.tile_w); }
+    int block_height(int by) const { return std::min(grid.tile_h, grid.height - by * grid.tile_h); }
+    size_t block_size(int index) const { return size_t(block_width(index % grid.tiles_x)) * block_height(index / grid.tiles_x); }
+
+    // Calls f(index, bx, by, x0, y0, x1, y1) for every block a rect overlaps, x0..x1 and y0..y1
+    // being the part of the rect within it
+    template <typename F>
+    void for_blocks(int x, int y, int w, int h, F&& f) const {
+        if (w <= 0 || h <= 0) return;
+        for (int by = y / grid.tile_h; by <= (y + h - 1) / grid.tile_h; by++) {
+            int y0 = std::max(y, by * grid.tile_h), y1 = std::min(y + h, (by + 1) * grid.tile_h);
+            for (int bx = x / grid.tile_w; bx <= (x + w - 1) / grid.tile_w; bx++) {
+                int x0 = std::max(x, bx * grid.tile_w), x1 = std::min(x + w, (bx + 1) * grid.tile_w);
+                f(size_t(by) * grid.tiles_x + bx, bx, by, x0, y0, x1, y1);
+            }
+        }
+    }
+};
@@ -0,0 +1,1003 @@
+// Headless tool for .nw savefiles, for batch jobs over archived turns and as a loader benchmark.
+// Uses the same savefile code as the editor (nw_savefile.h) without SDL or a window.
+//
+// Usage: nwtool <command> [options] <files...>
+//   info                      dimensions, layers and icon counts
+//   verify                    checks every section CRC, decodes every tile and icon layer
+//   stats                     tile codecs, tile sizes and id histograms per layer
+//   convert -o DIR            rewrites saves into DIR as the current version
+//       --version 1|6         1 writes untiled rasters and whole icons like the first savefiles
+//       --tile N              tiles of N chunks (the editor's grid by default)
+//       --codec auto|raw|rle|lz   every tile with one codec instead of the smallest
+//   extract-layer -o DIR LAYER   writes DIR/<save>.<LAYER>.raw (one id per pixel) or .png
+//       --png                 indexed PNG colored through the layer's IDmap
+//       --ids DIR             palettes for --png and convert thumbnails (default: ids)
+//   diff BASE                 the chunks in which every file differs from BASE, by their hash trees
+// Common options: --time prints how long every step took, --verbose keeps the debug output.
+// Files are worked on in parallel on NW_THREADS threads (every core by default), results are
+// printed in the order the files were given. Exits with 1 if any file failed.
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "nw_hash_tree.h"
+#include "nw_mapped_file.h"
+#include "nw_palette.h"
+#include "nw_parallel.h"
+#include "nw_savefile.h"
+
+struct Options {
+    std::string command;
+    std::vector<std::string> files;
+    std::string output_directory;
+    std::string layer_name;
+    std::string base_path; // diff
+    std::string ids_directory = "ids";
+    uint32_t version = SAVE_VERSION;
+    int tile_chunks = 0; // 0: make_tile_grid
+    int codec = -1; // -1: smallest, otherwise a TileCodec
+    bool png = false;
+    bool time = false;
+    bool verbose = false;
+};
+
+// printf into a string, every file builds its report on its own and it is printed in order
+static void appendf(std::string& out, const char* format, ...) {
+    char buffer[1024];
+    va_list args;
+    va_start(args, format);
+    int length = std::vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length > 0) out.append(buffer, std::min<size_t>(size_t(length), sizeof(buffer) - 1));
+}
+
+static double megabytes(uint64_t bytes) { return double(bytes) / (1024.0 * 1024.0); }
+
+// Wall time of the steps of one file, for --time
+struct StepTimer {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string steps;
+
+    void step(const char* name, uint64_t bytes = 0) {
+        auto now = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(now - start).count();
+        appendf(steps, " %s %.2f ms", name, ms);
+        if (bytes) appendf(steps, " (%.1f MB/s)", ms > 0.0 ? megabytes(bytes) / (ms / 1000.0) : 0.0);
+        start = now;
+    }
+};
+
+// A world or political layer as found in the savefile
+struct RasterLayer {
+    uint32_t type = SECTION_WORLD_LAYER;
+    bool visible = true;
+    SaveRasterHeader header;
+    RasterDecodeJob raster;
+    bool raster_ok = false;
+};
+
+struct Savefile {
+    FileSource source;
+    SaveHeader header;
+    std::vector<RasterLayer> rasters; // world layers, then political layers
+    std::vector<IconLayerSnapshot> icon_layers;
+    bool icons_ok = true;
+    bool has_save_id = false;
+    uint64_t save_id = 0;
+    SavePreview preview;
+};
+
+// Reads the header, layer headers, tile tables and icon layers. Rasters are found but not decoded.
+static bool open_savefile(const std::string& path, Savefile& save, std::string& error) {
+    if (!save.source.open(path)) {
+        error = "can't be opened";
+        return false;
+    }
+    ByteReader in = save.source.reader();
+    if (!read_save_header(in, save.header)) {
+        error = "unsupported or damaged header";
+        return false;
+    }
+    const SaveHeader& header = save.header;
+    if (header.world_width <= 0 || header.world_height <= 0 || header.chunk_width <= 0 || header.chunk_height <= 0) {
+        error = "invalid world dimensions";
+        return false;
+    }
+
+    if (const SaveSection* section = header.find_section(SECTION_SAVE_ID, 0)) {
+        ByteReader id_reader(save.source.data() + section->offset, size_t(section->length));
+        save.has_save_id = id_reader.read(save.save_id);
+    }
+    read_save_preview(path, save.preview);
+
+    for (uint32_t type : {uint32_t(SECTION_WORLD_LAYER), uint32_t(SECTION_POLITICAL_LAYER)}) {
+        int count = type == SECTION_WORLD_LAYER ? header.num_layers_world : header.num_layers_political;
+        for (int i = 0; i < count; i++) {
+            const SaveSection* section = header.find_section(type, i);
+            if (section) in.seek(section->offset);
+
+            RasterLayer layer;
+            layer.type = type;
+            layer.visible = !section || (section->flags & SECTION_VISIBLE);
+            if (!read_raster_header(in, type, layer.header) || layer.header.width <= 0 || layer.header.height <= 0) {
+                error = "damaged layer header";
+                return false;
+            }
+            layer.raster_ok = parse_raster(in, header.version, layer.header.width, layer.header.height, layer.raster);
+            if (!layer.raster_ok && !section) {
+                error = "damaged raster in " + layer.header.layer_name; // nothing after it can be found
+                return false;
+            }
+            save.rasters.push_back(std::move(layer));
+        }
+    }
+
+    bool columnar = header.version >= SAVE_ICON_COLUMNS_VERSION;
+    for (int i = 0; i < header.num_layers_icon; i++) {
+        const SaveSection* section = header.find_section(SECTION_ICON_LAYER, i);
+        if (section) in.seek(section->offset);
+
+        IconLayerSnapshot icon_layer;
+        icon_layer.visible = !section || (section->flags & SECTION_VISIBLE);
+        if (!in.read_string<int32_t>(icon_layer.layer_name, SAVE_MAX_NAME_LENGTH) || !read_icon_layer(in, icon_layer, columnar)) {
+            save.icons_ok = false;
+            if (!section) break;
+        }
+        save.icon_layers.push_back(std::move(icon_layer));
+    }
+    return true;
+}
+
+static uint64_t raster_pixels(const RasterLayer& layer) { return uint64_t(layer.header.width) * uint64_t(layer.header.height); }
+
+static bool decode_layer(const RasterLayer& layer, std::vector<uint8_t>& ids) {
+    if (!layer.raster_ok) return false; // the size of a damaged layer can be anything
+    ids.assign(size_t(raster_pixels(layer)), 0);
+    return decode_raster_ids(layer.raster, ids.data(), size_t(layer.header.width));
+}
+
+static const char* type_name(uint32_t type) { return type == SECTION_WORLD_LAYER ? "world" : "political"; }
+
+// Tiles the editor would write the layer in, the stored ones unless the raster is untiled (version 1)
+static TileGrid editor_tile_grid(const SaveHeader& header, const RasterLayer& layer) {
+    if (layer.raster.version != 1) return layer.raster.grid;
+    int chunk_w = layer.header.is_upper ? 1 : header.chunk_width, chunk_h = layer.header.is_upper ? 1 : header.chunk_height;
+    return make_tile_grid(layer.header.width, layer.header.height, chunk_w, chunk_h);
+}
+
+static WorldHashTree start_hash_tree(const SaveHeader& header) {
+    WorldHashTree tree;
+    tree.world_width = header.world_width;
+    tree.world_height = header.world_height;
+    tree.chunk_width = header.chunk_width;
+    tree.chunk_height = header.chunk_height;
+    return tree;
+}
+
+static RasterHashTree hash_layer(const RasterLayer& layer, const std::vector<uint8_t>& ids, const TileGrid& grid) {
+    RasterHashTree tree;
+    tree.type = layer.type;
+    tree.layer_name = layer.header.layer_name;
+    tree.idmap_name = layer.header.idmap_name;
+    tree.grid = grid;
+    tree.build(hash_raster_tiles(ids.data(), size_t(layer.header.width), grid));
+    return tree;
+}
+
+// The hash tree of the content, the one the editor would store for it. False if a raster is damaged.
+static bool build_hash_tree(const Savefile& save, WorldHashTree& tree, uint64_t* decoded = nullptr) {
+    tree = start_hash_tree(save.header);
+    std::vector<uint8_t> ids;
+    for (auto& layer : save.rasters) {
+        if (!decode_layer(layer, ids)) return false;
+        tree.rasters.push_back(hash_layer(layer, ids, editor_tile_grid(save.header, layer)));
+        if (decoded) *decoded += raster_pixels(layer);
+    }
+    for (auto& icon_layer : save.icon_layers) tree.icon_layers.push_back({icon_layer.layer_name, hash_icon_layer(icon_layer)});
+    tree.finish();
+    return true;
+}
+
+// --- info ---
+
+static bool command_info(const Options& options, const std::string& path, std::string& out) {
+    StepTimer timer;
+    Savefile save;
+    std::string error;
+    if (!open_savefile(path, save, error)) {
+        appendf(out, "%s: %s\n", path.c_str(), error.c_str());
+        return false;
+    }
+    timer.step("read");
+    const SaveHeader& header = save.header;
+
+    appendf(out, "%s: version %u, %dx%d chunks of %dx%d pixels, %.2f MB\n", path.c_str(), header.version, header.world_width, header.world_height,
+            header.chunk_width, header.chunk_height, megabytes(save.source.size()));
+    if (save.has_save_id) appendf(out, "  save id %016llx\n", (unsigned long long)save.save_id);
+    if (save.preview.save_time) {
+        std::time_t saved = std::time_t(save.preview.save_time);
+        char when[64] = "";
+        std::strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S UTC", std::gmtime(&saved));
+        appendf(out, "  saved %s\n", when);
+    }
+    WorldHashTree stored_tree;
+    if (read_savefile_hash_tree(save.source.data(), save.source.size(), header, stored_tree, true)) {
+        appendf(out, "  hash tree root %016llx\n", (unsigned long long)stored_tree.root);
+    }
+    for (auto& layer : save.rasters) {
+        appendf(out, "  %-9s %-24s %6dx%-6d idmap %s", type_name(layer.type), ("\"" + layer.header.layer_name + "\"").c_str(), layer.header.width,
+                layer.header.height, layer.header.idmap_name.c_str());
+        if (layer.type == SECTION_WORLD_LAYER) appendf(out, ", %s", layer.header.is_upper ? "upper" : "lower");
+        if (layer.type == SECTION_POLITICAL_LAYER) appendf(out, ", on %s", layer.header.world_layer_name.c_str());
+        if (!layer.visible) appendf(out, ", hidden");
+        if (layer.raster.version != 1 && layer.raster_ok) {
+            appendf(out, ", %d tiles of %dx%d", layer.raster.grid.count(), layer.raster.grid.tile_w, layer.raster.grid.tile_h);
+        }
+        appendf(out, ", %.2f MB\n", megabytes(layer.raster.payload_size));
+    }
+    size_t civilian = 0, military = 0, shapes = 0;
+    for (auto& icon_layer : save.icon_layers) {
+        appendf(out, "  %-9s %-24s %zu civilian, %zu military, %zu shapes%s\n", "icons", ("\"" + icon_layer.layer_name + "\"").c_str(),
+                icon_layer.civilian_icons.size(), icon_layer.military_icons.size(), icon_layer.shapes.size(), icon_layer.visible ? "" : ", hidden");
+        civilian += icon_layer.civilian_icons.size();
+        military += icon_layer.military_icons.size();
+        shapes += icon_layer.shapes.size();
+    }
+    appendf(out, "  %d world, %d political and %d icon layers, %zu civilian icons, %zu military icons, %zu shapes\n", header.num_layers_world,
+            header.num_layers_political, header.num_layers_icon, civilian, military, shapes);
+    if (!save.icons_ok) appendf(out, "  damaged icon layers\n");
+    if (options.time) appendf(out, "  time:%s\n", timer.steps.c_str());
+    return save.icons_ok;
+}
+
+// --- verify ---
+
+static bool command_verify(const Options& options, const std::string& path, std::string& out) {
+    StepTimer timer;
+    Savefile save;
+    std::string error;
+    if (!open_savefile(path, save, error)) {
+        appendf(out, "%s: FAILED, %s\n", path.c_str(), error.c_str());
+        return false;
+    }
+    timer.step("read", save.source.size());
+
+    std::vector<std::string> problems;
+    if (!verify_savefile(save.source.data(), save.source.size(), save.header, error)) problems.push_back(error);
+    timer.step("crc", save.source.size());
+
+    uint64_t decoded = 0;
+    std::vector<uint8_t> ids;
+    WorldHashTree tree = start_hash_tree(save.header);
+    bool hashed = true;
+    for (auto& layer : save.rasters) {
+        if (!decode_layer(layer, ids)) {
+            problems.push_back("raster of " + layer.header.layer_name + " is damaged");
+            hashed = false;
+        } else if (hashed) {
+            tree.rasters.push_back(hash_layer(layer, ids, editor_tile_grid(save.header, layer)));
+        }
+        decoded += raster_pixels(layer);
+    }
+    timer.step("decode", decoded);
+    if (!save.icons_ok) problems.push_back("icon layers are damaged");
+
+    // the stored hash tree has to be the one of the content
+    if (save.header.find_section(SECTION_HASH_TREE, 0) && hashed && save.icons_ok) {
+        for (auto& icon_layer : save.icon_layers) tree.icon_layers.push_back({icon_layer.layer_name, hash_icon_layer(icon_layer)});
+        tree.finish();
+        WorldHashTree stored;
+        if (!read_savefile_hash_tree(save.source.data(), save.source.size(), save.header, stored)) {
+            problems.push_back("hash tree is damaged");
+        } else if (stored.root != tree.root) {
+            problems.push_back("hash tree doesn't match the layers");
+        }
+        timer.step("hash", decoded);
+    }
+
+    if (problems.empty()) {
+        appendf(out, "%s: OK (version %u, %zu layers, %.1f megapixels)", path.c_str(), save.header.version,
+                save.rasters.size() + save.icon_layers.size(), double(decoded) / 1e6);
+    } else {
+        appendf(out, "%s: FAILED", path.c_str());
+        for (size_t i = 0; i < problems.size(); i++) appendf(out, "%s %s", i ? "," : "", problems[i].c_str());
+    }
+    if (options.time) out += timer.steps;
+    out += "\n";
+    return problems.empty();
+}
+
+// --- stats ---
+
+static bool command_stats(const Options& options, const std::string& path, std::string& out) {
+    StepTimer timer;
+    Savefile save;
+    std::string error;
+    if (!open_savefile(path, save, error)) {
+        appendf(out, "%s: %s\n", path.c_str(), error.c_str());
+        return false;
+    }
+    appendf(out, "%s: version %u\n", path.c_str(), save.header.version);
+
+    bool ok = true;
+    uint64_t decoded = 0;
+    std::vector<uint8_t> ids;
+    for (auto& layer : save.rasters) {
+        const RasterDecodeJob& raster = layer.raster;
+        uint64_t pixels = raster_pixels(layer);
+        appendf(out, "  %s layer \"%s\" %dx%d, idmap %s\n", type_name(layer.type), layer.header.layer_name.c_str(), layer.header.width,
+                layer.header.height, layer.header.idmap_name.c_str());
+        if (!decode_layer(layer, ids)) {
+            appendf(out, "    damaged\n");
+            ok = false;
+            continue;
+        }
+        decoded += pixels;
+
+        if (raster.version == 1) {
+            appendf(out, "    untiled, %.2f MB\n", megabytes(raster.payload_size));
+        } else {
+            // tiles by codec and by compressed size, tile i spans [offsets[i], offsets[i + 1])
+            const char* codec_names[3] = {"raw", "rle", "lz"};
+            uint64_t codec_tiles[4] = {}, codec_bytes[4] = {};
+            const uint64_t size_limits[] = {16, 64, 256, 1024, 4096, 16384};
+            const size_t buckets = sizeof(size_limits) / sizeof(size_limits[0]) + 1;
+            uint64_t size_tiles[buckets] = {};
+            for (int i = 0; i < raster.grid.count(); i++) {
+                uint64_t length = raster.offsets[i + 1] - raster.offsets[i];
+                uint8_t codec = length ? std::min<uint8_t>(raster.payload[raster.offsets[i]], 3) : 3;
+                codec_tiles[codec]++;
+                codec_bytes[codec] += length;
+                size_t bucket = 0;
+                while (bucket < buckets - 1 && length >= size_limits[bucket]) bucket++;
+                size_tiles[bucket]++;
+            }
+            appendf(out, "    %d tiles of %dx%d, %.2f MB -> %.2f MB (%.1fx)\n", raster.grid.count(), raster.grid.tile_w, raster.grid.tile_h,
+                    megabytes(pixels), megabytes(raster.payload_size), raster.payload_size ? double(pixels) / double(raster.payload_size) : 0.0);
+            appendf(out, "    codecs:");
+            for (int codec = 0; codec < 3; codec++) {
+                appendf(out, " %s %llu tiles %.1f KB,", codec_names[codec], (unsigned long long)codec_tiles[codec], double(codec_bytes[codec]) / 1024.0);
+            }
+            if (codec_tiles[3]) appendf(out, " unknown %llu tiles,", (unsigned long long)codec_tiles[3]);
+            out.pop_back();
+            appendf(out, "\n    tile sizes:");
+            for (size_t bucket = 0; bucket < buckets; bucket++) {
+                if (bucket < buckets - 1) {
+                    appendf(out, " <%llu %llu,", (unsigned long long)size_limits[bucket], (unsigned long long)size_tiles[bucket]);
+                } else {
+                    appendf(out, " more %llu\n", (unsigned long long)size_tiles[bucket]);
+                }
+            }
+        }
+
+        // ids by how often they appear
+        uint64_t counts[256] = {};
+        for (uint8_t id : ids) counts[id]++;
+        std::vector<std::pair<uint64_t, int>> used;
+        for (int id = 0; id < 256; id++) {
+            if (counts[id]) used.push_back({counts[id], id});
+        }
+        std::sort(used.begin(), used.end(), [](const auto& a, const auto& b) { return a.first != b.first ? a.first > b.first : a.second < b.second; });
+        appendf(out, "    %zu ids:", used.size());
+        for (auto& [count, id] : used) appendf(out, " %d %.2f%%", id, 100.0 * double(count) / double(pixels));
+        out += "\n";
+    }
+    for (auto& icon_layer : save.icon_layers) {
+        size_t points = 0;
+        for (auto& shape : icon_layer.shapes) points += shape.points.size();
+        appendf(out, "  icon layer \"%s\": %zu civilian, %zu military, %zu shapes of %zu points\n", icon_layer.layer_name.c_str(),
+                icon_layer.civilian_icons.size(), icon_layer.military_icons.size(), icon_layer.shapes.size(), points);
+    }
+    timer.step("stats", decoded);
+    if (options.time) appendf(out, "  time:%s\n", timer.steps.c_str());
+    return ok && save.icons_ok;
+}
+
+// --- convert ---
+
+// Appends one tile with the given codec, or the smallest with -1
+static void encode_tile_with(int codec, const uint8_t* tile, size_t n, std::vector<uint8_t>& out) {
+    if (codec < 0) {
+        encode_tile(tile, n, out);
+        return;
+    }
+    out.push_back(uint8_t(codec));
+    if (codec == TILE_RLE) {
+        rle_compress(tile, n, out);
+    } else if (codec == TILE_LZ) {
+        lz_compress(tile, n, out);
+    } else {
+        out.insert(out.end(), tile, tile + n);
+    }
+}
+
+// Encodes the ids of a raster into tiles of grid, bands of tiles on the worker pool
+static EncodedRaster encode_ids(const std::vector<uint8_t>& ids, const TileGrid& grid, int codec) {
+    std::vector<std::vector<uint8_t>> band_payloads(size_t(grid.tiles_y));
+    std::vector<std::vector<uint64_t>> band_offsets(size_t(grid.tiles_y));
+    worker_pool().parallel_for(band_payloads.size(), [&](size_t tile_row) {
+        int y0 = int(tile_row) * grid.tile_h;
+        int h = std::min(grid.tile_h, grid.height - y0);
+        std::vector<uint8_t> tile(grid.max_tile_size());
+        for (int tx = 0; tx < grid.tiles_x; tx++) {
+            int x0 = tx * grid.tile_w;
+            int w = std::min(grid.tile_w, grid.width - x0);
+            gather_tile(ids.data() + size_t(y0) * grid.width, size_t(grid.width), x0, w, h, tile.data());
+            encode_tile_with(codec, tile.data(), size_t(w) * h, band_payloads[tile_row]);
+            band_offsets[tile_row].push_back(band_payloads[tile_row].size());
+        }
+    });
+
+    EncodedRaster encoded;
+    encoded.grid = grid;
+    encoded.offsets.push_back(0);
+    for (size_t tile_row = 0; tile_row < band_payloads.size(); tile_row++) {
+        uint64_t base = encoded.payload.size();
+        for (uint64_t end : band_offsets[tile_row]) encoded.offsets.push_back(base + end);
+        encoded.payload.insert(encoded.payload.end(), band_payloads[tile_row].begin(), band_payloads[tile_row].end());
+    }
+    return encoded;
+}
+
+static TileGrid convert_tile_grid(const Options& options, const SaveHeader& header, const RasterLayer& layer) {
+    int chunk_w = layer.header.is_upper ? 1 : header.chunk_width, chunk_h = layer.header.is_upper ? 1 : header.chunk_height;
+    if (options.tile_chunks > 0) {
+        return make_tile_grid_sized(layer.header.width, layer.header.height, options.tile_chunks * chunk_w, options.tile_chunks * chunk_h);
+    }
+    return make_tile_grid(layer.header.width, layer.header.height, chunk_w, chunk_h);
+}
+
+static const PaletteFile* find_palette(const std::vector<PaletteFile>& palettes, const std::string& name) {
+    for (auto& palette : palettes) {
+        if (palette.name == name) return &palette;
+    }
+    return nullptr;
+}
+
+static const std::vector<PaletteFile>& palettes(const Options& options) {
+    static const std::vector<PaletteFile> loaded = [&]() {
+        std::vector<PaletteFile> files;
+        read_palette_directory(options.ids_directory, files);
+        return files;
+    }();
+    return loaded;
+}
+
+template <typename T>
+static void write_value(std::ostream& out, T value) {
+    value = nw_little_endian(value);
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void write_legacy_string(std::ostream& out, const std::string& value) {
+    write_value(out, int32_t(value.size()));
+    out.write(value.data(), std::streamsize(value.size()));
+}
+
+// An icon layer the way every savefile before version 6 stored it, read_icon_layer with columnar false
+static void write_legacy_icon_layer(std::ostream& out, const IconLayerSnapshot& icon_layer) {
+    write_legacy_string(out, icon_layer.layer_name);
+    write_value(out, int32_t(icon_layer.civilian_icons.size()));
+    for (auto& icon : icon_layer.civilian_icons) {
+        write_value(out, int32_t(icon.icon_id));
+        write_value(out, icon.x);
+        write_value(out, icon.y);
+        write_value(out, uint64_t(icon.description.size()));
+        out.write(icon.description.data(), std::streamsize(icon.description.size()));
+    }
+    write_value(out, int32_t(icon_layer.military_icons.size()));
+    for (auto& icon : icon_layer.military_icons) {
+        write_value(out, int32_t(icon.icon_id));
+        write_value(out, icon.angle);
+        write_value(out, int32_t(icon.country_id));
+        write_value(out, int32_t(icon.quality));
+        write_value(out, icon.x);
+        write_value(out, icon.y);
+        write_value(out, uint64_t(icon.description.size()));
+        out.write(icon.description.data(), std::streamsize(icon.description.size()));
+        write_value(out, int32_t(icon.decorators.size()));
+        for (int32_t decorator_id : icon.decorators) write_value(out, decorator_id);
+    }
+    write_value(out, int32_t(icon_layer.shapes.size()));
+    for (auto& shape : icon_layer.shapes) {
+        for (uint8_t channel : {shape.r, shape.g, shape.b, shape.a}) write_value(out, channel);
+        write_value(out, int32_t(shape.points.size()));
+        for (auto& point : shape.points) {
+            write_value(out, point.x);
+            write_value(out, point.y);
+        }
+    }
+}
+
+// Preview of the converted save: the one it had, or the visible layers colored through ids/
+static SavePreview convert_preview(const Options& options, const Savefile& save, const std::vector<std::vector<uint8_t>>& ids) {
+    SavePreview preview = save.preview;
+    if (preview.save_time == 0) preview.save_time = int64_t(std::time(nullptr));
+    preview.civilian_icons = preview.military_icons = preview.shapes = 0;
+    for (auto& icon_layer : save.icon_layers) {
+        preview.civilian_icons += int32_t(icon_layer.civilian_icons.size());
+        preview.military_icons += int32_t(icon_layer.military_icons.size());
+        preview.shapes += int32_t(icon_layer.shapes.size());
+    }
+    if (!preview.thumbnail.empty()) return preview;
+
+    start_save_thumbnail(preview, save.header.world_width, save.header.world_height);
+    for (size_t i = 0; i < save.rasters.size(); i++) {
+        const RasterLayer& layer = save.rasters[i];
+        const PaletteFile* palette = find_palette(palettes(options), layer.header.idmap_name);
+        if (!layer.visible || !palette) continue;
+        uint32_t colors[256];
+        palette_colors(*palette, colors);
+        const uint8_t* layer_ids = ids[i].data();
+        int width = layer.header.width;
+        blend_save_thumbnail(preview, width, layer.header.height, [&](int x, int y) { return colors[layer_ids[size_t(y) * width + x]]; });
+    }
+    return preview;
+}
+
+static bool command_convert(const Options& options, const std::string& path, std::string& out) {
+    StepTimer timer;
+    Savefile save;
+    std::string error;
+    if (!open_savefile(path, save, error)) {
+        appendf(out, "%s: %s\n", path.c_str(), error.c_str());
+        return false;
+    }
+    timer.step("read", save.source.size());
+
+    std::vector<std::vector<uint8_t>> ids(save.rasters.size());
+    uint64_t decoded = 0;
+    for (size_t i = 0; i < save.rasters.size(); i++) {
+        if (!decode_layer(save.rasters[i], ids[i])) {
+            appendf(out, "%s: raster of %s is damaged\n", path.c_str(), save.rasters[i].header.layer_name.c_str());
+            return false;
+        }
+        decoded += raster_pixels(save.rasters[i]);
+    }
+    if (!save.icons_ok) {
+        appendf(out, "%s: icon layers are damaged\n", path.c_str());
+        return false;
+    }
+    timer.step("decode", decoded);
+
+    std::string output = (std::filesystem::path(options.output_directory) / std::filesystem::path(path).filename()).string();
+    std::ofstream file(output, std::ios::binary);
+    if (!file) {
+        appendf(out, "%s: can't write %s\n", path.c_str(), output.c_str());
+        return false;
+    }
+    const SaveHeader& header = save.header;
+    if (options.version == 1) {
+        for (int32_t field : {header.world_width, header.world_height, header.chunk_width, header.chunk_height, header.num_layers_world,
+                              header.num_layers_political, int32_t(save.icon_layers.size())}) {
+            write_value(file, field);
+        }
+        for (size_t i = 0; i < save.rasters.size(); i++) {
+            const SaveRasterHeader& layer = save.rasters[i].header;
+            write_legacy_string(file, layer.layer_name);
+            write_legacy_string(file, layer.idmap_name);
+            if (save.rasters[i].type == SECTION_POLITICAL_LAYER) write_legacy_string(file, layer.world_layer_name);
+            write_value(file, layer.width);
+            write_value(file, layer.height);
+            if (save.rasters[i].type == SECTION_WORLD_LAYER) write_value(file, uint8_t(layer.is_upper ? 1 : 0));
+            file.write(reinterpret_cast<const char*>(ids[i].data()), std::streamsize(ids[i].size()));
+        }
+        for (auto& icon_layer : save.icon_layers) write_legacy_icon_layer(file, icon_layer);
+        file.flush();
+    } else {
+        SavefileWriter writer(file.rdbuf());
+        writer.write_header(header.world_width, header.world_height, header.chunk_width, header.chunk_height);
+
+        writer.begin_section(SECTION_PREVIEW, true, "");
+        write_save_preview(writer.stream(), convert_preview(options, save, ids));
+        writer.end_section();
+
+        if (save.has_save_id) {
+            writer.begin_section(SECTION_SAVE_ID, true, "");
+            uint64_t save_id = nw_little_endian(save.save_id);
+            writer.stream().write(reinterpret_cast<const char*>(&save_id), sizeof(save_id));
+            writer.end_section();
+        }
+
+        WorldHashTree tree = start_hash_tree(header);
+        for (size_t i = 0; i < save.rasters.size(); i++) {
+            const RasterLayer& layer = save.rasters[i];
+            TileGrid grid = convert_tile_grid(options, header, layer);
+            writer.begin_section(layer.type, layer.visible, layer.header.layer_name);
+            writer.write_raster_header(layer.type, layer.header);
+            write_encoded_raster(writer.stream(), encode_ids(ids[i], grid, options.codec));
+            writer.end_section();
+            tree.rasters.push_back(hash_layer(layer, ids[i], grid));
+            std::vector<uint8_t>().swap(ids[i]);
+        }
+
+        for (auto& icon_layer : save.icon_layers) {
+            writer.begin_section(SECTION_ICON_LAYER, icon_layer.visible, icon_layer.layer_name);
+            ByteWriter section;
+            write_icon_layer(section, icon_layer);
+            writer.stream().write(reinterpret_cast<const char*>(section.data()), std::streamsize(section.size()));
+            writer.end_section();
+            tree.icon_layers.push_back({icon_layer.layer_name, nw_hash64(section.data(), section.size())});
+        }
+
+        tree.finish();
+        writer.begin_section(SECTION_HASH_TREE, true, "");
+        ByteWriter section;
+        write_hash_tree(section, tree);
+        writer.stream().write(reinterpret_cast<const char*>(section.data()), std::streamsize(section.size()));
+        writer.end_section();
+        writer.finish();
+    }
+    file.close();
+    if (!file) {
+        appendf(out, "%s: failed to write %s\n", path.c_str(), output.c_str());
+        std::remove(output.c_str());
+        return false;
+    }
+    timer.step("write", decoded);
+
+    uint64_t output_size = std::filesystem::file_size(output);
+    appendf(out, "%s: version %u -> %u, %.2f MB -> %.2f MB, %s", path.c_str(), header.version, options.version, megabytes(save.source.size()),
+            megabytes(output_size), output.c_str());
+    if (options.time) out += timer.steps;
+    out += "\n";
+    return true;
+}
+
+// --- extract-layer ---
+
+// Standard CRC-32 of PNG chunks, not the CRC32C of the savefile sections
+static uint32_t png_crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+    static const std::vector<uint32_t> table = []() {
+        std::vector<uint32_t> entries(256);
+        for (uint32_t b = 0; b < 256; b++) {
+            uint32_t value = b;
+            for (int bit = 0; bit < 8; bit++) value = (value >> 1) ^ (0xEDB88320u & (0u - (value & 1)));
+            entries[b] = value;
+        }
+        return entries;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) crc = (crc >> 8) ^ table[(crc ^ data[i]) & 0xFF];
+    return ~crc;
+}
+
+// An 8-bit indexed (or grayscale without colors) PNG of the ids. The image data goes into
+// stored deflate blocks, so nothing but the PNG container has to be written.
+static bool write_index_png(const std::string& filename, const std::vector<uint8_t>& ids, int width, int height, const uint32_t* colors) {
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) return false;
+
+    auto chunk = [&](const char* type, const std::vector<uint8_t>& data) {
+        uint8_t length[4] = {uint8_t(data.size() >> 24), uint8_t(data.size() >> 16), uint8_t(data.size() >> 8), uint8_t(data.size())};
+        out.write(reinterpret_cast<const char*>(length), 4);
+        out.write(type, 4);
+        out.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size()));
+        uint32_t crc = png_crc32(data.data(), data.size(), png_crc32(reinterpret_cast<const uint8_t*>(type), 4));
+        uint8_t crc_bytes[4] = {uint8_t(crc >> 24), uint8_t(crc >> 16), uint8_t(crc >> 8), uint8_t(crc)};
+        out.write(reinterpret_cast<const char*>(crc_bytes), 4);
+    };
+    auto put32 = [](std::vector<uint8_t>& data, uint32_t value) {
+        for (int shift = 24; shift >= 0; shift -= 8) data.push_back(uint8_t(value >> shift));
+    };
+
+    out.write("\x89PNG\r\n\x1a\n", 8);
+    std::vector<uint8_t> ihdr;
+    put32(ihdr, uint32_t(width));
+    put32(ihdr, uint32_t(height));
+    ihdr.insert(ihdr.end(), {8, uint8_t(colors ? 3 : 0), 0, 0, 0}); // 8 bits, indexed or gray
+    chunk("IHDR", ihdr);
+    if (colors) {
+        std::vector<uint8_t> plte, trns;
+        for (int id = 0; id < 256; id++) {
+            plte.insert(plte.end(), {uint8_t(colors[id] >> 24), uint8_t(colors[id] >> 16), uint8_t(colors[id] >> 8)});
+            trns.push_back(uint8_t(colors[id]));
+        }
+        chunk("PLTE", plte);
+        chunk("tRNS", trns);
+    }
+
+    // zlib stream: every row is filter byte 0 and the ids, cut into stored blocks of up to 65535 bytes
+    std::vector<uint8_t> zlib = {0x78, 0x01};
+    uint32_t adler_a = 1, adler_b = 0;
+    std::vector<uint8_t> block;
+    size_t remaining = (size_t(width) + 1) * height;
+    auto flush_block = [&]() {
+        remaining -= block.size();
+        uint16_t length = uint16_t(block.size());
+        zlib.insert(zlib.end(), {uint8_t(remaining == 0), uint8_t(length), uint8_t(length >> 8), uint8_t(~length), uint8_t(~length >> 8)});
+        zlib.insert(zlib.end(), block.begin(), block.end());
+        for (uint8_t byte : block) {
+            adler_a = (adler_a + byte) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        }
+        block.clear();
+    };
+    for (int y = 0; y < height; y++) {
+        block.push_back(0);
+        if (block.size() == 65535) flush_block();
+        const uint8_t* row = ids.data() + size_t(y) * width;
+        for (int x = 0; x < width;) {
+            size_t n = std::min(size_t(width - x), 65535 - block.size());
+            block.insert(block.end(), row + x, row + x + n);
+            x += int(n);
+            if (block.size() == 65535) flush_block();
+        }
+        // chunks of 32 MB keep the buffer bounded on huge lower layers
+        if (zlib.size() > (size_t(32) << 20)) {
+            chunk("IDAT", zlib);
+            zlib.clear();
+        }
+    }
+    if (!block.empty()) flush_block();
+    put32(zlib, (adler_b << 16) | adler_a);
+    chunk("IDAT", zlib);
+    chunk("IEND", {});
+    return bool(out);
+}
+
+static bool command_extract_layer(const Options& options, const std::string& path, std::string& out) {
+    StepTimer timer;
+    Savefile save;
+    std::string error;
+    if (!open_savefile(path, save, error)) {
+        appendf(out, "%s: %s\n", path.c_str(), error.c_str());
+        return false;
+    }
+    auto layer = std::find_if(save.rasters.begin(), save.rasters.end(), [&](const RasterLayer& raster) { return raster.header.layer_name == options.layer_name; });
+    if (layer == save.rasters.end()) {
+        appendf(out, "%s: no layer named %s\n", path.c_str(), options.layer_name.c_str());
+        return false;
+    }
+    std::vector<uint8_t> ids;
+    if (!decode_layer(*layer, ids)) {
+        appendf(out, "%s: raster of %s is damaged\n", path.c_str(), options.layer_name.c_str());
+        return false;
+    }
+    timer.step("decode", ids.size());
+
+    std::string output = (std::filesystem::path(options.output_directory) /
+                          (std::filesystem::path(path).stem().string() + "." + options.layer_name + (options.png ? ".png" : ".raw"))).string();
+    bool written;
+    if (options.png) {
+        const PaletteFile* palette = find_palette(palettes(options), layer->header.idmap_name);
+        uint32_t colors[256];
+        if (palette) palette_colors(*palette, colors);
+        written = write_index_png(output, ids, layer->header.width, layer->header.height, palette ? colors : nullptr);
+        if (!palette) appendf(out, "%s: IDmap %s not found in %s, ids written as gray\n", path.c_str(), layer->header.idmap_name.c_str(),
+                              options.ids_directory.c_str());
+    } else {
+        std::ofstream file(output, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(ids.data()), std::streamsize(ids.size()));
+        written = bool(file);
+    }
+    if (!written) {
+        appendf(out, "%s: failed to write %s\n", path.c_str(), output.c_str());
+        return false;
+    }
+    timer.step("write", ids.size());
+
+    appendf(out, "%s: %s %dx%d -> %s", path.c_str(), options.layer_name.c_str(), layer->header.width, layer->header.height, output.c_str());
+    if (options.time) out += timer.steps;
+    out += "\n";
+    return true;
+}
+
+// --- diff ---
+
+// The stored hash tree, or the one of the content for savefiles written before there was one
+static bool load_hash_tree(const std::string& path, WorldHashTree& tree, bool& stored, std::string& error) {
+    Savefile save;
+    if (!open_savefile(path, save, error)) return false;
+    stored = read_savefile_hash_tree(save.source.data(), save.source.size(), save.header, tree);
+    if (stored) return true;
+    if (!save.icons_ok || !build_hash_tree(save, tree)) {
+        error = "damaged layers";
+        return false;
+    }
+    return true;
+}
+
+struct BaseTree {
+    WorldHashTree tree;
+    bool stored = false;
+    bool ok = false;
+    std::string error;
+};
+
+// BASE is read once, by whichever file gets to it first
+static const BaseTree& base_tree(const Options& options) {
+    static const BaseTree base = [&]() {
+        BaseTree loaded;
+        loaded.ok = load_hash_tree(options.base_path, loaded.tree, loaded.stored, loaded.error);
+        return loaded;
+    }();
+    return base;
+}
+
+static bool command_diff(const Options& options, const std::string& path, std::string& out) {
+    StepTimer timer;
+    const BaseTree& base = base_tree(options);
+    if (!base.ok) {
+        appendf(out, "%s: base %s: %s\n", path.c_str(), options.base_path.c_str(), base.error.c_str());
+        return false;
+    }
+    WorldHashTree tree;
+    bool stored = false;
+    std::string error;
+    if (!load_hash_tree(path, tree, stored, error)) {
+        appendf(out, "%s: %s\n", path.c_str(), error.c_str());
+        return false;
+    }
+    timer.step(stored ? "read" : "read and hash");
+
+    auto start = std::chrono::steady_clock::now();
+    WorldDifference difference = diff_hash_trees(base.tree, tree);
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    appendf(out, "%s: %s %s, %zu nodes compared in %.1f us%s\n", path.c_str(), difference.same ? "same as" : "differs from", options.base_path.c_str(),
+            difference.nodes_compared, us, stored && base.stored ? "" : " (hashed from the content)");
+    if (difference.dimensions_differ) {
+        appendf(out, "  world %dx%d chunks of %dx%d, base %dx%d chunks of %dx%d\n", tree.world_width, tree.world_height, tree.chunk_width,
+                tree.chunk_height, base.tree.world_width, base.tree.world_height, base.tree.chunk_width, base.tree.chunk_height);
+    }
+    const size_t max_rects = 8;
+    for (auto& layer : difference.rasters) {
+        appendf(out, "  %-9s %-24s ", type_name(layer.type), ("\"" + layer.layer_name + "\"").c_str());
+        if (layer.missing) {
+            appendf(out, "only in one of them, or of another size, tiling or IDmap\n");
+            continue;
+        }
+        appendf(out, "%zu tiles differ:", layer.chunks.size());
+        for (size_t i = 0; i < layer.chunks.size() && i < max_rects; i++) {
+            const ChunkRect& rect = layer.chunks[i];
+            appendf(out, " %d,%d %dx%d", rect.x, rect.y, rect.width, rect.height);
+        }
+        if (layer.chunks.size() > max_rects) appendf(out, " and %zu more", layer.chunks.size() - max_rects);
+        out += "\n";
+    }
+    for (auto& name : difference.icon_layers) appendf(out, "  %-9s %-24s differ\n", "icons", ("\"" + name + "\"").c_str());
+    if (options.time) appendf(out, "  time:%s\n", timer.steps.c_str());
+    return true;
+}
+
+// --- main ---
+
+static int usage() {
+    std::fprintf(stderr,
+                 "Usage: nwtool <command> [options] <files...>\n"
+                 "  info                         dimensions, layers and icon counts\n"
+                 "  verify                       checks section CRCs, decodes every tile and icon layer\n"
+                 "  stats                        tile codecs, tile sizes and id histograms per layer\n"
+                 "  convert -o DIR               rewrites saves into DIR as the current version\n"
+                 "      --version 1|%u            1 writes untiled rasters and whole icons\n"
+                 "      --tile N                 tiles of N chunks\n"
+                 "      --codec auto|raw|rle|lz  one codec for every tile instead of the smallest\n"
+                 "  extract-layer -o DIR LAYER   writes DIR/<save>.<LAYER>.raw, one id per pixel\n"
+                 "      --png                    indexed PNG colored through the layer's IDmap\n"
+                 "      --ids DIR                palettes for --png and thumbnails (default: ids)\n"
+                 "  diff BASE                    the chunks in which every file differs from BASE\n"
+                 "  --time                       how long every step took\n"
+                 "  --verbose                    keep the debug output of the savefile code\n"
+                 "Files are worked on in parallel on NW_THREADS threads.\n",
+                 SAVE_VERSION);
+    return 2;
+}
+
+// Swallows the Debug:: lines the shared savefile code writes to std::cout
+class NullBuffer : public std::streambuf {
+    protected:
+    int_type overflow(int_type ch) override { return traits_type::not_eof(ch); }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+int main(int argc, char** argv) {
+    if (argc < 2) return usage();
+    Options options;
+    options.command = argv[1];
+
+    bool needs_layer = options.command == "extract-layer";
+    bool needs_base = options.command == "diff";
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                std::fprintf(stderr, "%s needs a value\n", arg.c_str());
+                std::exit(usage());
+            }
+            return argv[++i];
+        };
+        if (arg == "-o") {
+            options.output_directory = value();
+        } else if (arg == "--version") {
+            options.version = uint32_t(std::atoi(value().c_str()));
+        } else if (arg == "--tile") {
+            options.tile_chunks = std::atoi(value().c_str());
+        } else if (arg == "--codec") {
+            std::string codec = value();
+            options.codec = codec == "raw" ? TILE_RAW : codec == "rle" ? TILE_RLE : codec == "lz" ? TILE_LZ : codec == "auto" ? -1 : -2;
+        } else if (arg == "--ids") {
+            options.ids_directory = value();
+        } else if (arg == "--png") {
+            options.png = true;
+        } else if (arg == "--time") {
+            options.time = true;
+        } else if (arg == "--verbose") {
+            options.verbose = true;
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            std::fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return usage();
+        } else if (needs_layer && options.layer_name.empty()) {
+            options.layer_name = arg;
+        } else if (needs_base && options.base_path.empty()) {
+            options.base_path = arg;
+        } else {
+            options.files.push_back(arg);
+        }
+    }
+
+    bool (*command)(const Options&, const std::string&, std::string&) = nullptr;
+    if (options.command == "info") command = command_info;
+    if (options.command == "verify") command = command_verify;
+    if (options.command == "stats") command = command_stats;
+    if (options.command == "convert") command = command_convert;
+    if (options.command == "extract-layer") command = command_extract_layer;
+    if (options.command == "diff") command = command_diff;
+    if (!command || options.files.empty()) return usage();
+    if (options.command == "convert" && ((options.version != 1 && options.version != SAVE_VERSION) || options.codec == -2 || options.tile_chunks < 0)) {
+        return usage();
+    }
+    if (options.command == "convert" || options.command == "extract-layer") {
+        std::error_code error;
+        if (options.output_directory.empty() || (std::filesystem::create_directories(options.output_directory, error), error)) {
+            std::fprintf(stderr, "%s needs an output directory, -o DIR\n", options.command.c_str());
+            return 2;
+        }
+    }
+
+    NullBuffer null_buffer;
+    std::streambuf* cout_buffer = std::cout.rdbuf();
+    if (!options.verbose) std::cout.rdbuf(&null_buffer);
+
+    // every file is a task on the pool, its report is printed once all before it are
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> reports(options.files.size());
+    std::vector<uint8_t> done(options.files.size(), 0), ok(options.files.size(), 0);
+    std::atomic<uint64_t> bytes{0};
+    std::mutex print_mutex;
+    size_t next_print = 0;
+    worker_pool().parallel_for(options.files.size(), [&](size_t i) {
+        ok[i] = command(options, options.files[i], reports[i]);
+        std::error_code error;
+        uint64_t size = std::filesystem::file_size(options.files[i], error);
+        if (!error) bytes += size;
+
+        std::lock_guard<std::mutex> lock(print_mutex);
+        done[i] = 1;
+        for (; next_print < reports.size() && done[next_print]; next_print++) {
+            std::fputs(reports[next_print].c_str(), stdout);
+            std::string().swap(reports[next_print]);
+        }
+        std::fflush(stdout);
+    });
+
+    std::cout.rdbuf(cout_buffer);
+    size_t failed = size_t(std::count(ok.begin(), ok.end(), 0));
+    if (options.time || options.files.size() > 1) {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::printf("%zu files, %zu failed, %.2f MB in %.1f ms on %u threads (%.1f MB/s)\n", options.files.size(), failed, megabytes(bytes),
+                    seconds * 1000.0, worker_pool().size(), seconds > 0.0 ? megabytes(bytes) / seconds : 0.0);
+    }
+    return failed ? 1 : 0;
+}